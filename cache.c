@@ -0,0 +1,222 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "lib/porting.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#if !defined(_MSC_VER)
+#include <unistd.h>
+#endif
+
+#include <libavutil/mem.h>
+#include <libavutil/sha.h>
+
+#include "cache.h"
+#include "lib/logging.h"
+
+#define COPY_BUFFER_SIZE 65536
+
+struct CacheHash {
+  struct AVSHA *sha;
+};
+
+CacheHash *cache_hash_new(void) {
+  CacheHash *hash = malloc(sizeof(CacheHash));
+  if (hash == NULL || (hash->sha = av_sha_alloc()) == NULL) {
+    errOutput("unable to allocate cache hash.");
+  }
+  av_sha_init(hash->sha, CACHE_KEY_SIZE * 8);
+  return hash;
+}
+
+void cache_hash_update(CacheHash *hash, const void *data, size_t size) {
+  av_sha_update(hash->sha, data, size);
+}
+
+bool cache_hash_file(CacheHash *hash, const char *filename) {
+  uint8_t buffer[COPY_BUFFER_SIZE];
+  size_t size;
+  bool success;
+  FILE *f = fopen(filename, "rb");
+
+  if (f == NULL) {
+    return false;
+  }
+  while ((size = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    av_sha_update(hash->sha, buffer, size);
+  }
+  success = !ferror(f);
+  fclose(f);
+  return success;
+}
+
+CacheKey cache_hash_final(CacheHash *hash) {
+  CacheKey key;
+
+  av_sha_final(hash->sha, key.bytes);
+  av_free(hash->sha);
+  free(hash);
+  return key;
+}
+
+static void entry_path(char *path, size_t size, const char *directory,
+                       CacheKey key, const char *suffix) {
+  char hex[CACHE_KEY_SIZE * 2 + 1];
+
+  for (int i = 0; i < CACHE_KEY_SIZE; i++) {
+    sprintf(hex + i * 2, "%02x", key.bytes[i]);
+  }
+  snprintf(path, size, "%s/%.2s/%s.%s", directory, hex, hex, suffix);
+}
+
+static bool make_directory(const char *path) {
+  return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+// Opens a temporary file next to path, to be renamed to path by
+// commit_temporary(). The name is unique to the process and the call.
+static FILE *open_temporary(const char *path, char *temporary, size_t size) {
+  static atomic_uint count;
+
+  if (snprintf(temporary, size, "%s.%ld.%u.tmp", path, (long)getpid(),
+               atomic_fetch_add(&count, 1)) >= (int)size) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  return fopen(temporary, "wbx");
+}
+
+static bool commit_temporary(FILE *f, bool success, const char *temporary,
+                             const char *path) {
+  if (fclose(f) != 0) {
+    success = false;
+  }
+  if (success && rename(temporary, path) != 0) {
+    success = false;
+  }
+  if (!success) {
+    verboseLog(VERBOSE_NORMAL, "cache: unable to write %s: %s\n", path,
+               strerror(errno));
+    remove(temporary);
+  }
+  return success;
+}
+
+static bool copy_file(FILE *from, FILE *to) {
+  uint8_t buffer[COPY_BUFFER_SIZE];
+  size_t size;
+
+  while ((size = fread(buffer, 1, sizeof(buffer), from)) > 0) {
+    if (fwrite(buffer, 1, size, to) != size) {
+      return false;
+    }
+  }
+  return !ferror(from);
+}
+
+// Opens a new entry for writing, creating its directory if needed.
+static FILE *create_entry(const char *directory, CacheKey key,
+                          const char *suffix, char *path, char *temporary) {
+  char parent[PATH_MAX];
+  FILE *f;
+
+  entry_path(path, PATH_MAX, directory, key, suffix);
+  snprintf(parent, sizeof(parent), "%s", path);
+  *strrchr(parent, '/') = '\0';
+
+  if (!make_directory(directory) || !make_directory(parent) ||
+      (f = open_temporary(path, temporary, PATH_MAX)) == NULL) {
+    verboseLog(VERBOSE_NORMAL, "cache: unable to create %s: %s\n", path,
+               strerror(errno));
+    return NULL;
+  }
+  return f;
+}
+
+bool cache_read(const char *directory, CacheKey key, const char *suffix,
+                uint8_t **data, size_t *size) {
+  char path[PATH_MAX];
+  struct stat st;
+  FILE *f;
+
+  entry_path(path, sizeof(path), directory, key, suffix);
+  if ((f = fopen(path, "rb")) == NULL) {
+    return false;
+  }
+
+  *data = NULL;
+  if (fstat(fileno(f), &st) == 0 && (*data = malloc(st.st_size + 1)) &&
+      fread(*data, 1, st.st_size, f) == (size_t)st.st_size) {
+    *size = st.st_size;
+    fclose(f);
+    return true;
+  }
+
+  verboseLog(VERBOSE_NORMAL, "cache: unable to read %s\n", path);
+  free(*data);
+  *data = NULL;
+  fclose(f);
+  return false;
+}
+
+bool cache_write(const char *directory, CacheKey key, const char *suffix,
+                 const uint8_t *data, size_t size) {
+  char path[PATH_MAX], temporary[PATH_MAX];
+  FILE *f = create_entry(directory, key, suffix, path, temporary);
+
+  if (f == NULL) {
+    return false;
+  }
+  return commit_temporary(f, fwrite(data, 1, size, f) == size, temporary,
+                          path);
+}
+
+bool cache_store_file(const char *directory, CacheKey key, const char *suffix,
+                      const char *filename) {
+  char path[PATH_MAX], temporary[PATH_MAX];
+  FILE *from = fopen(filename, "rb");
+  FILE *to;
+  bool success;
+
+  if (from == NULL) {
+    return false;
+  }
+  if ((to = create_entry(directory, key, suffix, path, temporary)) == NULL) {
+    fclose(from);
+    return false;
+  }
+
+  success = copy_file(from, to);
+  fclose(from);
+  return commit_temporary(to, success, temporary, path);
+}
+
+bool cache_fetch_file(const char *directory, CacheKey key, const char *suffix,
+                      const char *filename) {
+  char path[PATH_MAX], temporary[PATH_MAX];
+  FILE *from, *to;
+  bool success;
+
+  entry_path(path, sizeof(path), directory, key, suffix);
+  if ((from = fopen(path, "rb")) == NULL) {
+    return false;
+  }
+  if ((to = open_temporary(filename, temporary, sizeof(temporary))) == NULL) {
+    verboseLog(VERBOSE_NORMAL, "cache: unable to create %s: %s\n", filename,
+               strerror(errno));
+    fclose(from);
+    return false;
+  }
+
+  success = copy_file(from, to);
+  fclose(from);
+  return commit_temporary(to, success, temporary, filename);
+}
@@ -0,0 +1,49 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- content-addressed result cache ------------------------------------- */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_KEY_SIZE 32
+
+typedef struct {
+  uint8_t bytes[CACHE_KEY_SIZE];
+} CacheKey;
+
+/**
+ * Computes a key as the SHA-256 hash of everything passed to it.
+ */
+typedef struct CacheHash CacheHash;
+
+CacheHash *cache_hash_new(void);
+void cache_hash_update(CacheHash *hash, const void *data, size_t size);
+// Hashes the contents of a file, returns false if it cannot be read.
+bool cache_hash_file(CacheHash *hash, const char *filename);
+// Returns the key and frees the hash.
+CacheKey cache_hash_final(CacheHash *hash);
+
+/**
+ * Entries are files named after the key and a suffix, in a subdirectory of
+ * directory named after the first byte of the key. They are written under a
+ * temporary name and renamed when complete, so that they can be shared by
+ * concurrent runs. Failures are logged and reported as false, to fall back to
+ * processing without the cache.
+ */
+
+// Reads an entry into a newly allocated buffer, that the caller frees.
+bool cache_read(const char *directory, CacheKey key, const char *suffix,
+                uint8_t **data, size_t *size);
+bool cache_write(const char *directory, CacheKey key, const char *suffix,
+                 const uint8_t *data, size_t size);
+
+// Copies the file at filename to an entry, or an entry to filename.
+bool cache_store_file(const char *directory, CacheKey key, const char *suffix,
+                      const char *filename);
+bool cache_fetch_file(const char *directory, CacheKey key, const char *suffix,
+                      const char *filename);
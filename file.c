@@ -6,154 +6,640 @@
 
 /* --- tool functions for file handling ------------------------------------ */
 
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <sys/stat.h>
+
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
-#include <libavutil/opt.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
 
 #include "imageprocess/blit.h"
 #include "unpaper.h"
 
+#define PALETTE_SIZE 256
+
 /**
- * Loads image data from a file in pnm format.
- *
- * @param f file to load
- * @param image structure to hold loaded image
- * @param type returns the type of the loaded image
+ * Row converters used to bring decoded frames into one of the dense pixel
+ * formats the rest of the processing works on. They run once per row at load
+ * time, so that no later get_pixel() call needs to look up a palette or skip
+ * over an alpha channel.
  */
-void loadImage(const char *filename, Image *image, Pixel sheet_background,
-               uint8_t abs_black_threshold) {
+static void convert_row_ya8_to_gray8(const uint8_t *src, uint8_t *dst,
+                                     int32_t width) {
+  for (int32_t x = 0; x < width; x++) {
+    dst[x] = src[x * 2]; // drop the alpha byte.
+  }
+}
+
+static void convert_row_pal8_to_gray8(const uint8_t *src, uint8_t *dst,
+                                      int32_t width,
+                                      const uint8_t lut[PALETTE_SIZE]) {
+  for (int32_t x = 0; x < width; x++) {
+    dst[x] = lut[src[x]];
+  }
+}
+
+static void convert_row_pal8_to_rgb24(const uint8_t *src, uint8_t *dst,
+                                      int32_t width,
+                                      const Pixel lut[PALETTE_SIZE]) {
+  for (int32_t x = 0; x < width; x++, dst += 3) {
+    const Pixel pixel = lut[src[x]];
+    dst[0] = pixel.r;
+    dst[1] = pixel.g;
+    dst[2] = pixel.b;
+  }
+}
+
+/**
+ * Checks whether all the palette entries are shades of gray, in which case
+ * the image can be loaded as GRAY8 rather than expanded to RGB24.
+ */
+static bool palette_is_grayscale(const uint32_t palette[PALETTE_SIZE]) {
+  for (size_t i = 0; i < PALETTE_SIZE; i++) {
+    const Pixel entry = pixel_from_value(palette[i]);
+    if (entry.r != entry.g || entry.r != entry.b) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#define ERROR_MESSAGE_SIZE 1024
+#define IO_BUFFER_SIZE 4096
+#define TEMPORARY_SUFFIX ".tmp"
+
+static bool set_error(char *error, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static bool set_error(char *error, const char *fmt, ...) {
+  va_list vl;
+
+  va_start(vl, fmt);
+  vsnprintf(error, ERROR_MESSAGE_SIZE, fmt, vl);
+  va_end(vl);
+
+  return false;
+}
+
+/**
+ * Like set_error(), followed by the description of the libav error code ret.
+ */
+static bool set_av_error(char *error, int ret, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static bool set_av_error(char *error, int ret, const char *fmt, ...) {
+  char errbuff[ERROR_MESSAGE_SIZE];
+  size_t length;
+  va_list vl;
+
+  va_start(vl, fmt);
+  vsnprintf(error, ERROR_MESSAGE_SIZE, fmt, vl);
+  va_end(vl);
+
+  av_strerror(ret, errbuff, sizeof(errbuff));
+  length = strlen(error);
+  snprintf(error + length, ERROR_MESSAGE_SIZE - length, ": %s", errbuff);
+
+  return false;
+}
+
+/**
+ * Converts a decoded frame into an image in one of the supported pixel
+ * formats.
+ */
+static bool convert_frame(const AVFrame *frame, const char *name, Image *image,
+                          Pixel sheet_background, uint8_t abs_black_threshold,
+                          char *error) {
+  RectangleSize size = {.width = frame->width, .height = frame->height};
+
+  switch (frame->format) {
+  case AV_PIX_FMT_GRAY8:
+  case AV_PIX_FMT_RGB24:
+  case AV_PIX_FMT_MONOBLACK:
+  case AV_PIX_FMT_MONOWHITE:
+    *image = create_image(size, frame->format, false, sheet_background,
+                          abs_black_threshold);
+    av_frame_free(&image->frame);
+    image->frame = av_frame_clone(frame);
+    break;
+
+  case AV_PIX_FMT_Y400A: // 8-bit grayscale PNG with alpha channel
+    *image = create_image(size, AV_PIX_FMT_GRAY8, false, sheet_background,
+                          abs_black_threshold);
+    for (int y = 0; y < size.height; y++) {
+      convert_row_ya8_to_gray8(frame->data[0] + frame->linesize[0] * y,
+                               image->frame->data[0] +
+                                   image->frame->linesize[0] * y,
+                               size.width);
+    }
+    break;
+
+  case AV_PIX_FMT_PAL8: {
+    const uint32_t *palette = (const uint32_t *)frame->data[1];
+
+    if (palette_is_grayscale(palette)) {
+      uint8_t lut[PALETTE_SIZE];
+      for (size_t i = 0; i < PALETTE_SIZE; i++) {
+        lut[i] = pixel_from_value(palette[i]).r;
+      }
+
+      *image = create_image(size, AV_PIX_FMT_GRAY8, false, sheet_background,
+                            abs_black_threshold);
+      for (int y = 0; y < size.height; y++) {
+        convert_row_pal8_to_gray8(frame->data[0] + frame->linesize[0] * y,
+                                  image->frame->data[0] +
+                                      image->frame->linesize[0] * y,
+                                  size.width, lut);
+      }
+    } else {
+      Pixel lut[PALETTE_SIZE];
+      for (size_t i = 0; i < PALETTE_SIZE; i++) {
+        lut[i] = pixel_from_value(palette[i]);
+      }
+
+      *image = create_image(size, AV_PIX_FMT_RGB24, false, sheet_background,
+                            abs_black_threshold);
+      for (int y = 0; y < size.height; y++) {
+        convert_row_pal8_to_rgb24(frame->data[0] + frame->linesize[0] * y,
+                                  image->frame->data[0] +
+                                      image->frame->linesize[0] * y,
+                                  size.width, lut);
+      }
+    }
+  } break;
+
+  default:
+    return set_error(error, "unable to open file %s: unsupported pixel format",
+                     name);
+  }
+
+  return true;
+}
+
+/**
+ * Decodes the first frame of an opened input. Everything allocated here is
+ * released again before returning, also on failure, so that errors can be
+ * reported by callers that keep going afterwards.
+ */
+static bool decode_image(AVFormatContext *s, const char *name, Image *image,
+                         Pixel sheet_background, uint8_t abs_black_threshold,
+                         char *error) {
   int ret;
-  AVFormatContext *s = NULL;
   AVCodecContext *avctx = NULL;
   const AVCodec *codec;
-  AVPacket pkt;
+  AVPacket *pkt = av_packet_alloc();
   AVFrame *frame = av_frame_alloc();
-  char errbuff[1024];
+  bool success = false;
 
-  ret = avformat_open_input(&s, filename, NULL, NULL);
-  if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to open file %s: %s", filename, errbuff);
+  if (!pkt || !frame) {
+    set_error(error, "unable to allocate decoder buffers for %s", name);
+    goto cleanup;
   }
 
   avformat_find_stream_info(s, NULL);
 
-  if (verbose >= VERBOSE_MORE)
-    av_dump_format(s, 0, filename, 0);
+  if (verbose_level() >= VERBOSE_MORE)
+    av_dump_format(s, 0, name, 0);
 
-  if (s->nb_streams < 1)
-    errOutput("unable to open file %s: missing streams", filename);
+  if (s->nb_streams < 1) {
+    set_error(error, "unable to open file %s: missing streams", name);
+    goto cleanup;
+  }
 
   codec = avcodec_find_decoder(s->streams[0]->codecpar->codec_id);
-  if (!codec)
-    errOutput("unable to open file %s: unsupported format", filename);
+  if (!codec) {
+    set_error(error, "unable to open file %s: unsupported format", name);
+    goto cleanup;
+  }
 
   avctx = avcodec_alloc_context3(codec);
-  if (!avctx)
-    errOutput("cannot allocate decoder context for %s", filename);
+  if (!avctx) {
+    set_error(error, "cannot allocate decoder context for %s", name);
+    goto cleanup;
+  }
 
   ret = avcodec_parameters_to_context(avctx, s->streams[0]->codecpar);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("unable to copy parameters to context: %s", errbuff);
+    set_av_error(error, ret, "unable to copy parameters to context");
+    goto cleanup;
   }
 
   ret = avcodec_open2(avctx, codec, NULL);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("unable to open file %s: %s", filename, errbuff);
+    set_av_error(error, ret, "unable to open file %s", name);
+    goto cleanup;
   }
 
-  ret = av_read_frame(s, &pkt);
+  ret = av_read_frame(s, pkt);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("unable to open file %s: %s", filename, errbuff);
+    set_av_error(error, ret, "unable to open file %s", name);
+    goto cleanup;
   }
 
-  if (pkt.stream_index != 0)
-    errOutput("unable to open file %s: invalid stream.", filename);
+  if (pkt->stream_index != 0) {
+    set_error(error, "unable to open file %s: invalid stream.", name);
+    goto cleanup;
+  }
 
-  ret = avcodec_send_packet(avctx, &pkt);
+  ret = avcodec_send_packet(avctx, pkt);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("cannot send packet to decoder: %s", errbuff);
+    set_av_error(error, ret, "cannot send packet to decoder");
+    goto cleanup;
   }
 
   ret = avcodec_receive_frame(avctx, frame);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("error while receiving frame from decoder: %s", errbuff);
+    set_av_error(error, ret, "error while receiving frame from decoder");
+    goto cleanup;
   }
 
-  Rectangle area = rectangle_from_size(
-      POINT_ORIGIN,
-      (RectangleSize){.width = frame->width, .height = frame->height});
+  success = convert_frame(frame, name, image, sheet_background,
+                          abs_black_threshold, error);
 
-  switch (frame->format) {
-  case AV_PIX_FMT_Y400A: // 8-bit grayscale PNG
-  case AV_PIX_FMT_GRAY8:
-  case AV_PIX_FMT_RGB24:
-  case AV_PIX_FMT_MONOBLACK:
-  case AV_PIX_FMT_MONOWHITE:
-    *image = create_image(size_of_rectangle(area), frame->format, false,
-                          sheet_background, abs_black_threshold);
-    av_frame_free(&image->frame);
-    image->frame = av_frame_clone(frame);
-    break;
+cleanup:
+  av_frame_free(&frame);
+  av_packet_free(&pkt);
+  avcodec_free_context(&avctx);
+  return success;
+}
 
-  case AV_PIX_FMT_PAL8: {
-    *image = create_image(size_of_rectangle(area), AV_PIX_FMT_RGB24, false,
-                          sheet_background, abs_black_threshold);
+/**
+ * Opens the input either by url or, if io is not NULL, on the caller's I/O
+ * context, and decodes it.
+ */
+static bool load_image(const char *url, AVIOContext *io, const char *name,
+                       Image *image, Pixel sheet_background,
+                       uint8_t abs_black_threshold, char *error) {
+  AVFormatContext *s = NULL;
+  bool success;
+  int ret;
 
-    const uint32_t *palette = (const uint32_t *)frame->data[1];
-    scan_rectangle(area) {
-      const uint8_t palette_index = frame->data[0][frame->linesize[0] * y + x];
-      set_pixel(*image, (Point){x, y},
-                pixel_from_value(palette[palette_index]));
+  if (io != NULL) {
+    s = avformat_alloc_context();
+    if (!s) {
+      return set_error(error, "unable to allocate input context for %s", name);
     }
-  } break;
+    s->pb = io;
+    s->flags |= AVFMT_FLAG_CUSTOM_IO;
+  }
 
-  default:
-    errOutput("unable to open file %s: unsupported pixel format", filename);
+  // On failure the context is freed, but never a custom I/O context.
+  ret = avformat_open_input(&s, url, NULL, NULL);
+  if (ret < 0) {
+    return set_av_error(error, ret, "unable to open file %s", name);
   }
 
-  avcodec_free_context(&avctx);
+  success = decode_image(s, name, image, sheet_background, abs_black_threshold,
+                         error);
+
   avformat_close_input(&s);
+  return success;
 }
 
 /**
- * Saves image data to a file in pgm or pbm format.
+ * Loads image data from a file in any format supported by libavformat.
  *
- * @param filename file name to save image to
- * @param image image to save
- * @param type filetype of the image to save
- * @return true on success, false on failure
+ * @param filename file to load
+ * @param image structure to hold loaded image
+ */
+void loadImage(const char *filename, Image *image, Pixel sheet_background,
+               uint8_t abs_black_threshold) {
+  char error[ERROR_MESSAGE_SIZE];
+
+  if (!load_image(filename, NULL, filename, image, sheet_background,
+                  abs_black_threshold, error)) {
+    errOutput("%s", error);
+  }
+}
+
+void loadImageFromIO(AVIOContext *io, const char *name, Image *image,
+                     Pixel sheet_background, uint8_t abs_black_threshold) {
+  char error[ERROR_MESSAGE_SIZE];
+
+  if (!load_image(NULL, io, name, image, sheet_background, abs_black_threshold,
+                  error)) {
+    errOutput("%s", error);
+  }
+}
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t position;
+} MemoryReader;
+
+static int read_memory(void *opaque, uint8_t *buf, int buf_size) {
+  MemoryReader *reader = opaque;
+  size_t remaining = reader->size - reader->position;
+
+  if (remaining == 0) {
+    return AVERROR_EOF;
+  }
+  if ((size_t)buf_size > remaining) {
+    buf_size = (int)remaining;
+  }
+
+  memcpy(buf, reader->data + reader->position, buf_size);
+  reader->position += buf_size;
+  return buf_size;
+}
+
+static int64_t seek_memory(void *opaque, int64_t offset, int whence) {
+  MemoryReader *reader = opaque;
+
+  if (whence & AVSEEK_SIZE) {
+    return reader->size;
+  }
+
+  switch (whence & ~AVSEEK_FORCE) {
+  case SEEK_SET:
+    break;
+  case SEEK_CUR:
+    offset += reader->position;
+    break;
+  case SEEK_END:
+    offset += reader->size;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+
+  if (offset < 0 || (uint64_t)offset > reader->size) {
+    return AVERROR(EINVAL);
+  }
+
+  reader->position = offset;
+  return offset;
+}
+
+AVIOContext *openBufferIO(const uint8_t *data, size_t size) {
+  MemoryReader *reader = av_malloc(sizeof(MemoryReader));
+  uint8_t *buffer = av_malloc(IO_BUFFER_SIZE);
+  AVIOContext *io = NULL;
+
+  if (reader && buffer) {
+    *reader = (MemoryReader){.data = data, .size = size, .position = 0};
+    io = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0, reader, read_memory,
+                            NULL, seek_memory);
+  }
+  if (!io) {
+    av_free(buffer);
+    av_free(reader);
+    errOutput("unable to allocate I/O context.");
+  }
+
+  return io;
+}
+
+void closeBufferIO(AVIOContext **io) {
+  if (*io == NULL) {
+    return;
+  }
+
+  av_free((*io)->opaque);
+  // libavformat may have replaced the buffer, so free the current one.
+  av_freep(&(*io)->buffer);
+  avio_context_free(io);
+}
+
+void loadImageFromBuffer(const uint8_t *data, size_t size, const char *name,
+                         Image *image, Pixel sheet_background,
+                         uint8_t abs_black_threshold) {
+  char error[ERROR_MESSAGE_SIZE];
+  AVIOContext *io = openBufferIO(data, size);
+  bool success;
+
+  success = load_image(NULL, io, name, image, sheet_background,
+                       abs_black_threshold, error);
+  closeBufferIO(&io);
+
+  if (!success) {
+    errOutput("%s", error);
+  }
+}
+
+/* --- image streams ------------------------------------------------------ */
+
+#define STREAM_HEADER_SIZE 4096
+
+/**
+ * An image read from a stream, growing as header and image data come in.
+ */
+typedef struct {
+  const char *name;
+  FILE *file;
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+} StreamImage;
+
+static void stream_reserve(StreamImage *image, size_t size) {
+  if (image->size + size <= image->capacity) {
+    return;
+  }
+
+  size_t capacity = image->capacity * 2;
+  if (capacity < image->size + size) {
+    capacity = image->size + size;
+  }
+
+  uint8_t *data = av_realloc(image->data, capacity);
+  if (!data) {
+    av_freep(&image->data);
+    errOutput("unable to allocate buffer for image from %s", image->name);
+  }
+  image->data = data;
+  image->capacity = capacity;
+}
+
+// Reads a single byte of a pnm header, or EOF.
+static int stream_header_byte(StreamImage *image) {
+  int c = getc(image->file);
+
+  if (c != EOF) {
+    if (image->size >= STREAM_HEADER_SIZE) {
+      av_freep(&image->data);
+      errOutput("pnm header too long in %s", image->name);
+    }
+    stream_reserve(image, 1);
+    image->data[image->size++] = c;
+  }
+  return c;
+}
+
+static void invalid_header(StreamImage *image) {
+  av_freep(&image->data);
+  errOutput("invalid pnm header in %s", image->name);
+}
+
+/**
+ * Reads a decimal header field, skipping the whitespace and comments before
+ * it. The single whitespace character after it is consumed too, which after
+ * the last field separates the header from the image data.
+ */
+static uint32_t stream_header_number(StreamImage *image) {
+  uint64_t value = 0;
+  int c;
+
+  do {
+    c = stream_header_byte(image);
+    if (c == '#') {
+      while (c != '\n' && c != EOF) {
+        c = stream_header_byte(image);
+      }
+    }
+  } while (c != EOF && isspace(c));
+
+  if (c == EOF || !isdigit(c)) {
+    invalid_header(image);
+  }
+
+  for (; c != EOF && isdigit(c); c = stream_header_byte(image)) {
+    value = value * 10 + (c - '0');
+    if (value > UINT32_MAX) {
+      invalid_header(image);
+    }
+  }
+
+  if (c == EOF || !isspace(c)) {
+    invalid_header(image);
+  }
+
+  return value;
+}
+
+// Reads the header lines of a pam image, up to and including ENDHDR.
+static void stream_pam_header(StreamImage *image, uint32_t *width,
+                              uint32_t *height, uint32_t *depth,
+                              uint32_t *maxval) {
+  char line[STREAM_HEADER_SIZE];
+
+  for (;;) {
+    size_t length = 0;
+    int c;
+
+    while ((c = stream_header_byte(image)) != '\n') {
+      if (c == EOF) {
+        invalid_header(image);
+      }
+      line[length++] = c;
+    }
+    line[length] = '\0';
+
+    if (strcmp(line, "ENDHDR") == 0) {
+      return;
+    }
+
+    sscanf(line, "WIDTH %" SCNu32, width);
+    sscanf(line, "HEIGHT %" SCNu32, height);
+    sscanf(line, "DEPTH %" SCNu32, depth);
+    sscanf(line, "MAXVAL %" SCNu32, maxval);
+  }
+}
+
+bool readStreamImage(FILE *stream, const char *name, uint8_t **data,
+                     size_t *size) {
+  StreamImage image = {.name = name, .file = stream};
+  uint32_t width = 0, height = 0, depth = 1, maxval = 1;
+  uint64_t image_size;
+  int c;
+
+  // Tolerate whitespace between concatenated images.
+  do {
+    c = getc(stream);
+  } while (c != EOF && isspace(c));
+
+  if (c == EOF) {
+    return false;
+  }
+
+  stream_reserve(&image, IO_BUFFER_SIZE);
+  image.data[image.size++] = c;
+
+  c = stream_header_byte(&image);
+  if (image.data[0] != 'P' || c < '4' || c > '7') {
+    // Not a binary pnm image, so its end cannot be told apart from the
+    // beginning of the next one: it has to be the last one in the stream.
+    for (;;) {
+      stream_reserve(&image, IO_BUFFER_SIZE);
+      size_t read =
+          fread(image.data + image.size, 1, image.capacity - image.size,
+                stream);
+      if (read == 0) {
+        break;
+      }
+      image.size += read;
+    }
+
+    *data = image.data;
+    *size = image.size;
+    return true;
+  }
+
+  switch (c) {
+  case '4':
+    width = stream_header_number(&image);
+    height = stream_header_number(&image);
+    image_size = (uint64_t)((width + 7) / 8) * height;
+    break;
+  case '5':
+  case '6':
+    width = stream_header_number(&image);
+    height = stream_header_number(&image);
+    maxval = stream_header_number(&image);
+    depth = (c == '6') ? 3 : 1;
+    image_size = (uint64_t)width * height * depth * (maxval > 255 ? 2 : 1);
+    break;
+  default: // '7'
+    if (stream_header_byte(&image) != '\n') {
+      invalid_header(&image);
+    }
+    stream_pam_header(&image, &width, &height, &depth, &maxval);
+    image_size = (uint64_t)width * height * depth * (maxval > 255 ? 2 : 1);
+    break;
+  }
+
+  if (width == 0 || height == 0 || maxval == 0 || image_size > SIZE_MAX) {
+    invalid_header(&image);
+  }
+
+  stream_reserve(&image, image_size);
+  if (fread(image.data + image.size, 1, image_size, stream) != image_size) {
+    av_freep(&image.data);
+    errOutput("truncated image in %s", name);
+  }
+  image.size += image_size;
+
+  *data = image.data;
+  *size = image.size;
+  return true;
+}
+
+/**
+ * Encodes the image as a single pnm frame and writes it to io. Everything
+ * allocated here is released again before returning, also on failure.
  */
-void saveImage(char *filename, Image input, int outputPixFmt) {
+static bool encode_image(AVIOContext *io, const char *name, Image input,
+                         int outputPixFmt, char *error) {
   enum AVCodecID output_codec = -1;
   const AVCodec *codec;
-  AVFormatContext *out_ctx;
-  AVCodecContext *codec_ctx;
-  AVStream *video_st;
+  AVCodecContext *codec_ctx = NULL;
   Image output = input;
   AVPacket *pkt = NULL;
+  bool success = false;
   int ret;
-  char errbuff[1024];
-
-  if (avformat_alloc_output_context2(&out_ctx, NULL, "image2", filename) < 0 ||
-      out_ctx == NULL) {
-    errOutput("unable to allocate output context.");
-  }
-
-  if ((ret = av_opt_set(out_ctx->priv_data, "update", "true", 0)) < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to configure update option: %s", errbuff);
-  }
 
   switch (outputPixFmt) {
   case AV_PIX_FMT_RGB24:
@@ -174,90 +660,176 @@ void saveImage(char *filename, Image input, int outputPixFmt) {
     break;
   }
 
-  if (input.frame->format != outputPixFmt) {
-    output = create_image(size_of_image(input), outputPixFmt, false,
-                          input.background, input.abs_black_threshold);
-    copy_rectangle(input, output, full_image(input), POINT_ORIGIN);
-  }
-
   codec = avcodec_find_encoder(output_codec);
   if (!codec) {
-    errOutput("output codec not found");
+    return set_error(error, "output codec not found");
   }
 
-  video_st = avformat_new_stream(out_ctx, codec);
-  if (!video_st) {
-    errOutput("could not alloc output stream");
+  if (input.frame->format != outputPixFmt) {
+    output = create_image(size_of_image(input), outputPixFmt, false,
+                          input.background, input.abs_black_threshold);
+    if (!convert_image(input, output)) {
+      copy_rectangle(input, output, full_image(input), POINT_ORIGIN);
+    }
   }
 
   codec_ctx = avcodec_alloc_context3(codec);
   if (!codec_ctx) {
-    errOutput("could not alloc codec context");
+    set_error(error, "could not alloc codec context");
+    goto cleanup;
   }
 
   codec_ctx->width = output.frame->width;
   codec_ctx->height = output.frame->height;
   codec_ctx->pix_fmt = output.frame->format;
-  video_st->codecpar->width = output.frame->width;
-  video_st->codecpar->height = output.frame->height;
-  video_st->codecpar->format = output.frame->format;
-  video_st->time_base.den = codec_ctx->time_base.den = 1;
-  video_st->time_base.num = codec_ctx->time_base.num = 1;
+  codec_ctx->time_base.den = 1;
+  codec_ctx->time_base.num = 1;
 
   ret = avcodec_open2(codec_ctx, codec, NULL);
-
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to open codec: %s", errbuff);
+    set_av_error(error, ret, "unable to open codec");
+    goto cleanup;
   }
 
-  if (verbose >= VERBOSE_MORE)
-    av_dump_format(out_ctx, 0, filename, 1);
-
-  if ((ret = avio_open(&out_ctx->pb, filename, AVIO_FLAG_WRITE)) < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("cannot alloc I/O context for %s: %s", filename, errbuff);
-  }
-
-  if ((ret = avformat_write_header(out_ctx, NULL)) < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("error writing header to '%s': %s", filename, errbuff);
-  }
+  verboseLog(VERBOSE_MORE, "output %s: %s, %s, %dx%d\n", name, codec->name,
+             av_get_pix_fmt_name(output.frame->format), output.frame->width,
+             output.frame->height);
 
   pkt = av_packet_alloc();
   if (!pkt) {
-    errOutput("unable to allocate output packet");
+    set_error(error, "unable to allocate output packet");
+    goto cleanup;
   }
 
   ret = avcodec_send_frame(codec_ctx, output.frame);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to send frame to encoder: %s", errbuff);
+    set_av_error(error, ret, "unable to send frame to encoder");
+    goto cleanup;
   }
 
   ret = avcodec_receive_packet(codec_ctx, pkt);
   if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to receive packet from encoder: %s", errbuff);
+    set_av_error(error, ret, "unable to receive packet from encoder");
+    goto cleanup;
   }
 
-  av_write_frame(out_ctx, pkt);
-
-  av_write_trailer(out_ctx);
+  // A pnm packet is a complete file, no container is needed around it.
+  avio_write(io, pkt->data, pkt->size);
+  success = true;
 
+cleanup:
   av_packet_free(&pkt);
   avcodec_free_context(&codec_ctx);
-  avformat_free_context(out_ctx);
-
   if (output.frame != input.frame)
     av_frame_free(&output.frame);
+  return success;
+}
+
+// Regular files are written under a temporary name and renamed when
+// complete, so that an interrupted run never leaves a truncated image behind.
+// Devices, pipes and other protocols are written to directly.
+static bool write_through_temporary(const char *filename) {
+  const char *protocol = avio_find_protocol_name(filename);
+  struct stat st;
+
+  // Explicit "file:" URLs are not paths that rename() would understand.
+  if (protocol == NULL || strcmp(protocol, "file") != 0 ||
+      strncmp(filename, "file:", 5) == 0) {
+    return false;
+  }
+  if (stat(filename, &st) != 0) {
+    return errno == ENOENT;
+  }
+  return S_ISREG(st.st_mode);
+}
+
+/**
+ * Saves image data to a file in ppm, pgm or pbm format.
+ *
+ * @param filename file name to save image to
+ * @param image image to save
+ * @param outputPixFmt pixel format of the saved file
+ */
+void saveImage(const char *filename, Image image, int outputPixFmt) {
+  char error[ERROR_MESSAGE_SIZE];
+  char temporary[PATH_MAX];
+  const char *path = filename;
+  AVIOContext *io = NULL;
+  bool success;
+  int ret;
+
+  if (write_through_temporary(filename) &&
+      snprintf(temporary, sizeof(temporary), "%s" TEMPORARY_SUFFIX,
+               filename) < (int)sizeof(temporary)) {
+    path = temporary;
+  }
+
+  if ((ret = avio_open(&io, path, AVIO_FLAG_WRITE)) < 0) {
+    set_av_error(error, ret, "cannot alloc I/O context for %s", path);
+    errOutput("%s", error);
+  }
+
+  success = encode_image(io, filename, image, outputPixFmt, error);
+
+  if ((ret = avio_closep(&io)) < 0 && success) {
+    success = set_av_error(error, ret, "unable to write %s", path);
+  }
+
+  if (success && path != filename && rename(path, filename) != 0) {
+    success = set_error(error, "unable to rename %s to %s: %s", path,
+                        filename, strerror(errno));
+  }
+
+  if (!success) {
+    if (path != filename) {
+      remove(path);
+    }
+    errOutput("%s", error);
+  }
+}
+
+void saveImageToIO(AVIOContext *io, const char *name, Image image,
+                   int outputPixFmt) {
+  char error[ERROR_MESSAGE_SIZE];
+
+  if (!encode_image(io, name, image, outputPixFmt, error)) {
+    errOutput("%s", error);
+  }
+
+  avio_flush(io);
+  if (io->error < 0) {
+    set_av_error(error, io->error, "unable to write %s", name);
+    errOutput("%s", error);
+  }
+}
+
+void saveImageToBuffer(Image image, int outputPixFmt, uint8_t **data,
+                       size_t *size) {
+  char error[ERROR_MESSAGE_SIZE];
+  AVIOContext *io = NULL;
+  bool success;
+  int length;
+
+  if (avio_open_dyn_buf(&io) < 0) {
+    errOutput("unable to allocate output buffer");
+  }
+
+  success = encode_image(io, "buffer", image, outputPixFmt, error);
+
+  length = avio_close_dyn_buf(io, data);
+  if (!success) {
+    av_freep(data);
+    errOutput("%s", error);
+  }
+
+  *size = length;
 }
 
 /**
  * Saves the image if full debugging mode is enabled.
  */
 void saveDebug(char *filenameTemplate, int index, Image image) {
-  if (verbose >= VERBOSE_DEBUG_SAVE) {
+  if (verbose_level() >= VERBOSE_DEBUG_SAVE) {
     char debugFilename[100];
     sprintf(debugFilename, filenameTemplate, index);
     saveImage(debugFilename, image, image.frame->format);
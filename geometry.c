@@ -0,0 +1,345 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geometry.h"
+
+static void write_quad(Text *text, int32_t a, int32_t b, int32_t c,
+                       int32_t d) {
+  text_printf(text, "[%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "]", a, b,
+              c, d);
+}
+
+void geometry_write(Text *text, const SheetGeometry *geometry) {
+  text_printf(text, "{\"sheet\":%d,\"size\":[%" PRId32 ",%" PRId32 "]",
+              geometry->sheet, geometry->size.width, geometry->size.height);
+
+  text_printf(text, ",\"mask_scans\":[");
+  for (size_t i = 0; i < geometry->mask_scans_count; i++) {
+    const MaskScan *scan = &geometry->mask_scans[i];
+
+    text_printf(text, "%s", i > 0 ? ",[" : "[");
+    for (size_t j = 0; j < scan->count; j++) {
+      const Rectangle *mask = &scan->masks[j];
+
+      text_printf(text, "%s", j > 0 ? "," : "");
+      write_quad(text, mask->vertex[0].x, mask->vertex[0].y,
+                 mask->vertex[1].x, mask->vertex[1].y);
+    }
+    text_printf(text, "]");
+  }
+
+  // Rotations are written with enough digits to read back the same float.
+  text_printf(text, "],\"rotations\":[");
+  for (size_t i = 0; i < geometry->rotations_count; i++) {
+    text_printf(text, "%s%.9g", i > 0 ? "," : "", geometry->rotations[i]);
+  }
+
+  text_printf(text, "],\"borders\":[");
+  for (size_t i = 0; i < geometry->borders_count; i++) {
+    const Border *border = &geometry->borders[i];
+
+    text_printf(text, "%s", i > 0 ? "," : "");
+    write_quad(text, border->left, border->top, border->right,
+               border->bottom);
+  }
+  text_printf(text, "]}\n");
+}
+
+/* --- reading ------------------------------------------------------------- */
+
+// Reads the subset of JSON written above: objects, arrays, numbers and
+// strings. Unknown members are skipped, whatever their value.
+typedef struct {
+  const char *p;
+  bool failed;
+} Parser;
+
+static void skip_space(Parser *parser) {
+  while (isspace((unsigned char)*parser->p)) {
+    parser->p++;
+  }
+}
+
+static bool accept(Parser *parser, char c) {
+  skip_space(parser);
+  if (*parser->p != c) {
+    return false;
+  }
+  parser->p++;
+  return true;
+}
+
+static bool expect(Parser *parser, char c) {
+  if (!parser->failed && !accept(parser, c)) {
+    parser->failed = true;
+  }
+  return !parser->failed;
+}
+
+// Steps through the items of an array or object ending with close: returns
+// false once it is closed or if it is malformed.
+static bool next_item(Parser *parser, char close, size_t index) {
+  if (parser->failed || accept(parser, close)) {
+    return false;
+  }
+  if (index > 0 && !expect(parser, ',')) {
+    return false;
+  }
+  return true;
+}
+
+static double parse_number(Parser *parser) {
+  char *end;
+
+  skip_space(parser);
+  double value = strtod(parser->p, &end);
+  if (end == parser->p || !isfinite(value)) {
+    parser->failed = true;
+    value = 0.0;
+  }
+  parser->p = end;
+  return value;
+}
+
+static int32_t parse_integer(Parser *parser) {
+  double value = parse_number(parser);
+
+  // Written so that NaN fails too, before the cast would be undefined.
+  if (!(value >= INT32_MIN && value <= INT32_MAX)) {
+    parser->failed = true;
+    return 0;
+  }
+  return (int32_t)value;
+}
+
+// Parses a string into buffer, truncated to its size.
+static void parse_string(Parser *parser, char *buffer, size_t size) {
+  size_t length = 0;
+
+  buffer[0] = '\0';
+  if (!expect(parser, '"')) {
+    return;
+  }
+  while (*parser->p != '"') {
+    if (*parser->p == '\0') {
+      parser->failed = true;
+      return;
+    }
+    if (*parser->p == '\\' && parser->p[1] != '\0') {
+      parser->p++;
+    }
+    if (length + 1 < size) {
+      buffer[length++] = *parser->p;
+    }
+    parser->p++;
+  }
+  parser->p++;
+  buffer[length] = '\0';
+}
+
+static void skip_value(Parser *parser) {
+  char key[2];
+
+  if (accept(parser, '[')) {
+    for (size_t i = 0; next_item(parser, ']', i); i++) {
+      skip_value(parser);
+    }
+  } else if (accept(parser, '{')) {
+    for (size_t i = 0; next_item(parser, '}', i); i++) {
+      parse_string(parser, key, sizeof(key));
+      expect(parser, ':');
+      skip_value(parser);
+    }
+  } else if (*parser->p == '"') {
+    parse_string(parser, key, sizeof(key));
+  } else if (strncmp(parser->p, "true", 4) == 0 ||
+             strncmp(parser->p, "null", 4) == 0) {
+    parser->p += 4;
+  } else if (strncmp(parser->p, "false", 5) == 0) {
+    parser->p += 5;
+  } else {
+    parse_number(parser);
+  }
+}
+
+// Parses an array of count integers.
+static void parse_integers(Parser *parser, int32_t *values[], size_t count) {
+  size_t i = 0;
+
+  expect(parser, '[');
+  for (; next_item(parser, ']', i); i++) {
+    if (i >= count) {
+      parser->failed = true;
+      return;
+    }
+    *values[i] = parse_integer(parser);
+  }
+  if (i != count) {
+    parser->failed = true;
+  }
+}
+
+static void parse_rectangle(Parser *parser, Rectangle *rectangle) {
+  int32_t *values[] = {&rectangle->vertex[0].x, &rectangle->vertex[0].y,
+                       &rectangle->vertex[1].x, &rectangle->vertex[1].y};
+
+  parse_integers(parser, values, 4);
+}
+
+static void parse_border(Parser *parser, Border *border) {
+  int32_t *values[] = {&border->left, &border->top, &border->right,
+                       &border->bottom};
+
+  parse_integers(parser, values, 4);
+}
+
+// Checks that one more of at most maximum items can be stored.
+static bool fits(Parser *parser, size_t index, size_t maximum) {
+  if (index >= maximum) {
+    parser->failed = true;
+  }
+  return !parser->failed;
+}
+
+static void parse_geometry(Parser *parser, SheetGeometry *geometry) {
+  char key[32];
+
+  memset(geometry, 0, sizeof(SheetGeometry));
+  geometry->size = (RectangleSize){-1, -1};
+
+  expect(parser, '{');
+  for (size_t i = 0; next_item(parser, '}', i); i++) {
+    parse_string(parser, key, sizeof(key));
+    expect(parser, ':');
+
+    if (strcmp(key, "sheet") == 0) {
+      geometry->sheet = parse_integer(parser);
+    } else if (strcmp(key, "size") == 0) {
+      int32_t *values[] = {&geometry->size.width, &geometry->size.height};
+      parse_integers(parser, values, 2);
+    } else if (strcmp(key, "mask_scans") == 0) {
+      size_t *count = &geometry->mask_scans_count;
+
+      expect(parser, '[');
+      for (*count = 0; next_item(parser, ']', *count) &&
+                       fits(parser, *count, MAX_MASK_SCANS);
+           (*count)++) {
+        MaskScan *scan = &geometry->mask_scans[*count];
+
+        expect(parser, '[');
+        for (scan->count = 0; next_item(parser, ']', scan->count) &&
+                              fits(parser, scan->count, MAX_POINTS);
+             scan->count++) {
+          parse_rectangle(parser, &scan->masks[scan->count]);
+        }
+      }
+    } else if (strcmp(key, "rotations") == 0) {
+      size_t *count = &geometry->rotations_count;
+
+      expect(parser, '[');
+      for (*count = 0; next_item(parser, ']', *count) &&
+                       fits(parser, *count, MAX_MASKS);
+           (*count)++) {
+        geometry->rotations[*count] = (float)parse_number(parser);
+      }
+    } else if (strcmp(key, "borders") == 0) {
+      size_t *count = &geometry->borders_count;
+
+      expect(parser, '[');
+      for (*count = 0; next_item(parser, ']', *count) &&
+                       fits(parser, *count, MAX_PAGES);
+           (*count)++) {
+        parse_border(parser, &geometry->borders[*count]);
+      }
+    } else {
+      skip_value(parser);
+    }
+  }
+}
+
+static char *read_file(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  char *data = NULL;
+  size_t size = 0;
+  size_t capacity = 0;
+
+  if (f == NULL) {
+    return NULL;
+  }
+
+  do {
+    if (size + 1 >= capacity) {
+      capacity = capacity == 0 ? 4096 : capacity * 2;
+      char *grown = realloc(data, capacity);
+      if (grown == NULL) {
+        free(data);
+        fclose(f);
+        return NULL;
+      }
+      data = grown;
+    }
+    size += fread(data + size, 1, capacity - size - 1, f);
+  } while (!feof(f) && !ferror(f));
+
+  if (ferror(f)) {
+    free(data);
+    data = NULL;
+  } else {
+    data[size] = '\0';
+  }
+  fclose(f);
+  return data;
+}
+
+bool geometry_read(const char *filename, SheetGeometry **geometries,
+                   size_t *count) {
+  char *data = read_file(filename);
+  Parser parser = {.p = data, .failed = data == NULL};
+
+  *geometries = NULL;
+  *count = 0;
+
+  while (!parser.failed) {
+    skip_space(&parser);
+    if (*parser.p == '\0') {
+      break;
+    }
+
+    SheetGeometry *grown =
+        realloc(*geometries, (*count + 1) * sizeof(SheetGeometry));
+    if (grown == NULL) {
+      parser.failed = true;
+      break;
+    }
+    *geometries = grown;
+    parse_geometry(&parser, &(*geometries)[(*count)++]);
+  }
+
+  free(data);
+  if (parser.failed) {
+    free(*geometries);
+    *geometries = NULL;
+    *count = 0;
+  }
+  return !parser.failed;
+}
+
+const SheetGeometry *geometry_find(const SheetGeometry geometries[],
+                                   size_t count, int nr) {
+  for (size_t i = 0; i < count; i++) {
+    if (geometries[i].sheet == nr) {
+      return &geometries[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- detected sheet geometry -------------------------------------------- */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "constants.h"
+#include "imageprocess/masks.h"
+#include "imageprocess/primitives.h"
+#include "lib/text.h"
+
+// Masks are scanned before masking, before deskewing and before centering.
+#define MAX_MASK_SCANS 3
+
+// Masks found by one mask scan, one for each scan point.
+typedef struct {
+  size_t count;
+  Rectangle masks[MAX_POINTS];
+} MaskScan;
+
+/**
+ * Results of the detections on a sheet, in the order they are made: the mask
+ * scans, the rotation of each mask and the border of each page. Coordinates
+ * are in pixels of a sheet of the given size.
+ */
+typedef struct {
+  int sheet;
+  RectangleSize size;
+  size_t mask_scans_count;
+  MaskScan mask_scans[MAX_MASK_SCANS];
+  size_t rotations_count;
+  float rotations[MAX_MASKS];
+  size_t borders_count;
+  Border borders[MAX_PAGES];
+} SheetGeometry;
+
+/**
+ * Appends geometry to text as a JSON object on a single line, such as:
+ *
+ * {"sheet":1,"size":[2480,3508],"mask_scans":[[[0,0,2479,3507]]],
+ *  "rotations":[0.1],"borders":[[10,12,10,12]]}
+ */
+void geometry_write(Text *text, const SheetGeometry *geometry);
+
+/**
+ * Reads the geometries of the sheets in filename, which holds any number of
+ * objects as written by geometry_write(). Returns false if the file cannot be
+ * read or parsed.
+ */
+bool geometry_read(const char *filename, SheetGeometry **geometries,
+                   size_t *count);
+
+// Returns the geometry of sheet nr, or NULL if there is none.
+const SheetGeometry *geometry_find(const SheetGeometry geometries[],
+                                   size_t count, int nr);
@@ -2,20 +2,110 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixfmt.h>
+
 #include "imageprocess/blit.h"
 #include "imageprocess/interpolate.h"
+#include "imageprocess/occupancy.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "imageprocess/row_kernels.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
+/**
+ * Sets the bits from x_start to x_end (inclusive) of a packed bilevel row.
+ */
+static void fill_row_bits(uint8_t *row, int32_t x_start, int32_t x_end,
+                          bool value) {
+  int32_t first_byte = x_start / 8;
+  int32_t last_byte = x_end / 8;
+  uint8_t first_mask = 0xFF >> (x_start % 8);
+  uint8_t last_mask = 0xFF << (7 - x_end % 8);
+
+  if (first_byte == last_byte) {
+    first_mask &= last_mask;
+  }
+
+  row[first_byte] =
+      value ? (row[first_byte] | first_mask) : (row[first_byte] & ~first_mask);
+  if (first_byte == last_byte) {
+    return;
+  }
+
+  memset(row + first_byte + 1, value ? 0xFF : 0x00, last_byte - first_byte - 1);
+  row[last_byte] =
+      value ? (row[last_byte] | last_mask) : (row[last_byte] & ~last_mask);
+}
+
+/**
+ * Fills the pixels from x_start to x_end (inclusive) of a single row with the
+ * given color, producing the same values as set_pixel() would.
+ */
+static void fill_row(Image image, int32_t y, int32_t x_start, int32_t x_end,
+                     Pixel color) {
+  uint8_t *row = image.frame->data[0] + y * image.frame->linesize[0];
+  uint8_t gray = pixel_grayscale(color);
+  bool pixel_black = gray < image.abs_black_threshold;
+
+  switch (image.frame->format) {
+  case AV_PIX_FMT_GRAY8:
+    memset(row + x_start, gray, x_end - x_start + 1);
+    break;
+  case AV_PIX_FMT_Y400A:
+    for (int32_t x = x_start; x <= x_end; x++) {
+      row[x * 2] = gray;
+      row[x * 2 + 1] = 0xFF; // no alpha.
+    }
+    break;
+  case AV_PIX_FMT_RGB24:
+    if (color.r == color.g && color.g == color.b) {
+      memset(row + x_start * 3, color.r, (x_end - x_start + 1) * 3);
+      break;
+    }
+    for (int32_t x = x_start; x <= x_end; x++) {
+      row[x * 3] = color.r;
+      row[x * 3 + 1] = color.g;
+      row[x * 3 + 2] = color.b;
+    }
+    break;
+  case AV_PIX_FMT_MONOWHITE:
+    fill_row_bits(row, x_start, x_end, pixel_black);
+    break;
+  case AV_PIX_FMT_MONOBLACK:
+    fill_row_bits(row, x_start, x_end, !pixel_black);
+    break;
+  default:
+    errOutput("unknown pixel format.");
+  }
+
+  if (image.planes != NULL) {
+    image_planes_fill_row(image, y, x_start, x_end, color);
+  }
+  if (image.occupancy != NULL) {
+    image_occupancy_fill_row(image, y, x_start, x_end);
+  }
+}
+
 /**
  * Wipe a rectangular area of pixels with the defined color.
- * @return The number of pixels actually changed.
  */
 void wipe_rectangle(Image image, Rectangle input_area, Pixel color) {
   Rectangle area = clip_rectangle(image, input_area);
 
-  scan_rectangle(area) { set_pixel(image, (Point){x, y}, color); }
+  if (area.vertex[0].x > area.vertex[1].x) {
+    return;
+  }
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    fill_row(image, y, area.vertex[0].x, area.vertex[1].x, color);
+  }
 }
 
 void copy_rectangle(Image source, Image target, Rectangle source_area,
@@ -32,12 +122,130 @@ void copy_rectangle(Image source, Image target, Rectangle source_area,
   }
 }
 
+/**
+ * Copies width columns of source, starting at source_x, to target_x in target,
+ * an image of the same height and pixel format, a row at a time. Bilevel rows
+ * are copied bit by bit unless both columns start on a byte. The target must
+ * have neither derived planes nor an occupancy map.
+ */
+void copy_columns(Image source, Image target, int32_t source_x,
+                  int32_t target_x, int32_t width) {
+  int format = source.frame->format;
+
+  for (int32_t y = 0; y < source.frame->height; y++) {
+    const uint8_t *row = source.frame->data[0] + y * source.frame->linesize[0];
+    uint8_t *out = target.frame->data[0] + y * target.frame->linesize[0];
+
+    if (format != AV_PIX_FMT_MONOWHITE && format != AV_PIX_FMT_MONOBLACK) {
+      size_t bytes = format == AV_PIX_FMT_RGB24 ? 3 : 1;
+      memcpy(out + target_x * bytes, row + source_x * bytes, width * bytes);
+      continue;
+    }
+
+    int32_t x = 0;
+    if (source_x % 8 == 0 && target_x % 8 == 0) {
+      x = width - width % 8;
+      memcpy(out + target_x / 8, row + source_x / 8, x / 8);
+    }
+    for (; x < width; x++) {
+      int32_t sx = source_x + x;
+      int32_t tx = target_x + x;
+      uint8_t mask = 0x80 >> (tx % 8);
+
+      if (row[sx / 8] & (0x80 >> (sx % 8))) {
+        out[tx / 8] |= mask;
+      } else {
+        out[tx / 8] &= ~mask;
+      }
+    }
+  }
+}
+
+/**
+ * Converts source into target, an image of the same size in another pixel
+ * format, with the same result as copy_rectangle() but a row at a time.
+ * Returns false, leaving target untouched, if there is no row conversion
+ * between the two formats.
+ */
+bool convert_image(Image source, Image target) {
+  const RowKernels *kernels = get_row_kernels();
+  int source_format = source.frame->format;
+  int target_format = target.frame->format;
+  uint8_t *gray_row = NULL;
+
+  if (source_format == AV_PIX_FMT_RGB24 &&
+      target_format == AV_PIX_FMT_MONOWHITE) {
+    // Each row is converted to grayscale first, then packed.
+    gray_row = av_malloc(source.frame->width);
+    if (gray_row == NULL) {
+      errOutput("unable to allocate conversion buffer.");
+    }
+  } else if (!(source_format == AV_PIX_FMT_RGB24 &&
+               target_format == AV_PIX_FMT_GRAY8) &&
+             !(source_format == AV_PIX_FMT_GRAY8 &&
+               target_format == AV_PIX_FMT_MONOWHITE)) {
+    return false;
+  }
+
+  for (int32_t y = 0; y < source.frame->height; y++) {
+    const uint8_t *row = source.frame->data[0] + y * source.frame->linesize[0];
+    uint8_t *out = target.frame->data[0] + y * target.frame->linesize[0];
+
+    if (source_format == AV_PIX_FMT_RGB24) {
+      uint8_t *gray = gray_row != NULL ? gray_row : out;
+      kernels->convert_rgb24_to_gray8(row, gray, source.frame->width);
+      row = gray;
+    }
+    if (target_format == AV_PIX_FMT_MONOWHITE) {
+      kernels->pack_gray8_to_monowhite(row, out, source.frame->width,
+                                       target.abs_black_threshold);
+    }
+  }
+
+  av_free(gray_row);
+  return true;
+}
+
+typedef uint8_t (*PixelValueGetter)(Image image, Point coords);
+
+/**
+ * Sums a per-pixel metric over a clipped rectangular area. GRAY8 images and
+ * images with derived planes are summed one byte per pixel, RGB24 images
+ * through the given row kernel, anything else pixel by pixel.
+ */
+static uint64_t sum_rect(Image image, Rectangle area, PlaneMetric metric,
+                         RowSumKernel rgb24_kernel,
+                         PixelValueGetter get_value) {
+  const RowKernels *kernels = get_row_kernels();
+  int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  uint64_t sum = 0;
+
+  if (width <= 0) {
+    return 0;
+  }
+
+  if (image.frame->format == AV_PIX_FMT_GRAY8 || image.planes != NULL) {
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      sum += kernels->sum_gray8(
+          image_plane_row(image, metric, y) + area.vertex[0].x, width);
+    }
+  } else if (image.frame->format == AV_PIX_FMT_RGB24) {
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      sum += rgb24_kernel(image.frame->data[0] + y * image.frame->linesize[0] +
+                              area.vertex[0].x * 3,
+                          width);
+    }
+  } else {
+    scan_rectangle(area) { sum += get_value(image, (Point){x, y}); }
+  }
+
+  return sum;
+}
+
 /**
  * Returns the average brightness of a rectangular area.
  */
 uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
-  uint64_t grayscale = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -45,9 +253,9 @@ uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    grayscale += get_pixel_grayscale(image, (Point){x, y});
-  }
+  uint64_t grayscale =
+      sum_rect(image, area, PLANE_GRAYSCALE,
+               get_row_kernels()->sum_rgb24_grayscale, get_pixel_grayscale);
 
   return 0xFF - (grayscale / count);
 }
@@ -56,8 +264,6 @@ uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
  * Returns the inverse average lightness of a rectangular area.
  */
 uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
-  uint64_t lightness = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -65,9 +271,9 @@ uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    lightness += get_pixel_lightness(image, (Point){x, y});
-  }
+  uint64_t lightness =
+      sum_rect(image, area, PLANE_LIGHTNESS,
+               get_row_kernels()->sum_rgb24_lightness, get_pixel_lightness);
 
   return 0xFF - (lightness / count);
 }
@@ -76,8 +282,6 @@ uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
  * Returns the average darkness of a rectangular area.
  */
 uint8_t darkness_rect(Image image, Rectangle input_area) {
-  uint64_t darkness = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -85,9 +289,9 @@ uint8_t darkness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    darkness += get_pixel_darkness_inverse(image, (Point){x, y});
-  }
+  uint64_t darkness = sum_rect(image, area, PLANE_DARKNESS_INVERSE,
+                               get_row_kernels()->sum_rgb24_darkness_inverse,
+                               get_pixel_darkness_inverse);
 
   return 0xFF - (darkness / count);
 }
@@ -95,19 +299,69 @@ uint8_t darkness_rect(Image image, Rectangle input_area) {
 uint64_t count_pixels_within_brightness(Image image, Rectangle area,
                                         uint8_t min_brightness,
                                         uint8_t max_brightness, bool clear) {
+  const RowKernels *kernels = get_row_kernels();
+  RowCountKernel kernel = NULL;
+  int bytes_per_pixel = 1;
   uint64_t count = 0;
 
-  scan_rectangle(area) {
-    Point p = {x, y};
-    uint8_t brightness = get_pixel_grayscale(image, p);
-    if (brightness < min_brightness || brightness > max_brightness) {
-      continue;
+  // No pixel of an area made of white tiles is dark enough to be counted.
+  if (max_brightness < image_min_lightness(image, area)) {
+    return 0;
+  }
+
+  switch (image.frame->format) {
+  case AV_PIX_FMT_GRAY8:
+    kernel = kernels->count_gray8_within;
+    break;
+  case AV_PIX_FMT_RGB24:
+    kernel = kernels->count_rgb24_within;
+    bytes_per_pixel = 3;
+    break;
+  default:
+    break;
+  }
+
+  if (kernel == NULL || area.vertex[0].x > area.vertex[1].x ||
+      area.vertex[0].y > area.vertex[1].y) {
+    scan_rectangle(area) {
+      Point p = {x, y};
+      uint8_t brightness = get_pixel_grayscale(image, p);
+      if (brightness < min_brightness || brightness > max_brightness) {
+        continue;
+      }
+
+      if (clear) {
+        set_pixel(image, p, PIXEL_WHITE);
+      }
+      count++;
     }
 
-    if (clear) {
-      set_pixel(image, p, PIXEL_WHITE);
+    return count;
+  }
+
+  Rectangle inside = clip_rectangle(image, area);
+  uint64_t inside_count = 0;
+  int32_t width = inside.vertex[1].x - inside.vertex[0].x + 1;
+
+  if (width > 0) {
+    for (int32_t y = inside.vertex[0].y; y <= inside.vertex[1].y; y++) {
+      count += kernel(image.frame->data[0] + y * image.frame->linesize[0] +
+                          inside.vertex[0].x * bytes_per_pixel,
+                      width, min_brightness, max_brightness, clear);
+      inside_count += width;
     }
-    count++;
+  }
+
+  if (clear && count > 0 && image.planes != NULL) {
+    image_planes_invalidate(image, inside);
+  }
+  if (clear && count > 0 && image.occupancy != NULL) {
+    image_occupancy_invalidate(image, inside);
+  }
+
+  // Pixels outside of the image read as white, and cannot be cleared.
+  if (max_brightness == 0xFF) {
+    count += count_pixels(area) - inside_count;
   }
 
   return count;
@@ -169,6 +423,170 @@ static void stretch_frame(Image source, Image target,
   }
 }
 
+/**
+ * Returns the integer factor by which source is reduced to target, if it is
+ * at least 2 and leaves fewer source pixels over than that factor, or 0.
+ */
+static int32_t reduction_factor(int32_t source, int32_t target) {
+  int32_t factor = source / target;
+
+  return factor >= 2 && source - factor * target < factor ? factor : 0;
+}
+
+void box_sum_row(uint32_t sums[], const uint8_t *row, int32_t width,
+                 int32_t factor, size_t components) {
+  for (int32_t start = 0; start < width; start += factor) {
+    int32_t end = min(start + factor, width);
+
+    for (int32_t x = start; x < end; x++) {
+      for (size_t c = 0; c < components; c++) {
+        sums[c] += row[x * components + c];
+      }
+    }
+    sums += components;
+  }
+}
+
+void box_average_row(uint8_t *out, const uint32_t sums[], int32_t width,
+                     int32_t factor, int32_t rows, size_t components,
+                     bool rounded) {
+  for (int32_t start = 0; start < width; start += factor) {
+    uint32_t area = (min(start + factor, width) - start) * rows;
+    uint32_t bias = rounded ? area / 2 : 0;
+
+    for (size_t c = 0; c < components; c++) {
+      *out++ = (*sums++ + bias) / area;
+    }
+  }
+}
+
+/**
+ * Reduces a GRAY8 or RGB24 image by averaging each block of factor.width by
+ * factor.height pixels. Source rows are summed into a row of accumulators,
+ * so that each source pixel is read once.
+ */
+static void reduce_bytes(Image source, Image target, RectangleSize factor) {
+  size_t components = source.frame->format == AV_PIX_FMT_RGB24 ? 3 : 1;
+  size_t row_bytes = target.frame->width * components;
+  int32_t width = target.frame->width * factor.width;
+  uint32_t *sums = av_malloc(row_bytes * sizeof(uint32_t));
+
+  if (sums == NULL) {
+    errOutput("unable to allocate reduction buffer.");
+  }
+
+  for (int32_t y = 0; y < target.frame->height; y++) {
+    memset(sums, 0, row_bytes * sizeof(uint32_t));
+
+    for (int32_t dy = 0; dy < factor.height; dy++) {
+      const uint8_t *row =
+          source.frame->data[0] +
+          (y * factor.height + dy) * source.frame->linesize[0];
+      box_sum_row(sums, row, width, factor.width, components);
+    }
+
+    uint8_t *out = target.frame->data[0] + y * target.frame->linesize[0];
+    box_average_row(out, sums, width, factor.width, factor.height,
+                    components, true);
+  }
+
+  av_free(sums);
+}
+
+/**
+ * Reduces a bilevel image by 2 or 4 on each axis, counting the set bits of
+ * each block straight from the packed rows. A block turns black if its
+ * average brightness is below the black threshold, as set_pixel() would do.
+ */
+static void reduce_bits(Image source, Image target, RectangleSize factor) {
+  static const uint8_t nibble_bits[16] = {0, 1, 1, 2, 1, 2, 2, 3,
+                                          1, 2, 2, 3, 2, 3, 3, 4};
+  // MONOWHITE sets the bits of black pixels, MONOBLACK those of white ones.
+  bool bits_black = source.frame->format == AV_PIX_FMT_MONOWHITE;
+  uint8_t mask = (1 << factor.width) - 1;
+  uint32_t area = factor.width * factor.height;
+  int32_t width = target.frame->width;
+  uint8_t *counts = av_malloc(width);
+
+  if (counts == NULL) {
+    errOutput("unable to allocate reduction buffer.");
+  }
+
+  for (int32_t y = 0; y < target.frame->height; y++) {
+    memset(counts, 0, width);
+
+    for (int32_t dy = 0; dy < factor.height; dy++) {
+      const uint8_t *row =
+          source.frame->data[0] +
+          (y * factor.height + dy) * source.frame->linesize[0];
+
+      // Blocks of 2 or 4 bits never straddle two bytes.
+      for (int32_t x = 0; x < width; x++) {
+        int32_t bit = x * factor.width;
+        int shift = 8 - factor.width - bit % 8;
+        counts[x] += nibble_bits[(row[bit / 8] >> shift) & mask];
+      }
+    }
+
+    uint8_t *out = target.frame->data[0] + y * target.frame->linesize[0];
+    memset(out, 0, (width + 7) / 8);
+    for (int32_t x = 0; x < width; x++) {
+      uint32_t white = bits_black ? area - counts[x] : counts[x];
+      bool black = (white * UINT8_MAX + area / 2) / area <
+                   target.abs_black_threshold;
+      if (black == bits_black) {
+        out[x / 8] |= 0x80 >> (x % 8);
+      }
+    }
+  }
+
+  av_free(counts);
+}
+
+/**
+ * Reduces source into target by area averaging, if target is smaller by an
+ * integer factor on both axes that the pixel format supports. Returns false,
+ * leaving target untouched, otherwise.
+ */
+static bool reduce_frame(Image source, Image target) {
+  RectangleSize factor = {
+      .width = reduction_factor(source.frame->width, target.frame->width),
+      .height = reduction_factor(source.frame->height, target.frame->height),
+  };
+
+  if (factor.width == 0 || factor.height == 0) {
+    return false;
+  }
+
+  switch (source.frame->format) {
+  case AV_PIX_FMT_GRAY8:
+  case AV_PIX_FMT_RGB24:
+    verboseLog(VERBOSE_MORE, "reducing %dx%d by %dx%d\n",
+               source.frame->width, source.frame->height, factor.width,
+               factor.height);
+    reduce_bytes(source, target, factor);
+    return true;
+  case AV_PIX_FMT_MONOWHITE:
+  case AV_PIX_FMT_MONOBLACK:
+    if ((factor.width != 2 && factor.width != 4) ||
+        (factor.height != 2 && factor.height != 4)) {
+      return false;
+    }
+    verboseLog(VERBOSE_MORE, "reducing %dx%d by %dx%d\n",
+               source.frame->width, source.frame->height, factor.width,
+               factor.height);
+    reduce_bits(source, target, factor);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Stretches an image to size. Reductions by integer factors average the
+ * pixels of each block, unless nearest-neighbour interpolation is asked for;
+ * anything else samples the source through interpolate().
+ */
 void stretch_and_replace(Image *pImage, RectangleSize size,
                          Interpolation interpolate_type) {
   if (compare_sizes(size_of_image(*pImage), size) == 0)
@@ -176,7 +594,9 @@ void stretch_and_replace(Image *pImage, RectangleSize size,
 
   Image target = create_compatible_image(*pImage, size, false);
 
-  stretch_frame(*pImage, target, interpolate_type);
+  if (interpolate_type == INTERP_NN || !reduce_frame(*pImage, target)) {
+    stretch_frame(*pImage, target, interpolate_type);
+  }
   replace_image(pImage, &target);
 }
 
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "imageprocess/image.h"
@@ -13,6 +15,9 @@
 void wipe_rectangle(Image image, Rectangle input_area, Pixel color);
 void copy_rectangle(Image source, Image target, Rectangle source_area,
                     Point target_coords);
+void copy_columns(Image source, Image target, int32_t source_x,
+                  int32_t target_x, int32_t width);
+bool convert_image(Image source, Image target);
 uint8_t inverse_brightness_rect(Image image, Rectangle input_area);
 uint8_t inverse_lightness_rect(Image image, Rectangle input_area);
 uint8_t darkness_rect(Image image, Rectangle input_area);
@@ -20,6 +25,17 @@ uint64_t count_pixels_within_brightness(Image image, Rectangle area,
                                         uint8_t min_brightness,
                                         uint8_t max_brightness, bool clear);
 
+// Box averaging shared by the image reductions. box_sum_row() adds the first
+// width pixels of a row, of components interleaved bytes each, into one sum
+// per block of factor pixels; the last block takes what is left of the row.
+// box_average_row() turns the sums of that many rows into averages, rounded
+// or truncated as the full resolution metrics of blit.c are.
+void box_sum_row(uint32_t sums[], const uint8_t *row, int32_t width,
+                 int32_t factor, size_t components);
+void box_average_row(uint8_t *out, const uint32_t sums[], int32_t width,
+                     int32_t factor, int32_t rows, size_t components,
+                     bool rounded);
+
 typedef int8_t RotationDirection;
 static const RotationDirection ROTATE_CLOCKWISE = 1;
 static const RotationDirection ROTATE_ANTICLOCKWISE = -1;
@@ -13,27 +13,37 @@
 #include "imageprocess/deskew.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "imageprocess/pyramid.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/stats.h"
 
 // maximum pixel count of virtual line to detect rotation with
 #define MAX_ROTATION_SCAN_SIZE 10000
 
+// Angles scanned on either side of a hinted rotation, in scan steps. The
+// rotation found there is checked against angles a window apart over the
+// whole range.
+#define HINT_WINDOW_STEPS 4
+#define HINT_SAMPLE_STEPS (2 * HINT_WINDOW_STEPS + 1)
+
 static inline float degreesToRadians(float d) { return d * M_PI / 180.0; }
 
 bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
                                 float deskewScanStep, float deskewScanDeviation,
                                 int deskewScanSize, float deskewScanDepth,
-                                Edges deskewScanEdges) {
+                                Edges deskewScanEdges, int decimation) {
   *params = (DeskewParameters){
       .deskewScanRangeRad = degreesToRadians(deskewScanRange),
       .deskewScanStepRad = degreesToRadians(deskewScanStep),
       .deskewScanDeviationRad = degreesToRadians(deskewScanDeviation),
       .deskewScanSize = deskewScanSize,
       .deskewScanDepth = deskewScanDepth,
-      .scan_edges = deskewScanEdges};
+      .scan_edges = deskewScanEdges,
+      .decimation = decimation};
 
-  return true;
+  return valid_decimation(decimation);
 }
 
 /**
@@ -69,6 +79,14 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
   int accumulatedBlackness = 0;
   int deskewScanSize = params.deskewScanSize;
 
+  // Masks within the image apron are read straight from the plane rows.
+  bool direct = within_apron(image, mask.vertex[0], 0, 0) &&
+                within_apron(image, mask.vertex[1], 0, 0) &&
+                image_plane_row(image, PLANE_DARKNESS_INVERSE,
+                                mask.vertex[0].y) != NULL;
+
+  stats_count(COUNTER_DESKEW_PROBES, 1);
+
   if (shift.vertical == 0) { // horizontal detection
     if (deskewScanSize == -1) {
       deskewScanSize = size.height;
@@ -124,7 +142,9 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
       Point pt = p[lineStep];
       p[lineStep] = shift_point(pt, shift);
       if (point_in_rectangle(pt, mask)) {
-        pixel = get_pixel_darkness_inverse(image, pt);
+        pixel = direct ? image_plane_row(image, PLANE_DARKNESS_INVERSE,
+                                         pt.y)[pt.x]
+                       : get_pixel_darkness_inverse(image, pt);
         blackness += (255 - pixel);
       }
     }
@@ -145,10 +165,14 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
 /**
  * Detects rotation at one edge of the area specified by left, top, right,
  * bottom. Which of the four edges to take depends on whether shiftX or shiftY
- * is non-zero, and what sign this shifting value has.
+ * is non-zero, and what sign this shifting value has. Angles are scanned in
+ * steps of step radians, skipping those further than window from center. The
+ * peak value of the rotation found is returned in *peak.
  */
-static float detect_edge_rotation(Image image, const Rectangle mask,
-                                  const DeskewParameters params, Delta shift) {
+static float scan_edge_rotation(Image image, const Rectangle mask,
+                                const DeskewParameters params, Delta shift,
+                                float step, float center, float window,
+                                int *peak) {
   // either shiftX or shiftY is 0, the other value is -i|+i
   // depending on shiftX/shiftY the start edge for shifting is determined
   int max_peak = 0;
@@ -157,35 +181,105 @@ static float detect_edge_rotation(Image image, const Rectangle mask,
   // iteratively increase test angle, alternating between +/- sign while
   // increasing absolute value
   for (float rotation = 0.0; rotation <= params.deskewScanRangeRad;
-       rotation = (rotation >= 0.0) ? -(rotation + params.deskewScanStepRad)
-                                    : -rotation) {
+       rotation = (rotation >= 0.0) ? -(rotation + step) : -rotation) {
+    if (fabsf(rotation - center) > window) {
+      continue;
+    }
     float m = tanf(rotation);
-    int peak = detect_edge_rotation_peak(image, mask, params, shift, m);
-    if (peak > max_peak) {
+    int edge_peak = detect_edge_rotation_peak(image, mask, params, shift, m);
+    if (edge_peak > max_peak) {
       detected_rotation = rotation;
-      max_peak = peak;
+      max_peak = edge_peak;
     }
   }
+  *peak = max_peak;
   return detected_rotation;
 }
+
+/**
+ * Detects rotation at one edge like scan_edge_rotation(), only scanning the
+ * angles next to hint if it is not NULL. Otherwise, or if the rotation found
+ * there is not trusted, it is detected on the decimated image first if there
+ * is one, in steps as many times larger as it is smaller. Only the angles
+ * next to the one found there are scanned on image.
+ */
+static float detect_edge_rotation(Image image, Image *decimated,
+                                  const Rectangle mask,
+                                  const DeskewParameters params, Delta shift,
+                                  const float *hint) {
+  const int factor = params.decimation;
+  const float step = params.deskewScanStepRad;
+  float center = 0.0;
+  float window = INFINITY;
+  int peak;
+
+  if (hint != NULL) {
+    // Half a step more, for the rounding of the angles.
+    float hint_window = step * (HINT_WINDOW_STEPS + 0.5);
+    float rotation = scan_edge_rotation(image, mask, params, shift, step,
+                                        *hint, hint_window, &peak);
+
+    // Unless the angles sampled peak within the window, the rotation found
+    // must peak higher than them all, away from either end of the window.
+    if (peak > 0 &&
+        fabsf(rotation - *hint) < step * (HINT_WINDOW_STEPS - 0.5)) {
+      int sample_peak;
+      float sample =
+          scan_edge_rotation(image, mask, params, shift,
+                             step * HINT_SAMPLE_STEPS, 0.0, INFINITY,
+                             &sample_peak);
+      if (peak > sample_peak || fabsf(sample - *hint) <= hint_window) {
+        return rotation;
+      }
+    }
+    verboseLog(VERBOSE_MORE, "rotation not near hint (%f), full scan\n",
+               *hint);
+  }
+
+  Image coarse_image =
+      decimated_image(image, PLANE_DARKNESS_INVERSE, factor, decimated);
+  if (coarse_image.frame != NULL) {
+    DeskewParameters coarse_params = params;
+    coarse_params.deskewScanSize =
+        decimate_length(params.deskewScanSize, factor);
+
+    center = scan_edge_rotation(coarse_image,
+                                decimate_rectangle(mask, factor),
+                                coarse_params, shift, step * factor, 0.0,
+                                INFINITY, &peak);
+    // Half a step more, for the rounding of the angles.
+    window = step * (factor + 0.5);
+  }
+
+  return scan_edge_rotation(image, mask, params, shift, step, center, window,
+                            &peak);
+}
 /**
  * detect rotation of a whole area.
  * angles between -deskew_scan_range and +deskew_scan_range are scanned, at
  * either the horizontal or vertical edges of the area specified by left, top,
- * right, bottom.
+ * right, bottom. Only the angles next to hint are scanned first, if it is not
+ * NULL.
  */
 float detect_rotation(Image image, const Rectangle mask,
-                      const DeskewParameters params) {
+                      const DeskewParameters params, const float *hint) {
   float rotation[4];
   int count = 0;
   float total;
   float average;
   float deviation;
 
+  // The top and bottom edges are scanned with the opposite slope.
+  const float opposite = hint != NULL ? -*hint : 0.0;
+  const float *opposite_hint = hint != NULL ? &opposite : NULL;
+
+  Image decimated = EMPTY_IMAGE;
+
   if (params.scan_edges.left) {
     // left
     rotation[count] =
-        detect_edge_rotation(image, mask, params, DELTA_RIGHTWARD);
+        detect_edge_rotation(image, &decimated, mask, params, DELTA_RIGHTWARD,
+                             hint);
     verboseLog(VERBOSE_NORMAL, "detected rotation left: [%d,%d,%d,%d]: %f\n",
                mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
                mask.vertex[1].y, rotation[count]);
@@ -194,7 +288,8 @@ float detect_rotation(Image image, const Rectangle mask,
   if (params.scan_edges.top) {
     // top
     rotation[count] =
-        -detect_edge_rotation(image, mask, params, DELTA_DOWNWARD);
+        -detect_edge_rotation(image, &decimated, mask, params, DELTA_DOWNWARD,
+                             opposite_hint);
     verboseLog(VERBOSE_NORMAL, "detected rotation top: [%d,%d,%d,%d]: %f\n",
                mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
                mask.vertex[1].y, rotation[count]);
@@ -202,7 +297,9 @@ float detect_rotation(Image image, const Rectangle mask,
   }
   if (params.scan_edges.right) {
     // right
-    rotation[count] = detect_edge_rotation(image, mask, params, DELTA_LEFTWARD);
+    rotation[count] =
+        detect_edge_rotation(image, &decimated, mask, params, DELTA_LEFTWARD,
+                             hint);
     verboseLog(VERBOSE_NORMAL, "detected rotation right: [%d,%d,%d,%d]: %f\n",
                mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
                mask.vertex[1].y, rotation[count]);
@@ -210,12 +307,15 @@ float detect_rotation(Image image, const Rectangle mask,
   }
   if (params.scan_edges.bottom) {
     // bottom
-    rotation[count] = -detect_edge_rotation(image, mask, params, DELTA_UPWARD);
+    rotation[count] =
+        -detect_edge_rotation(image, &decimated, mask, params, DELTA_UPWARD,
+                             opposite_hint);
     verboseLog(VERBOSE_NORMAL, "detected rotation bottom: [%d,%d,%d,%d]: %f\n",
                mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
                mask.vertex[1].y, rotation[count]);
     count++;
   }
+  free_image(&decimated);
 
   total = 0.0;
   for (int i = 0; i < count; i++) {
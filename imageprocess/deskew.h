@@ -17,15 +17,20 @@ typedef struct {
   int deskewScanSize;
   float deskewScanDepth;
   Edges scan_edges;
+
+  // Factor of the decimated image scanned first, 1 to scan only the image.
+  int decimation;
 } DeskewParameters;
 
 bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
                                 float deskewScanStep, float deskewScanDeviation,
                                 int deskewScanSize, float deskewScanDepth,
-                                Edges deskewScanEdges);
+                                Edges deskewScanEdges, int decimation);
 
+// The rotation is detected near hint, if it is not NULL, unless it is not
+// found there.
 float detect_rotation(Image image, Rectangle mask,
-                      const DeskewParameters params);
+                      const DeskewParameters params, const float *hint);
 
 void deskew(Image source, Rectangle mask, float radians,
             Interpolation interpolate_type);
@@ -4,6 +4,7 @@
 
 #include "imageprocess/fill.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
 
 /**
  * Solidly fills a line of pixels heading towards a specified direction
@@ -22,9 +23,15 @@ static uint64_t fill_line(Image image, Point p, Delta step, Pixel color,
 
   Rectangle area = full_image(image);
 
+  // The line stops at the first pixel past the edges at the latest, so an
+  // apron lets it read the grayscale rows directly.
+  bool direct = image.apron > 0 && within_apron(image, p, 1, 1) &&
+                image_plane_row(image, PLANE_GRAYSCALE, p.y) != NULL;
+
   while (true) {
     p = shift_point(p, step);
-    uint8_t pixel = get_pixel_grayscale(image, p);
+    uint8_t pixel = direct ? image_plane_row(image, PLANE_GRAYSCALE, p.y)[p.x]
+                           : get_pixel_grayscale(image, p);
 
     if ((pixel >= mask_min) && (pixel <= mask_max)) {
       intensityCount = intensity; // reset counter
@@ -9,9 +9,21 @@
 #include "imageprocess/blit.h"
 #include "imageprocess/fill.h"
 #include "imageprocess/filters.h"
+#include "imageprocess/occupancy.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/stats.h"
+
+/**
+ * Tells, without averaging them, whether the pixels of an area are too light
+ * for any of its average darkness metrics to reach threshold, because the
+ * occupancy map of the image knows it is made of white tiles only.
+ */
+static bool certainly_lighter(Image image, Rectangle area, uint8_t threshold) {
+  return UINT8_MAX - image_min_lightness(image, area) < threshold;
+}
 
 /***************
  * Blackfilter *
@@ -69,16 +81,16 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
     bool already_excluded_logged = false;
 
     do {
-      uint8_t blackness = darkness_rect(image, area);
-
       // If we find a solidly black area.
-      if (blackness >= params.abs_threshold) {
+      if (!certainly_lighter(image, area, params.abs_threshold) &&
+          darkness_rect(image, area) >= params.abs_threshold) {
         if (!rectangle_overlap_any(area, params.exclusions_count,
                                    params.exclusions)) {
           verboseLog(VERBOSE_NORMAL, "black-area flood-fill: [%d,%d,%d,%d]\n",
                      area.vertex[0].x, area.vertex[0].y, area.vertex[1].x,
                      area.vertex[1].y);
           already_excluded_logged = false;
+          stats_count(COUNTER_FLOOD_FILLS, 1);
           // start flood-fill in this area (on each pixel to make sure we get
           // everything, in most cases first flood-fill from first pixel will
           // delete all other black pixels in the area already)
@@ -243,11 +255,40 @@ static bool noisefilter_compare_and_clear(Image image, Point p, bool clear,
   return true;
 }
 
+/**
+ * Counts the dark pixels on the square ring level pixels away from p, reading
+ * the lightness rows directly. The ring must lie within the image apron.
+ */
+static uint64_t noisefilter_count_ring(Image image, Point p, int32_t level,
+                                       uint8_t min_white_level) {
+  const uint8_t *upper = image_plane_row(image, PLANE_LIGHTNESS, p.y - level);
+  const uint8_t *lower = image_plane_row(image, PLANE_LIGHTNESS, p.y + level);
+  uint64_t count = 0;
+
+  for (int32_t xx = p.x - level; xx <= p.x + level; xx++) {
+    count += (upper[xx] < min_white_level) + (lower[xx] < min_white_level);
+  }
+
+  for (int32_t yy = p.y - (level - 1); yy <= p.y + (level - 1); yy++) {
+    const uint8_t *row = image_plane_row(image, PLANE_LIGHTNESS, yy);
+
+    count += (row[p.x - level] < min_white_level) +
+             (row[p.x + level] < min_white_level);
+  }
+
+  return count;
+}
+
 static uint64_t
 noisefilter_count_pixel_neighbors_level(Image image, Point p, uint32_t level,
                                         bool clear, uint8_t min_white_level) {
   uint64_t count = 0;
 
+  if (!clear && within_apron(image, p, level, level) &&
+      image_plane_row(image, PLANE_LIGHTNESS, p.y) != NULL) {
+    return noisefilter_count_ring(image, p, level, min_white_level);
+  }
+
   // upper and lower rows
   for (int32_t xx = p.x - level; xx <= p.x + level; xx++) {
     Point upper = {xx, p.y - level}, lower = {xx, p.y + level};
@@ -320,6 +361,15 @@ void noisefilter(Image image, uint64_t intensity, uint8_t min_white_level) {
   scan_rectangle(area) {
     Point p = {x, y};
 
+    // Skip the rest of the tile row when its tile holds no dark pixel.
+    if (x % OCCUPANCY_TILE_SIZE == 0 &&
+        image_min_lightness(
+            image, (Rectangle){{p, {x + OCCUPANCY_TILE_SIZE - 1, y}}}) >=
+            min_white_level) {
+      x += OCCUPANCY_TILE_SIZE - 1;
+      continue;
+    }
+
     uint8_t darkness = get_pixel_darkness_inverse(image, p);
     if (darkness < min_white_level) { // one dark pixel found
       // get number of non-light pixels in neighborhood
@@ -366,9 +416,9 @@ void grayfilter(Image image, GrayfilterParameters params) {
         image, area, 0, image.abs_black_threshold, false);
 
     if (count == 0) {
-      uint8_t lightness = inverse_lightness_rect(image, area);
       // (lower threshold->more deletion)
-      if (lightness < params.abs_threshold) {
+      if (certainly_lighter(image, area, params.abs_threshold) ||
+          inverse_lightness_rect(image, area) < params.abs_threshold) {
         count += count_pixels(area);
         wipe_rectangle(image, area, PIXEL_WHITE);
       }
@@ -386,3 +436,60 @@ void grayfilter(Image image, GrayfilterParameters params) {
 
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " pixels.\n", count);
 }
+
+/*******************
+ * Blank detection *
+ *******************/
+
+bool validate_blank_parameters(BlankParameters *params, float threshold,
+                               float density) {
+  *params = (BlankParameters){
+      .abs_threshold = WHITE * (1.0 - threshold),
+      .density = density,
+  };
+
+  return threshold >= 0.0 && threshold <= 1.0 && density >= 0.0 &&
+         density <= 1.0;
+}
+
+static Rectangle blank_area(Image image) {
+  RectangleSize size = size_of_image(image);
+
+  return (Rectangle){{
+      {size.width / BLANK_MARGIN_DIVISOR, size.height / BLANK_MARGIN_DIVISOR},
+      {size.width - size.width / BLANK_MARGIN_DIVISOR - 1,
+       size.height - size.height / BLANK_MARGIN_DIVISOR - 1},
+  }};
+}
+
+uint64_t count_blank_samples(Image image) {
+  RectangleSize size = size_of_rectangle(blank_area(image));
+
+  if (size.width <= 0 || size.height <= 0) {
+    return 0;
+  }
+  return (uint64_t)((size.width + BLANK_SAMPLE_STEP - 1) / BLANK_SAMPLE_STEP) *
+         ((size.height + BLANK_SAMPLE_STEP - 1) / BLANK_SAMPLE_STEP);
+}
+
+bool detect_blank(Image image, BlankParameters params) {
+  Rectangle area = blank_area(image);
+  uint64_t samples = 0;
+  uint64_t dark = 0;
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y;
+       y += BLANK_SAMPLE_STEP) {
+    for (int32_t x = area.vertex[0].x; x <= area.vertex[1].x;
+         x += BLANK_SAMPLE_STEP) {
+      if (get_pixel_grayscale(image, (Point){x, y}) < params.abs_threshold) {
+        dark++;
+      }
+      samples++;
+    }
+  }
+
+  verboseLog(VERBOSE_MORE,
+             "blank detection: %" PRIu64 " of %" PRIu64 " samples dark.\n",
+             dark, samples);
+  return samples > 0 && dark <= params.density * samples;
+}
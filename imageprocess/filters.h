@@ -68,3 +68,23 @@ bool validate_grayfilter_parameters(GrayfilterParameters *params,
                                     float threshold);
 
 void grayfilter(Image image, GrayfilterParameters params);
+
+// Sheets are sampled on a grid of this step, leaving out the edges on each
+// side by this fraction of the sheet size, where scanners leave shadows.
+#define BLANK_SAMPLE_STEP 4
+#define BLANK_MARGIN_DIVISOR 10
+
+typedef struct {
+  // Pixels of a lower grayscale value are dark.
+  uint8_t abs_threshold;
+  // Maximum fraction of dark samples on a blank sheet.
+  float density;
+} BlankParameters;
+
+bool validate_blank_parameters(BlankParameters *params, float threshold,
+                               float density);
+
+// Returns whether the image looks blank, from a sample of its pixels.
+bool detect_blank(Image image, BlankParameters params);
+// Returns the number of pixels that detect_blank() samples on the image.
+uint64_t count_blank_samples(Image image);
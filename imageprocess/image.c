@@ -4,11 +4,19 @@
 
 #include "lib/porting.h"
 
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/buffer.h>
+#include <libavutil/common.h>
 #include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
 
 #include "imageprocess/blit.h"
 #include "imageprocess/image.h"
+#include "imageprocess/occupancy.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
@@ -42,19 +50,127 @@ Image create_image(RectangleSize size, int pixel_format, bool fill,
   return image;
 }
 
+// Rows of padded images, and their first pixels, are aligned to this many
+// bytes.
+#define PADDED_ROW_ALIGNMENT 64
+
+/**
+ * Creates an image surrounded by an apron of white pixels, apron pixels wide
+ * on each side, so that neighbourhood kernels can read that far past its
+ * edges without checking their coordinates: the apron reads as get_pixel()
+ * does outside of any image. Only GRAY8 and RGB24 images get an apron, others
+ * are created as by create_image().
+ */
+Image create_padded_image(RectangleSize size, int pixel_format, bool fill,
+                          Pixel sheet_background, uint8_t abs_black_threshold,
+                          int32_t apron) {
+  size_t pixel_bytes = 0;
+
+  switch (pixel_format) {
+  case AV_PIX_FMT_GRAY8:
+    pixel_bytes = 1;
+    break;
+  case AV_PIX_FMT_RGB24:
+    pixel_bytes = 3;
+    break;
+  }
+  if (apron <= 0 || pixel_bytes == 0) {
+    return create_image(size, pixel_format, fill, sheet_background,
+                        abs_black_threshold);
+  }
+
+  Image image = {
+      .frame = av_frame_alloc(),
+      .background = sheet_background,
+      .abs_black_threshold = abs_black_threshold,
+      .apron = apron,
+  };
+  if (image.frame == NULL) {
+    errOutput("unable to allocate frame.");
+  }
+
+  image.frame->width = size.width;
+  image.frame->height = size.height;
+  image.frame->format = pixel_format;
+
+  // The left apron is widened so that the first pixel of each row is aligned
+  // as well; the right one takes up the rest of the aligned row.
+  size_t left = FFALIGN(apron * pixel_bytes, PADDED_ROW_ALIGNMENT);
+  size_t linesize = FFALIGN(left + (size.width + apron) * pixel_bytes,
+                            PADDED_ROW_ALIGNMENT);
+  size_t rows = size.height + 2 * (size_t)apron;
+
+  AVBufferRef *buffer =
+      av_buffer_alloc(linesize * rows + PADDED_ROW_ALIGNMENT - 1);
+  if (buffer == NULL) {
+    errOutput("unable to allocate padded buffer.");
+  }
+  uint8_t *start =
+      (uint8_t *)FFALIGN((uintptr_t)buffer->data, PADDED_ROW_ALIGNMENT);
+  size_t row_bytes = size.width * pixel_bytes;
+
+  image.frame->buf[0] = buffer;
+  image.frame->linesize[0] = linesize;
+  image.frame->data[0] = start + apron * linesize + left;
+  image.frame->extended_data = image.frame->data;
+
+  // Only the apron is white: the rows above and below, and the sides of each
+  // row. Pixels that are not filled start out black, as in a zeroed frame.
+  memset(start, UINT8_MAX, apron * linesize);
+  memset(start + (apron + size.height) * linesize, UINT8_MAX,
+         apron * linesize);
+  for (int32_t y = 0; y < size.height; y++) {
+    uint8_t *row = image.frame->data[0] + y * linesize;
+
+    memset(row - left, UINT8_MAX, left);
+    memset(row + row_bytes, UINT8_MAX, linesize - left - row_bytes);
+    if (!fill) {
+      memset(row, 0, row_bytes);
+    }
+  }
+  if (fill) {
+    wipe_rectangle(image, full_image(image), image.background);
+  }
+
+  return image;
+}
+
 void replace_image(Image *image, Image *new_image) {
+  bool planes = image->planes != NULL;
+  bool occupancy = image->occupancy != NULL;
+  uint8_t threshold = occupancy ? image_occupancy_threshold(*image) : 0;
+
   free_image(image);
   image->frame = new_image->frame;
   image->background = new_image->background;
   image->abs_black_threshold = new_image->abs_black_threshold;
+  image->apron = new_image->apron;
+  image->planes = new_image->planes;
+  image->occupancy = new_image->occupancy;
   new_image->frame = NULL;
+  new_image->planes = NULL;
+  new_image->occupancy = NULL;
+
+  // The replacement keeps caching the derived planes of the original.
+  if (planes) {
+    image_enable_planes(image);
+  }
+  if (occupancy) {
+    image_enable_occupancy(image, threshold);
+  }
 }
 
-void free_image(Image *image) { av_frame_free(&image->frame); }
+void free_image(Image *image) {
+  image_free_planes(image);
+  image_free_occupancy(image);
+  av_frame_free(&image->frame);
+}
 
+// Creates an image like source, with its apron if it has one.
 Image create_compatible_image(Image source, RectangleSize size, bool fill) {
-  return create_image(size, source.frame->format, fill, source.background,
-                      source.abs_black_threshold);
+  return create_padded_image(size, source.frame->format, fill,
+                             source.background, source.abs_black_threshold,
+                             source.apron);
 }
 
 RectangleSize size_of_image(Image image) {
@@ -7,18 +7,33 @@
 #include "imageprocess/primitives.h"
 
 typedef struct AVFrame AVFrame;
+typedef struct ImagePlanes ImagePlanes;
+typedef struct ImageOccupancy ImageOccupancy;
 
 typedef struct {
   AVFrame *frame;
   Pixel background;
   uint8_t abs_black_threshold;
+
+  // Width in pixels of the white apron around the pixels, which can be read
+  // without bounds checks; see create_padded_image().
+  int32_t apron;
+
+  // Optional cache of derived GRAY8 planes, see planes.h.
+  ImagePlanes *planes;
+
+  // Optional map of the tiles holding dark pixels, see occupancy.h.
+  ImageOccupancy *occupancy;
 } Image;
 
 #define EMPTY_IMAGE                                                            \
-  (Image) { NULL, PIXEL_WHITE, 0 }
+  (Image) { NULL, PIXEL_WHITE, 0, 0, NULL, NULL }
 
 Image create_image(RectangleSize size, int pixel_format, bool fill,
                    Pixel sheet_background, uint8_t abs_black_threshold);
+Image create_padded_image(RectangleSize size, int pixel_format, bool fill,
+                          Pixel sheet_background, uint8_t abs_black_threshold,
+                          int32_t apron);
 void replace_image(Image *image, Image *new_image);
 void free_image(Image *image);
 Image create_compatible_image(Image source, RectangleSize size, bool fill);
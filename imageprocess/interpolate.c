@@ -5,18 +5,37 @@
 #include "lib/porting.h"
 
 #include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <libavutil/common.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
 
 #include "imageprocess/interpolate.h"
 #include "imageprocess/pixel.h"
 
+// Reads a pixel straight from the image buffer if padded, as allowed by
+// within_apron(), or through get_pixel() otherwise.
+static inline Pixel neighbour(Image image, bool padded, int32_t x, int32_t y) {
+  if (!padded) {
+    return get_pixel(image, (Point){x, y});
+  }
+
+  const uint8_t *row =
+      image.frame->data[0] + (ptrdiff_t)y * image.frame->linesize[0];
+  if (image.frame->format == AV_PIX_FMT_GRAY8) {
+    return (Pixel){row[x], row[x], row[x]};
+  }
+  return (Pixel){row[x * 3], row[x * 3 + 1], row[x * 3 + 2]};
+}
+
 Pixel interp_nearest_neighbour(Image image, FloatPoint coords) {
   // Round to nearest location.
   Point p = {(int)roundf(coords.x), (int)roundf(coords.y)};
 
-  return get_pixel(image, p);
+  return neighbour(image, within_apron(image, p, 0, 0), p.x, p.y);
 }
 
 /**
@@ -45,15 +64,16 @@ static Pixel cubic_pixel_interpolation(float factor, Pixel pxls[4]) {
 // 2-D bicubic interpolation
 Pixel interp_bicubic(Image image, FloatPoint coords) {
   Point p = {(int)coords.x, (int)coords.y};
+  bool padded = within_apron(image, p, 1, 2);
 
   Pixel pxls[4];
 
   for (int i = -1; i < 3; ++i) {
     Pixel quad[4] = {
-        get_pixel(image, (Point){p.x - 1, p.y + i}),
-        get_pixel(image, (Point){p.x, p.y + i}),
-        get_pixel(image, (Point){p.x + 1, p.y + i}),
-        get_pixel(image, (Point){p.x + 2, p.y + i}),
+        neighbour(image, padded, p.x - 1, p.y + i),
+        neighbour(image, padded, p.x, p.y + i),
+        neighbour(image, padded, p.x + 1, p.y + i),
+        neighbour(image, padded, p.x + 2, p.y + i),
     };
     pxls[i + 1] = cubic_pixel_interpolation(coords.x - p.x, quad);
   }
@@ -86,32 +106,35 @@ Pixel interp_bilinear(Image image, FloatPoint coords) {
     return get_pixel(image, p1);
   }
 
+  // p2 is in the image, so p1 is at most a pixel away from it.
+  bool padded = within_apron(image, p1, 0, 0);
+
   // Single pixel.
   if (p1.x == p2.x && p1.y == p2.y) {
-    return get_pixel(image, p1);
+    return neighbour(image, padded, p1.x, p1.y);
   }
 
   // 2D vertical interpolation.
   if (p1.x == p2.x) {
-    Pixel pxl1 = get_pixel(image, p1);
-    Pixel pxl2 = get_pixel(image, p2);
+    Pixel pxl1 = neighbour(image, padded, p1.x, p1.y);
+    Pixel pxl2 = neighbour(image, padded, p2.x, p2.y);
 
     return linear_pixel_interpolation(coords.x - p1.x, pxl1, pxl2);
   }
 
   // 2D horizontal interpolation.
   if (p1.y == p2.y) {
-    Pixel pxl1 = get_pixel(image, p1);
-    Pixel pxl2 = get_pixel(image, p2);
+    Pixel pxl1 = neighbour(image, padded, p1.x, p1.y);
+    Pixel pxl2 = neighbour(image, padded, p2.x, p2.y);
 
     return linear_pixel_interpolation(coords.y - p1.y, pxl1, pxl2);
   }
 
   // Get the four pixels in a square.
-  Pixel pxl1 = get_pixel(image, (Point){p1.x, p1.y});
-  Pixel pxl2 = get_pixel(image, (Point){p2.x, p1.y});
-  Pixel pxl3 = get_pixel(image, (Point){p1.x, p2.y});
-  Pixel pxl4 = get_pixel(image, (Point){p2.x, p2.y});
+  Pixel pxl1 = neighbour(image, padded, p1.x, p1.y);
+  Pixel pxl2 = neighbour(image, padded, p2.x, p1.y);
+  Pixel pxl3 = neighbour(image, padded, p1.x, p2.y);
+  Pixel pxl4 = neighbour(image, padded, p2.x, p2.y);
 
   Pixel pxl_h1 = linear_pixel_interpolation(coords.x - p1.x, pxl1, pxl2);
   Pixel pxl_h2 = linear_pixel_interpolation(coords.x - p1.x, pxl3, pxl4);
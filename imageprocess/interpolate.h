@@ -14,4 +14,8 @@ typedef enum {
   INTERP_FUNCTIONS_COUNT
 } Interpolation;
 
+// Apron width that lets every interpolation function read the neighbourhood
+// of points near the edges of an image without bounds checks.
+#define INTERPOLATION_APRON 2
+
 Pixel interpolate(Image image, FloatPoint coords, Interpolation function);
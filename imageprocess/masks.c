@@ -2,6 +2,7 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <assert.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,14 +11,16 @@
 #include "imageprocess/masks.h"
 #include "imageprocess/pixel.h"
 #include "imageprocess/primitives.h"
+#include "imageprocess/pyramid.h"
 #include "lib/logging.h"
+#include "lib/math_util.h"
 
 bool validate_mask_detection_parameters(
     MaskDetectionParameters *params, Direction scan_direction,
     RectangleSize scan_size, const int scan_depth[DIRECTIONS_COUNT],
     Delta scan_step, const float scan_threshold[DIRECTIONS_COUNT],
     const int scan_mininum[DIMENSIONS_COUNT],
-    const int scan_maximum[DIMENSIONS_COUNT]) {
+    const int scan_maximum[DIMENSIONS_COUNT], int decimation) {
   *params = (MaskDetectionParameters){
       .scan_size = scan_size,
       .scan_depth =
@@ -39,20 +42,43 @@ bool validate_mask_detection_parameters(
 
       .minimum_height = scan_mininum[VERTICAL],
       .maximum_height = scan_maximum[VERTICAL],
+
+      .decimation = decimation,
   };
 
-  return true;
+  return valid_decimation(decimation);
 }
 
-/**
- * Finds one edge of non-black pixels heading from one starting point towards
- * edge direction.
- *
- * @return number of shift-steps until blank edge found
- */
-static uint32_t detect_edge(Image image, Point origin, Delta step,
-                            int32_t scan_size, int32_t scan_depth,
-                            float threshold) {
+// Step of a scan on the image decimated by factor.
+static int32_t decimate_step(int32_t step, int factor) {
+  if (step < 0) {
+    return -decimate_length(-step, factor);
+  }
+  return step == 0 ? 0 : decimate_length(step, factor);
+}
+
+// Scans started near a hint search the steps within a band of this fraction
+// of the image around it, and the whole image if the edge is not found there.
+#define HINT_BAND_FRACTION 32
+
+// Steps of step_length in the band around a hint on an image of length.
+static uint32_t hint_band(int32_t length, int32_t step_length) {
+  int32_t band = length / HINT_BAND_FRACTION / step_length;
+  return band > 0 ? band : 1;
+}
+
+// Progress of an edge scan: the number of shift-steps taken, and the total and
+// last of the blackness values found.
+typedef struct {
+  uint32_t count;
+  uint32_t total;
+  uint8_t last;
+} EdgeScan;
+
+// Area of an edge scan from origin after count shift-steps.
+static Rectangle edge_scan_area(Image image, Point origin, Delta step,
+                                int32_t scan_size, int32_t scan_depth,
+                                uint32_t count) {
   Rectangle scan_area;
   RectangleSize image_size = size_of_image(image);
 
@@ -81,41 +107,168 @@ static uint32_t detect_edge(Image image, Point origin, Delta step,
               step.horizontal, step.vertical);
   }
 
-  uint32_t total = 0;
-  uint32_t count = 0;
+  return shift_rectangle(scan_area,
+                         (Delta){step.horizontal * (int32_t)count,
+                                 step.vertical * (int32_t)count});
+}
+
+/**
+ * Finds one edge of non-black pixels heading from one starting point towards
+ * edge direction, continuing a scan that has taken scan.count steps.
+ *
+ * @return the scan, counting the shift-steps until blank edge found
+ */
+static EdgeScan scan_edge(Image image, Point origin, Delta step,
+                          int32_t scan_size, int32_t scan_depth,
+                          float threshold, EdgeScan scan) {
+  Rectangle scan_area = edge_scan_area(image, origin, step, scan_size,
+                                       scan_depth, scan.count);
+
   uint8_t blackness;
   do {
     blackness = inverse_brightness_rect(image, scan_area);
-    total += blackness;
-    count++;
+    scan.total += blackness;
+    scan.count++;
     scan_area = shift_rectangle(scan_area, step);
     // is blackness below threshold*average?
     // this will surely become true when pos reaches the outside of
     // the actual image area and blacknessRect() will deliver 0
     // because all pixels outside are considered white
-  } while ((blackness >= ((threshold * total) / count)) && blackness != 0);
+  } while ((blackness >= ((threshold * scan.total) / scan.count)) &&
+           blackness != 0);
 
-  return count;
+  scan.last = blackness;
+  return scan;
 }
 
 /**
- * Detects a mask of white borders around a starting point.
+ * Finds one edge like scan_edge(), starting two bands of steps before the
+ * edge hint steps away. The way there is only sampled every band steps, for
+ * an edge before and for the average blackness to continue the scan with.
+ *
+ * @return whether the edge found in *count is within band steps of hint
+ */
+static bool scan_edge_near(Image image, Point origin, Delta step,
+                           int32_t scan_size, int32_t scan_depth,
+                           float threshold, uint32_t hint, uint32_t band,
+                           uint32_t *count) {
+  uint32_t start = hint - 2 * band;
+  EdgeScan samples = {0};
+
+  for (uint32_t i = 0; i < start; i += band) {
+    uint8_t blackness = inverse_brightness_rect(
+        image, edge_scan_area(image, origin, step, scan_size, scan_depth, i));
+    samples.total += blackness;
+    samples.count++;
+    if (blackness < (threshold * samples.total) / samples.count ||
+        blackness == 0) {
+      return false;
+    }
+  }
+
+  EdgeScan scan = scan_edge(
+      image, origin, step, scan_size, scan_depth, threshold,
+      (EdgeScan){.count = start,
+                 .total = (uint64_t)samples.total * start / samples.count});
+
+  *count = scan.count;
+  return scan.count > hint - band && scan.count <= hint + band;
+}
+
+/**
+ * Finds one edge like scan_edge(), near the edge hint steps away if it is
+ * beyond the bands before it. Otherwise, or if it is not found there, the
+ * edge is found on the decimated image first if there is one. The scan of
+ * image then continues from a few steps before the edge found there, with the
+ * average blackness found on the way.
+ *
+ * @return number of shift-steps until blank edge found
+ */
+static uint32_t detect_edge(Image image, Image *decimated, int factor,
+                            Point origin, Delta step, int32_t scan_size,
+                            int32_t scan_depth, float threshold,
+                            int32_t hint) {
+  EdgeScan scan = {0};
+
+  // Edges closer than the bands are scanned from the origin anyway.
+  RectangleSize image_size = size_of_image(image);
+  int32_t length = step.vertical == 0 ? image_size.width : image_size.height;
+  uint32_t band = hint_band(length, abs(step.horizontal + step.vertical));
+  if (hint > 2 * (int32_t)band) {
+    uint32_t count;
+
+    if (scan_edge_near(image, origin, step, scan_size, scan_depth, threshold,
+                       hint, band, &count)) {
+      return count;
+    }
+    verboseLog(VERBOSE_MORE, "edge not near hint (%d steps), full scan\n",
+               hint);
+  }
+
+  Image coarse_image =
+      decimated_image(image, PLANE_GRAYSCALE, factor, decimated);
+  if (coarse_image.frame != NULL) {
+    Delta coarse_step = {decimate_step(step.horizontal, factor),
+                         decimate_step(step.vertical, factor)};
+    EdgeScan coarse = scan_edge(
+        coarse_image, decimate_point(origin, factor), coarse_step,
+        decimate_length(scan_size, factor), decimate_length(scan_depth, factor),
+        threshold, (EdgeScan){0});
+
+    // Steps of image up to the last area scanned on the decimated image,
+    // less the steps that the decimation may be off by.
+    uint32_t step_length = abs(step.horizontal + step.vertical);
+    uint32_t coarse_length =
+        abs(coarse_step.horizontal + coarse_step.vertical) * factor;
+    uint32_t steps = (coarse.count - 1) * coarse_length / step_length;
+    uint32_t margin = 2 * coarse_length / step_length + 1;
+
+    if (steps > margin) {
+      scan.count = steps - margin;
+      scan.total = (uint64_t)(coarse.total - coarse.last) * scan.count /
+                   (coarse.count - 1);
+    }
+  }
+
+  return scan_edge(image, origin, step, scan_size, scan_depth, threshold, scan)
+      .count;
+}
+
+// Shift-steps of step to an edge distance pixels away from the scan area
+// around the origin, or -1 if there is no such edge.
+static int32_t edge_hint(int32_t distance, int32_t step) {
+  return distance >= 0 ? distance / step : -1;
+}
+
+/**
+ * Detects a mask of white borders around a starting point, near the edges of
+ * hint if it is not NULL.
  * The result is returned via call-by-reference parameters left, top, right,
  * bottom.
  */
-static bool detect_mask(Image image, MaskDetectionParameters params,
-                        Point origin, Rectangle *mask) {
+static bool detect_mask(Image image, Image *decimated,
+                        MaskDetectionParameters params, Point origin,
+                        const Rectangle *hint, Rectangle *mask) {
   RectangleSize image_size = size_of_image(image);
+  Rectangle hinted = hint != NULL ? *hint : INVALID_MASK;
+  bool hinted_x = hinted.vertex[0].x >= 0 && hinted.vertex[1].x >= 0;
+  bool hinted_y = hinted.vertex[0].y >= 0 && hinted.vertex[1].y >= 0;
 
   if (params.scan_direction.horizontal) {
-    int32_t left_edge =
-        detect_edge(image, origin, (Delta){-params.scan_step.horizontal, 0},
-                    params.scan_size.width, params.scan_depth.horizontal,
-                    params.scan_threshold.horizontal);
-    int32_t right_edge =
-        detect_edge(image, origin, (Delta){params.scan_step.horizontal, 0},
-                    params.scan_size.width, params.scan_depth.horizontal,
-                    params.scan_threshold.horizontal);
+    int32_t half = params.scan_size.width / 2;
+    int32_t step = params.scan_step.horizontal;
+    int32_t left_edge = detect_edge(
+        image, decimated, params.decimation, origin, (Delta){-step, 0},
+        params.scan_size.width, params.scan_depth.horizontal,
+        params.scan_threshold.horizontal,
+        hinted_x ? edge_hint(origin.x - half - hinted.vertex[0].x, step)
+                 : -1);
+    int32_t right_edge = detect_edge(
+        image, decimated, params.decimation, origin, (Delta){step, 0},
+        params.scan_size.width, params.scan_depth.horizontal,
+        params.scan_threshold.horizontal,
+        hinted_x ? edge_hint(hinted.vertex[1].x - origin.x - half, step)
+                 : -1);
 
     mask->vertex[0].x = origin.x - (params.scan_step.horizontal * left_edge) -
                         params.scan_size.width / 2;
@@ -127,14 +280,20 @@ static bool detect_mask(Image image, MaskDetectionParameters params,
   }
 
   if (params.scan_direction.vertical) {
-    int32_t top_edge =
-        detect_edge(image, origin, (Delta){0, -params.scan_step.vertical},
-                    params.scan_size.height, params.scan_depth.vertical,
-                    params.scan_threshold.vertical);
-    int32_t bottom_edge =
-        detect_edge(image, origin, (Delta){0, params.scan_step.vertical},
-                    params.scan_size.height, params.scan_depth.vertical,
-                    params.scan_threshold.vertical);
+    int32_t half = params.scan_size.height / 2;
+    int32_t step = params.scan_step.vertical;
+    int32_t top_edge = detect_edge(
+        image, decimated, params.decimation, origin, (Delta){0, -step},
+        params.scan_size.height, params.scan_depth.vertical,
+        params.scan_threshold.vertical,
+        hinted_y ? edge_hint(origin.y - half - hinted.vertex[0].y, step)
+                 : -1);
+    int32_t bottom_edge = detect_edge(
+        image, decimated, params.decimation, origin, (Delta){0, step},
+        params.scan_size.height, params.scan_depth.vertical,
+        params.scan_threshold.vertical,
+        hinted_y ? edge_hint(hinted.vertex[1].y - origin.y - half, step)
+                 : -1);
 
     mask->vertex[0].y = origin.y - (params.scan_step.vertical * top_edge) -
                         params.scan_size.height / 2;
@@ -170,23 +329,26 @@ static bool detect_mask(Image image, MaskDetectionParameters params,
   return success;
 }
 
-static const Rectangle INVALID_MASK = {{{-1, -1}, {-1, -1}}};
-
 /**
- * Detects masks around the points specified in point[].
+ * Detects masks around the points specified in point[], near the masks in
+ * hints[] if it is not NULL.
  *
  * @return number of masks stored in mask[][]
  */
 size_t detect_masks(Image image, MaskDetectionParameters params,
                     const Point points[], size_t points_count,
-                    Rectangle masks[]) {
+                    const Rectangle hints[], Rectangle masks[]) {
   size_t masks_count = 0;
   if (!params.scan_direction.horizontal && !params.scan_direction.vertical) {
     return masks_count;
   }
 
+  Image decimated = EMPTY_IMAGE;
+
   for (size_t i = 0; i < points_count; i++) {
-    bool mask_valid = detect_mask(image, params, points[i], &masks[i]);
+    bool mask_valid =
+        detect_mask(image, &decimated, params, points[i],
+                    hints != NULL ? &hints[i] : NULL, &masks[i]);
 
     // Compare the newly-detected mask with an invalid mask where all the
     // vertex are (-1, -1)
@@ -204,6 +366,7 @@ size_t detect_masks(Image image, MaskDetectionParameters params,
     }
   }
 
+  free_image(&decimated);
   return masks_count;
 }
 
@@ -293,22 +456,18 @@ void align_mask(Image image, const Rectangle inside_area,
 
 /**
  * Permanently applies image masks. Each pixel which is not covered by at least
- * one mask is set to maskColor.
+ * one mask is set to maskColor. Returns the number of pixels cleared.
  */
-void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
-                 Pixel color) {
+uint64_t apply_masks(Image image, const Rectangle masks[], size_t masks_count,
+                     Pixel color) {
   if (masks_count <= 0) {
-    return;
+    return 0;
   }
 
-  Rectangle image_area = full_image(image);
+  MaskingPlan plan = masking_plan_init(image);
 
-  scan_rectangle(image_area) {
-    Point p = {x, y};
-    if (!point_in_rectangles_any(p, masks_count, masks)) {
-      set_pixel(image, p, color);
-    }
-  }
+  masking_plan_add_masks(&plan, masks, masks_count);
+  return apply_masking_plan(image, &plan, color);
 }
 
 /**
@@ -316,14 +475,10 @@ void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
  * is set to wipeColor.
  */
 void apply_wipes(Image image, Wipes wipes, Pixel color) {
-  for (size_t i = 0; i < wipes.count; i++) {
-    scan_rectangle(wipes.areas[i]) { set_pixel(image, (Point){x, y}, color); }
+  MaskingPlan plan = masking_plan_init(image);
 
-    verboseLog(VERBOSE_MORE,
-               "wipe [%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "]\n",
-               wipes.areas[i].vertex[0].x, wipes.areas[i].vertex[0].y,
-               wipes.areas[i].vertex[1].x, wipes.areas[i].vertex[1].y);
-  }
+  masking_plan_add_wipes(&plan, wipes);
+  apply_masking_plan(image, &plan, color);
 }
 
 Rectangle border_to_mask(Image image, const Border border) {
@@ -347,22 +502,16 @@ Rectangle border_to_mask(Image image, const Border border) {
  * edges of the sheet will be cleared.
  */
 void apply_border(Image image, const Border border, Pixel color) {
-  if (memcmp(&border, &BORDER_NULL, sizeof(BORDER_NULL)) == 0) {
-    return;
-  }
+  MaskingPlan plan = masking_plan_init(image);
 
-  Rectangle mask = border_to_mask(image, border);
-  verboseLog(VERBOSE_NORMAL, "applying border (%d,%d,%d,%d) [%d,%d,%d,%d]\n",
-             border.left, border.top, border.right, border.bottom,
-             mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-             mask.vertex[1].y);
-  apply_masks(image, &mask, 1, color);
+  masking_plan_add_border(&plan, image, border);
+  apply_masking_plan(image, &plan, color);
 }
 
 bool validate_border_scan_parameters(
     BorderScanParameters *params, Direction scan_direction,
     RectangleSize scan_size, Delta scan_step,
-    const int scan_threshold[DIRECTIONS_COUNT]) {
+    const int scan_threshold[DIRECTIONS_COUNT], int decimation) {
   *params = (BorderScanParameters){
       .scan_size = scan_size,
       .scan_step = scan_step,
@@ -373,20 +522,18 @@ bool validate_border_scan_parameters(
           },
 
       .scan_direction = scan_direction,
+
+      .decimation = decimation,
   };
 
-  return true;
+  return valid_decimation(decimation);
 }
 
-/**
- * Find the size of one border edge.
- */
-static uint32_t detect_border_edge(Image image, const Rectangle outside_mask,
-                                   Delta step, int32_t size,
-                                   int32_t threshold) {
+// Area scanned for one border edge, position pixels inside the outside mask.
+static Rectangle border_edge_area(const Rectangle outside_mask, Delta step,
+                                  int32_t size, uint32_t position) {
   Rectangle area = outside_mask;
-  RectangleSize mask_size = size_of_rectangle(outside_mask);
-  int32_t max_step;
+  int32_t steps = position / abs(step.horizontal + step.vertical);
 
   if (step.vertical == 0) { // horizontal detection
     if (step.horizontal > 0) {
@@ -394,21 +541,38 @@ static uint32_t detect_border_edge(Image image, const Rectangle outside_mask,
     } else {
       area.vertex[0].x = outside_mask.vertex[1].x - size;
     }
-    max_step = mask_size.width;
   } else { // vertical detection
     if (step.vertical > 0) {
       area.vertex[1].y = outside_mask.vertex[0].y + size;
     } else {
       area.vertex[0].y = outside_mask.vertex[1].y - size;
     }
-    max_step = mask_size.height;
   }
 
-  uint32_t result = 0;
+  return shift_rectangle(
+      area, (Delta){step.horizontal * steps, step.vertical * steps});
+}
+
+static bool border_edge_found(Image image, Rectangle area, int32_t threshold) {
+  uint32_t cnt = count_pixels_within_brightness(
+      image, area, 0, image.abs_black_threshold, false);
+  return cnt >= threshold;
+}
+
+/**
+ * Find the size of one border edge, scanning from start pixels inside the
+ * outside mask.
+ */
+static uint32_t scan_border_edge(Image image, const Rectangle outside_mask,
+                                 Delta step, int32_t size, int32_t threshold,
+                                 uint32_t start) {
+  RectangleSize mask_size = size_of_rectangle(outside_mask);
+  int32_t max_step = step.vertical == 0 ? mask_size.width : mask_size.height;
+  Rectangle area = border_edge_area(outside_mask, step, size, start);
+
+  uint32_t result = start;
   while (result < max_step) {
-    uint32_t cnt = count_pixels_within_brightness(
-        image, area, 0, image.abs_black_threshold, false);
-    if (cnt >= threshold) {
+    if (border_edge_found(image, area, threshold)) {
       return result; // border has been found: regular exit here
     }
 
@@ -421,12 +585,102 @@ static uint32_t detect_border_edge(Image image, const Rectangle outside_mask,
   return 0; // no border found between 0..max_step
 }
 
+/**
+ * Find the size of one border edge, starting two bands of steps before the
+ * edge of size hint. The way there is only sampled every band steps, for an
+ * edge before.
+ *
+ * @return whether the size found in *result is within band steps of hint
+ */
+static bool scan_border_edge_near(Image image, const Rectangle outside_mask,
+                                  Delta step, int32_t size, int32_t threshold,
+                                  uint32_t hint, uint32_t band,
+                                  uint32_t *result) {
+  uint32_t step_length = abs(step.horizontal + step.vertical);
+  uint32_t start =
+      (hint - 2 * band * step_length) / step_length * step_length;
+
+  for (uint32_t position = 0; position < start;
+       position += band * step_length) {
+    if (border_edge_found(
+            image, border_edge_area(outside_mask, step, size, position),
+            threshold)) {
+      return false;
+    }
+  }
+
+  *result = scan_border_edge(image, outside_mask, step, size, threshold, start);
+  return *result > hint - band * step_length &&
+         *result <= hint + band * step_length;
+}
+
+/**
+ * Find the size of one border edge, near the edge of size hint if it is
+ * beyond the bands before it. Otherwise, or if it is not found there, the
+ * edge is found on the decimated image first if there is one. The scan of
+ * image then starts a few steps before the edge found there, or before the
+ * first of the steps that reach the edge on image.
+ */
+static uint32_t detect_border_edge(Image image, Image *decimated, int factor,
+                                   const Rectangle outside_mask, Delta step,
+                                   int32_t size, int32_t threshold,
+                                   uint32_t hint) {
+  uint32_t start = 0;
+
+  // Edges closer than the bands are scanned from the start anyway.
+  RectangleSize mask_size = size_of_rectangle(outside_mask);
+  int32_t length = step.vertical == 0 ? mask_size.width : mask_size.height;
+  uint32_t step_length = abs(step.horizontal + step.vertical);
+  uint32_t band = hint_band(length, step_length);
+  if (hint > 2 * band * step_length) {
+    uint32_t result;
+
+    if (scan_border_edge_near(image, outside_mask, step, size, threshold,
+                              hint, band, &result)) {
+      return result;
+    }
+    verboseLog(VERBOSE_MORE, "border edge not near hint (%u), full scan\n",
+               hint);
+  }
+
+  Image coarse_image =
+      decimated_image(image, PLANE_GRAYSCALE, factor, decimated);
+  if (coarse_image.frame != NULL) {
+    Delta coarse_step = {decimate_step(step.horizontal, factor),
+                         decimate_step(step.vertical, factor)};
+    int32_t coarse_threshold = threshold / (factor * factor);
+    uint32_t coarse = scan_border_edge(
+        coarse_image, decimate_rectangle(outside_mask, factor), coarse_step,
+        decimate_length(size, factor),
+        coarse_threshold > 0 ? coarse_threshold : 1, 0);
+    if (coarse == 0) {
+      return 0;
+    }
+
+    uint32_t step_length = abs(step.horizontal + step.vertical);
+    uint32_t margin =
+        2 * abs(coarse_step.horizontal + coarse_step.vertical) * factor;
+    if (coarse * factor > margin) {
+      start = (coarse * factor - margin) / step_length * step_length;
+    }
+    while (start > 0 &&
+           border_edge_found(image,
+                             border_edge_area(outside_mask, step, size,
+                                              start - step_length),
+                             threshold)) {
+      start -= step_length;
+    }
+  }
+
+  return scan_border_edge(image, outside_mask, step, size, threshold, start);
+}
+
 /**
  * Detects a border of completely non-black pixels around the area
- * outsideBorder.
+ * outsideBorder, near the edges of hint if it is not NULL.
  */
 Border detect_border(Image image, BorderScanParameters params,
-                     const Rectangle outside_mask) {
+                     const Rectangle outside_mask, const Border *hint) {
   RectangleSize image_size = size_of_image(image);
 
   Border border = {
@@ -436,22 +690,40 @@ Border detect_border(Image image, BorderScanParameters params,
       .bottom = image_size.height - outside_mask.vertex[1].y,
   };
 
+  // Sizes of the hinted edges beyond the outside mask, 0 for none.
+  Border hinted = BORDER_NULL;
+  if (hint != NULL) {
+    hinted = (Border){
+        .left = max(hint->left - border.left, 0),
+        .top = max(hint->top - border.top, 0),
+        .right = max(hint->right - border.right, 0),
+        .bottom = max(hint->bottom - border.bottom, 0),
+    };
+  }
+
+  Image decimated = EMPTY_IMAGE;
+
   if (params.scan_direction.horizontal) {
     border.left += detect_border_edge(
-        image, outside_mask, (Delta){params.scan_step.horizontal, 0},
-        params.scan_size.width, params.scan_threshold.horizontal);
+        image, &decimated, params.decimation, outside_mask,
+        (Delta){params.scan_step.horizontal, 0}, params.scan_size.width,
+        params.scan_threshold.horizontal, hinted.left);
     border.right += detect_border_edge(
-        image, outside_mask, (Delta){-params.scan_step.horizontal, 0},
-        params.scan_size.width, params.scan_threshold.horizontal);
+        image, &decimated, params.decimation, outside_mask,
+        (Delta){-params.scan_step.horizontal, 0}, params.scan_size.width,
+        params.scan_threshold.horizontal, hinted.right);
   }
   if (params.scan_direction.vertical) {
     border.top += detect_border_edge(
-        image, outside_mask, (Delta){0, params.scan_step.vertical},
-        params.scan_size.height, params.scan_threshold.vertical);
+        image, &decimated, params.decimation, outside_mask,
+        (Delta){0, params.scan_step.vertical}, params.scan_size.height,
+        params.scan_threshold.vertical, hinted.top);
     border.bottom += detect_border_edge(
-        image, outside_mask, (Delta){0, -params.scan_step.vertical},
-        params.scan_size.height, params.scan_threshold.vertical);
+        image, &decimated, params.decimation, outside_mask,
+        (Delta){0, -params.scan_step.vertical}, params.scan_size.height,
+        params.scan_threshold.vertical, hinted.bottom);
   }
+  free_image(&decimated);
   verboseLog(VERBOSE_NORMAL,
              "border detected: (%d,%d,%d,%d) in [%d,%d,%d,%d]\n", border.left,
              border.top, border.right, border.bottom, outside_mask.vertex[0].x,
@@ -460,3 +732,245 @@ Border detect_border(Image image, BorderScanParameters params,
 
   return border;
 }
+
+MaskingPlan masking_plan_init(Image image) {
+  return (MaskingPlan){
+      .bounds = full_image(image),
+      .masks_count = 0,
+      .wipes = {.count = 0},
+  };
+}
+
+static int compare_rectangle_left(const void *a, const void *b) {
+  const Rectangle *rect_a = a;
+  const Rectangle *rect_b = b;
+
+  return (rect_a->vertex[0].x > rect_b->vertex[0].x) -
+         (rect_a->vertex[0].x < rect_b->vertex[0].x);
+}
+
+/**
+ * Adds a set of masks to the plan: each pixel which is not covered by at least
+ * one of them will be cleared. Only one set of masks can be added to a plan.
+ */
+void masking_plan_add_masks(MaskingPlan *plan, const Rectangle masks[],
+                            size_t masks_count) {
+  assert(plan->masks_count == 0 && masks_count <= MAX_MASKS);
+
+  for (size_t i = 0; i < masks_count; i++) {
+    plan->masks[plan->masks_count++] = normalize_rectangle(masks[i]);
+  }
+
+  // Sorted by their left edge, the masks covering any given row produce
+  // their x-intervals already in order.
+  qsort(plan->masks, plan->masks_count, sizeof(Rectangle),
+        compare_rectangle_left);
+}
+
+/**
+ * Adds wipe areas to the plan: each pixel covered by one of them will be
+ * cleared.
+ */
+void masking_plan_add_wipes(MaskingPlan *plan, Wipes wipes) {
+  assert(plan->wipes.count + wipes.count <= MAX_WIPES);
+
+  for (size_t i = 0; i < wipes.count; i++) {
+    plan->wipes.areas[plan->wipes.count++] = wipes.areas[i];
+
+    verboseLog(VERBOSE_MORE,
+               "wipe [%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "]\n",
+               wipes.areas[i].vertex[0].x, wipes.areas[i].vertex[0].y,
+               wipes.areas[i].vertex[1].x, wipes.areas[i].vertex[1].y);
+  }
+}
+
+/**
+ * Adds a border to the plan: all pixels in the border range at the edges of
+ * the sheet will be cleared.
+ */
+void masking_plan_add_border(MaskingPlan *plan, Image image,
+                             const Border border) {
+  if (memcmp(&border, &BORDER_NULL, sizeof(BORDER_NULL)) == 0) {
+    return;
+  }
+
+  Rectangle mask = border_to_mask(image, border);
+  verboseLog(VERBOSE_NORMAL, "applying border (%d,%d,%d,%d) [%d,%d,%d,%d]\n",
+             border.left, border.top, border.right, border.bottom,
+             mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
+             mask.vertex[1].y);
+
+  mask = normalize_rectangle(mask);
+  plan->bounds = (Rectangle){{
+      {max(plan->bounds.vertex[0].x, mask.vertex[0].x),
+       max(plan->bounds.vertex[0].y, mask.vertex[0].y)},
+      {min(plan->bounds.vertex[1].x, mask.vertex[1].x),
+       min(plan->bounds.vertex[1].y, mask.vertex[1].y)},
+  }};
+}
+
+typedef struct {
+  int32_t start;
+  int32_t end;
+} Span;
+
+static int compare_span_start(const void *a, const void *b) {
+  const Span *span_a = a;
+  const Span *span_b = b;
+
+  return (span_a->start > span_b->start) - (span_a->start < span_b->start);
+}
+
+/**
+ * Adds the span [start, end] to the list, unless it is empty.
+ */
+static void add_span(Span spans[], size_t *spans_count, int32_t start,
+                     int32_t end) {
+  if (start <= end) {
+    spans[(*spans_count)++] = (Span){start, end};
+  }
+}
+
+/**
+ * Compiles the spans of a single row that the plan clears, sorted and merged
+ * so that they do not overlap.
+ *
+ * @return the number of spans stored in clear.
+ */
+static size_t masking_plan_row_spans(const MaskingPlan *plan, int32_t y,
+                                     int32_t last_x, Span clear[]) {
+  size_t clear_count = 0;
+  Rectangle bounds = plan->bounds;
+
+  if (y < bounds.vertex[0].y || y > bounds.vertex[1].y ||
+      bounds.vertex[0].x > bounds.vertex[1].x) {
+    add_span(clear, &clear_count, 0, last_x);
+    return clear_count;
+  }
+
+  int32_t keep_start = max(bounds.vertex[0].x, 0);
+  int32_t keep_end = min(bounds.vertex[1].x, last_x);
+
+  if (plan->masks_count == 0) {
+    add_span(clear, &clear_count, 0, keep_start - 1);
+    add_span(clear, &clear_count, keep_end + 1, last_x);
+  } else {
+    Span keep[MAX_MASKS];
+    size_t keep_count = 0;
+
+    for (size_t i = 0; i < plan->masks_count; i++) {
+      const Rectangle mask = plan->masks[i];
+      if (y >= mask.vertex[0].y && y <= mask.vertex[1].y) {
+        add_span(keep, &keep_count, max(mask.vertex[0].x, keep_start),
+                 min(mask.vertex[1].x, keep_end));
+      }
+    }
+
+    // Clear the gaps left between the (possibly overlapping) masks.
+    int32_t cursor = 0;
+    for (size_t i = 0; i < keep_count; i++) {
+      add_span(clear, &clear_count, cursor, keep[i].start - 1);
+      cursor = max(cursor, keep[i].end + 1);
+    }
+    add_span(clear, &clear_count, cursor, last_x);
+  }
+
+  // The gaps are sorted and disjoint; only wipes can overlap them.
+  size_t gaps_count = clear_count;
+
+  // Wipe areas are scanned as given, so inverted ones do not clear anything.
+  for (size_t i = 0; i < plan->wipes.count; i++) {
+    const Rectangle wipe = plan->wipes.areas[i];
+    if (y >= wipe.vertex[0].y && y <= wipe.vertex[1].y) {
+      add_span(clear, &clear_count, max(wipe.vertex[0].x, 0),
+               min(wipe.vertex[1].x, last_x));
+    }
+  }
+
+  if (clear_count <= 1 || clear_count == gaps_count) {
+    return clear_count;
+  }
+
+  qsort(clear, clear_count, sizeof(Span), compare_span_start);
+
+  size_t merged_count = 0;
+  for (size_t i = 1; i < clear_count; i++) {
+    if (clear[i].start <= clear[merged_count].end + 1) {
+      clear[merged_count].end = max(clear[merged_count].end, clear[i].end);
+    } else {
+      clear[++merged_count] = clear[i];
+    }
+  }
+
+  return merged_count + 1;
+}
+
+static void update_next_change(int32_t *next_change, int32_t y,
+                               Rectangle area) {
+  if (area.vertex[0].y > y) {
+    *next_change = min(*next_change, area.vertex[0].y);
+  }
+  if (area.vertex[1].y >= y && area.vertex[1].y < INT32_MAX) {
+    *next_change = min(*next_change, area.vertex[1].y + 1);
+  }
+}
+
+/**
+ * Returns the first row after y whose clear spans may differ from those of y.
+ */
+static int32_t masking_plan_next_change(const MaskingPlan *plan, int32_t y) {
+  int32_t next_change = INT32_MAX;
+
+  update_next_change(&next_change, y, plan->bounds);
+  for (size_t i = 0; i < plan->masks_count; i++) {
+    update_next_change(&next_change, y, plan->masks[i]);
+  }
+  for (size_t i = 0; i < plan->wipes.count; i++) {
+    update_next_change(&next_change, y, plan->wipes.areas[i]);
+  }
+
+  return next_change;
+}
+
+/**
+ * Permanently applies all the masks, wipes and borders collected in the plan,
+ * clearing the affected pixels with the given color in a single pass over the
+ * image rows. Returns the number of pixels cleared, counting those of
+ * overlapping wipes once for each.
+ */
+uint64_t apply_masking_plan(Image image, const MaskingPlan *plan,
+                            Pixel color) {
+  Rectangle image_area = full_image(image);
+  uint64_t cleared = 0;
+
+  if (plan->masks_count == 0 && plan->wipes.count == 0 &&
+      plan->bounds.vertex[0].x <= image_area.vertex[0].x &&
+      plan->bounds.vertex[0].y <= image_area.vertex[0].y &&
+      plan->bounds.vertex[1].x >= image_area.vertex[1].x &&
+      plan->bounds.vertex[1].y >= image_area.vertex[1].y) {
+    return 0;
+  }
+
+  // Worst case: one gap per mask plus the one after the last, and every wipe.
+  Span clear[MAX_MASKS + 1 + MAX_WIPES];
+  size_t clear_count = 0;
+  int32_t next_change = 0;
+
+  for (int32_t y = 0; y <= image_area.vertex[1].y; y++) {
+    // Rows between two horizontal edges of the plan's areas share the same
+    // spans, so they are only compiled once per band.
+    if (y == next_change) {
+      clear_count =
+          masking_plan_row_spans(plan, y, image_area.vertex[1].x, clear);
+      next_change = masking_plan_next_change(plan, y);
+    }
+
+    for (size_t i = 0; i < clear_count; i++) {
+      wipe_rectangle(
+          image, (Rectangle){{{clear[i].start, y}, {clear[i].end, y}}}, color);
+      cleared += clear[i].end - clear[i].start + 1;
+    }
+  }
+
+  return cleared;
+}
@@ -33,6 +33,9 @@ typedef struct {
 
   int32_t minimum_height;
   int32_t maximum_height;
+
+  // Factor of the decimated image scanned first, 1 to scan only the image.
+  int decimation;
 } MaskDetectionParameters;
 
 bool validate_mask_detection_parameters(
@@ -40,11 +43,16 @@ bool validate_mask_detection_parameters(
     RectangleSize scan_size, const int32_t scan_depth[DIRECTIONS_COUNT],
     Delta scan_step, const float scan_threshold[DIRECTIONS_COUNT],
     const int scan_mininum[DIMENSIONS_COUNT],
-    const int scan_maximum[DIMENSIONS_COUNT]);
+    const int scan_maximum[DIMENSIONS_COUNT], int decimation);
+
+// Stored by detect_masks() for a point where no mask is found.
+static const Rectangle INVALID_MASK = {{{-1, -1}, {-1, -1}}};
 
+// Masks are detected near hints[], if it is not NULL, unless they are not
+// found there.
 size_t detect_masks(Image image, MaskDetectionParameters params,
                     const Point points[], size_t points_count,
-                    Rectangle masks[]);
+                    const Rectangle hints[], Rectangle masks[]);
 
 void center_mask(Image image, const Point center, const Rectangle area);
 
@@ -59,8 +67,8 @@ bool validate_mask_alignment_parameters(MaskAlignmentParameters *params,
 void align_mask(Image image, const Rectangle inside_area,
                 const Rectangle outside, MaskAlignmentParameters params);
 
-void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
-                 Pixel color);
+uint64_t apply_masks(Image image, const Rectangle masks[], size_t masks_count,
+                     Pixel color);
 
 #define MAX_WIPES MAX_MASKS
 
@@ -93,12 +101,42 @@ typedef struct {
   } scan_threshold;
 
   Direction scan_direction;
+
+  // Factor of the decimated image scanned first, 1 to scan only the image.
+  int decimation;
 } BorderScanParameters;
 
 bool validate_border_scan_parameters(
     BorderScanParameters *params, Direction scan_direction,
     RectangleSize scan_size, Delta scan_step,
-    const int32_t scan_threshold[DIRECTIONS_COUNT]);
+    const int32_t scan_threshold[DIRECTIONS_COUNT], int decimation);
 
+// The border is detected near hint, if it is not NULL, unless its edges are
+// not found there.
 Border detect_border(Image image, BorderScanParameters params,
-                     const Rectangle outside_mask);
+                     const Rectangle outside_mask, const Border *hint);
+
+// Masks, wipes and borders all clear areas of the image with the same color,
+// so consecutive processing steps using them can be compiled into a single
+// plan and applied in one sweep over the image rows.
+typedef struct {
+  // Pixels outside of these bounds are cleared (borders).
+  Rectangle bounds;
+
+  // When any are set, pixels not covered by at least one mask are cleared.
+  size_t masks_count;
+  Rectangle masks[MAX_MASKS];
+
+  // Pixels covered by any wipe are cleared.
+  Wipes wipes;
+} MaskingPlan;
+
+MaskingPlan masking_plan_init(Image image);
+void masking_plan_add_masks(MaskingPlan *plan, const Rectangle masks[],
+                            size_t masks_count);
+void masking_plan_add_wipes(MaskingPlan *plan, Wipes wipes);
+void masking_plan_add_border(MaskingPlan *plan, Image image,
+                             const Border border);
+// Returns the number of pixels cleared.
+uint64_t apply_masking_plan(Image image, const MaskingPlan *plan,
+                            Pixel color);
@@ -0,0 +1,202 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/occupancy.h"
+#include "imageprocess/pixel.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
+
+typedef enum {
+  TILE_EMPTY,
+  TILE_OCCUPIED,
+  // Occupied until proven otherwise: lighter pixels were written over it
+  // since it was last scanned.
+  TILE_UNKNOWN,
+} TileState;
+
+struct ImageOccupancy {
+  uint8_t threshold;
+  int32_t columns;
+  int32_t rows;
+  uint8_t *tiles;
+};
+
+void image_enable_occupancy(Image *image, uint8_t threshold) {
+  if (image->occupancy != NULL || image->frame == NULL) {
+    return;
+  }
+
+  ImageOccupancy *occupancy = av_mallocz(sizeof(ImageOccupancy));
+  if (occupancy == NULL) {
+    errOutput("unable to allocate occupancy map.");
+  }
+
+  occupancy->threshold = threshold;
+  occupancy->columns =
+      (image->frame->width + OCCUPANCY_TILE_SIZE - 1) / OCCUPANCY_TILE_SIZE;
+  occupancy->rows =
+      (image->frame->height + OCCUPANCY_TILE_SIZE - 1) / OCCUPANCY_TILE_SIZE;
+  occupancy->tiles =
+      av_malloc((size_t)occupancy->columns * (size_t)occupancy->rows);
+  if (occupancy->tiles == NULL) {
+    av_free(occupancy);
+    errOutput("unable to allocate occupancy map.");
+  }
+  memset(occupancy->tiles, TILE_UNKNOWN,
+         (size_t)occupancy->columns * (size_t)occupancy->rows);
+
+  image->occupancy = occupancy;
+}
+
+void image_free_occupancy(Image *image) {
+  if (image->occupancy == NULL) {
+    return;
+  }
+
+  av_freep(&image->occupancy->tiles);
+  av_freep(&image->occupancy);
+}
+
+uint8_t image_occupancy_threshold(Image image) {
+  return image.occupancy->threshold;
+}
+
+static inline uint8_t *tile_at(ImageOccupancy *occupancy, int32_t x,
+                               int32_t y) {
+  return &occupancy->tiles[(size_t)(y / OCCUPANCY_TILE_SIZE) *
+                               occupancy->columns +
+                           x / OCCUPANCY_TILE_SIZE];
+}
+
+static bool scan_tile(Image image, int32_t column, int32_t row) {
+  uint8_t threshold = image.occupancy->threshold;
+  int32_t x_start = column * OCCUPANCY_TILE_SIZE;
+  int32_t y_start = row * OCCUPANCY_TILE_SIZE;
+  int32_t x_end = min(x_start + OCCUPANCY_TILE_SIZE, image.frame->width);
+  int32_t y_end = min(y_start + OCCUPANCY_TILE_SIZE, image.frame->height);
+  int bytes_per_pixel = 0;
+
+  switch (image.frame->format) {
+  case AV_PIX_FMT_GRAY8:
+    bytes_per_pixel = 1;
+    break;
+  case AV_PIX_FMT_RGB24:
+    // The lightness of a pixel is its darkest channel.
+    bytes_per_pixel = 3;
+    break;
+  default:
+    break;
+  }
+
+  for (int32_t y = y_start; y < y_end; y++) {
+    if (bytes_per_pixel == 0) {
+      for (int32_t x = x_start; x < x_end; x++) {
+        if (get_pixel_lightness(image, (Point){x, y}) <= threshold) {
+          return true;
+        }
+      }
+      continue;
+    }
+
+    const uint8_t *pix = image.frame->data[0] + y * image.frame->linesize[0];
+    for (int32_t i = x_start * bytes_per_pixel; i < x_end * bytes_per_pixel;
+         i++) {
+      if (pix[i] <= threshold) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+uint8_t image_min_lightness(Image image, Rectangle area) {
+  ImageOccupancy *occupancy = image.occupancy;
+  if (occupancy == NULL) {
+    return 0;
+  }
+
+  Rectangle clipped = clip_rectangle(image, area);
+  if (clipped.vertex[0].x > clipped.vertex[1].x ||
+      clipped.vertex[0].y > clipped.vertex[1].y) {
+    return 0;
+  }
+
+  for (int32_t row = clipped.vertex[0].y / OCCUPANCY_TILE_SIZE;
+       row <= clipped.vertex[1].y / OCCUPANCY_TILE_SIZE; row++) {
+    for (int32_t column = clipped.vertex[0].x / OCCUPANCY_TILE_SIZE;
+         column <= clipped.vertex[1].x / OCCUPANCY_TILE_SIZE; column++) {
+      uint8_t *tile = &occupancy->tiles[(size_t)row * occupancy->columns +
+                                        column];
+
+      if (*tile == TILE_UNKNOWN) {
+        *tile = scan_tile(image, column, row) ? TILE_OCCUPIED : TILE_EMPTY;
+      }
+      if (*tile == TILE_OCCUPIED) {
+        return 0;
+      }
+    }
+  }
+
+  return occupancy->threshold + 1;
+}
+
+// Dark pixels occupy their tile; lighter ones may have covered the last dark
+// pixel of an occupied tile, which then needs scanning again.
+static inline void write_tile(ImageOccupancy *occupancy, uint8_t *tile,
+                              Pixel pixel) {
+  if (min3(pixel.r, pixel.g, pixel.b) <= occupancy->threshold) {
+    *tile = TILE_OCCUPIED;
+  } else if (*tile == TILE_OCCUPIED) {
+    *tile = TILE_UNKNOWN;
+  }
+}
+
+void image_occupancy_set_pixel(Image image, Point coords) {
+  ImageOccupancy *occupancy = image.occupancy;
+
+  write_tile(occupancy, tile_at(occupancy, coords.x, coords.y),
+             get_pixel(image, coords));
+}
+
+void image_occupancy_fill_row(Image image, int32_t y, int32_t x_start,
+                              int32_t x_end) {
+  ImageOccupancy *occupancy = image.occupancy;
+  Pixel color = get_pixel(image, (Point){x_start, y});
+
+  for (int32_t x = x_start - x_start % OCCUPANCY_TILE_SIZE; x <= x_end;
+       x += OCCUPANCY_TILE_SIZE) {
+    write_tile(occupancy, tile_at(occupancy, x, y), color);
+  }
+}
+
+/**
+ * Marks the occupied tiles covering an area for scanning again, for writers
+ * that only lighten the pixels they change.
+ */
+void image_occupancy_invalidate(Image image, Rectangle area) {
+  ImageOccupancy *occupancy = image.occupancy;
+  Rectangle clipped = clip_rectangle(image, area);
+
+  int32_t x_start =
+      clipped.vertex[0].x - clipped.vertex[0].x % OCCUPANCY_TILE_SIZE;
+  int32_t y_start =
+      clipped.vertex[0].y - clipped.vertex[0].y % OCCUPANCY_TILE_SIZE;
+
+  for (int32_t y = y_start; y <= clipped.vertex[1].y;
+       y += OCCUPANCY_TILE_SIZE) {
+    for (int32_t x = x_start; x <= clipped.vertex[1].x;
+         x += OCCUPANCY_TILE_SIZE) {
+      write_tile(occupancy, tile_at(occupancy, x, y), PIXEL_WHITE);
+    }
+  }
+}
@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+// Width and height of the square tiles tracked by an occupancy map.
+#define OCCUPANCY_TILE_SIZE 32
+
+// Attaches an occupancy map to an image, recording which of its tiles hold
+// any pixel with a lightness at or below threshold. Tiles are scanned on
+// first access, and kept up to date by the pixel writers.
+void image_enable_occupancy(Image *image, uint8_t threshold);
+void image_free_occupancy(Image *image);
+
+// Returns the threshold the occupancy map of an image was enabled with.
+uint8_t image_occupancy_threshold(Image image);
+
+// Returns a lower bound for the lightness of the pixels in area: above the
+// threshold of the map if none of the tiles it overlaps holds a darker pixel,
+// 0 otherwise or if the image has no occupancy map.
+uint8_t image_min_lightness(Image image, Rectangle area);
+
+// Notifications for writes into the image frame, used to keep the occupancy
+// map coherent. They read back the pixels as stored, so they are called after
+// the write. Callers check image.occupancy before calling these.
+void image_occupancy_set_pixel(Image image, Point coords);
+void image_occupancy_fill_row(Image image, int32_t y, int32_t x_start,
+                              int32_t x_end);
+void image_occupancy_invalidate(Image image, Rectangle area);
@@ -9,18 +9,18 @@
 #include <libavutil/frame.h>
 #include <libavutil/pixfmt.h>
 
+#include "imageprocess/occupancy.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
-static inline uint8_t pixel_grayscale(Pixel pixel) {
-  return (pixel.r + pixel.g + pixel.b) / 3;
-}
-
 static Pixel get_pixel_components(Image image, Point coords) {
   uint8_t *pix;
 
-  if (!point_in_rectangle(coords, full_image(image))) {
+  // The apron reads as white, just like any pixel farther out.
+  if (!within_apron(image, coords, 0, 0) &&
+      !point_in_rectangle(coords, full_image(image))) {
     return PIXEL_WHITE;
   }
 
@@ -84,10 +84,35 @@ Pixel get_pixel(Image image, Point coords) {
   return get_pixel_components(image, coords);
 }
 
+/**
+ * Reads a pixel metric from the image's derived planes, if it has any.
+ *
+ * @return false if the metric has to be computed from the pixel itself.
+ */
+static bool get_plane_value(Image image, PlaneMetric metric, Point coords,
+                            uint8_t *value) {
+  if (image.planes == NULL) {
+    return false;
+  }
+
+  if (!within_apron(image, coords, 0, 0)) {
+    *value = UINT8_MAX;
+    return true;
+  }
+
+  *value = image_plane_row(image, metric, coords.y)[coords.x];
+  return true;
+}
+
 /**
  * Returns the grayscale (=brightness) value of a single pixel.
  */
 uint8_t get_pixel_grayscale(Image image, Point coords) {
+  uint8_t value;
+  if (get_plane_value(image, PLANE_GRAYSCALE, coords, &value)) {
+    return value;
+  }
+
   return pixel_grayscale(get_pixel(image, coords));
 }
 
@@ -104,6 +129,11 @@ uint8_t get_pixel_grayscale(Image image, Point coords) {
  * UINT8_MAX if the coordinates are outside the image
  */
 uint8_t get_pixel_lightness(Image image, Point coords) {
+  uint8_t value;
+  if (get_plane_value(image, PLANE_LIGHTNESS, coords, &value)) {
+    return value;
+  }
+
   Pixel p = get_pixel_components(image, coords);
   return min3(p.r, p.g, p.b);
 }
@@ -121,6 +151,11 @@ uint8_t get_pixel_lightness(Image image, Point coords) {
  * pixel, or UINT8_MAX if the coordinates are outside the image
  */
 uint8_t get_pixel_darkness_inverse(Image image, Point coords) {
+  uint8_t value;
+  if (get_plane_value(image, PLANE_DARKNESS_INVERSE, coords, &value)) {
+    return value;
+  }
+
   Pixel p = get_pixel_components(image, coords);
   return max3(p.r, p.g, p.b);
 }
@@ -170,4 +205,11 @@ void set_pixel(Image image, Point coords, Pixel pixel) {
   default:
     errOutput("unknown pixel format.");
   }
+
+  if (image.planes != NULL) {
+    image_planes_set_pixel(image, coords, pixel);
+  }
+  if (image.occupancy != NULL) {
+    image_occupancy_set_pixel(image, coords);
+  }
 }
@@ -7,9 +7,32 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
 #include "imageprocess/image.h"
 #include "imageprocess/primitives.h"
 
+static inline uint8_t pixel_grayscale(Pixel pixel) {
+  return (pixel.r + pixel.g + pixel.b) / 3;
+}
+
+/**
+ * Tells whether the pixels from before pixels up and left of p to after
+ * pixels down and right of it can be read straight from the image rows, or
+ * from those of image_plane_row(), without bounds checks: the image stores a
+ * byte per component, and they all lie within it or its apron.
+ */
+static inline bool within_apron(Image image, Point p, int32_t before,
+                                int32_t after) {
+  int format = image.frame->format;
+
+  return (format == AV_PIX_FMT_GRAY8 || format == AV_PIX_FMT_RGB24) &&
+         p.x - before >= -image.apron && p.y - before >= -image.apron &&
+         p.x + after < image.frame->width + image.apron &&
+         p.y + after < image.frame->height + image.apron;
+}
+
 Pixel pixel_from_value(uint32_t value);
 int compare_pixel(Pixel a, Pixel b);
 Pixel get_pixel(Image image, Point coords);
@@ -0,0 +1,177 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
+
+struct ImagePlanes {
+  int32_t width;
+  int32_t height;
+
+  // White margin around each plane, as wide as the apron of the image.
+  int32_t apron;
+  size_t linesize;
+
+  // Both allocated on the first access to each metric; data points to the
+  // first pixel, past the apron.
+  uint8_t *data[PLANES_COUNT];
+  uint8_t *buffer[PLANES_COUNT];
+  bool *row_valid[PLANES_COUNT];
+};
+
+void image_enable_planes(Image *image) {
+  if (image->planes != NULL || image->frame == NULL ||
+      image->frame->format != AV_PIX_FMT_RGB24) {
+    return;
+  }
+
+  image->planes = av_mallocz(sizeof(ImagePlanes));
+  if (image->planes == NULL) {
+    errOutput("unable to allocate derived planes.");
+  }
+
+  image->planes->width = image->frame->width;
+  image->planes->height = image->frame->height;
+  image->planes->apron = image->apron;
+  image->planes->linesize = image->frame->width + 2 * (size_t)image->apron;
+}
+
+void image_free_planes(Image *image) {
+  if (image->planes == NULL) {
+    return;
+  }
+
+  for (int metric = 0; metric < PLANES_COUNT; metric++) {
+    av_freep(&image->planes->buffer[metric]);
+    av_freep(&image->planes->row_valid[metric]);
+  }
+  av_freep(&image->planes);
+}
+
+static inline uint8_t metric_value(PlaneMetric metric, Pixel pixel) {
+  switch (metric) {
+  case PLANE_GRAYSCALE:
+    return pixel_grayscale(pixel);
+  case PLANE_LIGHTNESS:
+    return min3(pixel.r, pixel.g, pixel.b);
+  case PLANE_DARKNESS_INVERSE:
+  default:
+    return max3(pixel.r, pixel.g, pixel.b);
+  }
+}
+
+static void compute_plane_row(Image image, PlaneMetric metric, int32_t y,
+                              uint8_t *row) {
+  const uint8_t *pix = image.frame->data[0] + y * image.frame->linesize[0];
+
+  for (int32_t x = 0; x < image.frame->width; x++, pix += 3) {
+    row[x] = metric_value(metric, (Pixel){pix[0], pix[1], pix[2]});
+  }
+}
+
+static uint8_t *plane_row(ImagePlanes *planes, PlaneMetric metric, int32_t y) {
+  return planes->data[metric] + (ptrdiff_t)y * (ptrdiff_t)planes->linesize;
+}
+
+// Whitens the apron of a plane, which is never written afterwards.
+static void fill_apron(ImagePlanes *planes, PlaneMetric metric) {
+  size_t apron_rows = planes->apron * planes->linesize;
+
+  memset(planes->buffer[metric], UINT8_MAX, apron_rows);
+  memset(plane_row(planes, metric, planes->height) - planes->apron, UINT8_MAX,
+         apron_rows);
+  for (int32_t y = 0; y < planes->height; y++) {
+    uint8_t *row = plane_row(planes, metric, y);
+
+    memset(row - planes->apron, UINT8_MAX, planes->apron);
+    memset(row + planes->width, UINT8_MAX, planes->apron);
+  }
+}
+
+const uint8_t *image_plane_row(Image image, PlaneMetric metric, int32_t y) {
+  if (image.frame->format == AV_PIX_FMT_GRAY8) {
+    return image.frame->data[0] + (ptrdiff_t)y * image.frame->linesize[0];
+  }
+
+  ImagePlanes *planes = image.planes;
+  if (planes == NULL) {
+    return NULL;
+  }
+
+  if (planes->data[metric] == NULL) {
+    size_t rows = planes->height + 2 * (size_t)planes->apron;
+
+    planes->buffer[metric] = av_malloc(planes->linesize * rows);
+    planes->row_valid[metric] = av_mallocz(planes->height * sizeof(bool));
+    if (planes->buffer[metric] == NULL || planes->row_valid[metric] == NULL) {
+      errOutput("unable to allocate derived plane.");
+    }
+    planes->data[metric] = planes->buffer[metric] +
+                           planes->apron * planes->linesize + planes->apron;
+    fill_apron(planes, metric);
+  }
+
+  uint8_t *row = plane_row(planes, metric, y);
+  if (y < 0 || y >= planes->height) {
+    return row;
+  }
+  if (!planes->row_valid[metric][y]) {
+    compute_plane_row(image, metric, y, row);
+    planes->row_valid[metric][y] = true;
+  }
+
+  return row;
+}
+
+void image_planes_set_pixel(Image image, Point coords, Pixel pixel) {
+  ImagePlanes *planes = image.planes;
+
+  for (int metric = 0; metric < PLANES_COUNT; metric++) {
+    if (planes->data[metric] != NULL && planes->row_valid[metric][coords.y]) {
+      plane_row(planes, metric, coords.y)[coords.x] =
+          metric_value(metric, pixel);
+    }
+  }
+}
+
+void image_planes_fill_row(Image image, int32_t y, int32_t x_start,
+                           int32_t x_end, Pixel color) {
+  ImagePlanes *planes = image.planes;
+
+  for (int metric = 0; metric < PLANES_COUNT; metric++) {
+    if (planes->data[metric] != NULL && planes->row_valid[metric][y]) {
+      memset(plane_row(planes, metric, y) + x_start,
+             metric_value(metric, color), x_end - x_start + 1);
+    }
+  }
+}
+
+/**
+ * Drops the cached plane rows covering an area, for writers that do not
+ * track the individual pixels they change.
+ */
+void image_planes_invalidate(Image image, Rectangle area) {
+  ImagePlanes *planes = image.planes;
+  Rectangle clipped = clip_rectangle(image, area);
+
+  for (int metric = 0; metric < PLANES_COUNT; metric++) {
+    if (planes->row_valid[metric] == NULL) {
+      continue;
+    }
+    for (int32_t y = clipped.vertex[0].y; y <= clipped.vertex[1].y; y++) {
+      planes->row_valid[metric][y] = false;
+    }
+  }
+}
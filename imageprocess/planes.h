@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+// Per-pixel metrics that can be cached as GRAY8 planes alongside an image.
+typedef enum {
+  PLANE_GRAYSCALE,        // (r + g + b) / 3
+  PLANE_LIGHTNESS,        // min(r, g, b)
+  PLANE_DARKNESS_INVERSE, // max(r, g, b)
+  PLANES_COUNT,
+} PlaneMetric;
+
+// Attaches a derived-plane cache to an RGB24 image. Planes rows are computed
+// on first access, and kept up to date by the pixel writers.
+void image_enable_planes(Image *image);
+void image_free_planes(Image *image);
+
+// Returns row y of the plane for the given metric, or NULL if the image has
+// no such plane. GRAY8 images return their own pixel data, as all metrics
+// are equal to the pixel value. Planes have the white apron of their image:
+// rows and pixels that within_apron() allows can be read as well.
+const uint8_t *image_plane_row(Image image, PlaneMetric metric, int32_t y);
+
+// Notifications for writes into the image frame, used to keep the cached
+// plane rows coherent. Callers check image.planes before calling these.
+void image_planes_set_pixel(Image image, Point coords, Pixel pixel);
+void image_planes_fill_row(Image image, int32_t y, int32_t x_start,
+                           int32_t x_end, Pixel color);
+void image_planes_invalidate(Image image, Rectangle area);
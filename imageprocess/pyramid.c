@@ -0,0 +1,81 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <string.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/blit.h"
+#include "imageprocess/pixel.h"
+#include "imageprocess/pyramid.h"
+#include "lib/logging.h"
+
+typedef uint8_t (*MetricGetter)(Image image, Point coords);
+
+static MetricGetter metric_getter(PlaneMetric metric) {
+  switch (metric) {
+  case PLANE_GRAYSCALE:
+    return get_pixel_grayscale;
+  case PLANE_LIGHTNESS:
+    return get_pixel_lightness;
+  case PLANE_DARKNESS_INVERSE:
+  default:
+    return get_pixel_darkness_inverse;
+  }
+}
+
+Image decimate_image(Image image, PlaneMetric metric, int factor) {
+  const int32_t width = image.frame->width;
+  const int32_t height = image.frame->height;
+  const RectangleSize size = {
+      .width = (width + factor - 1) / factor,
+      .height = (height + factor - 1) / factor,
+  };
+  Image decimated = create_image(size, AV_PIX_FMT_GRAY8, false,
+                                 image.background, image.abs_black_threshold);
+  uint32_t *sums = av_malloc(size.width * sizeof(uint32_t));
+  uint8_t *values = av_malloc(width);
+  MetricGetter getter = metric_getter(metric);
+
+  if (sums == NULL || values == NULL) {
+    errOutput("unable to allocate decimated image.");
+  }
+
+  for (int32_t y = 0; y < size.height; y++) {
+    int32_t rows = height - y * factor < factor ? height - y * factor : factor;
+
+    memset(sums, 0, size.width * sizeof(uint32_t));
+    for (int32_t row = y * factor; row < y * factor + rows; row++) {
+      // Formats without plane rows read the metric pixel by pixel.
+      const uint8_t *line = image_plane_row(image, metric, row);
+      if (line == NULL) {
+        for (int32_t x = 0; x < width; x++) {
+          values[x] = getter(image, (Point){x, row});
+        }
+        line = values;
+      }
+
+      box_sum_row(sums, line, width, factor, 1);
+    }
+
+    uint8_t *out =
+        decimated.frame->data[0] + y * decimated.frame->linesize[0];
+    // Truncated like the averages of the full resolution scans.
+    box_average_row(out, sums, width, factor, rows, 1, false);
+  }
+
+  av_free(sums);
+  av_free(values);
+  return decimated;
+}
+
+Image decimated_image(Image image, PlaneMetric metric, int factor,
+                      Image *decimated) {
+  if (factor > 1 && decimated->frame == NULL) {
+    *decimated = decimate_image(image, metric, factor);
+  }
+  return *decimated;
+}
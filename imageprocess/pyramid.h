@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/planes.h"
+#include "imageprocess/primitives.h"
+
+// Decimation factors supported for the detection scans.
+static inline bool valid_decimation(int factor) {
+  return factor == 1 || factor == 2 || factor == 4;
+}
+
+/**
+ * Returns a GRAY8 image reduced by factor in both dimensions, each pixel
+ * holding the average metric of a factor x factor block of image. Blocks cut
+ * by the right and bottom edges average the pixels they cover. Detection
+ * scans run on it first, and are refined on image near what they found.
+ */
+Image decimate_image(Image image, PlaneMetric metric, int factor);
+
+/**
+ * Returns image decimated as decimate_image() does into *decimated, which is
+ * only made the first time it is asked for, or an empty image if factor is 1.
+ * Scans that may be completed without it share it this way.
+ */
+Image decimated_image(Image image, PlaneMetric metric, int factor,
+                      Image *decimated);
+
+// Lengths and coordinates of image in the decimated image. Lengths are at
+// least one pixel, and -1 (unlimited) is kept.
+static inline int32_t decimate_length(int32_t length, int factor) {
+  if (length == -1) {
+    return -1;
+  }
+  return length / factor > 0 ? length / factor : 1;
+}
+
+static inline Point decimate_point(Point point, int factor) {
+  return (Point){point.x / factor, point.y / factor};
+}
+
+static inline Rectangle decimate_rectangle(Rectangle area, int factor) {
+  return (Rectangle){{decimate_point(area.vertex[0], factor),
+                      decimate_point(area.vertex[1], factor)}};
+}
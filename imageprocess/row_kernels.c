@@ -0,0 +1,848 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+
+#include "imageprocess/row_kernels.h"
+#include "lib/math_util.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ROW_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define ROW_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Scalar implementations, also used for the tail of each row by the
+// vectorized ones.
+
+static uint64_t sum_gray8_scalar(const uint8_t *row, int32_t width) {
+  uint64_t sum = 0;
+
+  for (int32_t x = 0; x < width; x++) {
+    sum += row[x];
+  }
+
+  return sum;
+}
+
+static uint64_t sum_rgb24_grayscale_scalar(const uint8_t *row, int32_t width) {
+  uint64_t sum = 0;
+
+  for (int32_t x = 0; x < width; x++, row += 3) {
+    sum += (row[0] + row[1] + row[2]) / 3;
+  }
+
+  return sum;
+}
+
+static uint64_t sum_rgb24_lightness_scalar(const uint8_t *row, int32_t width) {
+  uint64_t sum = 0;
+
+  for (int32_t x = 0; x < width; x++, row += 3) {
+    sum += min3(row[0], row[1], row[2]);
+  }
+
+  return sum;
+}
+
+static uint64_t sum_rgb24_darkness_inverse_scalar(const uint8_t *row,
+                                                  int32_t width) {
+  uint64_t sum = 0;
+
+  for (int32_t x = 0; x < width; x++, row += 3) {
+    sum += max3(row[0], row[1], row[2]);
+  }
+
+  return sum;
+}
+
+static uint64_t count_gray8_within_scalar(uint8_t *row, int32_t width,
+                                          uint8_t min, uint8_t max,
+                                          bool clear) {
+  uint64_t count = 0;
+
+  for (int32_t x = 0; x < width; x++) {
+    if (row[x] < min || row[x] > max) {
+      continue;
+    }
+
+    if (clear) {
+      row[x] = 0xFF;
+    }
+    count++;
+  }
+
+  return count;
+}
+
+static uint64_t count_rgb24_within_scalar(uint8_t *row, int32_t width,
+                                          uint8_t min, uint8_t max,
+                                          bool clear) {
+  uint64_t count = 0;
+
+  for (int32_t x = 0; x < width; x++, row += 3) {
+    uint8_t grayscale = (row[0] + row[1] + row[2]) / 3;
+    if (grayscale < min || grayscale > max) {
+      continue;
+    }
+
+    if (clear) {
+      memset(row, 0xFF, 3);
+    }
+    count++;
+  }
+
+  return count;
+}
+
+static void convert_rgb24_to_gray8_scalar(const uint8_t *row, uint8_t *out,
+                                          int32_t width) {
+  for (int32_t x = 0; x < width; x++, row += 3) {
+    out[x] = (row[0] + row[1] + row[2]) / 3;
+  }
+}
+
+static void pack_gray8_to_monowhite_scalar(const uint8_t *row, uint8_t *out,
+                                           int32_t width, uint8_t threshold) {
+  for (int32_t x = 0; x < width; x += 8) {
+    uint8_t bits = 0;
+
+    for (int32_t bit = 0; bit < 8 && x + bit < width; bit++) {
+      if (row[x + bit] < threshold) {
+        bits |= 0x80 >> bit;
+      }
+    }
+    out[x / 8] = bits;
+  }
+}
+
+// Movemask instructions put the first pixel in the least significant bit.
+static inline uint8_t reverse_bits(uint8_t bits) {
+  bits = (bits & 0xF0) >> 4 | (bits & 0x0F) << 4;
+  bits = (bits & 0xCC) >> 2 | (bits & 0x33) << 2;
+  return (bits & 0xAA) >> 1 | (bits & 0x55) << 1;
+}
+
+static const RowKernels scalar_kernels = {
+    .name = "scalar",
+    .sum_gray8 = sum_gray8_scalar,
+    .sum_rgb24_grayscale = sum_rgb24_grayscale_scalar,
+    .sum_rgb24_lightness = sum_rgb24_lightness_scalar,
+    .sum_rgb24_darkness_inverse = sum_rgb24_darkness_inverse_scalar,
+    .count_gray8_within = count_gray8_within_scalar,
+    .count_rgb24_within = count_rgb24_within_scalar,
+    .convert_rgb24_to_gray8 = convert_rgb24_to_gray8_scalar,
+    .pack_gray8_to_monowhite = pack_gray8_to_monowhite_scalar,
+};
+
+// The RGB24 kernels below load the same row three times, offset by one and
+// two bytes. Taking the minimum, maximum or sum of the three loads leaves the
+// result for each pixel in the lane of its red component, i.e. every third
+// lane, which is then selected with a mask.
+//
+// The grayscale division by three is exact for sums up to 765 when computed
+// as (sum * 0xAAAB) >> 17.
+#define DIV3_MULTIPLIER 0xAAAB
+
+#if defined(ROW_KERNELS_X86)
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+TARGET_SSE2 static uint64_t sum_epi64_sse2(__m128i v) {
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, v);
+  return lanes[0] + lanes[1];
+}
+
+TARGET_SSE2 static uint64_t sum_epi32_sse2(__m128i v) {
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, v);
+  return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+TARGET_SSE2 static uint64_t sum_gray8_sse2(const uint8_t *row, int32_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+  }
+
+  return sum_epi64_sse2(sum) + sum_gray8_scalar(row + x, width - x);
+}
+
+// Selects the lanes holding the red component of the six pixels covered by
+// three 16-byte loads at offsets 0, 1 and 2.
+#define SSE2_RGB24_SELECT                                                      \
+  _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1)
+#define SSE2_RGB24_SELECT_LO _mm_setr_epi16(-1, 0, 0, -1, 0, 0, -1, 0)
+#define SSE2_RGB24_SELECT_HI _mm_setr_epi16(0, -1, 0, 0, -1, 0, 0, -1)
+
+TARGET_SSE2 static uint64_t sum_rgb24_lightness_sse2(const uint8_t *row,
+                                                     int32_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i select = SSE2_RGB24_SELECT;
+  __m128i sum = zero;
+  int32_t x = 0;
+
+  for (; x + 6 <= width; x += 6) {
+    const uint8_t *p = row + x * 3;
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+    __m128i m = _mm_min_epu8(a, _mm_min_epu8(b, c));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(m, select), zero));
+  }
+
+  return sum_epi64_sse2(sum) + sum_rgb24_lightness_scalar(row + x * 3,
+                                                          width - x);
+}
+
+TARGET_SSE2 static uint64_t sum_rgb24_darkness_inverse_sse2(const uint8_t *row,
+                                                            int32_t width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i select = SSE2_RGB24_SELECT;
+  __m128i sum = zero;
+  int32_t x = 0;
+
+  for (; x + 6 <= width; x += 6) {
+    const uint8_t *p = row + x * 3;
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+    __m128i m = _mm_max_epu8(a, _mm_max_epu8(b, c));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(m, select), zero));
+  }
+
+  return sum_epi64_sse2(sum) +
+         sum_rgb24_darkness_inverse_scalar(row + x * 3, width - x);
+}
+
+// Computes the grayscale of six RGB24 pixels into the selected 16-bit lanes
+// of lo (lanes 0, 3, 6) and hi (lanes 1, 4, 7).
+TARGET_SSE2 static void grayscale_rgb24_sse2(const uint8_t *p, __m128i *lo,
+                                             __m128i *hi) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i div3 = _mm_set1_epi16((short)DIV3_MULTIPLIER);
+  __m128i a = _mm_loadu_si128((const __m128i *)p);
+  __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+  __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+
+  __m128i sum_lo = _mm_add_epi16(
+      _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+      _mm_unpacklo_epi8(c, zero));
+  __m128i sum_hi = _mm_add_epi16(
+      _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+      _mm_unpackhi_epi8(c, zero));
+
+  *lo = _mm_srli_epi16(_mm_mulhi_epu16(sum_lo, div3), 1);
+  *hi = _mm_srli_epi16(_mm_mulhi_epu16(sum_hi, div3), 1);
+}
+
+TARGET_SSE2 static uint64_t sum_rgb24_grayscale_sse2(const uint8_t *row,
+                                                     int32_t width) {
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i select_lo = SSE2_RGB24_SELECT_LO;
+  const __m128i select_hi = SSE2_RGB24_SELECT_HI;
+  __m128i sum = _mm_setzero_si128();
+  int32_t x = 0;
+
+  for (; x + 6 <= width; x += 6) {
+    __m128i lo, hi;
+    grayscale_rgb24_sse2(row + x * 3, &lo, &hi);
+    __m128i selected = _mm_add_epi16(_mm_and_si128(lo, select_lo),
+                                     _mm_and_si128(hi, select_hi));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(selected, ones));
+  }
+
+  return sum_epi32_sse2(sum) +
+         sum_rgb24_grayscale_scalar(row + x * 3, width - x);
+}
+
+TARGET_SSE2 static uint64_t count_gray8_within_sse2(uint8_t *row, int32_t width,
+                                                    uint8_t min, uint8_t max,
+                                                    bool clear) {
+  const __m128i min_v = _mm_set1_epi8((char)min);
+  const __m128i max_v = _mm_set1_epi8((char)max);
+  uint64_t count = 0;
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+    __m128i within =
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, min_v), v),
+                      _mm_cmpeq_epi8(_mm_min_epu8(v, max_v), v));
+    count += __builtin_popcount(_mm_movemask_epi8(within));
+    if (clear) {
+      _mm_storeu_si128((__m128i *)(row + x), _mm_or_si128(v, within));
+    }
+  }
+
+  return count +
+         count_gray8_within_scalar(row + x, width - x, min, max, clear);
+}
+
+TARGET_SSE2 static uint64_t count_rgb24_within_sse2(uint8_t *row, int32_t width,
+                                                    uint8_t min, uint8_t max,
+                                                    bool clear) {
+  const __m128i min_v = _mm_set1_epi16(min);
+  const __m128i max_v = _mm_set1_epi16(max);
+  const __m128i select_lo = SSE2_RGB24_SELECT_LO;
+  const __m128i select_hi = SSE2_RGB24_SELECT_HI;
+  uint64_t count = 0;
+  int32_t x = 0;
+
+  for (; x + 6 <= width; x += 6) {
+    uint8_t *p = row + x * 3;
+    __m128i lo, hi;
+    grayscale_rgb24_sse2(p, &lo, &hi);
+
+    __m128i outside_lo = _mm_or_si128(_mm_cmplt_epi16(lo, min_v),
+                                      _mm_cmpgt_epi16(lo, max_v));
+    __m128i outside_hi = _mm_or_si128(_mm_cmplt_epi16(hi, min_v),
+                                      _mm_cmpgt_epi16(hi, max_v));
+    // One bit per byte lane, so pixel n is at bit 3 * n.
+    uint32_t within = _mm_movemask_epi8(
+        _mm_packs_epi16(_mm_andnot_si128(outside_lo, select_lo),
+                        _mm_andnot_si128(outside_hi, select_hi)));
+
+    count += __builtin_popcount(within);
+    if (clear) {
+      for (int n = 0; within != 0; n++, within >>= 3) {
+        if (within & 1) {
+          memset(p + n * 3, 0xFF, 3);
+        }
+      }
+    }
+  }
+
+  return count + count_rgb24_within_scalar(row + x * 3, width - x, min, max,
+                                           clear);
+}
+
+TARGET_SSE2 static void pack_gray8_to_monowhite_sse2(const uint8_t *row,
+                                                     uint8_t *out,
+                                                     int32_t width,
+                                                     uint8_t threshold) {
+  int32_t x = 0;
+
+  // Nothing is darker than 0, which the scalar version handles.
+  if (threshold > 0) {
+    const __m128i below = _mm_set1_epi8((char)(threshold - 1));
+
+    for (; x + 16 <= width; x += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+      uint32_t black =
+          _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, below), v));
+      out[x / 8] = reverse_bits(black);
+      out[x / 8 + 1] = reverse_bits(black >> 8);
+    }
+  }
+
+  pack_gray8_to_monowhite_scalar(row + x, out + x / 8, width - x, threshold);
+}
+
+static const RowKernels sse2_kernels = {
+    .name = "sse2",
+    .sum_gray8 = sum_gray8_sse2,
+    .sum_rgb24_grayscale = sum_rgb24_grayscale_sse2,
+    .sum_rgb24_lightness = sum_rgb24_lightness_sse2,
+    .sum_rgb24_darkness_inverse = sum_rgb24_darkness_inverse_sse2,
+    .count_gray8_within = count_gray8_within_sse2,
+    .count_rgb24_within = count_rgb24_within_sse2,
+    .convert_rgb24_to_gray8 = convert_rgb24_to_gray8_scalar,
+    .pack_gray8_to_monowhite = pack_gray8_to_monowhite_sse2,
+};
+
+TARGET_AVX2 static uint64_t sum_epi64_avx2(__m256i v) {
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, v);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+TARGET_AVX2 static uint64_t sum_epi32_avx2(__m256i v) {
+  uint32_t lanes[8];
+  uint64_t sum = 0;
+  _mm256_storeu_si256((__m256i *)lanes, v);
+  for (int i = 0; i < 8; i++) {
+    sum += lanes[i];
+  }
+  return sum;
+}
+
+TARGET_AVX2 static uint64_t sum_gray8_avx2(const uint8_t *row, int32_t width) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sum = zero;
+  int32_t x = 0;
+
+  for (; x + 32 <= width; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+  }
+
+  return sum_epi64_avx2(sum) + sum_gray8_sse2(row + x, width - x);
+}
+
+// Selects the lanes holding the red component of the eleven pixels covered by
+// three 32-byte loads at offsets 0, 1 and 2; as the last load reads one byte
+// past them, a twelfth pixel must follow in the row. The 16-bit variants apply
+// to the zero-extended low and high halves of the loads.
+#define AVX2_RGB24_SELECT                                                      \
+  _mm256_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, \
+                   -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0)
+#define AVX2_RGB24_SELECT_LO                                                   \
+  _mm256_setr_epi16(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1)
+#define AVX2_RGB24_SELECT_HI                                                   \
+  _mm256_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0)
+
+TARGET_AVX2 static uint64_t sum_rgb24_lightness_avx2(const uint8_t *row,
+                                                     int32_t width) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i select = AVX2_RGB24_SELECT;
+  __m256i sum = zero;
+  int32_t x = 0;
+
+  for (; x + 12 <= width; x += 11) {
+    const uint8_t *p = row + x * 3;
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(p + 2));
+    __m256i m = _mm256_min_epu8(a, _mm256_min_epu8(b, c));
+    sum = _mm256_add_epi64(sum,
+                           _mm256_sad_epu8(_mm256_and_si256(m, select), zero));
+  }
+
+  return sum_epi64_avx2(sum) + sum_rgb24_lightness_sse2(row + x * 3,
+                                                        width - x);
+}
+
+TARGET_AVX2 static uint64_t sum_rgb24_darkness_inverse_avx2(const uint8_t *row,
+                                                            int32_t width) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i select = AVX2_RGB24_SELECT;
+  __m256i sum = zero;
+  int32_t x = 0;
+
+  for (; x + 12 <= width; x += 11) {
+    const uint8_t *p = row + x * 3;
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(p + 2));
+    __m256i m = _mm256_max_epu8(a, _mm256_max_epu8(b, c));
+    sum = _mm256_add_epi64(sum,
+                           _mm256_sad_epu8(_mm256_and_si256(m, select), zero));
+  }
+
+  return sum_epi64_avx2(sum) +
+         sum_rgb24_darkness_inverse_sse2(row + x * 3, width - x);
+}
+
+// Computes the grayscale of eleven RGB24 pixels into the lanes of lo and hi
+// selected by AVX2_RGB24_SELECT_LO and AVX2_RGB24_SELECT_HI. The last load
+// reads one byte past the eleventh pixel, so a twelfth one must follow.
+TARGET_AVX2 static void grayscale_rgb24_avx2(const uint8_t *p, __m256i *lo,
+                                             __m256i *hi) {
+  const __m256i div3 = _mm256_set1_epi16((short)DIV3_MULTIPLIER);
+  __m256i a = _mm256_loadu_si256((const __m256i *)p);
+  __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+  __m256i c = _mm256_loadu_si256((const __m256i *)(p + 2));
+
+  __m256i sum_lo =
+      _mm256_add_epi16(_mm256_add_epi16(_mm256_cvtepu8_epi16(
+                                            _mm256_castsi256_si128(a)),
+                                        _mm256_cvtepu8_epi16(
+                                            _mm256_castsi256_si128(b))),
+                       _mm256_cvtepu8_epi16(_mm256_castsi256_si128(c)));
+  __m256i sum_hi = _mm256_add_epi16(
+      _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1)),
+                       _mm256_cvtepu8_epi16(_mm256_extracti128_si256(b, 1))),
+      _mm256_cvtepu8_epi16(_mm256_extracti128_si256(c, 1)));
+
+  *lo = _mm256_srli_epi16(_mm256_mulhi_epu16(sum_lo, div3), 1);
+  *hi = _mm256_srli_epi16(_mm256_mulhi_epu16(sum_hi, div3), 1);
+}
+
+TARGET_AVX2 static uint64_t sum_rgb24_grayscale_avx2(const uint8_t *row,
+                                                     int32_t width) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i select_lo = AVX2_RGB24_SELECT_LO;
+  const __m256i select_hi = AVX2_RGB24_SELECT_HI;
+  __m256i sum = _mm256_setzero_si256();
+  int32_t x = 0;
+
+  for (; x + 12 <= width; x += 11) {
+    __m256i lo, hi;
+    grayscale_rgb24_avx2(row + x * 3, &lo, &hi);
+    __m256i selected = _mm256_add_epi16(_mm256_and_si256(lo, select_lo),
+                                        _mm256_and_si256(hi, select_hi));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(selected, ones));
+  }
+
+  return sum_epi32_avx2(sum) +
+         sum_rgb24_grayscale_sse2(row + x * 3, width - x);
+}
+
+TARGET_AVX2 static uint64_t count_gray8_within_avx2(uint8_t *row, int32_t width,
+                                                    uint8_t min, uint8_t max,
+                                                    bool clear) {
+  const __m256i min_v = _mm256_set1_epi8((char)min);
+  const __m256i max_v = _mm256_set1_epi8((char)max);
+  uint64_t count = 0;
+  int32_t x = 0;
+
+  for (; x + 32 <= width; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+    __m256i within =
+        _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, min_v), v),
+                         _mm256_cmpeq_epi8(_mm256_min_epu8(v, max_v), v));
+    count += __builtin_popcount((uint32_t)_mm256_movemask_epi8(within));
+    if (clear) {
+      _mm256_storeu_si256((__m256i *)(row + x), _mm256_or_si256(v, within));
+    }
+  }
+
+  return count +
+         count_gray8_within_sse2(row + x, width - x, min, max, clear);
+}
+
+TARGET_AVX2 static uint64_t count_rgb24_within_avx2(uint8_t *row, int32_t width,
+                                                    uint8_t min, uint8_t max,
+                                                    bool clear) {
+  const __m256i min_v = _mm256_set1_epi16(min);
+  const __m256i max_v = _mm256_set1_epi16(max);
+  const __m256i select_lo = AVX2_RGB24_SELECT_LO;
+  const __m256i select_hi = AVX2_RGB24_SELECT_HI;
+  uint64_t count = 0;
+  int32_t x = 0;
+
+  for (; x + 12 <= width; x += 11) {
+    uint8_t *p = row + x * 3;
+    __m256i lo, hi;
+    grayscale_rgb24_avx2(p, &lo, &hi);
+
+    __m256i outside_lo =
+        _mm256_or_si256(_mm256_cmpgt_epi16(min_v, lo),
+                        _mm256_cmpgt_epi16(lo, max_v));
+    __m256i outside_hi =
+        _mm256_or_si256(_mm256_cmpgt_epi16(min_v, hi),
+                        _mm256_cmpgt_epi16(hi, max_v));
+    // Two bits per 16-bit lane: byte n of the loads is at bit 2 * n of
+    // within_lo for n < 16, and at bit 2 * (n - 16) of within_hi otherwise.
+    uint32_t within_lo = _mm256_movemask_epi8(
+        _mm256_andnot_si256(outside_lo, select_lo));
+    uint32_t within_hi = _mm256_movemask_epi8(
+        _mm256_andnot_si256(outside_hi, select_hi));
+
+    count += (__builtin_popcount(within_lo) + __builtin_popcount(within_hi)) /
+             2;
+    if (clear && (within_lo | within_hi) != 0) {
+      for (int n = 0; n < 11; n++) {
+        int lane = n * 3;
+        uint32_t bits = lane < 16 ? within_lo >> (lane * 2)
+                                  : within_hi >> ((lane - 16) * 2);
+        if (bits & 1) {
+          memset(p + lane, 0xFF, 3);
+        }
+      }
+    }
+  }
+
+  return count + count_rgb24_within_sse2(row + x * 3, width - x, min, max,
+                                         clear);
+}
+
+// Deinterleaves sixteen RGB24 pixels, loaded as three vectors, into the
+// vector of one of their components with the shuffle masks of its lanes.
+#define SHUFFLE_RGB24(a, b, c, mask_a, mask_b, mask_c)                         \
+  _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, mask_a),                       \
+                            _mm_shuffle_epi8(b, mask_b)),                      \
+               _mm_shuffle_epi8(c, mask_c))
+
+TARGET_AVX2 static void convert_rgb24_to_gray8_avx2(const uint8_t *row,
+                                                    uint8_t *out,
+                                                    int32_t width) {
+  const __m128i red_a = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1,
+                                      -1, -1, -1, -1, -1);
+  const __m128i red_b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14,
+                                      -1, -1, -1, -1, -1);
+  const __m128i red_c = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                      -1, 1, 4, 7, 10, 13);
+  const __m128i green_a = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, -1);
+  const __m128i green_b = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12,
+                                        15, -1, -1, -1, -1, -1);
+  const __m128i green_c = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, 2, 5, 8, 11, 14);
+  const __m128i blue_a = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1,
+                                       -1, -1, -1, -1, -1, -1);
+  const __m128i blue_b = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13,
+                                       -1, -1, -1, -1, -1, -1);
+  const __m128i blue_c = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       0, 3, 6, 9, 12, 15);
+  const __m256i div3 = _mm256_set1_epi16((short)DIV3_MULTIPLIER);
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    const uint8_t *p = row + x * 3;
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+
+    __m256i sum = _mm256_add_epi16(
+        _mm256_add_epi16(
+            _mm256_cvtepu8_epi16(SHUFFLE_RGB24(a, b, c, red_a, red_b, red_c)),
+            _mm256_cvtepu8_epi16(
+                SHUFFLE_RGB24(a, b, c, green_a, green_b, green_c))),
+        _mm256_cvtepu8_epi16(SHUFFLE_RGB24(a, b, c, blue_a, blue_b, blue_c)));
+    __m256i gray = _mm256_srli_epi16(_mm256_mulhi_epu16(sum, div3), 1);
+
+    _mm_storeu_si128((__m128i *)(out + x),
+                     _mm_packus_epi16(_mm256_castsi256_si128(gray),
+                                      _mm256_extracti128_si256(gray, 1)));
+  }
+
+  convert_rgb24_to_gray8_scalar(row + x * 3, out + x, width - x);
+}
+
+TARGET_AVX2 static void pack_gray8_to_monowhite_avx2(const uint8_t *row,
+                                                     uint8_t *out,
+                                                     int32_t width,
+                                                     uint8_t threshold) {
+  int32_t x = 0;
+
+  if (threshold > 0) {
+    const __m256i below = _mm256_set1_epi8((char)(threshold - 1));
+
+    for (; x + 32 <= width; x += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+      uint32_t black = _mm256_movemask_epi8(
+          _mm256_cmpeq_epi8(_mm256_min_epu8(v, below), v));
+      for (int i = 0; i < 4; i++) {
+        out[x / 8 + i] = reverse_bits(black >> (i * 8));
+      }
+    }
+  }
+
+  pack_gray8_to_monowhite_sse2(row + x, out + x / 8, width - x, threshold);
+}
+
+static const RowKernels avx2_kernels = {
+    .name = "avx2",
+    .sum_gray8 = sum_gray8_avx2,
+    .sum_rgb24_grayscale = sum_rgb24_grayscale_avx2,
+    .sum_rgb24_lightness = sum_rgb24_lightness_avx2,
+    .sum_rgb24_darkness_inverse = sum_rgb24_darkness_inverse_avx2,
+    .count_gray8_within = count_gray8_within_avx2,
+    .count_rgb24_within = count_rgb24_within_avx2,
+    .convert_rgb24_to_gray8 = convert_rgb24_to_gray8_avx2,
+    .pack_gray8_to_monowhite = pack_gray8_to_monowhite_avx2,
+};
+
+#endif // ROW_KERNELS_X86
+
+#if defined(ROW_KERNELS_NEON)
+
+static uint64_t sum_u32x4_neon(uint32x4_t v) {
+  uint64x2_t pairs = vpaddlq_u32(v);
+  return vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1);
+}
+
+static uint64_t sum_gray8_neon(const uint8_t *row, int32_t width) {
+  uint32x4_t sum = vdupq_n_u32(0);
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    sum = vpadalq_u16(sum, vpaddlq_u8(vld1q_u8(row + x)));
+  }
+
+  return sum_u32x4_neon(sum) + sum_gray8_scalar(row + x, width - x);
+}
+
+static uint64_t sum_rgb24_lightness_neon(const uint8_t *row, int32_t width) {
+  uint32x4_t sum = vdupq_n_u32(0);
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t rgb = vld3q_u8(row + x * 3);
+    uint8x16_t m = vminq_u8(rgb.val[0], vminq_u8(rgb.val[1], rgb.val[2]));
+    sum = vpadalq_u16(sum, vpaddlq_u8(m));
+  }
+
+  return sum_u32x4_neon(sum) +
+         sum_rgb24_lightness_scalar(row + x * 3, width - x);
+}
+
+static uint64_t sum_rgb24_darkness_inverse_neon(const uint8_t *row,
+                                                int32_t width) {
+  uint32x4_t sum = vdupq_n_u32(0);
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t rgb = vld3q_u8(row + x * 3);
+    uint8x16_t m = vmaxq_u8(rgb.val[0], vmaxq_u8(rgb.val[1], rgb.val[2]));
+    sum = vpadalq_u16(sum, vpaddlq_u8(m));
+  }
+
+  return sum_u32x4_neon(sum) +
+         sum_rgb24_darkness_inverse_scalar(row + x * 3, width - x);
+}
+
+static uint16x8_t div3_u16_neon(uint16x8_t v) {
+  const uint16x4_t div3 = vdup_n_u16(DIV3_MULTIPLIER);
+  uint32x4_t lo = vmull_u16(vget_low_u16(v), div3);
+  uint32x4_t hi = vmull_u16(vget_high_u16(v), div3);
+  return vshrq_n_u16(vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16)),
+                     1);
+}
+
+// Computes the grayscale of sixteen deinterleaved RGB24 pixels.
+static uint8x16_t grayscale_rgb24_neon(uint8x16x3_t rgb) {
+  uint16x8_t lo = vaddw_u8(vaddl_u8(vget_low_u8(rgb.val[0]),
+                                    vget_low_u8(rgb.val[1])),
+                           vget_low_u8(rgb.val[2]));
+  uint16x8_t hi = vaddw_u8(vaddl_u8(vget_high_u8(rgb.val[0]),
+                                    vget_high_u8(rgb.val[1])),
+                           vget_high_u8(rgb.val[2]));
+  return vcombine_u8(vmovn_u16(div3_u16_neon(lo)),
+                     vmovn_u16(div3_u16_neon(hi)));
+}
+
+static uint64_t sum_rgb24_grayscale_neon(const uint8_t *row, int32_t width) {
+  uint32x4_t sum = vdupq_n_u32(0);
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t grayscale = grayscale_rgb24_neon(vld3q_u8(row + x * 3));
+    sum = vpadalq_u16(sum, vpaddlq_u8(grayscale));
+  }
+
+  return sum_u32x4_neon(sum) +
+         sum_rgb24_grayscale_scalar(row + x * 3, width - x);
+}
+
+static uint64_t count_mask_neon(uint8x16_t within) {
+  return sum_u32x4_neon(vpaddlq_u16(vpaddlq_u8(vshrq_n_u8(within, 7))));
+}
+
+static uint64_t count_gray8_within_neon(uint8_t *row, int32_t width,
+                                        uint8_t min, uint8_t max, bool clear) {
+  const uint8x16_t min_v = vdupq_n_u8(min);
+  const uint8x16_t max_v = vdupq_n_u8(max);
+  uint64_t count = 0;
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t v = vld1q_u8(row + x);
+    uint8x16_t within = vandq_u8(vcgeq_u8(v, min_v), vcleq_u8(v, max_v));
+    count += count_mask_neon(within);
+    if (clear) {
+      vst1q_u8(row + x, vorrq_u8(v, within));
+    }
+  }
+
+  return count +
+         count_gray8_within_scalar(row + x, width - x, min, max, clear);
+}
+
+static uint64_t count_rgb24_within_neon(uint8_t *row, int32_t width,
+                                        uint8_t min, uint8_t max, bool clear) {
+  const uint8x16_t min_v = vdupq_n_u8(min);
+  const uint8x16_t max_v = vdupq_n_u8(max);
+  uint64_t count = 0;
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x3_t rgb = vld3q_u8(row + x * 3);
+    uint8x16_t grayscale = grayscale_rgb24_neon(rgb);
+    uint8x16_t within =
+        vandq_u8(vcgeq_u8(grayscale, min_v), vcleq_u8(grayscale, max_v));
+    count += count_mask_neon(within);
+    if (clear) {
+      for (int i = 0; i < 3; i++) {
+        rgb.val[i] = vorrq_u8(rgb.val[i], within);
+      }
+      vst3q_u8(row + x * 3, rgb);
+    }
+  }
+
+  return count + count_rgb24_within_scalar(row + x * 3, width - x, min, max,
+                                           clear);
+}
+
+static void convert_rgb24_to_gray8_neon(const uint8_t *row, uint8_t *out,
+                                        int32_t width) {
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    vst1q_u8(out + x, grayscale_rgb24_neon(vld3q_u8(row + x * 3)));
+  }
+
+  convert_rgb24_to_gray8_scalar(row + x * 3, out + x, width - x);
+}
+
+static void pack_gray8_to_monowhite_neon(const uint8_t *row, uint8_t *out,
+                                         int32_t width, uint8_t threshold) {
+  // The weight of each lane in its output byte, most significant first.
+  const uint8_t weights[16] = {128, 64, 32, 16, 8, 4, 2, 1,
+                               128, 64, 32, 16, 8, 4, 2, 1};
+  const uint8x16_t weights_v = vld1q_u8(weights);
+  const uint8x16_t threshold_v = vdupq_n_u8(threshold);
+  int32_t x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t black =
+        vandq_u8(vcltq_u8(vld1q_u8(row + x), threshold_v), weights_v);
+    uint64x2_t bytes = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(black)));
+    out[x / 8] = vgetq_lane_u64(bytes, 0);
+    out[x / 8 + 1] = vgetq_lane_u64(bytes, 1);
+  }
+
+  pack_gray8_to_monowhite_scalar(row + x, out + x / 8, width - x, threshold);
+}
+
+static const RowKernels neon_kernels = {
+    .name = "neon",
+    .sum_gray8 = sum_gray8_neon,
+    .sum_rgb24_grayscale = sum_rgb24_grayscale_neon,
+    .sum_rgb24_lightness = sum_rgb24_lightness_neon,
+    .sum_rgb24_darkness_inverse = sum_rgb24_darkness_inverse_neon,
+    .count_gray8_within = count_gray8_within_neon,
+    .count_rgb24_within = count_rgb24_within_neon,
+    .convert_rgb24_to_gray8 = convert_rgb24_to_gray8_neon,
+    .pack_gray8_to_monowhite = pack_gray8_to_monowhite_neon,
+};
+
+#endif // ROW_KERNELS_NEON
+
+const RowKernels *get_row_kernels(void) {
+  int flags = av_get_cpu_flags();
+
+#if defined(ROW_KERNELS_X86)
+  if (flags & AV_CPU_FLAG_AVX2) {
+    return &avx2_kernels;
+  }
+  if (flags & AV_CPU_FLAG_SSE2) {
+    return &sse2_kernels;
+  }
+#endif
+#if defined(ROW_KERNELS_NEON)
+  if (flags & AV_CPU_FLAG_NEON) {
+    return &neon_kernels;
+  }
+#endif
+
+  (void)flags;
+  return &scalar_kernels;
+}
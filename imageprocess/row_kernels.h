@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sums a per-pixel value over the first width pixels of a row.
+typedef uint64_t (*RowSumKernel)(const uint8_t *row, int32_t width);
+
+// Counts the pixels of a row whose grayscale value is within [min, max],
+// optionally setting them to white.
+typedef uint64_t (*RowCountKernel)(uint8_t *row, int32_t width, uint8_t min,
+                                   uint8_t max, bool clear);
+
+// Converts the first width pixels of a row into another pixel format.
+typedef void (*RowConvertKernel)(const uint8_t *row, uint8_t *out,
+                                 int32_t width);
+
+// Packs the first width GRAY8 pixels of a row into bits, most significant
+// first, setting those of the pixels darker than threshold. The padding bits
+// of the last byte are cleared.
+typedef void (*RowPackKernel)(const uint8_t *row, uint8_t *out, int32_t width,
+                              uint8_t threshold);
+
+// Row-level kernels for the rectangle reductions and pixel format conversions
+// in blit.c, operating directly on GRAY8 and RGB24 frame data. All
+// implementations produce the same results as the per-pixel accessors in
+// pixel.c.
+typedef struct {
+  const char *name;
+
+  // GRAY8 pixels have the same grayscale, lightness and inverse darkness.
+  RowSumKernel sum_gray8;
+
+  RowSumKernel sum_rgb24_grayscale;
+  RowSumKernel sum_rgb24_lightness;
+  RowSumKernel sum_rgb24_darkness_inverse;
+
+  RowCountKernel count_gray8_within;
+  RowCountKernel count_rgb24_within;
+
+  RowConvertKernel convert_rgb24_to_gray8;
+  // The MONOWHITE format has one bit per pixel, set for black.
+  RowPackKernel pack_gray8_to_monowhite;
+} RowKernels;
+
+// Returns the fastest implementation supported by the running CPU.
+const RowKernels *get_row_kernels(void);
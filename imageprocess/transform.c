@@ -0,0 +1,103 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imageprocess/pixel.h"
+#include "imageprocess/transform.h"
+#include "lib/logging.h"
+
+ImageTransform transform_identity(RectangleSize size) {
+  return (ImageTransform){
+      .size = size,
+      .x_x = 1,
+      .y_y = 1,
+      .offset = POINT_ORIGIN,
+  };
+}
+
+bool transform_is_identity(ImageTransform transform, RectangleSize size) {
+  return compare_sizes(transform.size, size) == 0 && transform.x_x == 1 &&
+         transform.x_y == 0 && transform.y_x == 0 && transform.y_y == 1 &&
+         transform.offset.x == 0 && transform.offset.y == 0;
+}
+
+/**
+ * Composes an operation given by the coordinates each of its pixels is read
+ * from: (a * x + b * y + origin.x, c * x + d * y + origin.y), in an image of
+ * the current transform size.
+ */
+static void compose(ImageTransform *transform, int32_t a, int32_t b,
+                    int32_t c, int32_t d, Point origin, RectangleSize size) {
+  ImageTransform t = *transform;
+
+  *transform = (ImageTransform){
+      .size = size,
+      .x_x = t.x_x * a + t.x_y * c,
+      .x_y = t.x_x * b + t.x_y * d,
+      .y_x = t.y_x * a + t.y_y * c,
+      .y_y = t.y_x * b + t.y_y * d,
+      .offset =
+          {
+              t.x_x * origin.x + t.x_y * origin.y + t.offset.x,
+              t.y_x * origin.x + t.y_y * origin.y + t.offset.y,
+          },
+  };
+}
+
+void transform_mirror(ImageTransform *transform, Direction direction) {
+  RectangleSize size = transform->size;
+  int32_t a = direction.horizontal ? -1 : 1;
+  int32_t d = direction.vertical ? -1 : 1;
+  Point origin = {direction.horizontal ? size.width - 1 : 0,
+                  direction.vertical ? size.height - 1 : 0};
+
+  compose(transform, a, 0, 0, d, origin, size);
+}
+
+void transform_shift(ImageTransform *transform, Delta d) {
+  compose(transform, 1, 0, 0, 1, (Point){-d.horizontal, -d.vertical},
+          transform->size);
+}
+
+void transform_rotate_90(ImageTransform *transform,
+                         RotationDirection direction) {
+  RectangleSize size = transform->size;
+  RectangleSize rotated = {.width = size.height, .height = size.width};
+
+  if (direction > 0) {
+    compose(transform, 0, 1, -1, 0, (Point){0, size.height - 1}, rotated);
+  } else {
+    compose(transform, 0, -1, 1, 0, (Point){size.width - 1, 0}, rotated);
+  }
+}
+
+void apply_transform(Image *pImage, ImageTransform transform) {
+  RectangleSize image_size = size_of_image(*pImage);
+  if (transform_is_identity(transform, image_size)) {
+    return;
+  }
+
+  verboseLog(VERBOSE_MORE, "transforming %dx%d -> %dx%d\n", image_size.width,
+             image_size.height, transform.size.width, transform.size.height);
+
+  Image target = create_compatible_image(*pImage, transform.size, false);
+  Rectangle source_area = full_image(*pImage);
+  Rectangle target_area = full_image(target);
+
+  scan_rectangle(target_area) {
+    Point source = {
+        transform.x_x * x + transform.x_y * y + transform.offset.x,
+        transform.y_x * x + transform.y_y * y + transform.offset.y,
+    };
+
+    set_pixel(target, (Point){x, y},
+              point_in_rectangle(source, source_area)
+                  ? get_pixel(*pImage, source)
+                  : pImage->background);
+  }
+
+  replace_image(pImage, &target);
+}
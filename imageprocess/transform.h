@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imageprocess/blit.h"
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+/**
+ * A deferred combination of the lossless geometric operations: mirroring,
+ * shifting and rotating by 90 degrees. Pixel (x, y) of the transformed image,
+ * of the given size, is read from the source pixel at
+ *
+ *   (x_x * x + x_y * y + offset.x, y_x * x + y_y * y + offset.y)
+ *
+ * or is the background, if that falls outside of the source.
+ */
+typedef struct {
+  RectangleSize size;
+  int32_t x_x, x_y;
+  int32_t y_x, y_y;
+  Point offset;
+} ImageTransform;
+
+ImageTransform transform_identity(RectangleSize size);
+bool transform_is_identity(ImageTransform transform, RectangleSize size);
+
+// Compose one more operation after the ones already recorded; they behave
+// as mirror(), shift_image() and flip_rotate_90() respectively.
+void transform_mirror(ImageTransform *transform, Direction direction);
+void transform_shift(ImageTransform *transform, Delta d);
+void transform_rotate_90(ImageTransform *transform,
+                         RotationDirection direction);
+
+// Applies all the recorded operations in a single pass over the image,
+// replacing it unless the transform is the identity.
+void apply_transform(Image *pImage, ImageTransform transform);
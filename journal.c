@@ -0,0 +1,211 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#if !defined(_MSC_VER)
+#include <unistd.h>
+#endif
+
+#include "journal.h"
+#include "lib/logging.h"
+#include "lib/porting.h"
+#include "lib/text.h"
+
+struct Journal {
+  const char *filename;
+  FILE *f;
+  pthread_mutex_t lock;
+
+  // Keys of the sheets completed by previous runs, sorted.
+  int completed_count;
+  char **completed;
+};
+
+// Paths are written as they are, except for the characters separating fields
+// and records.
+static void write_path(Text *text, const char *path) {
+  for (const char *p = path; *p != '\0'; p++) {
+    if (*p == '%' || *p == '\t' || *p == '\n' || *p == '\r') {
+      text_printf(text, "%%%02X", (unsigned char)*p);
+    } else {
+      text_printf(text, "%c", *p);
+    }
+  }
+}
+
+/**
+ * Describes the files of a sheet as journal fields, or returns NULL if an
+ * input cannot be found or, if check_outputs is true, an output is missing.
+ * The outputs of a skipped sheet, which were not written, are recorded as
+ * such instead.
+ */
+static char *sheet_key(int input_count, const char *const inputs[],
+                       int output_count, const char *const outputs[],
+                       bool skipped, bool check_outputs) {
+  Text key = EMPTY_TEXT;
+  bool found = true;
+
+  for (int i = 0; i < input_count && found; i++) {
+    struct stat st;
+
+    if (inputs[i] == NULL) {
+      text_printf(&key, "%sblank", i > 0 ? "\t" : "");
+    } else if (stat(inputs[i], &st) == 0) {
+      text_printf(&key, "%sinput %lld %lld ", i > 0 ? "\t" : "",
+                  (long long)st.st_size, (long long)st.st_mtime);
+      write_path(&key, inputs[i]);
+    } else {
+      found = false;
+    }
+  }
+
+  for (int i = 0; i < output_count && found; i++) {
+    struct stat st;
+
+    if (check_outputs && !skipped && stat(outputs[i], &st) != 0) {
+      found = false;
+    }
+    text_printf(&key, "\t%s ", skipped ? "skipped" : "output");
+    write_path(&key, outputs[i]);
+  }
+
+  if (!found) {
+    text_free(&key);
+    return NULL;
+  }
+  return key.data;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Loads the keys of the complete records: a record cut short by a crash has
+// no final newline.
+static void load_completed(Journal *journal, FILE *f) {
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t length;
+  int capacity = 0;
+
+  while ((length = getline(&line, &line_size, f)) != -1) {
+    char *fields = strchr(line, '\t');
+    if (line[0] == '#' || line[length - 1] != '\n' || fields == NULL) {
+      continue;
+    }
+    line[length - 1] = '\0';
+
+    if (journal->completed_count == capacity) {
+      capacity = capacity == 0 ? 256 : capacity * 2;
+      journal->completed =
+          realloc(journal->completed, capacity * sizeof(char *));
+      if (journal->completed == NULL) {
+        errOutput("unable to allocate journal %s.", journal->filename);
+      }
+    }
+    journal->completed[journal->completed_count] = strdup(fields + 1);
+    if (journal->completed[journal->completed_count++] == NULL) {
+      errOutput("unable to allocate journal %s.", journal->filename);
+    }
+  }
+  free(line);
+
+  if (ferror(f)) {
+    errOutput("unable to read journal %s.", journal->filename);
+  }
+
+  qsort(journal->completed, journal->completed_count, sizeof(char *),
+        compare_keys);
+}
+
+Journal *journal_open(const char *filename, bool load) {
+  Journal *journal = calloc(1, sizeof(Journal));
+  if (journal == NULL) {
+    errOutput("unable to allocate journal %s.", filename);
+  }
+  journal->filename = filename;
+  pthread_mutex_init(&journal->lock, NULL);
+
+  journal->f = fopen(filename, "a+");
+  if (journal->f == NULL) {
+    errOutput("unable to open journal %s: %s", filename, strerror(errno));
+  }
+
+  if (load) {
+    rewind(journal->f);
+    load_completed(journal, journal->f);
+  }
+
+  // Terminate a record cut short by a crash, so that it is not joined with
+  // the first new one.
+  if (fseek(journal->f, -1, SEEK_END) == 0 && fgetc(journal->f) != '\n') {
+    fputc('\n', journal->f);
+  }
+
+  return journal;
+}
+
+void journal_close(Journal *journal) {
+  if (journal == NULL) {
+    return;
+  }
+
+  fclose(journal->f);
+  for (int i = 0; i < journal->completed_count; i++) {
+    free(journal->completed[i]);
+  }
+  free(journal->completed);
+  pthread_mutex_destroy(&journal->lock);
+  free(journal);
+}
+
+static bool find_completed(Journal *journal, char *key) {
+  bool completed =
+      key != NULL && bsearch(&key, journal->completed,
+                             journal->completed_count, sizeof(char *),
+                             compare_keys) != NULL;
+
+  free(key);
+  return completed;
+}
+
+bool journal_completed(Journal *journal, int input_count,
+                       const char *const inputs[], int output_count,
+                       const char *const outputs[]) {
+  return find_completed(journal, sheet_key(input_count, inputs, output_count,
+                                           outputs, false, true)) ||
+         find_completed(journal, sheet_key(input_count, inputs, output_count,
+                                           outputs, true, true));
+}
+
+void journal_record(Journal *journal, int nr, int input_count,
+                    const char *const inputs[], int output_count,
+                    const char *const outputs[], bool skipped) {
+  char *key =
+      sheet_key(input_count, inputs, output_count, outputs, skipped, false);
+  bool success;
+
+  if (key == NULL) {
+    return;
+  }
+
+  // Each record is synced on its own, so that it survives a crash of the
+  // following sheets.
+  pthread_mutex_lock(&journal->lock);
+  success = fprintf(journal->f, "%d\t%s\n", nr, key) > 0 &&
+            fflush(journal->f) == 0 && fsync(fileno(journal->f)) == 0;
+  pthread_mutex_unlock(&journal->lock);
+
+  free(key);
+  if (!success) {
+    errOutput("unable to write journal %s.", journal->filename);
+  }
+}
@@ -0,0 +1,36 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- completion journal ------------------------------------------------- */
+
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Append-only record of the sheets that were processed completely, so that an
+ * interrupted batch can be resumed.
+ *
+ * Each line records a sheet number, the size and modification time of each
+ * input file (or a blank input), and the output files written, or skipped
+ * if the sheet was found blank and none were written. A sheet counts as
+ * completed if a line of a previous run matches its inputs, unchanged, and
+ * its outputs, still present unless skipped. Records can be added from
+ * several threads.
+ */
+typedef struct Journal Journal;
+
+// Opens the journal at filename for appending, loading the sheets it records
+// as completed if load is true.
+Journal *journal_open(const char *filename, bool load);
+void journal_close(Journal *journal);
+
+// inputs holds input_count file names, where NULL is a blank input, and
+// outputs holds output_count file names, not written if skipped is true.
+bool journal_completed(Journal *journal, int input_count,
+                       const char *const inputs[], int output_count,
+                       const char *const outputs[]);
+void journal_record(Journal *journal, int nr, int input_count,
+                    const char *const inputs[], int output_count,
+                    const char *const outputs[], bool skipped);
@@ -0,0 +1,20 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include "lib/json.h"
+
+void write_json_string(Text *text, const char *str) {
+  text_printf(text, "\"");
+  for (; *str != '\0'; str++) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\') {
+      text_printf(text, "\\%c", c);
+    } else if (c < 0x20) {
+      text_printf(text, "\\u%04x", c);
+    } else {
+      text_printf(text, "%c", c);
+    }
+  }
+  text_printf(text, "\"");
+}
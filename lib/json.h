@@ -0,0 +1,11 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "lib/text.h"
+
+// Appends str to text as a quoted JSON string, escaping quotes, backslashes
+// and control characters.
+void write_json_string(Text *text, const char *str);
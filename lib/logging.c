@@ -8,24 +8,61 @@
 
 #include "logging.h"
 
-VerboseLevel verbose = VERBOSE_NONE;
+static Logger default_logger = {
+    .verbose = VERBOSE_NONE,
+};
+
+static _Thread_local Logger *current_logger = NULL;
+
+static Logger *logger(void) {
+  return current_logger != NULL ? current_logger : &default_logger;
+}
+
+Logger *logging_install(Logger *new_logger) {
+  Logger *previous = logger();
+
+  current_logger = new_logger;
+  return previous;
+}
+
+VerboseLevel verbose_level(void) { return logger()->verbose; }
+
+void set_verbose_level(VerboseLevel level) { logger()->verbose = level; }
 
 void verboseLog(VerboseLevel level, const char *fmt, ...) {
-  if (verbose < level)
+  Logger *l = logger();
+
+  if (l->verbose < level)
     return;
 
   va_list vl;
   va_start(vl, fmt);
-  vfprintf(stderr, fmt, vl);
+  if (l->log == NULL) {
+    vfprintf(stderr, fmt, vl);
+  } else {
+    char message[LOGGER_ERROR_SIZE];
+    vsnprintf(message, sizeof(message), fmt, vl);
+    l->log(l->opaque, level, message);
+  }
   va_end(vl);
 }
 
 /**
- * Print an error and exit process
+ * Print an error and exit process, or return to the error handler of the
+ * current logger.
  */
 void errOutput(const char *fmt, ...) {
+  Logger *l = logger();
   va_list vl;
 
+  if (l->error_handler != NULL) {
+    va_start(vl, fmt);
+    vsnprintf(l->error, sizeof(l->error), fmt, vl);
+    va_end(vl);
+
+    longjmp(*l->error_handler, 1);
+  }
+
   fprintf(stderr, "unpaper: error: ");
 
   va_start(vl, fmt);
@@ -6,6 +6,8 @@
 
 #include "porting.h"
 
+#include <setjmp.h>
+
 typedef enum {
   VERBOSE_QUIET = -1,
   VERBOSE_NONE = 0,
@@ -15,8 +17,33 @@ typedef enum {
   VERBOSE_DEBUG_SAVE = 4
 } VerboseLevel;
 
-// TODO: stop exposing the global variable.
-extern VerboseLevel verbose;
+typedef void (*LogFunction)(void *opaque, VerboseLevel level,
+                            const char *message);
+
+#define LOGGER_ERROR_SIZE 1024
+
+/**
+ * Destination of the log messages and errors of one thread.
+ *
+ * Messages up to the verbosity level go to the log function, or to stderr if
+ * none is set. Errors terminate the process, unless an error handler is set:
+ * then the message is stored in error and errOutput() jumps back to it.
+ */
+typedef struct {
+  VerboseLevel verbose;
+  LogFunction log;
+  void *opaque;
+
+  jmp_buf *error_handler;
+  char error[LOGGER_ERROR_SIZE];
+} Logger;
+
+// Makes logger the destination for the calling thread, returning the previous
+// one. Passing NULL restores the process-wide default logger.
+Logger *logging_install(Logger *logger);
+
+VerboseLevel verbose_level(void);
+void set_verbose_level(VerboseLevel level);
 
 void verboseLog(VerboseLevel level, const char *fmt, ...)
     __attribute__((format(printf, 2, 3)));
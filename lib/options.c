@@ -32,6 +32,10 @@ void options_init(Options *o) {
       .start_output = -1,
       .input_count = 1,
       .output_count = 1,
+      .cache_directory = NULL,
+      .detect_only = false,
+      .geometry_file = NULL,
+      .coherent_scans = false,
 
       // default: process all between start-sheet and end-sheet
       // this does not use .count = 0 because we use the -1 as a sentinel for
@@ -84,11 +88,37 @@ void options_init(Options *o) {
       .border = BORDER_NULL,
       .post_border = BORDER_NULL,
 
+      .pre_masks_count = 0,
+      .masks_count = 0,
+      .points_count = 0,
+      .middle_wipe = {0, 0},
+
       .interpolate_type = INTERP_CUBIC,
       .noisefilter_intensity = 4,
+
+      .blank_sheets = BLANK_SHEETS_PROCESS,
   };
 }
 
+void options_free(Options *o) {
+  struct MultiIndex *multi_indexes[] = {
+      &o->sheet_multi_index,          &o->exclude_multi_index,
+      &o->ignore_multi_index,         &o->insert_blank,
+      &o->replace_blank,              &o->no_blackfilter_multi_index,
+      &o->no_noisefilter_multi_index, &o->no_blurfilter_multi_index,
+      &o->no_grayfilter_multi_index,  &o->no_mask_scan_multi_index,
+      &o->no_mask_center_multi_index, &o->no_deskew_multi_index,
+      &o->no_wipe_multi_index,        &o->no_border_multi_index,
+      &o->no_border_scan_multi_index, &o->no_border_align_multi_index,
+  };
+
+  for (size_t i = 0; i < sizeof(multi_indexes) / sizeof(multi_indexes[0]);
+       i++) {
+    free(multi_indexes[i]->indexes);
+    multi_indexes[i]->indexes = NULL;
+  }
+}
+
 bool parse_rectangle(const char *str, Rectangle *rect) {
   if (sscanf(str, "%" SCNd32 ",%" SCNd32 ",%" SCNd32 ",%" SCNd32 "",
              &rect->vertex[0].x, &rect->vertex[0].y, &rect->vertex[1].x,
@@ -100,10 +130,10 @@ bool parse_rectangle(const char *str, Rectangle *rect) {
   return count_pixels(*rect) > 0;
 }
 
-int print_rectangle(Rectangle rect) {
-  return printf("[%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "] ",
-                rect.vertex[0].x, rect.vertex[0].y, rect.vertex[1].x,
-                rect.vertex[1].y);
+void print_rectangle(Text *text, Rectangle rect) {
+  text_printf(text, "[%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "] ",
+              rect.vertex[0].x, rect.vertex[0].y, rect.vertex[1].x,
+              rect.vertex[1].y);
 }
 
 /**
@@ -153,8 +183,8 @@ bool parse_rectangle_size(const char *str, RectangleSize *size) {
   return size->width >= 0 && size->height >= 0;
 }
 
-int print_rectangle_size(RectangleSize size) {
-  return printf("[%" PRId32 ",%" PRId32 "] ", size.width, size.height);
+void print_rectangle_size(Text *text, RectangleSize size) {
+  text_printf(text, "[%" PRId32 ",%" PRId32 "] ", size.width, size.height);
 }
 
 bool parse_delta(const char *str, Delta *delta) {
@@ -172,8 +202,9 @@ bool parse_scan_step(const char *str, Delta *delta) {
   return delta->horizontal > 0 && delta->vertical > 0;
 }
 
-int print_delta(Delta delta) {
-  return printf("[%" PRId32 ",%" PRId32 "] ", delta.horizontal, delta.vertical);
+void print_delta(Text *text, Delta delta) {
+  text_printf(text, "[%" PRId32 ",%" PRId32 "] ", delta.horizontal,
+              delta.vertical);
 }
 
 /**
@@ -207,9 +238,9 @@ bool parse_border(const char *str, Border *border) {
           border->bottom >= 0);
 }
 
-int print_border(Border border) {
-  return printf("[%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "] ",
-                border.left, border.top, border.right, border.bottom);
+void print_border(Text *text, Border border) {
+  text_printf(text, "[%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "] ",
+              border.left, border.top, border.right, border.bottom);
 }
 
 bool parse_color(const char *str, Pixel *color) {
@@ -231,15 +262,14 @@ bool parse_color(const char *str, Pixel *color) {
   return true;
 }
 
-int print_color(Pixel color) {
+void print_color(Text *text, Pixel color) {
   if (compare_pixel(color, PIXEL_BLACK) == 0) {
-    return printf("black");
-  }
-  if (compare_pixel(color, PIXEL_WHITE) == 0) {
-    return printf("white");
+    text_printf(text, "black");
+  } else if (compare_pixel(color, PIXEL_WHITE) == 0) {
+    text_printf(text, "white");
+  } else {
+    text_printf(text, "#%02x%02x%02x", color.r, color.g, color.b);
   }
-
-  return printf("#%02x%02x%02x", color.r, color.g, color.b);
 }
 
 bool parse_direction(const char *str, Direction *direction) {
@@ -342,13 +372,14 @@ bool parse_edges(const char *str, Edges *edges) {
   return next_token == NULL;
 }
 
-int print_edges(Edges edges) {
+void print_edges(Text *text, Edges edges) {
   if (!edges.left && !edges.top && !edges.right && !edges.bottom) {
-    return printf("[none]");
+    text_printf(text, "[none]");
+    return;
   }
 
-  return printf(
-      "[%s%s%s%s%s%s%s]", edges.left ? "left" : "",
+  text_printf(
+      text, "[%s%s%s%s%s%s%s]", edges.left ? "left" : "",
       (edges.left && (edges.top || edges.right || edges.bottom)) ? "," : "",
       edges.top ? "top" : "",
       (edges.top && (edges.right || edges.bottom)) ? "," : "",
@@ -396,3 +427,23 @@ bool parse_interpolate(const char *str, Interpolation *interpolation) {
 
   return false;
 }
+
+static const struct {
+  const char name[8];
+  BlankSheets blank_sheets;
+} BLANK_SHEETS[] = {
+    {"process", BLANK_SHEETS_PROCESS},
+    {"white", BLANK_SHEETS_WHITE},
+    {"skip", BLANK_SHEETS_SKIP},
+};
+
+bool parse_blank_sheets(const char *str, BlankSheets *blank_sheets) {
+  for (size_t j = 0; j < sizeof(BLANK_SHEETS) / sizeof(BLANK_SHEETS[0]); j++) {
+    if (strcasecmp(str, BLANK_SHEETS[j].name) == 0) {
+      *blank_sheets = BLANK_SHEETS[j].blank_sheets;
+      return true;
+    }
+  }
+
+  return false;
+}
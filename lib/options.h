@@ -5,6 +5,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdio.h>
 
 #include <libavutil/pixfmt.h>
 
@@ -14,8 +15,18 @@
 #include "imageprocess/interpolate.h"
 #include "imageprocess/masks.h"
 #include "imageprocess/primitives.h"
+#include "lib/text.h"
 #include "parse.h"
 
+typedef enum {
+  // Blank sheets are processed like the others.
+  BLANK_SHEETS_PROCESS,
+  // White pages are written for blank sheets, without processing them.
+  BLANK_SHEETS_WHITE,
+  // No pages are written for blank sheets.
+  BLANK_SHEETS_SKIP,
+} BlankSheets;
+
 typedef struct {
   bool write_output;
   bool overwrite_output;
@@ -30,6 +41,16 @@ typedef struct {
   int input_count;
   int output_count;
 
+  // Directory of the result cache, or NULL to process every sheet.
+  const char *cache_directory;
+
+  // Write the detections of each sheet instead of its pages.
+  bool detect_only;
+  // File of detections to use instead of making them, or NULL.
+  const char *geometry_file;
+  // Start the scans of each sheet near the detections of the previous one.
+  bool coherent_scans;
+
   struct MultiIndex sheet_multi_index;
   struct MultiIndex exclude_multi_index;
   struct MultiIndex ignore_multi_index;
@@ -80,6 +101,21 @@ typedef struct {
   Border border;
   Border post_border;
 
+  size_t pre_masks_count;
+  Rectangle pre_masks[MAX_MASKS];
+
+  // Explicit masks and mask scan points, otherwise detected on each sheet.
+  size_t masks_count;
+  Rectangle masks[MAX_MASKS];
+  size_t points_count;
+  Point points[MAX_POINTS];
+
+  // Left and right extent of the wipe in the middle of double layout sheets.
+  int32_t middle_wipe[2];
+
+  // Storage for blackfilter_parameters.exclusions.
+  Rectangle blackfilter_exclusions[MAX_MASKS];
+
   DeskewParameters deskew_parameters;
   MaskDetectionParameters mask_detection_parameters;
   MaskAlignmentParameters mask_alignment_parameters;
@@ -90,38 +126,46 @@ typedef struct {
   BlackfilterParameters blackfilter_parameters;
   BlurfilterParameters blurfilter_parameters;
   uint64_t noisefilter_intensity;
+
+  BlankSheets blank_sheets;
+  BlankParameters blank_parameters;
 } Options;
 
 void options_init(Options *o);
 
+// Releases the sheet lists allocated while parsing options.
+void options_free(Options *o);
+
 bool parse_symmetric_integers(const char *str, int32_t *value_1,
                               int32_t *value_2);
 bool parse_symmetric_floats(const char *str, float *value_1, float *value_2);
 
 bool parse_rectangle(const char *str, Rectangle *rect);
-int print_rectangle(Rectangle rect);
+void print_rectangle(Text *text, Rectangle rect);
 
 bool parse_rectangle_size(const char *str, RectangleSize *size);
-int print_rectangle_size(RectangleSize size);
+void print_rectangle_size(Text *text, RectangleSize size);
 
 bool parse_delta(const char *str, Delta *delta);
 bool parse_scan_step(const char *str, Delta *delta);
-int print_delta(Delta delta);
+void print_delta(Text *text, Delta delta);
 
 bool parse_wipe(const char *optname, const char *str, Wipes *wipes);
 
 bool parse_border(const char *str, Border *rect);
-int print_border(Border rect);
+void print_border(Text *text, Border rect);
 
 bool parse_color(const char *str, Pixel *color);
-int print_color(Pixel color);
+void print_color(Text *text, Pixel color);
 
 bool parse_direction(const char *str, Direction *direction);
 const char *direction_to_string(Direction direction);
 
 bool parse_edges(const char *str, Edges *edges);
-int print_edges(Edges edges);
+void print_edges(Text *text, Edges edges);
 
 bool parse_layout(const char *str, Layout *layout);
 
 bool parse_interpolate(const char *str, Interpolation *interpolation);
+
+bool parse_blank_sheets(const char *str, BlankSheets *blank_sheets);
@@ -17,9 +17,18 @@
 
 #define __typeof__(a)         decltype(a)
 
+#define _Thread_local         __declspec(thread)
+
 #define strcasecmp(a, b)      stricmp(a, b)
 #define strncasecmp(a, b)     strnicmp(a, b)
 
+#include <io.h>
+
+#define dup(fd)               _dup(fd)
+#define dup2(fd, fd2)         _dup2(fd, fd2)
+#define STDOUT_FILENO         1
+#define STDERR_FILENO         2
+
 #else
 #include <strings.h>
 #endif
@@ -0,0 +1,259 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "lib/json.h"
+#include "lib/stats.h"
+#include "lib/text.h"
+
+static const char *const STAGE_NAMES[STAGES_COUNT] = {
+    [STAGE_LOAD] = "load",
+    [STAGE_BLANK_DETECTION] = "blank_detection",
+    [STAGE_TRANSFORM] = "transform",
+    [STAGE_RESIZE] = "resize",
+    [STAGE_MASKING] = "masking",
+    [STAGE_BLACKFILTER] = "blackfilter",
+    [STAGE_NOISEFILTER] = "noisefilter",
+    [STAGE_BLURFILTER] = "blurfilter",
+    [STAGE_MASK_DETECTION] = "mask_detection",
+    [STAGE_GRAYFILTER] = "grayfilter",
+    [STAGE_DESKEW] = "deskew",
+    [STAGE_CENTERING] = "centering",
+    [STAGE_BORDER_SCAN] = "border_scan",
+    [STAGE_SAVE] = "save",
+};
+
+static const char *const COUNTER_NAMES[COUNTERS_COUNT] = {
+    [COUNTER_FLOOD_FILLS] = "flood_fills",
+    [COUNTER_DESKEW_PROBES] = "deskew_probes",
+    [COUNTER_BYTES_READ] = "bytes_read",
+    [COUNTER_BYTES_WRITTEN] = "bytes_written",
+    [COUNTER_BLANK_SHEETS] = "blank_sheets",
+};
+
+static _Thread_local Statistics *current_stats = NULL;
+
+bool parse_stats_format(const char *str, StatsFormat *format) {
+  if (strcmp(str, "json") == 0) {
+    *format = STATS_JSON;
+    return true;
+  }
+
+  return false;
+}
+
+Statistics *stats_install(Statistics *stats) {
+  Statistics *previous = current_stats;
+
+  current_stats = stats;
+  return previous;
+}
+
+bool stats_enabled(void) {
+  return current_stats != NULL && current_stats->format != STATS_NONE;
+}
+
+// Sheets are processed on one thread, whose CPU time is that of the sheet
+// even while other contexts run concurrently; batches use that of the process.
+static StatsTimer start_timer(clockid_t cpu_clock) {
+  StatsTimer timer;
+
+  clock_gettime(CLOCK_MONOTONIC, &timer.wall);
+  clock_gettime(cpu_clock, &timer.cpu);
+  return timer;
+}
+
+void stats_enable(Statistics *stats, StatsFormat format, FILE *output) {
+  *stats = EMPTY_STATISTICS;
+  stats->format = format;
+  stats->output = output;
+  stats->timer = start_timer(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static uint64_t elapsed_ns(struct timespec start, struct timespec end) {
+  return (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+         (end.tv_nsec - start.tv_nsec);
+}
+
+static void stop_timer(StatsTimer timer, clockid_t cpu_clock,
+                       uint64_t *wall_ns, uint64_t *cpu_ns) {
+  StatsTimer now = start_timer(cpu_clock);
+
+  *wall_ns += elapsed_ns(timer.wall, now.wall);
+  *cpu_ns += elapsed_ns(timer.cpu, now.cpu);
+}
+
+void stats_begin_sheet(int nr) {
+  if (!stats_enabled()) {
+    return;
+  }
+
+  current_stats->sheet_nr = nr;
+  memset(&current_stats->sheet, 0, sizeof(current_stats->sheet));
+  current_stats->sheet_timer = start_timer(CLOCK_THREAD_CPUTIME_ID);
+}
+
+StatsTimer stats_start(void) {
+  if (!stats_enabled()) {
+    return (StatsTimer){{0, 0}, {0, 0}};
+  }
+
+  return start_timer(CLOCK_THREAD_CPUTIME_ID);
+}
+
+/**
+ * Accounts the time since the timer was started, and the pixels processed,
+ * to a processing stage of the current sheet.
+ */
+void stats_stop(StatsTimer timer, Stage stage, uint64_t pixels) {
+  if (!stats_enabled()) {
+    return;
+  }
+
+  StageStats *stage_stats = &current_stats->sheet.stages[stage];
+  stop_timer(timer, CLOCK_THREAD_CPUTIME_ID, &stage_stats->wall_ns,
+             &stage_stats->cpu_ns);
+  stage_stats->calls++;
+  stage_stats->pixels += pixels;
+}
+
+void stats_count(Counter counter, uint64_t value) {
+  if (!stats_enabled()) {
+    return;
+  }
+
+  current_stats->sheet.counters[counter] += value;
+}
+
+void stats_count_file_size(Counter counter, const char *filename) {
+  struct stat statbuf;
+
+  if (stats_enabled() && stat(filename, &statbuf) == 0) {
+    stats_count(counter, statbuf.st_size);
+  }
+}
+
+static void print_json_files(Text *text, const char *key,
+                             const char *const files[], int count) {
+  text_printf(text, "\"%s\":[", key);
+  for (int i = 0; i < count; i++) {
+    if (i > 0) {
+      text_printf(text, ",");
+    }
+    if (files[i] == NULL) {
+      text_printf(text, "null");
+    } else {
+      write_json_string(text, files[i]);
+    }
+  }
+  text_printf(text, "],");
+}
+
+static void print_json_stats(Text *text, const Stats *stats) {
+  text_printf(text, "\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"stages\":{",
+              stats->wall_ns / 1e6, stats->cpu_ns / 1e6);
+
+  bool first = true;
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    const StageStats *stage_stats = &stats->stages[stage];
+    if (stage_stats->calls == 0) {
+      continue;
+    }
+
+    text_printf(text,
+                "%s\"%s\":{\"calls\":%" PRIu64 ",\"wall_ms\":%.3f,"
+                "\"cpu_ms\":%.3f,\"pixels\":%" PRIu64 "}",
+                first ? "" : ",", STAGE_NAMES[stage], stage_stats->calls,
+                stage_stats->wall_ns / 1e6, stage_stats->cpu_ns / 1e6,
+                stage_stats->pixels);
+    first = false;
+  }
+
+  text_printf(text, "},\"counters\":{");
+  for (int counter = 0; counter < COUNTERS_COUNT; counter++) {
+    text_printf(text, "%s\"%s\":%" PRIu64, counter == 0 ? "" : ",",
+                COUNTER_NAMES[counter], stats->counters[counter]);
+  }
+  text_printf(text, "}");
+}
+
+// Writes a report as one write, so that the lines of concurrent contexts
+// sharing the stream do not interleave.
+static void print_report(const Statistics *stats, Text *text) {
+  fputs(text->data, stats->output);
+  fflush(stats->output);
+  text_free(text);
+}
+
+/**
+ * Writes the report of the current sheet, and adds it to the totals.
+ */
+void stats_end_sheet(const char *const input_files[], int input_count,
+                     const char *const output_files[], int output_count) {
+  if (!stats_enabled()) {
+    return;
+  }
+
+  Statistics *stats = current_stats;
+  Statistics sheet = EMPTY_STATISTICS;
+  Text text = EMPTY_TEXT;
+
+  stop_timer(stats->sheet_timer, CLOCK_THREAD_CPUTIME_ID, &stats->sheet.wall_ns,
+             &stats->sheet.cpu_ns);
+
+  text_printf(&text, "{\"sheet\":%d,", stats->sheet_nr);
+  print_json_files(&text, "input", input_files, input_count);
+  print_json_files(&text, "output", output_files, output_count);
+  print_json_stats(&text, &stats->sheet);
+  text_printf(&text, "}\n");
+  print_report(stats, &text);
+
+  sheet.sheets = 1;
+  sheet.total = stats->sheet;
+  stats_add(stats, &sheet);
+}
+
+void stats_add(Statistics *total, const Statistics *part) {
+  for (int stage = 0; stage < STAGES_COUNT; stage++) {
+    StageStats *sum = &total->total.stages[stage];
+    const StageStats *add = &part->total.stages[stage];
+
+    sum->calls += add->calls;
+    sum->wall_ns += add->wall_ns;
+    sum->cpu_ns += add->cpu_ns;
+    sum->pixels += add->pixels;
+  }
+  for (int counter = 0; counter < COUNTERS_COUNT; counter++) {
+    total->total.counters[counter] += part->total.counters[counter];
+  }
+  total->sheets += part->sheets;
+}
+
+/**
+ * Writes the totals, timed from stats_enable().
+ */
+void stats_print_summary(Statistics *stats) {
+  if (stats->format == STATS_NONE) {
+    return;
+  }
+
+  Text text = EMPTY_TEXT;
+
+  stats->total.wall_ns = 0;
+  stats->total.cpu_ns = 0;
+  stop_timer(stats->timer, CLOCK_PROCESS_CPUTIME_ID, &stats->total.wall_ns,
+             &stats->total.cpu_ns);
+
+  text_printf(&text, "{\"summary\":{\"sheets\":%" PRIu64 ",", stats->sheets);
+  print_json_stats(&text, &stats->total);
+  text_printf(&text, "}}\n");
+  print_report(stats, &text);
+}
@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef enum {
+  STATS_NONE,
+  STATS_JSON,
+} StatsFormat;
+
+typedef enum {
+  STAGE_LOAD,
+  STAGE_BLANK_DETECTION,
+  STAGE_TRANSFORM,
+  STAGE_RESIZE,
+  STAGE_MASKING,
+  STAGE_BLACKFILTER,
+  STAGE_NOISEFILTER,
+  STAGE_BLURFILTER,
+  STAGE_MASK_DETECTION,
+  STAGE_GRAYFILTER,
+  STAGE_DESKEW,
+  STAGE_CENTERING,
+  STAGE_BORDER_SCAN,
+  STAGE_SAVE,
+  STAGES_COUNT,
+} Stage;
+
+typedef enum {
+  COUNTER_FLOOD_FILLS,
+  COUNTER_DESKEW_PROBES,
+  COUNTER_BYTES_READ,
+  COUNTER_BYTES_WRITTEN,
+  COUNTER_BLANK_SHEETS,
+  COUNTERS_COUNT,
+} Counter;
+
+typedef struct {
+  struct timespec wall;
+  struct timespec cpu;
+} StatsTimer;
+
+typedef struct {
+  uint64_t calls;
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+  uint64_t pixels;
+} StageStats;
+
+typedef struct {
+  StageStats stages[STAGES_COUNT];
+  uint64_t counters[COUNTERS_COUNT];
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+} Stats;
+
+/**
+ * Statistics collected by one processing context, or totalled over a batch.
+ *
+ * The functions below that take no Statistics act on the ones installed for
+ * the calling thread, so that concurrent contexts collect their own. Start
+ * from EMPTY_STATISTICS, which collects nothing.
+ */
+typedef struct {
+  StatsFormat format;
+  FILE *output;
+
+  int sheet_nr;
+  StatsTimer sheet_timer;
+  Stats sheet;
+
+  uint64_t sheets;
+  StatsTimer timer;
+  Stats total;
+} Statistics;
+
+#define EMPTY_STATISTICS                                                       \
+  (Statistics) { .format = STATS_NONE, .output = NULL }
+
+bool parse_stats_format(const char *str, StatsFormat *format);
+
+// Enables collection, with reports written to the given stream, and starts
+// timing the batch.
+void stats_enable(Statistics *stats, StatsFormat format, FILE *output);
+
+// Installs the statistics of the calling thread, returning the previous ones.
+Statistics *stats_install(Statistics *stats);
+bool stats_enabled(void);
+
+void stats_begin_sheet(int nr);
+StatsTimer stats_start(void);
+void stats_stop(StatsTimer timer, Stage stage, uint64_t pixels);
+void stats_count(Counter counter, uint64_t value);
+void stats_count_file_size(Counter counter, const char *filename);
+void stats_end_sheet(const char *const input_files[], int input_count,
+                     const char *const output_files[], int output_count);
+
+// Adds the sheet totals of part to total.
+void stats_add(Statistics *total, const Statistics *part);
+void stats_print_summary(Statistics *stats);
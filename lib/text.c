@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib/logging.h"
+#include "lib/text.h"
+
+static void text_vprintf(Text *text, const char *fmt, va_list args) {
+  va_list retry;
+
+  va_copy(retry, args);
+  size_t available = text->capacity - text->length;
+  int length = vsnprintf(text->data == NULL ? NULL : text->data + text->length,
+                         available, fmt, args);
+  if (length < 0) {
+    errOutput("unable to format text.");
+  }
+
+  if ((size_t)length >= available) {
+    size_t capacity = text->capacity > 0 ? text->capacity : 256;
+    while (capacity <= text->length + length) {
+      capacity *= 2;
+    }
+
+    char *data = realloc(text->data, capacity);
+    if (data == NULL) {
+      errOutput("unable to allocate text.");
+    }
+    text->data = data;
+    text->capacity = capacity;
+    vsnprintf(text->data + text->length, capacity - text->length, fmt, retry);
+  }
+  va_end(retry);
+
+  text->length += length;
+}
+
+void text_printf(Text *text, const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  text_vprintf(text, fmt, args);
+  va_end(args);
+}
+
+void text_free(Text *text) {
+  free(text->data);
+  *text = EMPTY_TEXT;
+}
@@ -0,0 +1,27 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "porting.h"
+
+#include <stddef.h>
+
+/**
+ * Text built up in memory with printf-style appends, standing in for
+ * open_memstream(), which not every C library provides. Start from
+ * EMPTY_TEXT; data is NUL-terminated once anything has been appended.
+ */
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+} Text;
+
+#define EMPTY_TEXT                                                             \
+  (Text) { NULL, 0, 0 }
+
+void text_printf(Text *text, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void text_free(Text *text);
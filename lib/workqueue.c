@@ -0,0 +1,120 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lib/logging.h"
+#include "lib/workqueue.h"
+
+typedef struct WorkItem {
+  void *item;
+  struct WorkItem *next;
+} WorkItem;
+
+struct WorkQueue {
+  WorkFunction work;
+  void *opaque;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t available;
+  WorkItem *head;
+  WorkItem *tail;
+  bool finishing;
+
+  int workers;
+  pthread_t threads[];
+};
+
+static void *worker_main(void *arg) {
+  WorkQueue *queue = arg;
+
+  pthread_mutex_lock(&queue->mutex);
+  for (;;) {
+    while (queue->head == NULL && !queue->finishing) {
+      pthread_cond_wait(&queue->available, &queue->mutex);
+    }
+    if (queue->head == NULL) {
+      break; // finishing, and nothing left to do.
+    }
+
+    WorkItem *next = queue->head;
+    queue->head = next->next;
+    if (queue->head == NULL) {
+      queue->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    queue->work(next->item, queue->opaque);
+    free(next);
+    pthread_mutex_lock(&queue->mutex);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return NULL;
+}
+
+WorkQueue *workqueue_new(int workers, WorkFunction work, void *opaque) {
+  WorkQueue *queue = calloc(1, sizeof(WorkQueue) + workers * sizeof(pthread_t));
+
+  if (queue == NULL) {
+    errOutput("unable to allocate work queue.");
+  }
+
+  queue->work = work;
+  queue->opaque = opaque;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->available, NULL);
+
+  for (; queue->workers < workers; queue->workers++) {
+    if (pthread_create(&queue->threads[queue->workers], NULL, worker_main,
+                       queue) != 0) {
+      errOutput("unable to start worker thread.");
+    }
+  }
+
+  return queue;
+}
+
+void workqueue_push(WorkQueue *queue, void *item) {
+  WorkItem *entry = malloc(sizeof(WorkItem));
+
+  if (entry == NULL) {
+    errOutput("unable to allocate work item.");
+  }
+  *entry = (WorkItem){.item = item, .next = NULL};
+
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->tail != NULL) {
+    queue->tail->next = entry;
+  } else {
+    queue->head = entry;
+  }
+  queue->tail = entry;
+  pthread_cond_signal(&queue->available);
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+void workqueue_finish(WorkQueue *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->finishing = true;
+  pthread_cond_broadcast(&queue->available);
+  pthread_mutex_unlock(&queue->mutex);
+
+  for (int i = 0; i < queue->workers; i++) {
+    pthread_join(queue->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&queue->available);
+  pthread_mutex_destroy(&queue->mutex);
+  free(queue);
+}
+
+int workqueue_default_workers(void) {
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return processors > 0 ? (int)processors : 1;
+}
@@ -0,0 +1,24 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- queue of work items processed by a pool of threads ----------------- */
+
+#pragma once
+
+typedef void (*WorkFunction)(void *item, void *opaque);
+
+typedef struct WorkQueue WorkQueue;
+
+// Starts worker threads calling work(item, opaque) for each queued item.
+WorkQueue *workqueue_new(int workers, WorkFunction work, void *opaque);
+
+// Queues an item, to be processed by the first worker that is available.
+void workqueue_push(WorkQueue *queue, void *item);
+
+// Waits for all the queued items to be processed, then stops the workers and
+// frees the queue.
+void workqueue_finish(WorkQueue *queue);
+
+// Number of processors available, as a default for the number of workers.
+int workqueue_default_workers(void);
@@ -0,0 +1,2300 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- sheet processing library ------------------------------------------- */
+
+#include "lib/porting.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+
+#include "cache.h"
+#include "geometry.h"
+#include "imageprocess/blit.h"
+#include "imageprocess/deskew.h"
+#include "imageprocess/filters.h"
+#include "imageprocess/image.h"
+#include "imageprocess/interpolate.h"
+#include "imageprocess/masks.h"
+#include "imageprocess/occupancy.h"
+#include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "imageprocess/transform.h"
+#include "lib/stats.h"
+#include "lib/text.h"
+#include "libunpaper.h"
+#include "parse.h"
+#include "unpaper.h"
+#include "version.h"
+
+typedef enum {
+  DETECTIONS_OFF,
+  DETECTIONS_RECORD,
+  DETECTIONS_REPLAY,
+} DetectionsMode;
+
+// Results of the detections on a sheet, recorded as they are made or
+// replayed instead of making them.
+typedef struct {
+  DetectionsMode mode;
+  SheetGeometry geometry;
+  size_t mask_scans_position;
+  size_t rotations_position;
+  size_t borders_position;
+} Detections;
+
+struct UnpaperContext {
+  Options options;
+  Logger logger;
+  Statistics stats;
+
+  // Scan points and masks, either explicit or detected on the sheets.
+  size_t points_count;
+  Point points[MAX_POINTS];
+  size_t masks_count;
+  Rectangle masks[MAX_MASKS];
+
+  // Outside areas to start the border scan from, set by the layout.
+  size_t outside_borderscan_masks_count;
+  Rectangle outside_borderscan_masks[MAX_PAGES];
+
+  RectangleSize input_size;
+  RectangleSize previous_size;
+
+  Image sheet;
+  Image page;
+  // Input pages of the sheet, between loading and placing them.
+  Image pages[MAX_PAGES];
+
+  // Recorded for, or replayed from, the result cache or a geometry file.
+  Detections detections;
+
+  // Detections of the previous sheet, which those of the next one start
+  // near with options.coherent_scans, and of the sheet being processed.
+  SheetGeometry hints;
+  SheetGeometry detected;
+
+  // Whether the last sheet was blank and no pages were written for it.
+  bool skipped;
+
+  // Read from options.geometry_file for the first sheet.
+  bool geometries_loaded;
+  size_t geometries_count;
+  SheetGeometry *geometries;
+};
+
+UnpaperContext *unpaper_context_new(const Options *options,
+                                    VerboseLevel verbose, LogFunction log,
+                                    void *opaque) {
+  UnpaperContext *ctx = calloc(1, sizeof(UnpaperContext));
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  ctx->options = *options;
+  memcpy(ctx->options.blackfilter_exclusions,
+         options->blackfilter_parameters.exclusions,
+         options->blackfilter_parameters.exclusions_count * sizeof(Rectangle));
+  ctx->options.blackfilter_parameters.exclusions =
+      ctx->options.blackfilter_exclusions;
+
+  ctx->logger = (Logger){.verbose = verbose, .log = log, .opaque = opaque};
+  ctx->stats = EMPTY_STATISTICS;
+
+  ctx->points_count = options->points_count;
+  memcpy(ctx->points, options->points, sizeof(ctx->points));
+  ctx->masks_count = options->masks_count;
+  memcpy(ctx->masks, options->masks, sizeof(ctx->masks));
+
+  ctx->input_size = (RectangleSize){-1, -1};
+  ctx->previous_size = (RectangleSize){-1, -1};
+  ctx->sheet = EMPTY_IMAGE;
+  ctx->page = EMPTY_IMAGE;
+  for (int j = 0; j < MAX_PAGES; j++) {
+    ctx->pages[j] = EMPTY_IMAGE;
+  }
+
+  return ctx;
+}
+
+static void free_pages(UnpaperContext *ctx) {
+  for (int j = 0; j < MAX_PAGES; j++) {
+    free_image(&ctx->pages[j]);
+  }
+}
+
+void unpaper_context_free(UnpaperContext *ctx) {
+  if (ctx == NULL) {
+    return;
+  }
+
+  free_image(&ctx->sheet);
+  free_image(&ctx->page);
+  free_pages(ctx);
+  free(ctx->geometries);
+  free(ctx);
+}
+
+const Options *unpaper_context_options(const UnpaperContext *ctx) {
+  return &ctx->options;
+}
+
+void unpaper_context_enable_stats(UnpaperContext *ctx, StatsFormat format,
+                                  FILE *output) {
+  stats_enable(&ctx->stats, format, output);
+}
+
+const Statistics *unpaper_context_stats(const UnpaperContext *ctx) {
+  return &ctx->stats;
+}
+
+bool unpaper_last_sheet_skipped(const UnpaperContext *ctx) {
+  return ctx->skipped;
+}
+
+const char *unpaper_last_error(const UnpaperContext *ctx) {
+  return ctx->logger.error;
+}
+
+/**
+ * Logs the parameter settings at the debug level, a line at a time so that
+ * they reach the log function of the context like any other message.
+ */
+static void print_parameters(const UnpaperContext *ctx,
+                             const char *const inputs[],
+                             const char *const outputs[]) {
+  const Options *options = &ctx->options;
+  char s1[1023]; // buffer for result of implode()
+  Text text = EMPTY_TEXT;
+
+  switch (options->layout) {
+  case LAYOUT_NONE:
+    text_printf(&text, "layout: none\n");
+    break;
+  case LAYOUT_SINGLE:
+    text_printf(&text, "layout: single\n");
+    break;
+  case LAYOUT_DOUBLE:
+    text_printf(&text, "layout: double\n");
+    break;
+  default:
+    assert(false); // unreachable
+  }
+
+  if (options->pre_rotate != 0) {
+    text_printf(&text, "pre-rotate: %d\n", options->pre_rotate);
+  }
+  text_printf(&text, "pre-mirror: %s\n",
+              direction_to_string(options->pre_mirror));
+  if (options->pre_shift.horizontal != 0 ||
+      options->pre_shift.vertical != 0) {
+    text_printf(&text, "pre-shift: [%" PRId32 ",%" PRId32 "]\n",
+                options->pre_shift.horizontal, options->pre_shift.vertical);
+  }
+  if (options->pre_wipes.count > 0) {
+    text_printf(&text, "pre-wipe: ");
+    for (size_t i = 0; i < options->pre_wipes.count; i++) {
+      print_rectangle(&text, options->pre_wipes.areas[i]);
+    }
+    text_printf(&text, "\n");
+  }
+  if (memcmp(&options->pre_border, &BORDER_NULL, sizeof(BORDER_NULL)) !=
+      0) {
+    text_printf(&text, "pre-border: ");
+    print_border(&text, options->pre_border);
+    text_printf(&text, "\n");
+  }
+  if (options->pre_masks_count > 0) {
+    text_printf(&text, "pre-masking: ");
+    for (int i = 0; i < options->pre_masks_count; i++) {
+      print_rectangle(&text, options->pre_masks[i]);
+    }
+    text_printf(&text, "\n");
+  }
+  if (options->stretch_size.width != -1 ||
+      options->stretch_size.height != -1) {
+    text_printf(&text, "stretch to: %" PRId32 "x%" PRId32 "\n",
+                options->stretch_size.width, options->stretch_size.height);
+  }
+  if (options->post_stretch_size.width != -1 ||
+      options->post_stretch_size.height != -1) {
+    text_printf(&text, "post-stretch to: %" PRId32 "x%" PRId32 "d\n",
+                options->post_stretch_size.width,
+                options->post_stretch_size.height);
+  }
+  if (options->pre_zoom_factor != 1.0) {
+    text_printf(&text, "zoom: %f\n", options->pre_zoom_factor);
+  }
+  if (options->post_zoom_factor != 1.0) {
+    text_printf(&text, "post-zoom: %f\n", options->post_zoom_factor);
+  }
+  if (options->no_blackfilter_multi_index.count != -1) {
+    text_printf(&text, "blackfilter-scan-direction: %s\n",
+                direction_to_string(
+                    options->blackfilter_parameters.scan_direction));
+    text_printf(&text, "blackfilter-scan-size: ");
+    print_rectangle_size(&text, options->blackfilter_parameters.scan_size);
+    text_printf(&text, "\nblackfilter-scan-depth: [%d,%d]\n",
+                options->blackfilter_parameters.scan_depth.horizontal,
+                options->blackfilter_parameters.scan_depth.vertical);
+    text_printf(&text, "blackfilter-scan-step: ");
+    print_delta(&text, options->blackfilter_parameters.scan_step);
+    text_printf(&text, "\nblackfilter-scan-threshold: %d\n",
+                options->blackfilter_parameters.abs_threshold);
+    if (options->blackfilter_parameters.exclusions_count > 0) {
+      text_printf(&text, "blackfilter-scan-exclude: ");
+      for (size_t i = 0;
+           i < options->blackfilter_parameters.exclusions_count; i++) {
+        print_rectangle(&text, options->blackfilter_parameters.exclusions[i]);
+      }
+      text_printf(&text, "\n");
+    }
+    text_printf(&text, "blackfilter-intensity: %d\n",
+                options->blackfilter_parameters.intensity);
+    if (options->no_blackfilter_multi_index.count > 0) {
+      text_printf(&text, "blackfilter DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_blackfilter_multi_index);
+    }
+  } else {
+    text_printf(&text, "blackfilter DISABLED for all sheets.\n");
+  }
+  if (options->no_noisefilter_multi_index.count != -1) {
+    text_printf(&text, "noisefilter-intensity: %" PRIu64 "\n",
+                options->noisefilter_intensity);
+    if (options->no_noisefilter_multi_index.count > 0) {
+      text_printf(&text, "noisefilter DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_noisefilter_multi_index);
+    }
+  } else {
+    text_printf(&text, "noisefilter DISABLED for all sheets.\n");
+  }
+  if (options->no_blurfilter_multi_index.count != -1) {
+    text_printf(&text, "blurfilter-size: ");
+    print_rectangle_size(&text, options->blurfilter_parameters.scan_size);
+    text_printf(&text, "\nblurfilter-step: ");
+    print_delta(&text, options->blurfilter_parameters.scan_step);
+    text_printf(&text, "\nblurfilter-intensity: %f\n",
+                options->blurfilter_parameters.intensity);
+    if (options->no_blurfilter_multi_index.count > 0) {
+      text_printf(&text, "blurfilter DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_blurfilter_multi_index);
+    }
+  } else {
+    text_printf(&text, "blurfilter DISABLED for all sheets.\n");
+  }
+  if (options->no_grayfilter_multi_index.count != -1) {
+    text_printf(&text, "grayfilter-size: ");
+    print_rectangle_size(&text, options->grayfilter_parameters.scan_size);
+    text_printf(&text, "\ngrayfilter-step: ");
+    print_delta(&text, options->grayfilter_parameters.scan_step);
+    text_printf(&text, "\ngrayfilter-threshold: %d\n",
+                options->grayfilter_parameters.abs_threshold);
+    if (options->no_grayfilter_multi_index.count > 0) {
+      text_printf(&text, "grayfilter DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_grayfilter_multi_index);
+    }
+  } else {
+    text_printf(&text, "grayfilter DISABLED for all sheets.\n");
+  }
+  if (options->no_mask_scan_multi_index.count != -1) {
+    text_printf(&text, "mask points: ");
+    for (int i = 0; i < ctx->points_count; i++) {
+      text_printf(&text, "(%d,%d) ", ctx->points[i].x, ctx->points[i].y);
+    }
+    text_printf(&text, "\n");
+    text_printf(&text, "mask-scan-direction: %s\n",
+                direction_to_string(
+                    options->mask_detection_parameters.scan_direction));
+    text_printf(&text, "mask-scan-size: ");
+    print_rectangle_size(&text, options->mask_detection_parameters.scan_size);
+    text_printf(&text, "\nmask-scan-depth: [%d,%d]\n",
+                options->mask_detection_parameters.scan_depth.horizontal,
+                options->mask_detection_parameters.scan_depth.vertical);
+    text_printf(&text, "mask-scan-step: ");
+    print_delta(&text, options->mask_detection_parameters.scan_step);
+    text_printf(&text, "\nmask-scan-threshold: [%f,%f]\n",
+                options->mask_detection_parameters.scan_threshold.horizontal,
+                options->mask_detection_parameters.scan_threshold.vertical);
+    text_printf(&text, "mask-scan-minimum: [%d,%d]\n",
+                options->mask_detection_parameters.minimum_width,
+                options->mask_detection_parameters.minimum_height);
+    text_printf(&text, "mask-scan-maximum: [%d,%d]\n",
+                options->mask_detection_parameters.maximum_width,
+                options->mask_detection_parameters.maximum_height);
+    text_printf(&text, "mask-color: ");
+    print_color(&text, options->mask_color);
+    text_printf(&text, "\n");
+    if (options->no_mask_scan_multi_index.count > 0) {
+      text_printf(&text, "mask-scan DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_mask_scan_multi_index);
+    }
+  } else {
+    text_printf(&text, "mask-scan DISABLED for all sheets.\n");
+  }
+  if (options->no_deskew_multi_index.count != -1) {
+    text_printf(&text, "deskew-scan-direction: ");
+    print_edges(&text, options->deskew_parameters.scan_edges);
+    text_printf(&text, "deskew-scan-size: %d\n",
+                options->deskew_parameters.deskewScanSize);
+    text_printf(&text, "deskew-scan-depth: %f\n",
+                options->deskew_parameters.deskewScanDepth);
+    text_printf(&text, "deskew-scan-range: %f\n",
+                options->deskew_parameters.deskewScanRangeRad);
+    text_printf(&text, "deskew-scan-step: %f\n",
+                options->deskew_parameters.deskewScanStepRad);
+    text_printf(&text, "deskew-scan-deviation: %f\n",
+                options->deskew_parameters.deskewScanDeviationRad);
+    if (options->no_deskew_multi_index.count > 0) {
+      text_printf(&text, "deskew-scan DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_deskew_multi_index);
+    }
+  } else {
+    text_printf(&text, "deskew-scan DISABLED for all sheets.\n");
+  }
+  if (options->no_wipe_multi_index.count != -1) {
+    if (options->wipes.count > 0) {
+      text_printf(&text, "wipe areas: ");
+      for (size_t i = 0; i < options->wipes.count; i++) {
+        print_rectangle(&text, options->wipes.areas[i]);
+      }
+      text_printf(&text, "\n");
+    }
+  } else {
+    text_printf(&text, "wipe DISABLED for all sheets.\n");
+  }
+  if (options->middle_wipe[0] > 0 || options->middle_wipe[1] > 0) {
+    text_printf(&text, "middle-wipe (l,r): %d,%d\n", options->middle_wipe[0],
+                options->middle_wipe[1]);
+  }
+  if (options->no_border_multi_index.count != -1) {
+    if (memcmp(&options->border, &BORDER_NULL, sizeof(BORDER_NULL)) != 0) {
+      text_printf(&text, "explicit border: ");
+      print_border(&text, options->border);
+      text_printf(&text, "\n");
+    }
+  } else {
+    text_printf(&text, "border DISABLED for all sheets.\n");
+  }
+  if (options->no_border_scan_multi_index.count != -1) {
+    text_printf(&text, "border-scan-direction: %s\n",
+                direction_to_string(
+                    options->border_scan_parameters.scan_direction));
+    text_printf(&text, "border-scan-size: ");
+    print_rectangle_size(&text, options->border_scan_parameters.scan_size);
+    text_printf(&text, "\nborder-scan-step: ");
+    print_delta(&text, options->border_scan_parameters.scan_step);
+    text_printf(&text, "\nborder-scan-threshold: [%d,%d]\n",
+                options->border_scan_parameters.scan_threshold.horizontal,
+                options->border_scan_parameters.scan_threshold.vertical);
+    if (options->no_border_scan_multi_index.count > 0) {
+      text_printf(&text, "border-scan DISABLED for sheets: ");
+      printMultiIndex(&text, options->no_border_scan_multi_index);
+    }
+    text_printf(&text, "border-align: ");
+    print_edges(&text, options->mask_alignment_parameters.alignment);
+    text_printf(&text, "border-margin: [%d,%d]\n",
+                options->mask_alignment_parameters.margin.horizontal,
+                options->mask_alignment_parameters.margin.vertical);
+  } else {
+    text_printf(&text, "border-scan DISABLED for all sheets.\n");
+  }
+  if (options->mask_detection_parameters.decimation > 1) {
+    text_printf(&text, "scan-decimation: %d\n",
+                options->mask_detection_parameters.decimation);
+  }
+  if (options->coherent_scans) {
+    text_printf(&text, "coherent-scans: yes\n");
+  }
+  if (options->post_wipes.count > 0) {
+    text_printf(&text, "post-wipe: ");
+    for (size_t i = 0; i < options->post_wipes.count; i++) {
+      print_rectangle(&text, options->post_wipes.areas[i]);
+    }
+    text_printf(&text, "\n");
+  }
+  if (memcmp(&options->post_border, &BORDER_NULL, sizeof(BORDER_NULL)) !=
+      0) {
+    text_printf(&text, "post-border: ");
+    print_border(&text, options->post_border);
+    text_printf(&text, "\n");
+  }
+  text_printf(&text, "post-mirror: %s\n",
+              direction_to_string(options->post_mirror));
+  if (options->post_shift.horizontal != 0 ||
+      options->post_shift.vertical != 0) {
+    text_printf(&text, "post-shift: [%" PRId32 ",%" PRId32 "]\n",
+                options->post_shift.horizontal, options->post_shift.vertical);
+  }
+  if (options->post_rotate != 0) {
+    text_printf(&text, "post-rotate: %d\n", options->post_rotate);
+  }
+  // if (options.ignoreMultiIndex.count > 0) {
+  //    text_printf(&text, "EXCLUDE sheets: ");
+  //    printMultiIndex(&text, options.ignoreMultiIndex);
+  //}
+  text_printf(&text, "white-threshold: %d\n", options->abs_white_threshold);
+  text_printf(&text, "black-threshold: %d\n", options->abs_black_threshold);
+  text_printf(&text, "sheet-background: ");
+  print_color(&text, options->sheet_background);
+  text_printf(&text, "\n");
+  text_printf(&text, "input-files per sheet: %d\n", options->input_count);
+  text_printf(&text, "output-files per sheet: %d\n", options->output_count);
+  if (options->sheet_size.width != -1 || options->sheet_size.height != -1) {
+    text_printf(&text,
+                "sheet size forced to: %" PRId32 " x %" PRId32 " pixels\n",
+                options->sheet_size.width, options->sheet_size.height);
+  }
+  text_printf(&text, "input-file-sequence:  %s\n",
+              implode(s1, (const char **)inputs, options->input_count));
+  text_printf(&text, "output-file-sequence: %s\n",
+              implode(s1, (const char **)outputs, options->output_count));
+  if (options->overwrite_output) {
+    text_printf(&text, "OVERWRITING EXISTING FILES\n");
+  }
+  text_printf(&text, "\n");
+
+  for (const char *line = text.data; *line != '\0';) {
+    const char *end = strchr(line, '\n');
+    int length = (int)(end - line) + 1;
+
+    verboseLog(VERBOSE_DEBUG, "%.*s", length, line);
+    line += length;
+  }
+  text_free(&text);
+}
+
+/**
+ * Loads the input images of a sheet into ctx->pages, learning the output
+ * pixel format and the sheet size from the first ones. Pages are left empty
+ * for the blank pages inserted on purpose.
+ */
+static void load_pages(UnpaperContext *ctx, int nr, const char *const inputs[],
+                       AVIOContext *const input_io[]) {
+  Options *options = &ctx->options;
+
+  for (int j = 0; j < options->input_count; j++) {
+    int debug_index = (nr - 1) * options->input_count + j + 1;
+    Image *page = &ctx->pages[j];
+
+    if (inputs[j] !=
+        NULL) { // may be null if --insert-blank or --replace-blank
+      verboseLog(VERBOSE_MORE, "loading file %s.\n", inputs[j]);
+
+      if (input_io != NULL && input_io[j] != NULL) {
+        int64_t start = avio_tell(input_io[j]);
+        loadImageFromIO(input_io[j], inputs[j], page,
+                        options->sheet_background,
+                        options->abs_black_threshold);
+        stats_count(COUNTER_BYTES_READ, avio_tell(input_io[j]) - start);
+      } else {
+        loadImage(inputs[j], page, options->sheet_background,
+                  options->abs_black_threshold);
+        stats_count_file_size(COUNTER_BYTES_READ, inputs[j]);
+      }
+      saveDebug("_loaded_%d.pnm", debug_index, *page);
+
+      if (options->output_pixel_format == AV_PIX_FMT_NONE &&
+          page->frame != NULL) {
+        options->output_pixel_format = page->frame->format;
+      }
+
+      // pre-rotate
+      if (options->pre_rotate != 0) {
+        verboseLog(VERBOSE_NORMAL, "pre-rotating %hd degrees.\n",
+                   options->pre_rotate);
+
+        flip_rotate_90(page, options->pre_rotate / 90);
+      }
+
+      // if sheet-size is not known yet (and not forced by --sheet-size),
+      // set now based on size of (first) input image
+      RectangleSize inputSheetSize = {
+          .width = page->frame->width * options->input_count,
+          .height = page->frame->height,
+      };
+      ctx->input_size = coerce_size(
+          ctx->input_size, coerce_size(options->sheet_size, inputSheetSize));
+    } else { // inputFiles[j] == NULL
+      *page = EMPTY_IMAGE;
+    }
+  }
+}
+
+/**
+ * Places the loaded pages side by side into ctx->sheet, allocating it with
+ * the sheet size, and frees them.
+ */
+static void place_pages(UnpaperContext *ctx, int nr) {
+  Options *options = &ctx->options;
+
+  for (int j = 0; j < options->input_count; j++) {
+    int debug_index = (nr - 1) * options->input_count + j + 1;
+    Image *page = &ctx->pages[j];
+
+    // place image into sheet buffer
+    // allocate sheet-buffer if not done yet, with an apron for deskewing and
+    // stretching to interpolate past its edges.
+    if ((ctx->sheet.frame == NULL) && (ctx->input_size.width != -1) &&
+        (ctx->input_size.height != -1)) {
+      ctx->sheet = create_padded_image(
+          ctx->input_size, AV_PIX_FMT_RGB24, true, options->sheet_background,
+          options->abs_black_threshold, INTERPOLATION_APRON);
+    }
+    if (page->frame != NULL) {
+      saveDebug("_page%d.pnm", debug_index, *page);
+      saveDebug("_before_center_page%d.pnm", debug_index, ctx->sheet);
+
+      center_image(*page, ctx->sheet,
+                   (Point){(ctx->input_size.width * j / options->input_count),
+                           0},
+                   (RectangleSize){(ctx->input_size.width /
+                                    options->input_count),
+                                   ctx->input_size.height});
+
+      saveDebug("_after_center_page%d.pnm", debug_index, ctx->sheet);
+      free_image(page);
+    }
+  }
+
+  // the only case that buffer is not yet initialized is if all blank pages
+  // have been inserted
+  if (ctx->sheet.frame == NULL) {
+    // last chance: try to get previous (unstretched/not zoomed) sheet size
+    ctx->input_size = ctx->previous_size;
+    verboseLog(VERBOSE_NORMAL,
+               "need to guess sheet size from previous sheet: %dx%d\n",
+               ctx->input_size.width, ctx->input_size.height);
+
+    if ((ctx->input_size.width == -1) || (ctx->input_size.height == -1)) {
+      errOutput("sheet size unknown, use at least one input file per "
+                "sheet, or force using --sheet-size.");
+    } else {
+      ctx->sheet = create_padded_image(
+          ctx->input_size, AV_PIX_FMT_RGB24, true, options->sheet_background,
+          options->abs_black_threshold, INTERPOLATION_APRON);
+    }
+  }
+}
+
+/**
+ * Loads the input images of a sheet into ctx->sheet, learning the output pixel
+ * format and the sheet size from the first ones.
+ */
+static void load_sheet(UnpaperContext *ctx, int nr, const char *const inputs[],
+                       AVIOContext *const input_io[]) {
+  load_pages(ctx, nr, inputs, input_io);
+  place_pages(ctx, nr);
+}
+
+/* --- scans coherent with the previous sheet ----------------------------- */
+
+// Returns whether the previous sheet holds the next of count results, to
+// start detecting it near. Only sheets of the same size are coherent.
+static bool hinted(const UnpaperContext *ctx, size_t position, size_t count) {
+  RectangleSize size = size_of_image(ctx->sheet);
+
+  return ctx->options.coherent_scans && position < count &&
+         ctx->hints.size.width == size.width &&
+         ctx->hints.size.height == size.height;
+}
+
+// Returns the geometry to keep the next result in for the next sheet, or
+// NULL.
+static SheetGeometry *keeping(UnpaperContext *ctx) {
+  if (!ctx->options.coherent_scans) {
+    return NULL;
+  }
+  ctx->detected.size = size_of_image(ctx->sheet);
+  return &ctx->detected;
+}
+
+// The detections of the sheet are the hints of the next one. They are
+// copied as bytes, padding included, as the result cache hashes them.
+static void keep_detections(UnpaperContext *ctx) {
+  if (ctx->options.coherent_scans) {
+    memcpy(&ctx->hints, &ctx->detected, sizeof(ctx->hints));
+  }
+}
+
+/* --- detections recorded and replayed ----------------------------------- */
+
+static void record_detections(UnpaperContext *ctx) {
+  ctx->detections = (Detections){.mode = DETECTIONS_RECORD};
+}
+
+static void replay_detections(UnpaperContext *ctx,
+                              const SheetGeometry *geometry) {
+  ctx->detections = (Detections){
+      .mode = DETECTIONS_REPLAY,
+      .geometry = *geometry,
+  };
+}
+
+static void end_detections(UnpaperContext *ctx) {
+  ctx->detections.mode = DETECTIONS_OFF;
+}
+
+// Returns whether the next of count results can be replayed: otherwise it is
+// detected, and so are the following ones.
+static bool replaying(UnpaperContext *ctx, size_t position, size_t count) {
+  if (ctx->detections.mode != DETECTIONS_REPLAY) {
+    return false;
+  }
+  if (position >= count) {
+    // Not recorded with the same options: detect this and the next ones.
+    verboseLog(VERBOSE_NORMAL, "recorded detections incomplete.\n");
+    ctx->detections.mode = DETECTIONS_OFF;
+    return false;
+  }
+  return true;
+}
+
+// Returns the geometry to record the next result in, or NULL.
+static SheetGeometry *recording(UnpaperContext *ctx) {
+  if (ctx->detections.mode != DETECTIONS_RECORD) {
+    return NULL;
+  }
+  ctx->detections.geometry.size = size_of_image(ctx->sheet);
+  return &ctx->detections.geometry;
+}
+
+// Scales a coordinate recorded on a sheet of length from to the sheet being
+// processed, of length to. Negative coordinates mark missing masks.
+static int32_t replay_coordinate(int32_t value, int32_t from, int32_t to) {
+  if (from <= 0 || from == to || value < 0) {
+    return value;
+  }
+  return (int32_t)(((int64_t)value * to + from / 2) / from);
+}
+
+static Rectangle replay_rectangle(const UnpaperContext *ctx,
+                                  Rectangle rectangle) {
+  RectangleSize from = ctx->detections.geometry.size;
+  RectangleSize to = size_of_image(ctx->sheet);
+
+  // The second vertex is the last pixel inside, scaled as the end of it.
+  Point *first = &rectangle.vertex[0], *last = &rectangle.vertex[1];
+  first->x = replay_coordinate(first->x, from.width, to.width);
+  first->y = replay_coordinate(first->y, from.height, to.height);
+  if (last->x >= 0 && last->y >= 0) {
+    last->x = replay_coordinate(last->x + 1, from.width, to.width) - 1;
+    last->y = replay_coordinate(last->y + 1, from.height, to.height) - 1;
+  }
+  return rectangle;
+}
+
+// Stores the masks of the last mask scan in geometry, if it is not NULL.
+static void store_mask_scan(const UnpaperContext *ctx,
+                            SheetGeometry *geometry) {
+  const MaskDetectionParameters *params =
+      &ctx->options.mask_detection_parameters;
+
+  if (geometry == NULL || geometry->mask_scans_count >= MAX_MASK_SCANS) {
+    return;
+  }
+  MaskScan *scan = &geometry->mask_scans[geometry->mask_scans_count++];
+
+  // Without a scan direction, no mask is stored.
+  scan->count = 0;
+  if (params->scan_direction.horizontal || params->scan_direction.vertical) {
+    scan->count = ctx->points_count;
+    memcpy(scan->masks, ctx->masks, scan->count * sizeof(Rectangle));
+  }
+}
+
+static size_t replay_detect_masks(UnpaperContext *ctx) {
+  Detections *detections = &ctx->detections;
+  MaskDetectionParameters *params = &ctx->options.mask_detection_parameters;
+  size_t masks_count = 0;
+
+  if (replaying(ctx, detections->mask_scans_position,
+                detections->geometry.mask_scans_count)) {
+    const MaskScan *scan =
+        &detections->geometry.mask_scans[detections->mask_scans_position++];
+
+    for (size_t i = 0; i < scan->count && i < ctx->points_count; i++) {
+      ctx->masks[i] = replay_rectangle(ctx, scan->masks[i]);
+      if (memcmp(&ctx->masks[i], &INVALID_MASK, sizeof(INVALID_MASK)) != 0) {
+        masks_count++;
+      }
+    }
+    store_mask_scan(ctx, keeping(ctx));
+    return masks_count;
+  }
+
+  const Rectangle *hints = NULL;
+  size_t position = ctx->detected.mask_scans_count;
+  if (hinted(ctx, position, ctx->hints.mask_scans_count) &&
+      ctx->hints.mask_scans[position].count == ctx->points_count) {
+    hints = ctx->hints.mask_scans[position].masks;
+  }
+
+  masks_count = detect_masks(ctx->sheet, *params, ctx->points,
+                             ctx->points_count, hints, ctx->masks);
+
+  store_mask_scan(ctx, recording(ctx));
+  store_mask_scan(ctx, keeping(ctx));
+  return masks_count;
+}
+
+// Stores a rotation in geometry, if it is not NULL.
+static void store_rotation(SheetGeometry *geometry, float rotation) {
+  if (geometry != NULL && geometry->rotations_count < MAX_MASKS) {
+    geometry->rotations[geometry->rotations_count++] = rotation;
+  }
+}
+
+static float replay_detect_rotation(UnpaperContext *ctx, Rectangle mask) {
+  Detections *detections = &ctx->detections;
+  float rotation;
+
+  if (replaying(ctx, detections->rotations_position,
+                detections->geometry.rotations_count)) {
+    rotation = detections->geometry.rotations[detections->rotations_position++];
+    store_rotation(keeping(ctx), rotation);
+    return rotation;
+  }
+
+  const float *hint = NULL;
+  size_t position = ctx->detected.rotations_count;
+  if (hinted(ctx, position, ctx->hints.rotations_count)) {
+    hint = &ctx->hints.rotations[position];
+  }
+
+  rotation =
+      detect_rotation(ctx->sheet, mask, ctx->options.deskew_parameters, hint);
+
+  store_rotation(recording(ctx), rotation);
+  store_rotation(keeping(ctx), rotation);
+  return rotation;
+}
+
+// Stores a border in geometry, if it is not NULL.
+static void store_border(SheetGeometry *geometry, Border border) {
+  if (geometry != NULL && geometry->borders_count < MAX_PAGES) {
+    geometry->borders[geometry->borders_count++] = border;
+  }
+}
+
+static Border replay_detect_border(UnpaperContext *ctx, Rectangle outside) {
+  Detections *detections = &ctx->detections;
+  Border border;
+
+  if (replaying(ctx, detections->borders_position,
+                detections->geometry.borders_count)) {
+    Border recorded =
+        detections->geometry.borders[detections->borders_position++];
+    RectangleSize from = detections->geometry.size;
+    RectangleSize to = size_of_image(ctx->sheet);
+
+    border = (Border){
+        .left = replay_coordinate(recorded.left, from.width, to.width),
+        .top = replay_coordinate(recorded.top, from.height, to.height),
+        .right = replay_coordinate(recorded.right, from.width, to.width),
+        .bottom = replay_coordinate(recorded.bottom, from.height, to.height),
+    };
+    store_border(keeping(ctx), border);
+    return border;
+  }
+
+  const Border *hint = NULL;
+  size_t position = ctx->detected.borders_count;
+  if (hinted(ctx, position, ctx->hints.borders_count)) {
+    hint = &ctx->hints.borders[position];
+  }
+
+  border = detect_border(ctx->sheet, ctx->options.border_scan_parameters,
+                         outside, hint);
+
+  store_border(recording(ctx), border);
+  store_border(keeping(ctx), border);
+  return border;
+}
+
+/**
+ * Writes the detections of a sheet next to its first output, in a file named
+ * after it with ".json" appended, or to its stream.
+ */
+static void write_geometry(UnpaperContext *ctx, int nr,
+                           const char *const outputs[],
+                           AVIOContext *const output_io[]) {
+  SheetGeometry *geometry = &ctx->detections.geometry;
+  char filename[PATH_MAX];
+  Text text = EMPTY_TEXT;
+  FILE *f;
+
+  geometry->sheet = nr;
+  geometry->size = size_of_image(ctx->sheet);
+  geometry_write(&text, geometry);
+
+  if (output_io != NULL && output_io[0] != NULL) {
+    avio_write(output_io[0], (const unsigned char *)text.data, text.length);
+    avio_flush(output_io[0]);
+    text_free(&text);
+    return;
+  }
+
+  snprintf(filename, sizeof(filename), "%s.json", outputs[0]);
+  if ((f = fopen(filename, "w")) == NULL) {
+    text_free(&text);
+    errOutput("unable to open geometry file %s.", filename);
+  }
+  size_t written = fwrite(text.data, 1, text.length, f);
+  bool complete = written == text.length;
+  text_free(&text);
+  if (fclose(f) != 0 || !complete) {
+    errOutput("unable to write geometry file %s.", filename);
+  }
+  verboseLog(VERBOSE_NORMAL, "geometry written to %s.\n", filename);
+}
+
+// Writes ctx->page as output page j and frees it.
+static void save_page(UnpaperContext *ctx, int j, const char *const outputs[],
+                      AVIOContext *const output_io[]) {
+  Options *options = &ctx->options;
+
+  verboseLog(VERBOSE_MORE, "saving file %s.\n", outputs[j]);
+
+  if (output_io != NULL && output_io[j] != NULL) {
+    int64_t start = avio_tell(output_io[j]);
+    saveImageToIO(output_io[j], outputs[j], ctx->page,
+                  options->output_pixel_format);
+    stats_count(COUNTER_BYTES_WRITTEN, avio_tell(output_io[j]) - start);
+  } else {
+    saveImage(outputs[j], ctx->page, options->output_pixel_format);
+    stats_count_file_size(COUNTER_BYTES_WRITTEN, outputs[j]);
+  }
+
+  free_image(&ctx->page);
+}
+
+/**
+ * Splits the sheet into its pages and writes them to outputs, or to the I/O
+ * contexts of output_io that are not NULL.
+ */
+static void save_pages(UnpaperContext *ctx, int nr,
+                       const char *const outputs[],
+                       AVIOContext *const output_io[]) {
+  Options *options = &ctx->options;
+  StatsTimer timer;
+
+  verboseLog(VERBOSE_NORMAL, "writing output.\n");
+  // write files
+  saveDebug("_before-save%d.pnm", nr, ctx->sheet);
+
+  if (options->output_pixel_format == AV_PIX_FMT_NONE) {
+    options->output_pixel_format = ctx->sheet.frame->format;
+  }
+
+  timer = stats_start();
+  for (int j = 0; j < options->output_count; j++) {
+    // get pagebuffer
+    ctx->page = create_compatible_image(
+        ctx->sheet,
+        (RectangleSize){ctx->sheet.frame->width / options->output_count,
+                        ctx->sheet.frame->height},
+        false);
+    copy_rectangle(
+        ctx->sheet, ctx->page,
+        (Rectangle){{{ctx->page.frame->width * j, 0},
+                     {ctx->page.frame->width * j + ctx->page.frame->width,
+                      ctx->page.frame->height}}},
+        POINT_ORIGIN);
+
+    save_page(ctx, j, outputs, output_io);
+  }
+  stats_stop(timer, STAGE_SAVE, count_pixels(full_image(ctx->sheet)));
+
+  free_image(&ctx->sheet);
+}
+
+/**
+ * Tells whether sheet nr is only laid out again: --no-processing applies to
+ * it, and no option changes its geometry or pixels.
+ */
+static bool layout_only_sheet(const UnpaperContext *ctx, int nr) {
+  const Options *options = &ctx->options;
+  const RectangleSize unset = {-1, -1};
+
+  return isInMultiIndex(nr, options->ignore_multi_index) &&
+         !options->detect_only &&
+         options->blank_sheets == BLANK_SHEETS_PROCESS &&
+         ctx->masks_count == 0 && options->pre_masks_count == 0 &&
+         options->pre_rotate == 0 && options->post_rotate == 0 &&
+         !options->pre_mirror.horizontal && !options->pre_mirror.vertical &&
+         !options->post_mirror.horizontal && !options->post_mirror.vertical &&
+         options->pre_shift.horizontal == 0 &&
+         options->pre_shift.vertical == 0 &&
+         options->post_shift.horizontal == 0 &&
+         options->post_shift.vertical == 0 &&
+         compare_sizes(options->sheet_size, unset) == 0 &&
+         compare_sizes(options->stretch_size, unset) == 0 &&
+         compare_sizes(options->page_size, unset) == 0 &&
+         compare_sizes(options->post_stretch_size, unset) == 0 &&
+         compare_sizes(options->post_page_size, unset) == 0 &&
+         options->pre_zoom_factor == 1.0 && options->post_zoom_factor == 1.0;
+}
+
+/**
+ * Tells whether the loaded pages fill the sheet exactly when laid side by
+ * side, so that placing them needs no centering nor padding.
+ */
+static bool pages_fill_sheet(const UnpaperContext *ctx) {
+  const Image *pages = ctx->pages;
+
+  for (int j = 0; j < ctx->options.input_count; j++) {
+    if (pages[j].frame == NULL ||
+        pages[j].frame->format != pages[0].frame->format ||
+        compare_sizes(size_of_image(pages[j]), size_of_image(pages[0])) != 0) {
+      return false;
+    }
+  }
+
+  RectangleSize sheet_size = {
+      .width = pages[0].frame->width * ctx->options.input_count,
+      .height = pages[0].frame->height,
+  };
+  return compare_sizes(ctx->input_size, sheet_size) == 0;
+}
+
+/**
+ * Writes the output pages of a layout-only sheet by copying the rows of the
+ * input pages straight into them, in their own pixel format, without going
+ * through the sheet buffer.
+ */
+static void copy_pages(UnpaperContext *ctx, const char *const outputs[],
+                       AVIOContext *const output_io[]) {
+  Options *options = &ctx->options;
+  const Image *pages = ctx->pages;
+  int32_t page_width = pages[0].frame->width;
+  int32_t output_width = ctx->input_size.width / options->output_count;
+  StatsTimer timer;
+
+  verboseLog(VERBOSE_NORMAL, "writing output without processing.\n");
+
+  timer = stats_start();
+  for (int j = 0; j < options->output_count; j++) {
+    ctx->page = create_compatible_image(
+        pages[0], (RectangleSize){output_width, ctx->input_size.height},
+        false);
+
+    // The padding bits of bilevel rows are written out as well.
+    if (ctx->page.frame->format == AV_PIX_FMT_MONOWHITE ||
+        ctx->page.frame->format == AV_PIX_FMT_MONOBLACK) {
+      memset(ctx->page.frame->data[0], 0,
+             (size_t)ctx->page.frame->linesize[0] * ctx->page.frame->height);
+    }
+
+    // Output columns from start to end, each from the input page it is on.
+    int32_t start = output_width * j;
+    int32_t end = start + output_width;
+    for (int32_t x = start; x < end;) {
+      int32_t page_x = x % page_width;
+      int32_t width = min(page_width - page_x, end - x);
+
+      copy_columns(pages[x / page_width], ctx->page, page_x, x - start, width);
+      x += width;
+    }
+
+    save_page(ctx, j, outputs, output_io);
+  }
+  stats_stop(timer, STAGE_SAVE,
+             count_pixels(rectangle_from_size(POINT_ORIGIN, ctx->input_size)));
+}
+
+// Returns the pixels of the valid masks, which the steps working on masks
+// process rather than the whole sheet.
+static uint64_t count_masks_pixels(const Rectangle masks[], size_t count) {
+  uint64_t pixels = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (memcmp(&masks[i], &INVALID_MASK, sizeof(INVALID_MASK)) != 0) {
+      pixels += count_pixels(masks[i]);
+    }
+  }
+
+  return pixels;
+}
+
+// Returns the pixels written by resizing the sheet from size, none if it was
+// left as it was.
+static uint64_t count_resized_pixels(RectangleSize size, Image sheet) {
+  if (compare_sizes(size, size_of_image(sheet)) == 0) {
+    return 0;
+  }
+
+  return count_pixels(full_image(sheet));
+}
+
+// Returns whether a sheet has an input file, rather than only blank pages
+// inserted on purpose.
+static bool has_input_file(const UnpaperContext *ctx,
+                           const char *const inputs[]) {
+  for (int j = 0; j < ctx->options.input_count; j++) {
+    if (inputs[j] != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Writes white pages of the size that processing a blank sheet gives, or
+ * none at all, without processing it.
+ */
+static void process_blank_sheet(UnpaperContext *ctx, int nr,
+                                const char *const inputs[],
+                                const char *const outputs[],
+                                AVIOContext *const output_io[]) {
+  Options *options = &ctx->options;
+  int output_count = options->output_count;
+
+  stats_count(COUNTER_BLANK_SHEETS, 1);
+
+  // the sizes set by stretch, size, post-rotate, post-stretch and post-size.
+  RectangleSize size =
+      coerce_size(options->stretch_size, size_of_image(ctx->sheet));
+  size.width *= options->pre_zoom_factor;
+  size.height *= options->pre_zoom_factor;
+  if (options->page_size.width != -1 || options->page_size.height != -1) {
+    size = coerce_size(options->page_size, size);
+  }
+  if (options->post_rotate != 0) {
+    size = (RectangleSize){size.height, size.width};
+  }
+  size = coerce_size(options->post_stretch_size, size);
+  size.width *= options->post_zoom_factor;
+  size.height *= options->post_zoom_factor;
+  if (options->post_page_size.width != -1 ||
+      options->post_page_size.height != -1) {
+    size = coerce_size(options->post_page_size, size);
+  }
+  ctx->input_size = size;
+
+  if (options->detect_only) {
+    verboseLog(VERBOSE_NORMAL, "sheet %d is blank, nothing detected.\n", nr);
+    write_geometry(ctx, nr, outputs, output_io);
+  } else if (options->blank_sheets == BLANK_SHEETS_WHITE) {
+    verboseLog(VERBOSE_NORMAL, "sheet %d is blank, writing white pages.\n",
+               nr);
+    enum AVPixelFormat format = ctx->sheet.frame->format;
+    free_image(&ctx->sheet);
+    ctx->sheet = create_image(size, format, true, PIXEL_WHITE,
+                              options->abs_black_threshold);
+    if (options->write_output) {
+      save_pages(ctx, nr, outputs, output_io);
+    }
+  } else {
+    verboseLog(VERBOSE_NORMAL, "sheet %d is blank, no pages written.\n", nr);
+    output_count = 0;
+    ctx->skipped = true;
+  }
+
+  free_image(&ctx->sheet);
+  stats_end_sheet(inputs, options->input_count, outputs, output_count);
+}
+
+/**
+ * Processes one sheet. inputs and outputs name the files, unless input_io and
+ * output_io are not NULL and hold an I/O context to use instead.
+ */
+static void process_sheet(UnpaperContext *ctx, int nr,
+                          const char *const inputs[],
+                          const char *const outputs[],
+                          AVIOContext *const input_io[],
+                          AVIOContext *const output_io[]) {
+  Options *options = &ctx->options;
+  char s1[1023]; // buffers for result of implode()
+  char s2[1023];
+  StatsTimer timer;
+
+  stats_begin_sheet(nr);
+  memset(&ctx->detected, 0, sizeof(ctx->detected));
+
+  verboseLog(
+      VERBOSE_NORMAL,
+      "\n-------------------------------------------------------------"
+      "------------------\n");
+
+  if (options->multiple_sheets) {
+    verboseLog(
+        VERBOSE_NORMAL, "Processing sheet #%d: %s -> %s\n", nr,
+        implode(s1, inputs, options->input_count),
+        implode(s2, outputs, options->output_count));
+  } else {
+    verboseLog(
+        VERBOSE_NORMAL, "Processing sheet: %s -> %s\n",
+        implode(s1, inputs, options->input_count),
+        implode(s2, outputs, options->output_count));
+  }
+
+  // load input image(s)
+  timer = stats_start();
+  load_pages(ctx, nr, inputs, input_io);
+  bool layout_only = layout_only_sheet(ctx, nr) && pages_fill_sheet(ctx);
+  if (!layout_only) {
+    place_pages(ctx, nr);
+  }
+  stats_stop(timer, STAGE_LOAD,
+             count_pixels(rectangle_from_size(POINT_ORIGIN, ctx->input_size)));
+
+  ctx->previous_size = ctx->input_size;
+
+  // sheets that are only laid out again are copied row by row, in the pixel
+  // format of their pages.
+  if (layout_only) {
+    if (options->write_output) {
+      copy_pages(ctx, outputs, output_io);
+    }
+    free_pages(ctx);
+    stats_end_sheet(inputs, options->input_count, outputs,
+                    options->output_count);
+    return;
+  }
+
+  // filters and detection read the grayscale, lightness and darkness of
+  // the same pixels many times over, so cache them as derived planes.
+  image_enable_planes(&ctx->sheet);
+  // most of a scanned page is white paper, which the filters can step over.
+  image_enable_occupancy(&ctx->sheet, options->abs_white_threshold);
+
+  // blank sheets skip all the processing steps.
+  if (options->blank_sheets != BLANK_SHEETS_PROCESS &&
+      has_input_file(ctx, inputs)) {
+    timer = stats_start();
+    bool blank = detect_blank(ctx->sheet, options->blank_parameters);
+    stats_stop(timer, STAGE_BLANK_DETECTION, count_blank_samples(ctx->sheet));
+    if (blank) {
+      process_blank_sheet(ctx, nr, inputs, outputs, output_io);
+      return;
+    }
+  }
+
+  // pre-mirroring and pre-shifting are recorded, then applied in one pass.
+  timer = stats_start();
+  ImageTransform transform = transform_identity(size_of_image(ctx->sheet));
+  if (options->pre_mirror.horizontal || options->pre_mirror.vertical) {
+    verboseLog(VERBOSE_NORMAL, "pre-mirroring %s\n",
+               direction_to_string(options->pre_mirror));
+
+    transform_mirror(&transform, options->pre_mirror);
+  }
+
+  // pre-shifting
+  if (options->pre_shift.horizontal != 0 ||
+      options->pre_shift.vertical != 0) {
+    verboseLog(VERBOSE_NORMAL, "pre-shifting [%" PRId32 ",%" PRId32 "]\n",
+               options->pre_shift.horizontal, options->pre_shift.vertical);
+
+    transform_shift(&transform, options->pre_shift);
+  }
+  bool transformed =
+      !transform_is_identity(transform, size_of_image(ctx->sheet));
+  apply_transform(&ctx->sheet, transform);
+  stats_stop(timer, STAGE_TRANSFORM,
+             transformed ? count_pixels(full_image(ctx->sheet)) : 0);
+
+  // pre-masking
+  if (options->pre_masks_count > 0) {
+    verboseLog(VERBOSE_NORMAL, "pre-masking\n ");
+
+    timer = stats_start();
+    uint64_t cleared = apply_masks(ctx->sheet, options->pre_masks,
+                                   options->pre_masks_count,
+                                   options->mask_color);
+    stats_stop(timer, STAGE_MASKING, cleared);
+  }
+
+  // --------------------------------------------------------------
+  // --- verbose parameter output,                              ---
+  // --------------------------------------------------------------
+
+  // parameters and size are known now
+
+  if (verbose_level() >= VERBOSE_DEBUG) {
+    print_parameters(ctx, inputs, outputs);
+  }
+  verboseLog(
+      VERBOSE_NORMAL, "input-file%s for sheet %d: %s\n",
+      pluralS(options->input_count), nr,
+      implode(s1, inputs, options->input_count));
+  verboseLog(
+      VERBOSE_NORMAL, "output-file%s for sheet %d: %s\n",
+      pluralS(options->output_count), nr,
+      implode(s1, outputs, options->output_count));
+  verboseLog(VERBOSE_NORMAL, "sheet size: %dx%d\n", ctx->sheet.frame->width,
+             ctx->sheet.frame->height);
+  verboseLog(VERBOSE_NORMAL, "...\n");
+
+  // -------------------------------------------------------
+  // --- process image data                              ---
+  // -------------------------------------------------------
+
+  // stretch
+  timer = stats_start();
+  uint64_t resized = 0;
+  RectangleSize size = size_of_image(ctx->sheet);
+  ctx->input_size =
+      coerce_size(options->stretch_size, size_of_image(ctx->sheet));
+
+  ctx->input_size.width *= options->pre_zoom_factor;
+  ctx->input_size.height *= options->pre_zoom_factor;
+
+  saveDebug("_before-stretch%d.pnm", nr, ctx->sheet);
+  stretch_and_replace(&ctx->sheet, ctx->input_size, options->interpolate_type);
+  saveDebug("_after-stretch%d.pnm", nr, ctx->sheet);
+  resized += count_resized_pixels(size, ctx->sheet);
+  size = size_of_image(ctx->sheet);
+
+  // size
+  if (options->page_size.width != -1 || options->page_size.height != -1) {
+    ctx->input_size =
+        coerce_size(options->page_size, size_of_image(ctx->sheet));
+    saveDebug("_before-resize%d.pnm", nr, ctx->sheet);
+    resize_and_replace(&ctx->sheet, ctx->input_size, options->interpolate_type);
+    saveDebug("_after-resize%d.pnm", nr, ctx->sheet);
+    resized += count_resized_pixels(size, ctx->sheet);
+  }
+  stats_stop(timer, STAGE_RESIZE, resized);
+
+  // handle sheet layout
+
+  // LAYOUT_SINGLE
+  if (options->layout == LAYOUT_SINGLE) {
+    // set middle of sheet as single starting point for mask detection
+    if (ctx->points_count == 0) { // no manual settings, use auto-values
+      ctx->points[ctx->points_count++] =
+          (Point){ctx->sheet.frame->width / 2, ctx->sheet.frame->height / 2};
+    }
+    if (options->mask_detection_parameters.maximum_width == -1) {
+      options->mask_detection_parameters.maximum_width =
+          ctx->sheet.frame->width;
+    }
+    if (options->mask_detection_parameters.maximum_height == -1) {
+      options->mask_detection_parameters.maximum_height =
+          ctx->sheet.frame->height;
+    }
+    // avoid inner half of the sheet to be blackfilter-detectable
+    if (options->blackfilter_parameters.exclusions_count == 0) {
+      // no manual settings, use auto-values
+      RectangleSize sheetSize = size_of_image(ctx->sheet);
+      options->blackfilter_parameters
+          .exclusions[options->blackfilter_parameters.exclusions_count++] =
+          rectangle_from_size(
+              (Point){sheetSize.width / 4, sheetSize.height / 4},
+              (RectangleSize){.width = sheetSize.width / 2,
+                              .height = sheetSize.height / 2});
+    }
+    // set single outside border to start scanning for final border-scan
+    if (ctx->outside_borderscan_masks_count ==
+        0) { // no manual settings, use auto-values
+      ctx->outside_borderscan_masks[ctx->outside_borderscan_masks_count++] =
+          full_image(ctx->sheet);
+    }
+
+    // LAYOUT_DOUBLE
+  } else if (options->layout == LAYOUT_DOUBLE) {
+    // set two middle of left/right side of sheet as starting points for
+    // mask detection
+    if (ctx->points_count == 0) { // no manual settings, use auto-values
+      ctx->points[ctx->points_count++] =
+          (Point){ctx->sheet.frame->width / 4, ctx->sheet.frame->height / 2};
+      ctx->points[ctx->points_count++] =
+          (Point){ctx->sheet.frame->width - ctx->sheet.frame->width / 4,
+                  ctx->sheet.frame->height / 2};
+    }
+    if (options->mask_detection_parameters.maximum_width == -1) {
+      options->mask_detection_parameters.maximum_width =
+          ctx->sheet.frame->width / 2;
+    }
+    if (options->mask_detection_parameters.maximum_height == -1) {
+      options->mask_detection_parameters.maximum_height =
+          ctx->sheet.frame->height;
+    }
+    if (options->middle_wipe[0] > 0 ||
+        options->middle_wipe[1] > 0) { // left, right
+      options->wipes.areas[options->wipes.count++] = (Rectangle){{
+          {ctx->sheet.frame->width / 2 - options->middle_wipe[0], 0},
+          {ctx->sheet.frame->width / 2 + options->middle_wipe[1],
+           ctx->sheet.frame->height - 1},
+      }};
+    }
+    // avoid inner half of each page to be blackfilter-detectable
+    if (options->blackfilter_parameters.exclusions_count == 0) {
+      // no manual settings, use auto-values
+      RectangleSize sheetSize = size_of_image(ctx->sheet);
+      RectangleSize filterSize = {
+          .width = sheetSize.width / 4,
+          .height = sheetSize.height / 2,
+      };
+      Point firstFilterOrigin = {sheetSize.width / 8, sheetSize.height / 4};
+      Point secondFilterOrigin =
+          shift_point(firstFilterOrigin, (Delta){ctx->sheet.frame->width / 2});
+
+      options->blackfilter_parameters
+          .exclusions[options->blackfilter_parameters.exclusions_count++] =
+          rectangle_from_size(firstFilterOrigin, filterSize);
+      options->blackfilter_parameters
+          .exclusions[options->blackfilter_parameters.exclusions_count++] =
+          rectangle_from_size(secondFilterOrigin, filterSize);
+    }
+    // set two outside borders to start scanning for final border-scan
+    if (ctx->outside_borderscan_masks_count ==
+        0) { // no manual settings, use auto-values
+      ctx->outside_borderscan_masks[ctx->outside_borderscan_masks_count++] =
+          (Rectangle){{POINT_ORIGIN,
+                       {ctx->sheet.frame->width / 2,
+                        ctx->sheet.frame->height - 1}}};
+      ctx->outside_borderscan_masks[ctx->outside_borderscan_masks_count++] =
+          (Rectangle){{{ctx->sheet.frame->width / 2, 0},
+                       {ctx->sheet.frame->width - 1,
+                        ctx->sheet.frame->height - 1}}};
+    }
+  }
+  // if maskScanMaximum still unset (no --layout specified), set to full
+  // sheet size now
+  if (options->mask_detection_parameters.maximum_width == -1) {
+    options->mask_detection_parameters.maximum_width = ctx->sheet.frame->width;
+  }
+  if (options->mask_detection_parameters.maximum_height == -1) {
+    options->mask_detection_parameters.maximum_height =
+        ctx->sheet.frame->height;
+  }
+
+  // pre-wipe and pre-border, applied in a single pass
+  timer = stats_start();
+  MaskingPlan pre_masking = masking_plan_init(ctx->sheet);
+  if (!isExcluded(nr, options->no_wipe_multi_index,
+                  options->ignore_multi_index)) {
+    masking_plan_add_wipes(&pre_masking, options->pre_wipes);
+  }
+  if (!isExcluded(nr, options->no_border_multi_index,
+                  options->ignore_multi_index)) {
+    masking_plan_add_border(&pre_masking, ctx->sheet, options->pre_border);
+  }
+  stats_stop(timer, STAGE_MASKING,
+             apply_masking_plan(ctx->sheet, &pre_masking, options->mask_color));
+
+  // black area filter
+  if (!isExcluded(nr, options->no_blackfilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-blackfilter%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+    blackfilter(ctx->sheet, options->blackfilter_parameters);
+    stats_stop(timer, STAGE_BLACKFILTER, count_pixels(full_image(ctx->sheet)));
+    saveDebug("_after-blackfilter%d.pnm", nr, ctx->sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ blackfilter DISABLED for sheet %d\n", nr);
+  }
+
+  // noise filter
+  if (!isExcluded(nr, options->no_noisefilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-noisefilter%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+    noisefilter(ctx->sheet, options->noisefilter_intensity,
+                options->abs_white_threshold);
+    stats_stop(timer, STAGE_NOISEFILTER, count_pixels(full_image(ctx->sheet)));
+    saveDebug("_after-noisefilter%d.pnm", nr, ctx->sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ noisefilter DISABLED for sheet %d\n", nr);
+  }
+
+  // blur filter
+  if (!isExcluded(nr, options->no_blurfilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-blurfilter%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+    blurfilter(ctx->sheet, options->blurfilter_parameters,
+               options->abs_white_threshold);
+    stats_stop(timer, STAGE_BLURFILTER, count_pixels(full_image(ctx->sheet)));
+    saveDebug("_after-blurfilter%d.pnm", nr, ctx->sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ blurfilter DISABLED for sheet %d\n", nr);
+  }
+
+  // mask-detection
+  if (!isExcluded(nr, options->no_mask_scan_multi_index,
+                  options->ignore_multi_index)) {
+    // the scans stop at the edges of the masks they find.
+    timer = stats_start();
+    size_t count = replay_detect_masks(ctx);
+    stats_stop(timer, STAGE_MASK_DETECTION,
+               count_masks_pixels(ctx->masks, count));
+  } else {
+    verboseLog(VERBOSE_MORE, "+ mask-scan DISABLED for sheet %d\n", nr);
+  }
+
+  // permanently apply masks
+  if (ctx->masks_count > 0) {
+    saveDebug("_before-masking%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+    stats_stop(timer, STAGE_MASKING,
+               apply_masks(ctx->sheet, ctx->masks, ctx->masks_count,
+                           options->mask_color));
+    saveDebug("_after-masking%d.pnm", nr, ctx->sheet);
+  }
+
+  // gray filter
+  if (!isExcluded(nr, options->no_grayfilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-grayfilter%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+    grayfilter(ctx->sheet, options->grayfilter_parameters);
+    stats_stop(timer, STAGE_GRAYFILTER, count_pixels(full_image(ctx->sheet)));
+    saveDebug("_after-grayfilter%d.pnm", nr, ctx->sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ grayfilter DISABLED for sheet %d\n", nr);
+  }
+
+  // rotation-detection
+  if ((!isExcluded(nr, options->no_deskew_multi_index,
+                   options->ignore_multi_index))) {
+    saveDebug("_before-deskew%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+
+    // detect masks again, we may get more precise results now after first
+    // masking and grayfilter
+    if (!isExcluded(nr, options->no_mask_scan_multi_index,
+                    options->ignore_multi_index)) {
+      ctx->masks_count = replay_detect_masks(ctx);
+    } else {
+      verboseLog(VERBOSE_MORE, "(mask-scan before deskewing disabled)\n");
+    }
+
+    // auto-deskew each mask
+    for (size_t i = 0; i < ctx->masks_count; i++) {
+      float rotation = replay_detect_rotation(ctx, ctx->masks[i]);
+
+      verboseLog(VERBOSE_NORMAL, "rotate (%d,%d): %f\n", ctx->points[i].x,
+                 ctx->points[i].y, rotation);
+
+      if (rotation != 0.0) {
+        saveDebug("_before-deskew-detect%d.pnm", nr * ctx->masks_count + i,
+                  ctx->sheet);
+        deskew(ctx->sheet, ctx->masks[i], rotation, options->interpolate_type);
+        saveDebug("_after-deskew-detect%d.pnm", nr * ctx->masks_count + i,
+                  ctx->sheet);
+      }
+    }
+
+    stats_stop(timer, STAGE_DESKEW,
+               count_masks_pixels(ctx->masks, ctx->masks_count));
+    saveDebug("_after-deskew%d.pnm", nr, ctx->sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ deskewing DISABLED for sheet %d\n", nr);
+  }
+
+  // auto-center masks on either single-page or double-page layout
+  if (!isExcluded(
+          nr, options->no_mask_center_multi_index,
+          options->ignore_multi_index)) { // (maskCount==pointCount to
+                                         // make sure all masks had
+                                         // correctly been detected)
+    timer = stats_start();
+    // perform auto-masking again to get more precise masks after rotation
+    if (!isExcluded(nr, options->no_mask_scan_multi_index,
+                    options->ignore_multi_index)) {
+      ctx->masks_count = replay_detect_masks(ctx);
+    } else {
+      verboseLog(VERBOSE_MORE, "(mask-scan before centering disabled)\n");
+    }
+
+    saveDebug("_before-centering%d.pnm", nr, ctx->sheet);
+    // center masks on the sheet, according to their page position
+    for (int i = 0; i < ctx->masks_count; i++) {
+      center_mask(ctx->sheet, ctx->points[i], ctx->masks[i]);
+    }
+    stats_stop(timer, STAGE_CENTERING,
+               count_masks_pixels(ctx->masks, ctx->masks_count));
+    saveDebug("_after-centering%d.pnm", nr, ctx->sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ auto-centering DISABLED for sheet %d\n",
+               nr);
+  }
+
+  // explicit wipe and border, applied in a single pass
+  timer = stats_start();
+  MaskingPlan masking = masking_plan_init(ctx->sheet);
+  if (!isExcluded(nr, options->no_wipe_multi_index,
+                  options->ignore_multi_index)) {
+    masking_plan_add_wipes(&masking, options->wipes);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ wipe DISABLED for sheet %d\n", nr);
+  }
+  if (!isExcluded(nr, options->no_border_multi_index,
+                  options->ignore_multi_index)) {
+    masking_plan_add_border(&masking, ctx->sheet, options->border);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ border DISABLED for sheet %d\n", nr);
+  }
+  stats_stop(timer, STAGE_MASKING,
+             apply_masking_plan(ctx->sheet, &masking, options->mask_color));
+
+  // border-detection; without border-centering, the detected borders are
+  // applied together with post-wipe and post-border.
+  MaskingPlan post_masking = masking_plan_init(ctx->sheet);
+  bool borders_pending = false;
+  if (!isExcluded(nr, options->no_border_scan_multi_index,
+                  options->ignore_multi_index)) {
+    Rectangle autoborderMask[ctx->outside_borderscan_masks_count];
+    saveDebug("_before-border%d.pnm", nr, ctx->sheet);
+    timer = stats_start();
+    for (int i = 0; i < ctx->outside_borderscan_masks_count; i++) {
+      autoborderMask[i] = border_to_mask(
+          ctx->sheet,
+          replay_detect_border(ctx, ctx->outside_borderscan_masks[i]));
+    }
+    masking_plan_add_masks(&post_masking, autoborderMask,
+                           ctx->outside_borderscan_masks_count);
+
+    // border-centering
+    if (!isExcluded(nr, options->no_border_align_multi_index,
+                    options->ignore_multi_index)) {
+      apply_masking_plan(ctx->sheet, &post_masking, options->mask_color);
+      post_masking = masking_plan_init(ctx->sheet);
+      for (int i = 0; i < ctx->outside_borderscan_masks_count; i++) {
+        align_mask(ctx->sheet, autoborderMask[i],
+                   ctx->outside_borderscan_masks[i],
+                   options->mask_alignment_parameters);
+      }
+      saveDebug("_after-border%d.pnm", nr, ctx->sheet);
+    } else {
+      verboseLog(VERBOSE_MORE, "+ border-centering DISABLED for sheet %d\n",
+                 nr);
+      borders_pending = true;
+    }
+    stats_stop(timer, STAGE_BORDER_SCAN,
+               count_masks_pixels(ctx->outside_borderscan_masks,
+                                  ctx->outside_borderscan_masks_count));
+  } else {
+    verboseLog(VERBOSE_MORE, "+ border-scan DISABLED for sheet %d\n", nr);
+  }
+  keep_detections(ctx);
+
+  // only the detections are written, the following steps change none.
+  if (options->detect_only) {
+    write_geometry(ctx, nr, outputs, output_io);
+    free_image(&ctx->sheet);
+    stats_end_sheet(inputs, options->input_count, outputs,
+                    options->output_count);
+    return;
+  }
+
+  // post-wipe and post-border
+  timer = stats_start();
+  if (!isExcluded(nr, options->no_wipe_multi_index,
+                  options->ignore_multi_index)) {
+    masking_plan_add_wipes(&post_masking, options->post_wipes);
+  }
+  if (!isExcluded(nr, options->no_border_multi_index,
+                  options->ignore_multi_index)) {
+    masking_plan_add_border(&post_masking, ctx->sheet, options->post_border);
+  }
+  uint64_t cleared =
+      apply_masking_plan(ctx->sheet, &post_masking, options->mask_color);
+  stats_stop(timer, STAGE_MASKING, cleared);
+  if (borders_pending) {
+    // the detected borders were only applied now, with post-wipe and
+    // post-border.
+    saveDebug("_after-border-post-masking%d.pnm", nr, ctx->sheet);
+  }
+
+  // post-mirroring, post-shifting and post-rotating are likewise applied
+  // in one pass.
+  timer = stats_start();
+  transform = transform_identity(size_of_image(ctx->sheet));
+  if (options->post_mirror.horizontal || options->post_mirror.vertical) {
+    verboseLog(VERBOSE_NORMAL, "post-mirroring %s\n",
+               direction_to_string(options->post_mirror));
+    transform_mirror(&transform, options->post_mirror);
+  }
+
+  // post-shifting
+  if ((options->post_shift.horizontal != 0) ||
+      ((options->post_shift.vertical != 0))) {
+    verboseLog(VERBOSE_NORMAL, "post-shifting [%" PRId32 ",%" PRId32 "]\n",
+               options->post_shift.horizontal, options->post_shift.vertical);
+
+    transform_shift(&transform, options->post_shift);
+  }
+
+  // post-rotating
+  if (options->post_rotate != 0) {
+    verboseLog(VERBOSE_NORMAL, "post-rotating %d degrees.\n",
+               options->post_rotate);
+    transform_rotate_90(&transform, options->post_rotate / 90);
+  }
+  transformed = !transform_is_identity(transform, size_of_image(ctx->sheet));
+  apply_transform(&ctx->sheet, transform);
+  stats_stop(timer, STAGE_TRANSFORM,
+             transformed ? count_pixels(full_image(ctx->sheet)) : 0);
+
+  // post-stretch
+  timer = stats_start();
+  resized = 0;
+  size = size_of_image(ctx->sheet);
+  ctx->input_size =
+      coerce_size(options->post_stretch_size, size_of_image(ctx->sheet));
+
+  ctx->input_size.width *= options->post_zoom_factor;
+  ctx->input_size.height *= options->post_zoom_factor;
+
+  stretch_and_replace(&ctx->sheet, ctx->input_size, options->interpolate_type);
+  resized += count_resized_pixels(size, ctx->sheet);
+  size = size_of_image(ctx->sheet);
+
+  // post-size
+  if (options->post_page_size.width != -1 ||
+      options->post_page_size.height != -1) {
+    ctx->input_size =
+        coerce_size(options->post_page_size, size_of_image(ctx->sheet));
+    resize_and_replace(&ctx->sheet, ctx->input_size, options->interpolate_type);
+    resized += count_resized_pixels(size, ctx->sheet);
+  }
+  stats_stop(timer, STAGE_RESIZE, resized);
+
+  // --- write output file ---
+
+  // write split pages output
+
+  if (options->write_output) {
+    save_pages(ctx, nr, outputs, output_io);
+  }
+
+  stats_end_sheet(inputs, options->input_count,
+                  outputs,
+                  options->output_count);
+}
+
+/**
+ * Updates the state carried over to the following sheets as if the sheet had
+ * been processed, without writing it. Only the first sheets need to be
+ * loaded for that: the sheet size and output format are kept from them.
+ */
+static void skip_sheet(UnpaperContext *ctx, int nr,
+                       const char *const inputs[]) {
+  Options *options = &ctx->options;
+
+  if (ctx->input_size.width != -1 &&
+      options->output_pixel_format != AV_PIX_FMT_NONE) {
+    return;
+  }
+
+  verboseLog(VERBOSE_MORE, "loading skipped sheet %d for its size.\n", nr);
+  load_sheet(ctx, nr, inputs, NULL);
+  ctx->previous_size = ctx->input_size;
+
+  ctx->input_size =
+      coerce_size(options->stretch_size, size_of_image(ctx->sheet));
+  ctx->input_size.width *= options->pre_zoom_factor;
+  ctx->input_size.height *= options->pre_zoom_factor;
+
+  free_image(&ctx->sheet);
+}
+
+/* --- result cache -------------------------------------------------------- */
+
+/**
+ * State carried over to the following sheets, saved with the outputs of a
+ * sheet to continue after them as if the sheet had been processed.
+ */
+typedef struct {
+  size_t points_count;
+  Point points[MAX_POINTS];
+  size_t masks_count;
+  Rectangle masks[MAX_MASKS];
+  size_t outside_borderscan_masks_count;
+  Rectangle outside_borderscan_masks[MAX_PAGES];
+  RectangleSize input_size;
+  RectangleSize previous_size;
+
+  enum AVPixelFormat output_pixel_format;
+  MaskDetectionParameters mask_detection_parameters;
+  size_t blackfilter_exclusions_count;
+  Rectangle blackfilter_exclusions[MAX_MASKS];
+  Wipes wipes;
+
+  // Only with options.coherent_scans, where the detections depend on them.
+  SheetGeometry hints;
+} SheetState;
+
+static void save_state(const UnpaperContext *ctx, SheetState *state) {
+  const Options *options = &ctx->options;
+
+  // The state is stored as bytes: zero the padding, and the hints that are
+  // not copied.
+  memset(state, 0, sizeof(SheetState));
+  state->points_count = ctx->points_count;
+  memcpy(state->points, ctx->points, sizeof(state->points));
+  state->masks_count = ctx->masks_count;
+  memcpy(state->masks, ctx->masks, sizeof(state->masks));
+  state->outside_borderscan_masks_count = ctx->outside_borderscan_masks_count;
+  memcpy(state->outside_borderscan_masks, ctx->outside_borderscan_masks,
+         sizeof(state->outside_borderscan_masks));
+  state->input_size = ctx->input_size;
+  state->previous_size = ctx->previous_size;
+
+  state->output_pixel_format = options->output_pixel_format;
+  memcpy(&state->mask_detection_parameters,
+         &options->mask_detection_parameters,
+         sizeof(state->mask_detection_parameters));
+  state->blackfilter_exclusions_count =
+      options->blackfilter_parameters.exclusions_count;
+  memcpy(state->blackfilter_exclusions, options->blackfilter_exclusions,
+         sizeof(state->blackfilter_exclusions));
+  memcpy(&state->wipes, &options->wipes, sizeof(state->wipes));
+
+  if (options->coherent_scans) {
+    memcpy(&state->hints, &ctx->hints, sizeof(state->hints));
+  }
+}
+
+static void restore_state(UnpaperContext *ctx, const SheetState *state) {
+  Options *options = &ctx->options;
+
+  ctx->points_count = state->points_count;
+  memcpy(ctx->points, state->points, sizeof(ctx->points));
+  ctx->masks_count = state->masks_count;
+  memcpy(ctx->masks, state->masks, sizeof(ctx->masks));
+  ctx->outside_borderscan_masks_count = state->outside_borderscan_masks_count;
+  memcpy(ctx->outside_borderscan_masks, state->outside_borderscan_masks,
+         sizeof(ctx->outside_borderscan_masks));
+  ctx->input_size = state->input_size;
+  ctx->previous_size = state->previous_size;
+
+  options->output_pixel_format = state->output_pixel_format;
+  options->mask_detection_parameters = state->mask_detection_parameters;
+  options->blackfilter_parameters.exclusions_count =
+      state->blackfilter_exclusions_count;
+  memcpy(options->blackfilter_exclusions, state->blackfilter_exclusions,
+         sizeof(options->blackfilter_exclusions));
+  options->wipes = state->wipes;
+
+  if (options->coherent_scans) {
+    memcpy(&ctx->hints, &state->hints, sizeof(ctx->hints));
+  }
+}
+
+// Hashes the contents of the input files, or returns false if one cannot be
+// read.
+static bool hash_inputs(const UnpaperContext *ctx, const char *const inputs[],
+                        CacheKey *key) {
+  CacheHash *hash = cache_hash_new();
+  bool success = true;
+
+  for (int j = 0; j < ctx->options.input_count && success; j++) {
+    if (inputs[j] == NULL) {
+      cache_hash_update(hash, "blank", sizeof("blank"));
+    } else {
+      CacheHash *file = cache_hash_new();
+      success = cache_hash_file(file, inputs[j]);
+      CacheKey file_key = cache_hash_final(file);
+      cache_hash_update(hash, file_key.bytes, sizeof(file_key.bytes));
+    }
+  }
+
+  *key = cache_hash_final(hash);
+  return success;
+}
+
+/*
+ * Cache keys hash a text description of the settings and state that make up
+ * the results of a sheet, a "name value" line each, rather than the bytes of
+ * their structs: padding and field order are not part of their value. Floats
+ * are written in hexadecimal, so that they are described exactly.
+ */
+
+static void describe_rectangles(Text *text, const char *name,
+                                const Rectangle rectangles[], size_t count) {
+  text_printf(text, "%s %zu ", name, count);
+  for (size_t i = 0; i < count; i++) {
+    print_rectangle(text, rectangles[i]);
+  }
+  text_printf(text, "\n");
+}
+
+static void describe_size(Text *text, const char *name, RectangleSize size) {
+  text_printf(text, "%s ", name);
+  print_rectangle_size(text, size);
+  text_printf(text, "\n");
+}
+
+static void describe_delta(Text *text, const char *name, Delta delta) {
+  text_printf(text, "%s ", name);
+  print_delta(text, delta);
+  text_printf(text, "\n");
+}
+
+static void describe_border(Text *text, const char *name, Border border) {
+  text_printf(text, "%s ", name);
+  print_border(text, border);
+  text_printf(text, "\n");
+}
+
+static void describe_color(Text *text, const char *name, Pixel color) {
+  text_printf(text, "%s ", name);
+  print_color(text, color);
+  text_printf(text, "\n");
+}
+
+static void describe_edges(Text *text, const char *name, Edges edges) {
+  text_printf(text, "%s ", name);
+  print_edges(text, edges);
+  text_printf(text, "\n");
+}
+
+static void describe_direction(Text *text, const char *name,
+                               Direction direction) {
+  text_printf(text, "%s %s\n", name, direction_to_string(direction));
+}
+
+static void describe_mask_detection(Text *text,
+                                    const MaskDetectionParameters *params) {
+  describe_size(text, "mask-scan-size", params->scan_size);
+  describe_delta(text, "mask-scan-step", params->scan_step);
+  text_printf(text, "mask-scan-depth %" PRId32 " %" PRId32 "\n",
+              params->scan_depth.horizontal, params->scan_depth.vertical);
+  describe_direction(text, "mask-scan-direction", params->scan_direction);
+  text_printf(text, "mask-scan-threshold %a %a\n",
+              params->scan_threshold.horizontal,
+              params->scan_threshold.vertical);
+  text_printf(text,
+              "mask-scan-bounds %" PRId32 " %" PRId32 " %" PRId32 " %" PRId32
+              "\n",
+              params->minimum_width, params->maximum_width,
+              params->minimum_height, params->maximum_height);
+  text_printf(text, "mask-scan-decimation %d\n", params->decimation);
+}
+
+/**
+ * Describes the options that apply to every sheet, leaving out those that
+ * select sheets and files. For the detection results, those applied after the
+ * last detection are left out as well.
+ *
+ * The mask detection parameters, the wipes and the blackfilter exclusions can
+ * change from sheet to sheet, they are described with the sheet state.
+ */
+static void describe_options(Text *text, const Options *options,
+                             bool detections) {
+  text_printf(text, "layout %d\n", options->layout);
+  text_printf(text, "write-output %d\n", options->write_output);
+  text_printf(text, "files %d %d\n", options->input_count,
+              options->output_count);
+  text_printf(text, "detect-only %d\n", options->detect_only);
+  text_printf(text, "apply-geometry %s\n",
+              options->geometry_file != NULL ? options->geometry_file : "");
+  text_printf(text, "coherent-scans %d\n", options->coherent_scans);
+
+  describe_rectangles(text, "pre-wipe", options->pre_wipes.areas,
+                      options->pre_wipes.count);
+  describe_delta(text, "pre-shift", options->pre_shift);
+  text_printf(text, "pre-rotate %d\n", options->pre_rotate);
+  describe_direction(text, "pre-mirror", options->pre_mirror);
+  describe_size(text, "sheet-size", options->sheet_size);
+  describe_size(text, "size", options->page_size);
+  describe_size(text, "stretch", options->stretch_size);
+  text_printf(text, "zoom %a\n", options->pre_zoom_factor);
+  describe_color(text, "sheet-background", options->sheet_background);
+  describe_color(text, "mask-color", options->mask_color);
+  text_printf(text, "thresholds %d %d\n", options->abs_black_threshold,
+              options->abs_white_threshold);
+  describe_border(text, "pre-border", options->pre_border);
+  describe_border(text, "border", options->border);
+  describe_rectangles(text, "pre-mask", options->pre_masks,
+                      options->pre_masks_count);
+  describe_rectangles(text, "mask", options->masks, options->masks_count);
+  text_printf(text, "mask-scan-point %zu ", options->points_count);
+  for (size_t i = 0; i < options->points_count; i++) {
+    text_printf(text, "[%" PRId32 ",%" PRId32 "] ", options->points[i].x,
+                options->points[i].y);
+  }
+  text_printf(text, "\n");
+  text_printf(text, "middle-wipe %" PRId32 " %" PRId32 "\n",
+              options->middle_wipe[0], options->middle_wipe[1]);
+
+  const DeskewParameters *deskew = &options->deskew_parameters;
+  text_printf(text, "deskew-scan %a %a %a %d %a %d\n",
+              deskew->deskewScanRangeRad, deskew->deskewScanStepRad,
+              deskew->deskewScanDeviationRad, deskew->deskewScanSize,
+              deskew->deskewScanDepth, deskew->decimation);
+  describe_edges(text, "deskew-scan-direction", deskew->scan_edges);
+
+  const BorderScanParameters *border_scan = &options->border_scan_parameters;
+  describe_size(text, "border-scan-size", border_scan->scan_size);
+  describe_delta(text, "border-scan-step", border_scan->scan_step);
+  text_printf(text, "border-scan-threshold %" PRId32 " %" PRId32 "\n",
+              border_scan->scan_threshold.horizontal,
+              border_scan->scan_threshold.vertical);
+  describe_direction(text, "border-scan-direction",
+                     border_scan->scan_direction);
+  text_printf(text, "border-scan-decimation %d\n", border_scan->decimation);
+
+  text_printf(text, "interpolate %d\n", options->interpolate_type);
+
+  const GrayfilterParameters *grayfilter = &options->grayfilter_parameters;
+  describe_size(text, "grayfilter-size", grayfilter->scan_size);
+  describe_delta(text, "grayfilter-step", grayfilter->scan_step);
+  text_printf(text, "grayfilter-threshold %d\n", grayfilter->abs_threshold);
+
+  const BlackfilterParameters *blackfilter = &options->blackfilter_parameters;
+  describe_size(text, "blackfilter-scan-size", blackfilter->scan_size);
+  describe_delta(text, "blackfilter-scan-step", blackfilter->scan_step);
+  text_printf(text, "blackfilter-scan-depth %" PRIu32 " %" PRIu32 "\n",
+              blackfilter->scan_depth.horizontal,
+              blackfilter->scan_depth.vertical);
+  describe_direction(text, "blackfilter-scan-direction",
+                     blackfilter->scan_direction);
+  text_printf(text, "blackfilter-scan-threshold %d\n",
+              blackfilter->abs_threshold);
+  text_printf(text, "blackfilter-intensity %" PRId32 "\n",
+              blackfilter->intensity);
+
+  const BlurfilterParameters *blurfilter = &options->blurfilter_parameters;
+  describe_size(text, "blurfilter-size", blurfilter->scan_size);
+  describe_delta(text, "blurfilter-step", blurfilter->scan_step);
+  text_printf(text, "blurfilter-intensity %a\n", blurfilter->intensity);
+
+  text_printf(text, "noisefilter-intensity %" PRIu64 "\n",
+              options->noisefilter_intensity);
+  text_printf(text, "blank-sheets %d %d %a\n", options->blank_sheets,
+              options->blank_parameters.abs_threshold,
+              options->blank_parameters.density);
+
+  if (detections) {
+    return;
+  }
+
+  text_printf(text, "output-pixel-format %d\n", options->output_pixel_format);
+  describe_rectangles(text, "post-wipe", options->post_wipes.areas,
+                      options->post_wipes.count);
+  describe_delta(text, "post-shift", options->post_shift);
+  text_printf(text, "post-rotate %d\n", options->post_rotate);
+  describe_direction(text, "post-mirror", options->post_mirror);
+  describe_size(text, "post-size", options->post_page_size);
+  describe_size(text, "post-stretch", options->post_stretch_size);
+  text_printf(text, "post-zoom %a\n", options->post_zoom_factor);
+  describe_border(text, "post-border", options->post_border);
+  describe_edges(text, "border-align",
+                 options->mask_alignment_parameters.alignment);
+  describe_delta(text, "border-margin",
+                 options->mask_alignment_parameters.margin);
+}
+
+// Describes the state left by the previous sheets, see describe_options().
+static void describe_state(Text *text, const SheetState *state,
+                           bool detections) {
+  text_printf(text, "points %zu ", state->points_count);
+  for (size_t i = 0; i < state->points_count; i++) {
+    text_printf(text, "[%" PRId32 ",%" PRId32 "] ", state->points[i].x,
+                state->points[i].y);
+  }
+  text_printf(text, "\n");
+  describe_rectangles(text, "masks", state->masks, state->masks_count);
+  describe_rectangles(text, "outside-borderscan-masks",
+                      state->outside_borderscan_masks,
+                      state->outside_borderscan_masks_count);
+  describe_size(text, "input-size", state->input_size);
+  describe_size(text, "previous-size", state->previous_size);
+  if (!detections) {
+    text_printf(text, "sheet-pixel-format %d\n", state->output_pixel_format);
+  }
+  describe_mask_detection(text, &state->mask_detection_parameters);
+  describe_rectangles(text, "blackfilter-scan-exclude",
+                      state->blackfilter_exclusions,
+                      state->blackfilter_exclusions_count);
+  describe_rectangles(text, "wipe", state->wipes.areas, state->wipes.count);
+
+  // Hints are written as the detections of a sheet, rotations included
+  // exactly.
+  text_printf(text, "hints ");
+  geometry_write(text, &state->hints);
+}
+
+/**
+ * Computes the key of the results of a sheet from its inputs, the options
+ * that apply to it and the state left by the previous sheets.
+ */
+static CacheKey sheet_key(const UnpaperContext *ctx, int nr, CacheKey inputs,
+                          bool detections) {
+  const Options *options = &ctx->options;
+  CacheHash *hash = cache_hash_new();
+  Text text = EMPTY_TEXT;
+  SheetState state;
+
+  struct {
+    const char *name;
+    struct MultiIndex sheets;
+  } disabled[] = {
+      {"blackfilter", options->no_blackfilter_multi_index},
+      {"noisefilter", options->no_noisefilter_multi_index},
+      {"blurfilter", options->no_blurfilter_multi_index},
+      {"grayfilter", options->no_grayfilter_multi_index},
+      {"mask-scan", options->no_mask_scan_multi_index},
+      {"mask-center", options->no_mask_center_multi_index},
+      {"deskew", options->no_deskew_multi_index},
+      {"wipe", options->no_wipe_multi_index},
+      {"border", options->no_border_multi_index},
+      {"border-scan", options->no_border_scan_multi_index},
+      {"border-align", options->no_border_align_multi_index},
+  };
+
+  text_printf(&text, "%s\n", detections ? "detections" : "outputs");
+  text_printf(&text, "version %s\n", VERSION_STR);
+  describe_options(&text, options, detections);
+  for (size_t i = 0; i < sizeof(disabled) / sizeof(disabled[0]); i++) {
+    text_printf(&text, "no-%s %d\n", disabled[i].name,
+                isExcluded(nr, disabled[i].sheets,
+                           options->ignore_multi_index));
+  }
+
+  save_state(ctx, &state);
+  describe_state(&text, &state, detections);
+
+  cache_hash_update(hash, inputs.bytes, sizeof(inputs.bytes));
+  cache_hash_update(hash, text.data, text.length);
+  text_free(&text);
+  return cache_hash_final(hash);
+}
+
+static const char *output_suffix(char *suffix, size_t size, int j) {
+  snprintf(suffix, size, "output%d", j);
+  return suffix;
+}
+
+// Copies the cached outputs of a sheet, returns false if they are not all
+// cached.
+static bool fetch_sheet(UnpaperContext *ctx, int nr, CacheKey key,
+                        const char *const inputs[],
+                        const char *const outputs[]) {
+  const Options *options = &ctx->options;
+  uint8_t *data;
+  size_t size;
+  char suffix[32];
+
+  if (!cache_read(options->cache_directory, key, "state", &data, &size)) {
+    return false;
+  }
+  if (size != sizeof(SheetState)) {
+    free(data);
+    return false;
+  }
+
+  for (int j = 0; j < options->output_count; j++) {
+    if (!cache_fetch_file(options->cache_directory, key,
+                          output_suffix(suffix, sizeof(suffix), j),
+                          outputs[j])) {
+      free(data);
+      return false;
+    }
+  }
+
+  restore_state(ctx, (const SheetState *)data);
+  free(data);
+
+  stats_begin_sheet(nr);
+  for (int j = 0; j < options->output_count; j++) {
+    stats_count_file_size(COUNTER_BYTES_WRITTEN, outputs[j]);
+  }
+  stats_end_sheet(inputs, options->input_count, outputs,
+                  options->output_count);
+  return true;
+}
+
+// Stores the outputs of a sheet, then the state that marks them complete.
+static void store_sheet(const UnpaperContext *ctx, CacheKey key,
+                        const char *const outputs[]) {
+  const Options *options = &ctx->options;
+  SheetState state;
+  char suffix[32];
+
+  for (int j = 0; j < options->output_count; j++) {
+    if (!cache_store_file(options->cache_directory, key,
+                          output_suffix(suffix, sizeof(suffix), j),
+                          outputs[j])) {
+      return;
+    }
+  }
+
+  save_state(ctx, &state);
+  cache_write(options->cache_directory, key, "state", (const uint8_t *)&state,
+              sizeof(state));
+}
+
+/**
+ * Copies the outputs of a sheet from the cache, or processes it and stores
+ * them. Detections are replayed from the cache if a sheet with the same
+ * inputs and detection options was processed before, and recorded
+ * otherwise.
+ */
+static void process_cached_sheet(UnpaperContext *ctx, int nr,
+                                 const char *const inputs[],
+                                 const char *const outputs[]) {
+  const char *directory = ctx->options.cache_directory;
+  CacheKey inputs_key, outputs_key, detections_key;
+  uint8_t *data = NULL;
+  size_t size = 0;
+
+  if (!hash_inputs(ctx, inputs, &inputs_key)) {
+    // Let processing report the input that cannot be read.
+    process_sheet(ctx, nr, inputs, outputs, NULL, NULL);
+    return;
+  }
+  outputs_key = sheet_key(ctx, nr, inputs_key, false);
+  detections_key = sheet_key(ctx, nr, inputs_key, true);
+
+  if (fetch_sheet(ctx, nr, outputs_key, inputs, outputs)) {
+    verboseLog(VERBOSE_NORMAL, "sheet %d copied from cache.\n", nr);
+    return;
+  }
+
+  if (cache_read(directory, detections_key, "detections", &data, &size) &&
+      size == sizeof(SheetGeometry)) {
+    verboseLog(VERBOSE_NORMAL, "sheet %d detections replayed from cache.\n",
+               nr);
+    replay_detections(ctx, (const SheetGeometry *)data);
+  } else {
+    record_detections(ctx);
+  }
+  free(data);
+
+  process_sheet(ctx, nr, inputs, outputs, NULL, NULL);
+
+  if (ctx->detections.mode == DETECTIONS_RECORD) {
+    cache_write(directory, detections_key, "detections",
+                (const uint8_t *)&ctx->detections.geometry,
+                sizeof(ctx->detections.geometry));
+  }
+  end_detections(ctx);
+
+  store_sheet(ctx, outputs_key, outputs);
+}
+
+/**
+ * Processes a sheet with the detections read from the geometry file, or only
+ * makes the detections and writes them.
+ */
+static void process_geometry_sheet(UnpaperContext *ctx, int nr,
+                                   const char *const inputs[],
+                                   const char *const outputs[],
+                                   AVIOContext *const input_io[],
+                                   AVIOContext *const output_io[]) {
+  const char *filename = ctx->options.geometry_file;
+
+  if (ctx->options.detect_only) {
+    record_detections(ctx);
+  } else {
+    if (!ctx->geometries_loaded) {
+      if (!geometry_read(filename, &ctx->geometries, &ctx->geometries_count)) {
+        errOutput("unable to read geometry file %s.", filename);
+      }
+      ctx->geometries_loaded = true;
+    }
+
+    const SheetGeometry *geometry =
+        geometry_find(ctx->geometries, ctx->geometries_count, nr);
+    if (geometry == NULL) {
+      errOutput("no geometry for sheet %d in %s.", nr, filename);
+    }
+    verboseLog(VERBOSE_NORMAL, "sheet %d detections read from %s.\n", nr,
+               filename);
+    replay_detections(ctx, geometry);
+  }
+
+  process_sheet(ctx, nr, inputs, outputs, input_io, output_io);
+  end_detections(ctx);
+}
+
+// Processes, or skips if outputs is NULL, a sheet.
+static UnpaperStatus run_sheet(UnpaperContext *ctx, int nr,
+                               const char *const inputs[],
+                               const char *const outputs[],
+                               AVIOContext *const input_io[],
+                               AVIOContext *const output_io[]) {
+  jmp_buf error_handler;
+  Logger *previous = logging_install(&ctx->logger);
+  Statistics *previous_stats = stats_install(&ctx->stats);
+
+  ctx->logger.error[0] = '\0';
+  ctx->logger.error_handler = &error_handler;
+  ctx->skipped = false;
+
+  if (setjmp(error_handler) != 0) {
+    // errOutput() was called: drop the partially processed sheet.
+    end_detections(ctx);
+    free_image(&ctx->page);
+    free_pages(ctx);
+    free_image(&ctx->sheet);
+    ctx->logger.error_handler = NULL;
+    logging_install(previous);
+    stats_install(previous_stats);
+    return UNPAPER_ERROR;
+  }
+
+  if (outputs == NULL) {
+    skip_sheet(ctx, nr, inputs);
+  } else if (ctx->options.detect_only ||
+             ctx->options.geometry_file != NULL) {
+    process_geometry_sheet(ctx, nr, inputs, outputs, input_io, output_io);
+  } else if (ctx->options.cache_directory != NULL &&
+             ctx->options.write_output && input_io == NULL &&
+             output_io == NULL) {
+    process_cached_sheet(ctx, nr, inputs, outputs);
+  } else {
+    process_sheet(ctx, nr, inputs, outputs, input_io, output_io);
+  }
+
+  ctx->logger.error_handler = NULL;
+  logging_install(previous);
+  stats_install(previous_stats);
+  return UNPAPER_OK;
+}
+
+UnpaperStatus unpaper_process_sheet(UnpaperContext *ctx, int nr,
+                                    const char *const inputs[],
+                                    const char *const outputs[]) {
+  return run_sheet(ctx, nr, inputs, outputs, NULL, NULL);
+}
+
+UnpaperStatus unpaper_process_sheet_io(UnpaperContext *ctx, int nr,
+                                       const UnpaperStream inputs[],
+                                       const UnpaperStream outputs[]) {
+  const char *input_names[MAX_PAGES];
+  const char *output_names[MAX_PAGES];
+  AVIOContext *input_io[MAX_PAGES];
+  AVIOContext *output_io[MAX_PAGES];
+  bool streams = false;
+
+  for (int j = 0; j < ctx->options.input_count; j++) {
+    input_names[j] = inputs[j].name;
+    input_io[j] = inputs[j].io;
+    streams |= input_io[j] != NULL;
+  }
+  for (int j = 0; j < ctx->options.output_count; j++) {
+    output_names[j] = outputs[j].name;
+    output_io[j] = outputs[j].io;
+    streams |= output_io[j] != NULL;
+  }
+
+  // Sheets of files only are processed as by unpaper_process_sheet().
+  if (!streams) {
+    return run_sheet(ctx, nr, input_names, output_names, NULL, NULL);
+  }
+  return run_sheet(ctx, nr, input_names, output_names, input_io, output_io);
+}
+
+UnpaperStatus unpaper_skip_sheet(UnpaperContext *ctx, int nr,
+                                 const char *const inputs[]) {
+  return run_sheet(ctx, nr, inputs, NULL, NULL, NULL);
+}
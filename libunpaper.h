@@ -0,0 +1,96 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- sheet processing library ------------------------------------------- */
+
+#pragma once
+
+#include <libavformat/avio.h>
+
+#include "lib/logging.h"
+#include "lib/options.h"
+#include "lib/stats.h"
+
+typedef enum {
+  UNPAPER_OK = 0,
+  // Processing failed, unpaper_last_error() describes why.
+  UNPAPER_ERROR,
+} UnpaperStatus;
+
+/**
+ * State for processing a sequence of sheets with the same options.
+ *
+ * Like a single run of the command line tool, a context keeps what it learns
+ * from the first sheets (sheet size, auto-detected scan points and layout
+ * areas, output pixel format) for the following ones. Contexts are
+ * independent of each other and can be used from different threads, each
+ * context from one thread at a time.
+ */
+typedef struct UnpaperContext UnpaperContext;
+
+// Creates a context processing sheets with a copy of options. Log messages up
+// to the verbose level are passed to log, or printed to stderr if it is NULL.
+UnpaperContext *unpaper_context_new(const Options *options,
+                                    VerboseLevel verbose, LogFunction log,
+                                    void *opaque);
+void unpaper_context_free(UnpaperContext *ctx);
+
+// Options in effect for the context, including the values detected so far.
+const Options *unpaper_context_options(const UnpaperContext *ctx);
+
+/**
+ * Loads, processes and saves sheet number nr.
+ *
+ * inputs holds options.input_count file names, where NULL inserts a blank
+ * page; outputs holds options.output_count file names. Errors never terminate
+ * the process: they are reported by the returned status, and the context can
+ * keep being used for the following sheets.
+ */
+UnpaperStatus unpaper_process_sheet(UnpaperContext *ctx, int nr,
+                                    const char *const inputs[],
+                                    const char *const outputs[]);
+
+/**
+ * An input or output of a sheet. If io is not NULL, the image is read from or
+ * written to it, such as a memory buffer or a pipe, and name is only used in
+ * messages and statistics; otherwise name is the file to use.
+ */
+typedef struct {
+  const char *name;
+  AVIOContext *io;
+} UnpaperStream;
+
+/**
+ * Like unpaper_process_sheet(), reading one image from each of the
+ * options.input_count inputs, where a NULL name inserts a blank page, and
+ * writing one image to each of the options.output_count outputs. The I/O
+ * contexts stay owned by the caller, and outputs are flushed but not closed.
+ */
+UnpaperStatus unpaper_process_sheet_io(UnpaperContext *ctx, int nr,
+                                       const UnpaperStream inputs[],
+                                       const UnpaperStream outputs[]);
+
+/**
+ * Skips sheet number nr, whose outputs were written before, such as by an
+ * interrupted run. Sheets following it are processed as if it had been
+ * processed too: the inputs are loaded if the sheet is the first one, for the
+ * sheet size and output format that it sets for the following ones.
+ */
+UnpaperStatus unpaper_skip_sheet(UnpaperContext *ctx, int nr,
+                                 const char *const inputs[]);
+
+/**
+ * Collects statistics on the sheets processed with the context, writing a
+ * report of each one to output. They are kept per context, so concurrent
+ * contexts can share the stream; the totals are added up with stats_add().
+ */
+void unpaper_context_enable_stats(UnpaperContext *ctx, StatsFormat format,
+                                  FILE *output);
+const Statistics *unpaper_context_stats(const UnpaperContext *ctx);
+
+// Whether the last sheet processed was found blank and, with
+// options.blank_sheets set to skip it, none of its outputs were written.
+bool unpaper_last_sheet_skipped(const UnpaperContext *ctx);
+
+const char *unpaper_last_error(const UnpaperContext *ctx);
@@ -0,0 +1,159 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/logging.h"
+#include "manifest.h"
+
+#define OPTIONS_SEPARATOR "|"
+
+typedef struct {
+  int count;
+  int capacity;
+  char **arguments;
+} Arguments;
+
+static void append_argument(Arguments *arguments, const char *argument) {
+  if (arguments->count + 1 >= arguments->capacity) {
+    arguments->capacity =
+        arguments->capacity == 0 ? 8 : arguments->capacity * 2;
+    arguments->arguments = realloc(arguments->arguments,
+                                   arguments->capacity * sizeof(char *));
+    if (arguments->arguments == NULL) {
+      errOutput("unable to allocate manifest entry.");
+    }
+  }
+
+  arguments->arguments[arguments->count] = strdup(argument);
+  if (arguments->arguments[arguments->count] == NULL) {
+    errOutput("unable to allocate manifest entry.");
+  }
+  arguments->arguments[++arguments->count] = NULL;
+}
+
+static void free_arguments(int count, char **arguments) {
+  for (int i = 0; i < count; i++) {
+    free(arguments[i]);
+  }
+  free(arguments);
+}
+
+// Splits a line into files and options, returns false if it is empty or a
+// comment.
+static bool parse_entry(const char *filename, int line_number, char *line,
+                        ManifestEntry *entry) {
+  Arguments files = {0}, options = {0};
+  Arguments *current = &files;
+  char *p = line;
+
+  while (isspace((unsigned char)*p)) {
+    p++;
+  }
+  if (*p == '\0' || *p == '#') {
+    return false;
+  }
+
+  while (*p != '\0') {
+    // Quotes can appear anywhere in an argument, as in a shell, so the
+    // argument is rebuilt in place without them.
+    char *argument = p, *end = p;
+    bool quoted = false;
+    while (*p != '\0' && !isspace((unsigned char)*p)) {
+      if (*p == '"' || *p == '\'') {
+        char quote = *p++;
+        while (*p != quote) {
+          if (*p == '\0') {
+            errOutput("%s:%d: unterminated quote.", filename, line_number);
+          }
+          *end++ = *p++;
+        }
+        p++;
+        quoted = true;
+      } else {
+        *end++ = *p++;
+      }
+    }
+    while (isspace((unsigned char)*p)) {
+      p++;
+    }
+    *end = '\0';
+
+    if (!quoted && strcmp(argument, OPTIONS_SEPARATOR) == 0) {
+      if (current == &options) {
+        errOutput("%s:%d: options given twice.", filename, line_number);
+      }
+      current = &options;
+    } else {
+      append_argument(current, argument);
+    }
+  }
+
+  if (files.count < 2) {
+    errOutput("%s:%d: no input or output files given.", filename, line_number);
+  }
+
+  *entry = (ManifestEntry){
+      .line = line_number,
+      .file_count = files.count,
+      .files = files.arguments,
+      .option_count = options.count,
+      .options = options.arguments,
+  };
+  return true;
+}
+
+void manifest_read(const char *filename, Manifest *manifest) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    errOutput("unable to open manifest %s.", filename);
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  int capacity = 0;
+
+  *manifest = (Manifest){0};
+  for (int line_number = 1; getline(&line, &line_size, f) != -1;
+       line_number++) {
+    ManifestEntry entry;
+    if (!parse_entry(filename, line_number, line, &entry)) {
+      continue;
+    }
+
+    if (manifest->count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      manifest->entries =
+          realloc(manifest->entries, capacity * sizeof(ManifestEntry));
+      if (manifest->entries == NULL) {
+        errOutput("unable to allocate manifest entry.");
+      }
+    }
+    manifest->entries[manifest->count++] = entry;
+  }
+
+  bool failed = ferror(f);
+  free(line);
+  fclose(f);
+
+  if (failed) {
+    manifest_free(manifest);
+    errOutput("unable to read manifest %s.", filename);
+  }
+}
+
+void manifest_free(Manifest *manifest) {
+  for (int i = 0; i < manifest->count; i++) {
+    free_arguments(manifest->entries[i].file_count,
+                   manifest->entries[i].files);
+    free_arguments(manifest->entries[i].option_count,
+                   manifest->entries[i].options);
+  }
+  free(manifest->entries);
+  *manifest = (Manifest){0};
+}
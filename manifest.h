@@ -0,0 +1,37 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- job manifests ------------------------------------------------------ */
+
+#pragma once
+
+typedef struct {
+  // Line of the entry in the manifest, for messages.
+  int line;
+
+  // Input and output files, as on the command line.
+  int file_count;
+  char **files;
+
+  // Options applied on top of the ones of the command line.
+  int option_count;
+  char **options;
+} ManifestEntry;
+
+typedef struct {
+  int count;
+  ManifestEntry *entries;
+} Manifest;
+
+/**
+ * Reads the entries of a manifest, one per line:
+ *
+ *   input-file(s) output-file(s) [| option(s)]
+ *
+ * Arguments are separated by blanks, and can be quoted with single or double
+ * quotes. Empty lines and lines starting with '#' are ignored.
+ */
+void manifest_read(const char *filename, Manifest *manifest);
+
+void manifest_free(Manifest *manifest);
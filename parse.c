@@ -21,7 +21,7 @@
 /**
  * Combines an array of strings to a comma-separated string.
  */
-char *implode(char *buf, const char *s[], int cnt) {
+char *implode(char *buf, const char *const s[], int cnt) {
   if (cnt > 0) {
     if (s[0] != NULL) {
       strcpy(buf, s[0]);
@@ -132,20 +132,20 @@ bool isInMultiIndex(int index, struct MultiIndex multiIndex) {
 }
 
 /**
- * Outputs all entries in an array of integer to the console.
+ * Appends all entries in an array of integer to text.
  */
-void printMultiIndex(struct MultiIndex multiIndex) {
+void printMultiIndex(Text *text, struct MultiIndex multiIndex) {
   if (multiIndex.count == -1) {
-    printf("all");
+    text_printf(text, "all");
   } else if (multiIndex.count == 0) {
-    printf("none");
+    text_printf(text, "none");
   } else {
     for (int i = 0; i < multiIndex.count; i++) {
-      printf("%d", multiIndex.indexes[i]);
+      text_printf(text, "%d", multiIndex.indexes[i]);
       if (i < multiIndex.count - 1) {
-        printf(",");
+        text_printf(text, ",");
       }
     }
   }
-  printf("\n");
+  text_printf(text, "\n");
 }
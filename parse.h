@@ -7,10 +7,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdio.h>
+
+#include "lib/text.h"
 
 /* --- tool functions for parameter parsing and verbose output ------------ */
 
-char *implode(char *buf, const char *s[], int cnt);
+char *implode(char *buf, const char *const s[], int cnt);
 
 struct MultiIndex {
   int count;
@@ -33,4 +36,4 @@ static inline bool isExcluded(int index, struct MultiIndex multiIndex,
           isInMultiIndex(index, multiIndex));
 }
 
-void printMultiIndex(struct MultiIndex multiIndex);
+void printMultiIndex(Text *text, struct MultiIndex multiIndex);
@@ -0,0 +1,328 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- batch server on a Unix domain socket ------------------------------- */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libavutil/mem.h>
+
+#include "lib/json.h"
+#include "lib/workqueue.h"
+#include "serve.h"
+
+#define MAX_ARGUMENTS 4096
+#define MAX_ARGUMENT_LENGTH 65536
+#define MAX_INPUT_SIZE (UINT64_C(1) << 32)
+
+typedef struct {
+  JobHandler handler;
+  void *opaque;
+} Server;
+
+typedef struct {
+  int fd;
+  struct timespec accepted;
+} Connection;
+
+typedef struct {
+  int argc;
+  char **argv;
+  uint8_t *data;
+  size_t size;
+} Request;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_serving(int signal) {
+  (void)signal;
+  stopping = 1;
+}
+
+static bool read_all(int fd, void *buffer, size_t size) {
+  uint8_t *next = buffer;
+
+  while (size > 0) {
+    ssize_t count = read(fd, next, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    next += count;
+    size -= count;
+  }
+
+  return true;
+}
+
+static bool write_all(int fd, const void *buffer, size_t size) {
+  const uint8_t *next = buffer;
+
+  while (size > 0) {
+    ssize_t count = write(fd, next, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    next += count;
+    size -= count;
+  }
+
+  return true;
+}
+
+static bool read_uint32(int fd, uint32_t *value) {
+  uint8_t bytes[4];
+
+  if (!read_all(fd, bytes, sizeof(bytes))) {
+    return false;
+  }
+
+  *value = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+           (uint32_t)bytes[2] << 8 | bytes[3];
+  return true;
+}
+
+static bool read_uint64(int fd, uint64_t *value) {
+  uint32_t high, low;
+
+  if (!read_uint32(fd, &high) || !read_uint32(fd, &low)) {
+    return false;
+  }
+
+  *value = (uint64_t)high << 32 | low;
+  return true;
+}
+
+static bool request_error(JobResult *result, const char *message) {
+  snprintf(result->error, sizeof(result->error), "invalid request: %s",
+           message);
+  return false;
+}
+
+static bool read_request(int fd, Request *request, JobResult *result) {
+  uint32_t count;
+  uint64_t size;
+
+  if (!read_uint32(fd, &count) || count > MAX_ARGUMENTS) {
+    return request_error(result, "bad argument count");
+  }
+
+  // Room for the program name and the terminating NULL.
+  request->argv = calloc(count + 2, sizeof(char *));
+  if (request->argv == NULL) {
+    return request_error(result, "too many arguments");
+  }
+  char *program = strdup("unpaper");
+  if (program == NULL) {
+    return request_error(result, "out of memory");
+  }
+  request->argv[request->argc++] = program;
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t length;
+    char *argument;
+
+    if (!read_uint32(fd, &length) || length > MAX_ARGUMENT_LENGTH) {
+      return request_error(result, "bad argument length");
+    }
+
+    argument = malloc(length + 1);
+    if (argument == NULL) {
+      return request_error(result, "argument too long");
+    }
+    request->argv[request->argc++] = argument;
+
+    if (!read_all(fd, argument, length)) {
+      return request_error(result, "truncated argument");
+    }
+    argument[length] = '\0';
+    if (strlen(argument) != length) {
+      return request_error(result, "argument contains a null character");
+    }
+  }
+
+  if (!read_uint64(fd, &size) || size > MAX_INPUT_SIZE) {
+    return request_error(result, "bad data length");
+  }
+
+  request->size = size;
+  request->data = malloc(size > 0 ? size : 1);
+  if (request->data == NULL) {
+    return request_error(result, "data too large");
+  }
+  if (!read_all(fd, request->data, request->size)) {
+    return request_error(result, "truncated data");
+  }
+
+  return true;
+}
+
+static void free_request(Request *request) {
+  for (int i = 0; i < request->argc; i++) {
+    free(request->argv[i]);
+  }
+  free(request->argv);
+  free(request->data);
+}
+
+static double elapsed_ms(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) * 1000.0 +
+         (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+static void send_response(int fd, bool success, const JobResult *result,
+                          double queue_ms, double wall_ms, const uint8_t *data,
+                          size_t size) {
+  Text line = EMPTY_TEXT;
+
+  text_printf(&line, "{\"status\":\"%s\",\"error\":",
+              success ? "ok" : "error");
+  write_json_string(&line, success ? "" : result->error);
+  text_printf(&line,
+              ",\"sheets\":%d,\"queue_ms\":%.3f,\"wall_ms\":%.3f,"
+              "\"output_bytes\":%zu}\n",
+              result->sheets, queue_ms, wall_ms, size);
+
+  if (write_all(fd, line.data, line.length) && size > 0) {
+    write_all(fd, data, size);
+  }
+  text_free(&line);
+}
+
+static void handle_connection(void *item, void *opaque) {
+  Connection *connection = item;
+  const Server *server = opaque;
+  Request request = {.argc = 0, .argv = NULL, .data = NULL, .size = 0};
+  JobResult result = {.sheets = 0, .error = ""};
+  AVIOContext *output = NULL;
+  uint8_t *data = NULL;
+  int size = 0;
+  bool success = false;
+  struct timespec started, finished;
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  if (read_request(connection->fd, &request, &result)) {
+    if (avio_open_dyn_buf(&output) < 0) {
+      snprintf(result.error, sizeof(result.error),
+               "unable to allocate output buffer.");
+    } else {
+      FILE *input = NULL;
+      if (request.size > 0) {
+        input = fmemopen(request.data, request.size, "r");
+      }
+
+      success = server->handler(request.argc, request.argv, input, output,
+                                &result, server->opaque);
+
+      if (input != NULL) {
+        fclose(input);
+      }
+      size = avio_close_dyn_buf(output, &data);
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+
+  verboseLog(VERBOSE_NORMAL, "job %s: %d sheet%s in %.1f ms%s%s\n",
+             success ? "completed" : "failed", result.sheets,
+             result.sheets == 1 ? "" : "s", elapsed_ms(started, finished),
+             success ? "" : ": ", success ? "" : result.error);
+
+  send_response(connection->fd, success, &result,
+                elapsed_ms(connection->accepted, started),
+                elapsed_ms(started, finished), data, size);
+
+  av_free(data);
+  free_request(&request);
+  close(connection->fd);
+  free(connection);
+}
+
+int serve(const char *socket_path, int workers, JobHandler handler,
+          void *opaque) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  struct sigaction action = {.sa_handler = stop_serving};
+  Server server = {.handler = handler, .opaque = opaque};
+  sigset_t signals;
+  WorkQueue *queue;
+  int listener;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    errOutput("socket path too long: %s", socket_path);
+  }
+  strcpy(address.sun_path, socket_path);
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    errOutput("unable to create socket: %s", strerror(errno));
+  }
+  if (bind(listener, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    errOutput("unable to listen on %s: %s", socket_path, strerror(errno));
+  }
+  if (listen(listener, SOMAXCONN) < 0) {
+    errOutput("unable to listen on %s: %s", socket_path, strerror(errno));
+  }
+
+  // Only this thread handles the signals, so that they interrupt accept().
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  queue = workqueue_new(workers, handle_connection, &server);
+
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN); // clients going away are seen by write().
+  pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+  verboseLog(VERBOSE_NORMAL, "serving on %s with %d worker%s.\n",
+             socket_path, workers, workers == 1 ? "" : "s");
+
+  while (!stopping) {
+    Connection *connection;
+    int fd = accept(listener, NULL, NULL);
+
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      errOutput("unable to accept connection: %s", strerror(errno));
+    }
+
+    connection = malloc(sizeof(Connection));
+    if (connection == NULL) {
+      errOutput("unable to allocate connection.");
+    }
+    connection->fd = fd;
+    clock_gettime(CLOCK_MONOTONIC, &connection->accepted);
+
+    workqueue_push(queue, connection);
+  }
+
+  verboseLog(VERBOSE_NORMAL, "stopping, completing the accepted jobs.\n");
+
+  close(listener);
+  unlink(socket_path);
+  workqueue_finish(queue);
+
+  return 0;
+}
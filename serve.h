@@ -0,0 +1,50 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- batch server on a Unix domain socket ------------------------------- */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <libavformat/avio.h>
+
+#include "lib/logging.h"
+
+typedef struct {
+  // Sheets processed, also when the job failed half-way.
+  int sheets;
+  char error[LOGGER_ERROR_SIZE];
+} JobResult;
+
+/**
+ * Runs the command line of a job: argv[0] is the program name, followed by
+ * options, input files and output files. Images for '-' inputs are read from
+ * input, which is NULL if the request has no data, and images for '-'
+ * outputs are written to output. opaque is the pointer given to serve().
+ * Returns false and describes the error in result on failure.
+ */
+typedef bool (*JobHandler)(int argc, char *argv[], FILE *input,
+                           AVIOContext *output, JobResult *result,
+                           void *opaque);
+
+/**
+ * Listens on the Unix domain socket at socket_path, and runs the job in each
+ * request on a pool of worker threads, until interrupted by SIGINT or
+ * SIGTERM. Jobs that were already accepted are completed before returning.
+ *
+ * A request is made of the number of arguments followed by each argument, as
+ * a length and the bytes of the argument, then the length and the bytes of
+ * the data read for '-' inputs. Numbers are unsigned big-endian, of 32 bits
+ * for the arguments and 64 bits for the data length.
+ *
+ * The response is a line with a JSON object reporting "status" ("ok" or
+ * "error"), "error", the number of "sheets" processed, the time spent in
+ * the queue ("queue_ms") and running ("wall_ms"), and the number of
+ * "output_bytes" that follow the line, holding the images written to '-'
+ * outputs.
+ */
+int serve(const char *socket_path, int workers, JobHandler handler,
+          void *opaque);
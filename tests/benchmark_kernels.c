@@ -0,0 +1,457 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Micro-benchmark for the image processing kernels.
+//
+// Every kernel runs on a synthetic scanned page (skewed text lines, a black
+// scanner border, a gray picture block and speckle noise) for each supported
+// pixel format and resolution, and the time spent is reported in nanoseconds
+// per pixel of the input page. Each run starts from a fresh copy of the page,
+// and only the kernel itself is timed.
+
+#include "lib/porting.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+#include "constants.h"
+#include "imageprocess/blit.h"
+#include "imageprocess/deskew.h"
+#include "imageprocess/filters.h"
+#include "imageprocess/image.h"
+#include "imageprocess/interpolate.h"
+#include "imageprocess/masks.h"
+#include "imageprocess/occupancy.h"
+#include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "imageprocess/row_kernels.h"
+#include "lib/logging.h"
+
+#define MAX_DPIS 8
+
+typedef struct {
+  const char *name;
+  int pixel_format;
+} Format;
+
+static const Format formats[] = {
+    {"gray8", AV_PIX_FMT_GRAY8},         {"y400a", AV_PIX_FMT_Y400A},
+    {"rgb24", AV_PIX_FMT_RGB24},         {"monowhite", AV_PIX_FMT_MONOWHITE},
+    {"monoblack", AV_PIX_FMT_MONOBLACK},
+};
+
+#define FORMATS_COUNT (sizeof(formats) / sizeof(formats[0]))
+
+// Parameters matching the command line defaults of unpaper.
+typedef struct {
+  uint8_t abs_black_threshold;
+  uint8_t abs_white_threshold;
+  BlackfilterParameters blackfilter;
+  BlurfilterParameters blurfilter;
+  GrayfilterParameters grayfilter;
+  MaskDetectionParameters mask_detection;
+  DeskewParameters deskew;
+} KernelParameters;
+
+typedef void (*KernelFunction)(Image *image, const KernelParameters *params);
+
+typedef struct {
+  const char *name;
+  KernelFunction run;
+} Kernel;
+
+static void run_blackfilter(Image *image, const KernelParameters *params) {
+  blackfilter(*image, params->blackfilter);
+}
+
+static void run_noisefilter(Image *image, const KernelParameters *params) {
+  noisefilter(*image, 4, params->abs_white_threshold);
+}
+
+static void run_blurfilter(Image *image, const KernelParameters *params) {
+  blurfilter(*image, params->blurfilter, params->abs_white_threshold);
+}
+
+static void run_grayfilter(Image *image, const KernelParameters *params) {
+  grayfilter(*image, params->grayfilter);
+}
+
+static Point page_center(Image image) {
+  return (Point){image.frame->width / 2, image.frame->height / 2};
+}
+
+static void run_detect_masks(Image *image, const KernelParameters *params) {
+  Point center = page_center(*image);
+  Rectangle masks[1];
+
+  detect_masks(*image, params->mask_detection, &center, 1, NULL, masks);
+}
+
+static void run_detect_rotation(Image *image, const KernelParameters *params) {
+  detect_rotation(*image, full_image(*image), params->deskew, NULL);
+}
+
+// The detections with --scan-decimation=4.
+static void run_detect_masks_decimated(Image *image,
+                                       const KernelParameters *params) {
+  KernelParameters decimated = *params;
+
+  decimated.mask_detection.decimation = 4;
+  run_detect_masks(image, &decimated);
+}
+
+static void run_detect_rotation_decimated(Image *image,
+                                          const KernelParameters *params) {
+  KernelParameters decimated = *params;
+
+  decimated.deskew.decimation = 4;
+  run_detect_rotation(image, &decimated);
+}
+
+// The detections with --coherent-scans, after a sheet like the page.
+static void run_detect_masks_hinted(Image *image,
+                                    const KernelParameters *params) {
+  Point center = page_center(*image);
+  RectangleSize size = size_of_image(*image);
+  // The one inch margin of the text drawn by create_page().
+  int32_t margin = size.width * 100 / 827;
+  Rectangle hint = {{{margin, 0}, {size.width - margin, size.height - 1}}};
+  Rectangle masks[1];
+
+  detect_masks(*image, params->mask_detection, &center, 1, &hint, masks);
+}
+
+static void run_detect_rotation_hinted(Image *image,
+                                       const KernelParameters *params) {
+  // The rotation detected for the skew of the text drawn by create_page().
+  float hint = -0.8 * M_PI / 180;
+
+  detect_rotation(*image, full_image(*image), params->deskew, &hint);
+}
+
+static void run_deskew(Image *image, const KernelParameters *params) {
+  (void)params;
+  deskew(*image, full_image(*image), 0.8 * M_PI / 180, INTERP_CUBIC);
+}
+
+static void run_stretch(Image *image, const KernelParameters *params) {
+  (void)params;
+  RectangleSize size = size_of_image(*image);
+
+  stretch_and_replace(
+      image, (RectangleSize){size.width * 3 / 4, size.height * 3 / 4},
+      INTERP_CUBIC);
+}
+
+// The reduction done by --post-zoom 0.5, such as from 600 to 300 dpi.
+static void run_stretch_half(Image *image, const KernelParameters *params) {
+  (void)params;
+  RectangleSize size = size_of_image(*image);
+
+  stretch_and_replace(
+      image, (RectangleSize){size.width / 2, size.height / 2}, INTERP_CUBIC);
+}
+
+static void run_flip_rotate_90(Image *image, const KernelParameters *params) {
+  (void)params;
+  flip_rotate_90(image, ROTATE_CLOCKWISE);
+}
+
+// The conversion done when saving a page in another pixel format.
+static void run_convert(Image *image, int pixel_format) {
+  Image converted =
+      create_image(size_of_image(*image), pixel_format, false,
+                   image->background, image->abs_black_threshold);
+
+  if (!convert_image(*image, converted)) {
+    copy_rectangle(*image, converted, full_image(*image), POINT_ORIGIN);
+  }
+  free_image(&converted);
+}
+
+static void run_convert_gray8(Image *image, const KernelParameters *params) {
+  (void)params;
+  run_convert(image, AV_PIX_FMT_GRAY8);
+}
+
+static void run_convert_monowhite(Image *image,
+                                  const KernelParameters *params) {
+  (void)params;
+  run_convert(image, AV_PIX_FMT_MONOWHITE);
+}
+
+static const Kernel kernels[] = {
+    {"blackfilter", run_blackfilter},
+    {"noisefilter", run_noisefilter},
+    {"blurfilter", run_blurfilter},
+    {"grayfilter", run_grayfilter},
+    {"detect_masks", run_detect_masks},
+    {"detect_rotation", run_detect_rotation},
+    {"detect_masks_decimated", run_detect_masks_decimated},
+    {"detect_rotation_decimated", run_detect_rotation_decimated},
+    {"detect_masks_hinted", run_detect_masks_hinted},
+    {"detect_rotation_hinted", run_detect_rotation_hinted},
+    {"deskew", run_deskew},
+    {"stretch_and_replace", run_stretch},
+    {"stretch_half", run_stretch_half},
+    {"flip_rotate_90", run_flip_rotate_90},
+    {"convert_gray8", run_convert_gray8},
+    {"convert_monowhite", run_convert_monowhite},
+};
+
+#define KERNELS_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+
+static void init_parameters(KernelParameters *params, RectangleSize page) {
+  const int32_t mask_scan_depth[DIRECTIONS_COUNT] = {-1, -1};
+  const float mask_scan_threshold[DIRECTIONS_COUNT] = {0.1, 0.1};
+  const int mask_scan_minimum[DIMENSIONS_COUNT] = {100, 100};
+  const int mask_scan_maximum[DIMENSIONS_COUNT] = {page.width, page.height};
+  const Edges deskew_scan_edges = {
+      .left = true, .top = false, .right = true, .bottom = false};
+
+  params->abs_black_threshold = WHITE * (1.0 - 0.33);
+  params->abs_white_threshold = WHITE * 0.9;
+
+  if (!validate_blackfilter_parameters(
+          &params->blackfilter, (RectangleSize){20, 20}, (Delta){5, 5}, 500,
+          500, DIRECTION_BOTH, 0.95, 20, 0, NULL) ||
+      !validate_blurfilter_parameters(&params->blurfilter,
+                                      (RectangleSize){100, 100},
+                                      (Delta){50, 50}, 0.01) ||
+      !validate_grayfilter_parameters(
+          &params->grayfilter, (RectangleSize){50, 50}, (Delta){20, 20}, 0.5) ||
+      !validate_mask_detection_parameters(
+          &params->mask_detection, DIRECTION_HORIZONTAL,
+          (RectangleSize){50, 50}, mask_scan_depth, (Delta){5, 5},
+          mask_scan_threshold, mask_scan_minimum, mask_scan_maximum, 1) ||
+      !validate_deskew_parameters(&params->deskew, 5.0, 0.1, 1.0, 1500, 0.5,
+                                  deskew_scan_edges, 1)) {
+    errOutput("benchmark parameters are not valid.");
+  }
+}
+
+// Small deterministic generator, so that every run sees the same page.
+static uint32_t next_random(uint32_t *state) {
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 16) & 0x7fff;
+}
+
+/**
+ * Draws an A4 page scanned at the given resolution: a black scanner border
+ * on the left and bottom edges, lines of skewed text inside a one inch
+ * margin, a gray picture block and scattered speckles.
+ */
+static Image create_page(int dpi, uint8_t abs_black_threshold) {
+  RectangleSize size = {.width = 827 * dpi / 100, .height = 1169 * dpi / 100};
+  Image page = create_image(size, AV_PIX_FMT_RGB24, true, PIXEL_WHITE,
+                            abs_black_threshold);
+  uint32_t state = 42;
+  int32_t margin = dpi;
+  int32_t border = dpi * 15 / 100;
+  float slope = tanf(0.8 * M_PI / 180);
+
+  wipe_rectangle(page, (Rectangle){{{0, 0}, {border, size.height - 1}}},
+                 (Pixel){20, 20, 20});
+  wipe_rectangle(page,
+                 (Rectangle){{{0, size.height - border},
+                              {size.width - 1, size.height - 1}}},
+                 (Pixel){20, 20, 20});
+
+  wipe_rectangle(page,
+                 (Rectangle){{{size.width / 2, size.height / 2},
+                              {size.width - margin, size.height / 2 + dpi}}},
+                 (Pixel){150, 160, 170});
+
+  int32_t line_height = dpi / 10;
+  for (int32_t line_y = margin; line_y < size.height / 2 - line_height;
+       line_y += dpi / 5) {
+    int32_t x = margin;
+    while (true) {
+      int32_t word = dpi / 20 + next_random(&state) % (dpi * 35 / 100);
+      if (x + word > size.width - margin) {
+        break;
+      }
+      Pixel ink = {next_random(&state) % 40, next_random(&state) % 40,
+                   next_random(&state) % 60};
+      for (int32_t wx = x; wx < x + word; wx++) {
+        int32_t y = line_y + (int32_t)((wx - margin) * slope);
+        wipe_rectangle(page, (Rectangle){{{wx, y}, {wx, y + line_height}}},
+                       ink);
+      }
+      x += word + dpi / 20;
+    }
+  }
+
+  uint64_t speckles = (uint64_t)size.width * size.height / 2000;
+  for (uint64_t i = 0; i < speckles; i++) {
+    Point p = {(next_random(&state) << 15 | next_random(&state)) % size.width,
+               (next_random(&state) << 15 | next_random(&state)) %
+                   size.height};
+    wipe_rectangle(page, (Rectangle){{p, {p.x + 1, p.y + 1}}}, PIXEL_BLACK);
+  }
+
+  return page;
+}
+
+static Image copy_page(Image page, int pixel_format,
+                       uint8_t abs_white_threshold) {
+  // Padded like the sheets that unpaper processes.
+  Image copy = create_padded_image(size_of_image(page), pixel_format, false,
+                                   page.background, page.abs_black_threshold,
+                                   INTERPOLATION_APRON);
+
+  copy_rectangle(page, copy, full_image(page), POINT_ORIGIN);
+  image_enable_planes(&copy);
+  image_enable_occupancy(&copy, abs_white_threshold);
+  return copy;
+}
+
+static double elapsed_ns(struct timespec start, struct timespec end) {
+  return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static bool selected(const char *list, const char *name) {
+  if (list == NULL) {
+    return true;
+  }
+
+  size_t length = strlen(name);
+  for (const char *item = list; item != NULL;
+       item = strchr(item, ','), item = item ? item + 1 : NULL) {
+    if (strncmp(item, name, length) == 0 &&
+        (item[length] == ',' || item[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: benchmark_kernels [--kernels=LIST] [--formats=LIST]\n"
+          "                         [--dpi=LIST] [--repeat=N] [--scalar]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *kernel_list = NULL;
+  const char *format_list = NULL;
+  int dpis[MAX_DPIS] = {150, 300};
+  int dpis_count = 2;
+  int repeat = 3;
+
+  static const struct option long_options[] = {
+      {"kernels", required_argument, NULL, 'k'},
+      {"formats", required_argument, NULL, 'f'},
+      {"dpi", required_argument, NULL, 'd'},
+      {"repeat", required_argument, NULL, 'r'},
+      {"scalar", no_argument, NULL, 's'},
+      {NULL, no_argument, NULL, 0}};
+
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+    switch (c) {
+    case 'k':
+      kernel_list = optarg;
+      break;
+    case 'f':
+      format_list = optarg;
+      break;
+    case 'd':
+      dpis_count = 0;
+      for (char *item = optarg; item != NULL && dpis_count < MAX_DPIS;) {
+        char *end;
+        dpis[dpis_count++] = strtol(item, &end, 10);
+        item = (*end == ',') ? end + 1 : NULL;
+      }
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      break;
+    case 's':
+      // Disable the SIMD dispatch to measure the portable implementations.
+      av_force_cpu_flags(0);
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (repeat < 1) {
+    usage();
+  }
+  for (int i = 0; i < dpis_count; i++) {
+    if (dpis[i] < 50) {
+      usage();
+    }
+  }
+
+  double *samples = malloc(repeat * sizeof(double));
+
+  printf("# row kernels: %s\n", get_row_kernels()->name);
+  printf("%-26s %-10s %5s %10s %14s %14s\n", "kernel", "format", "dpi",
+         "pixels", "best ns/px", "median ns/px");
+
+  for (int d = 0; d < dpis_count; d++) {
+    KernelParameters params;
+    Image page = create_page(dpis[d], WHITE * (1.0 - 0.33));
+    RectangleSize size = size_of_image(page);
+    uint64_t pixels = (uint64_t)size.width * size.height;
+
+    init_parameters(&params, size);
+
+    for (size_t f = 0; f < FORMATS_COUNT; f++) {
+      if (!selected(format_list, formats[f].name)) {
+        continue;
+      }
+
+      for (size_t k = 0; k < KERNELS_COUNT; k++) {
+        if (!selected(kernel_list, kernels[k].name)) {
+          continue;
+        }
+
+        for (int r = 0; r < repeat; r++) {
+          struct timespec start, end;
+          Image image = copy_page(page, formats[f].pixel_format,
+                                  params.abs_white_threshold);
+
+          clock_gettime(CLOCK_MONOTONIC, &start);
+          kernels[k].run(&image, &params);
+          clock_gettime(CLOCK_MONOTONIC, &end);
+
+          samples[r] = elapsed_ns(start, end) / pixels;
+          free_image(&image);
+        }
+
+        qsort(samples, repeat, sizeof(double), compare_double);
+        printf("%-26s %-10s %5d %10" PRIu64 " %14.3f %14.3f\n",
+               kernels[k].name, formats[f].name, dpis[d], pixels, samples[0],
+               samples[repeat / 2]);
+        fflush(stdout);
+      }
+    }
+
+    free_image(&page);
+  }
+
+  free(samples);
+  return 0;
+}
@@ -0,0 +1,293 @@
+# SPDX-FileCopyrightText: 2021 The unpaper authors
+#
+# SPDX-License-Identifier: GPL-2.0-only
+# SPDX-License-Identifier: MIT
+
+"""End-to-end throughput benchmark.
+
+Generates a reproducible corpus of synthetic scans (skewed text blocks, black
+scanner borders, speckle noise, single pages and two-page spreads) for each
+requested resolution and color mode, runs the full unpaper pipeline over each
+set with fixed options, and reports throughput, per-sheet latency percentiles
+and peak resident memory.
+
+Per-sheet latencies are taken from the `--stats=json` report, peak RSS from
+the resource usage of the unpaper process.
+"""
+
+import argparse
+import json
+import math
+import os
+import pathlib
+import random
+import subprocess
+import sys
+import tempfile
+import time
+from typing import List, NamedTuple, Sequence
+
+import PIL.Image
+import PIL.ImageDraw
+
+A4_INCHES = (8.27, 11.69)
+
+MODES = {
+    "bilevel": ("1", "pbm"),
+    "gray": ("L", "pgm"),
+    "color": ("RGB", "ppm"),
+}
+
+LAYOUTS = ("single", "double")
+
+
+class Result(NamedTuple):
+    name: str
+    sheets: int
+    seconds: float
+    latencies_ms: List[float]
+    peak_rss_kib: int
+
+
+def ink(rng: random.Random, mode: str):
+    if mode == "RGB":
+        return (rng.randrange(40), rng.randrange(40), rng.randrange(80))
+    return 0 if mode == "1" else rng.randrange(40)
+
+
+def draw_page(
+    image: PIL.Image.Image, box: Sequence[int], dpi: int, rng: random.Random
+) -> None:
+    """Draws text-like blocks of words inside box, rotated by a small skew."""
+
+    left, top, right, bottom = box
+    width, height = right - left, bottom - top
+    page = PIL.Image.new(image.mode, (width, height), "white")
+    draw = PIL.ImageDraw.Draw(page)
+
+    margin = dpi
+    line_y = margin
+    while line_y < height - margin:
+        # Paragraphs of 4 to 12 lines, separated by an empty line.
+        for _ in range(rng.randint(4, 12)):
+            if line_y >= height - margin:
+                break
+            x = margin
+            while True:
+                word = rng.randint(dpi // 20, dpi * 2 // 5)
+                if x + word > width - margin:
+                    break
+                draw.rectangle(
+                    (x, line_y, x + word, line_y + dpi // 10),
+                    fill=ink(rng, image.mode),
+                )
+                x += word + dpi // 20
+            line_y += dpi // 5
+        line_y += dpi // 5
+
+    skew = rng.uniform(-2.0, 2.0)
+    page = page.rotate(
+        skew,
+        resample=PIL.Image.NEAREST if image.mode == "1" else PIL.Image.BICUBIC,
+        fillcolor="white",
+    )
+    image.paste(page, (left, top))
+
+
+def generate_sheet(mode: str, dpi: int, layout: str, seed: int) -> PIL.Image.Image:
+    rng = random.Random(seed)
+    page_width = int(A4_INCHES[0] * dpi)
+    page_height = int(A4_INCHES[1] * dpi)
+    pages = 2 if layout == "double" else 1
+
+    sheet = PIL.Image.new(mode, (page_width * pages, page_height), "white")
+    for page in range(pages):
+        draw_page(
+            sheet,
+            (page_width * page, 0, page_width * (page + 1), page_height),
+            dpi,
+            rng,
+        )
+
+    draw = PIL.ImageDraw.Draw(sheet)
+    black = 0 if mode != "RGB" else (0, 0, 0)
+
+    # Scanner borders of varying thickness along the edges of the glass.
+    border = dpi * rng.randint(5, 25) // 100
+    draw.rectangle((0, 0, border, page_height), fill=black)
+    border = dpi * rng.randint(5, 25) // 100
+    draw.rectangle(
+        (0, page_height - border, sheet.width, page_height), fill=black
+    )
+
+    # Speckle noise, single pixels and small clusters.
+    for _ in range(sheet.width * sheet.height // 4000):
+        x = rng.randrange(sheet.width - 2)
+        y = rng.randrange(sheet.height - 2)
+        size = rng.choice((0, 0, 0, 1))
+        draw.rectangle((x, y, x + size, y + size), fill=black)
+
+    return sheet
+
+
+def generate_corpus(
+    directory: pathlib.Path, mode: str, dpi: int, layout: str, sheets: int
+) -> str:
+    """Writes the sheets of a corpus, returns the input file pattern."""
+
+    pil_mode, extension = MODES[mode]
+    for index in range(1, sheets + 1):
+        sheet = generate_sheet(pil_mode, dpi, layout, seed=dpi * 1000 + index)
+        sheet.save(directory / f"sheet-{index:03d}.{extension}")
+
+    return str(directory / f"sheet-%03d.{extension}")
+
+
+def run_corpus(
+    unpaper: str,
+    name: str,
+    input_pattern: str,
+    output_directory: pathlib.Path,
+    dpi: int,
+    layout: str,
+    extension: str,
+) -> Result:
+    cmdline = [
+        unpaper,
+        "--quiet",
+        "--overwrite",
+        "--stats=json",
+        "--dpi",
+        str(dpi),
+        "--layout",
+        layout,
+    ]
+    if layout == "double":
+        cmdline += ["--output-pages", "2"]
+    cmdline += [input_pattern, str(output_directory / f"out-%03d.{extension}")]
+
+    start = time.monotonic()
+    process = subprocess.Popen(
+        cmdline, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True
+    )
+    stderr = process.stderr.read()
+    _, status, rusage = os.wait4(process.pid, 0)
+    seconds = time.monotonic() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+
+    if process.returncode != 0:
+        sys.stderr.write(stderr)
+        raise RuntimeError(f"unpaper failed on {name}")
+
+    latencies = []
+    for line in stderr.splitlines():
+        try:
+            report = json.loads(line)
+        except ValueError:
+            continue
+        if "sheet" in report:
+            latencies.append(report["wall_ms"])
+
+    # ru_maxrss is reported in KiB on Linux.
+    return Result(name, len(latencies), seconds, latencies, rusage.ru_maxrss)
+
+
+def percentile(values: Sequence[float], fraction: float) -> float:
+    """Nearest-rank percentile."""
+
+    ordered = sorted(values)
+    rank = max(1, math.ceil(fraction * len(ordered)))
+    return ordered[rank - 1]
+
+
+def parse_list(value: str) -> List[str]:
+    return [item for item in value.split(",") if item]
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument(
+        "--unpaper",
+        default=os.getenv("TEST_UNPAPER_BINARY", "unpaper"),
+        help="unpaper binary to benchmark",
+    )
+    parser.add_argument("--dpi", type=parse_list, default=["150", "300", "600"])
+    parser.add_argument("--modes", type=parse_list, default=list(MODES))
+    parser.add_argument("--layouts", type=parse_list, default=list(LAYOUTS))
+    parser.add_argument(
+        "--sheets", type=int, default=5, help="sheets per corpus"
+    )
+    parser.add_argument(
+        "--corpus-dir",
+        type=pathlib.Path,
+        help="keep the generated corpus and outputs in this directory",
+    )
+    parser.add_argument(
+        "--json", action="store_true", help="print one JSON object per corpus"
+    )
+    args = parser.parse_args()
+
+    for mode in args.modes:
+        if mode not in MODES:
+            parser.error(f"unknown mode {mode!r}")
+    for layout in args.layouts:
+        if layout not in LAYOUTS:
+            parser.error(f"unknown layout {layout!r}")
+
+    with tempfile.TemporaryDirectory(prefix="unpaper-benchmark-") as tmp:
+        base = args.corpus_dir or pathlib.Path(tmp)
+
+        if not args.json:
+            print(
+                f"{'corpus':<24} {'sheets':>6} {'pages/s':>8} "
+                f"{'p50 ms':>9} {'p99 ms':>9} {'peak RSS MiB':>13}"
+            )
+
+        for dpi in (int(dpi) for dpi in args.dpi):
+            for mode in args.modes:
+                for layout in args.layouts:
+                    name = f"{mode}-{dpi}dpi-{layout}"
+                    directory = base / name
+                    directory.mkdir(parents=True, exist_ok=True)
+
+                    pattern = generate_corpus(
+                        directory, mode, dpi, layout, args.sheets
+                    )
+                    result = run_corpus(
+                        args.unpaper,
+                        name,
+                        pattern,
+                        directory,
+                        dpi,
+                        layout,
+                        MODES[mode][1],
+                    )
+                    pages = result.sheets * (2 if layout == "double" else 1)
+                    report = {
+                        "corpus": name,
+                        "sheets": result.sheets,
+                        "pages": pages,
+                        "seconds": round(result.seconds, 3),
+                        "pages_per_second": pages / result.seconds,
+                        "p50_ms": percentile(result.latencies_ms, 0.50),
+                        "p99_ms": percentile(result.latencies_ms, 0.99),
+                        "peak_rss_kib": result.peak_rss_kib,
+                    }
+
+                    if args.json:
+                        print(json.dumps(report))
+                    else:
+                        print(
+                            f"{name:<24} {result.sheets:>6} "
+                            f"{report['pages_per_second']:>8.2f} "
+                            f"{report['p50_ms']:>9.1f} "
+                            f"{report['p99_ms']:>9.1f} "
+                            f"{result.peak_rss_kib / 1024:>13.1f}"
+                        )
+                    sys.stdout.flush()
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
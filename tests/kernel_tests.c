@@ -0,0 +1,515 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+// Unit tests for the image processing kernels.
+//
+// Each row kernel set that is compiled in and supported by the running CPU
+// is checked against the scalar one, and against the per-pixel accessors and
+// copy_rectangle() conversions they replace, on random rows of widths around
+// the vector sizes. Images shrunk by whole factors are checked against the
+// averages of their blocks.
+
+#include "lib/porting.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/blit.h"
+#include "imageprocess/image.h"
+#include "imageprocess/interpolate.h"
+#include "imageprocess/pixel.h"
+#include "imageprocess/pyramid.h"
+#include "imageprocess/row_kernels.h"
+
+#define ROWS_PER_WIDTH 8
+
+static const int32_t widths[] = {1, 15, 16, 17, 31, 33, 63, 65, 140};
+#define WIDTHS_COUNT (sizeof(widths) / sizeof(widths[0]))
+
+static const uint8_t thresholds[] = {0, 127, 255};
+#define THRESHOLDS_COUNT (sizeof(thresholds) / sizeof(thresholds[0]))
+
+// The CPU flag that selects each kernel set in get_row_kernels(), fastest
+// first, and none for the scalar one. The flag values overlap across
+// architectures, so sets that come up again are skipped.
+static const int kernel_flags[] = {AV_CPU_FLAG_AVX2, AV_CPU_FLAG_SSE2,
+                                   AV_CPU_FLAG_NEON, 0};
+#define KERNEL_FLAGS_COUNT (sizeof(kernel_flags) / sizeof(kernel_flags[0]))
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                                                  \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);                          \
+      fprintf(stderr, __VA_ARGS__);                                            \
+      fprintf(stderr, "\n");                                                   \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static uint32_t random_state = 2463534242u;
+
+// xorshift32, so that the rows are the same on every platform.
+static uint32_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+// Fills bytes with random values, a quarter of them black or white so that
+// the thresholds are hit.
+static void fill_random(uint8_t *bytes, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    uint32_t value = next_random();
+
+    switch (value % 8) {
+    case 0:
+      bytes[i] = 0;
+      break;
+    case 1:
+      bytes[i] = UINT8_MAX;
+      break;
+    default:
+      bytes[i] = value >> 24;
+    }
+  }
+}
+
+// Returns a one row image holding bytes.
+static Image row_image(const uint8_t *bytes, int32_t width, int format,
+                       uint8_t threshold) {
+  size_t components = format == AV_PIX_FMT_RGB24 ? 3 : 1;
+  Image image = create_image((RectangleSize){width, 1}, format, false,
+                             PIXEL_WHITE, threshold);
+
+  memcpy(image.frame->data[0], bytes, width * components);
+  return image;
+}
+
+// Copies source into a new image of another pixel format, pixel by pixel.
+static Image copy_to_format(Image source, int format, uint8_t threshold) {
+  Image target = create_image(size_of_image(source), format, true,
+                              PIXEL_WHITE, threshold);
+
+  copy_rectangle(source, target, full_image(source), POINT_ORIGIN);
+  return target;
+}
+
+static uint64_t sum_pixels(Image image,
+                           uint8_t (*get)(Image image, Point coords)) {
+  uint64_t sum = 0;
+
+  for (int32_t x = 0; x < image.frame->width; x++) {
+    sum += get(image, (Point){x, 0});
+  }
+  return sum;
+}
+
+static void test_sums(const RowKernels *kernels, const RowKernels *scalar,
+                      int32_t width) {
+  uint8_t *gray = malloc(width);
+  uint8_t *rgb = malloc(width * 3);
+
+  fill_random(gray, width);
+  fill_random(rgb, width * 3);
+
+  Image gray_image = row_image(gray, width, AV_PIX_FMT_GRAY8, 0);
+  Image rgb_image = row_image(rgb, width, AV_PIX_FMT_RGB24, 0);
+
+  uint64_t sum = kernels->sum_gray8(gray, width);
+  CHECK(sum == scalar->sum_gray8(gray, width), "%s sum_gray8 width %" PRId32,
+        kernels->name, width);
+  CHECK(sum == sum_pixels(gray_image, get_pixel_grayscale),
+        "%s sum_gray8 width %" PRId32 " differs from the pixels",
+        kernels->name, width);
+
+  sum = kernels->sum_rgb24_grayscale(rgb, width);
+  CHECK(sum == scalar->sum_rgb24_grayscale(rgb, width),
+        "%s sum_rgb24_grayscale width %" PRId32, kernels->name, width);
+  CHECK(sum == sum_pixels(rgb_image, get_pixel_grayscale),
+        "%s sum_rgb24_grayscale width %" PRId32 " differs from the pixels",
+        kernels->name, width);
+
+  sum = kernels->sum_rgb24_lightness(rgb, width);
+  CHECK(sum == scalar->sum_rgb24_lightness(rgb, width),
+        "%s sum_rgb24_lightness width %" PRId32, kernels->name, width);
+  CHECK(sum == sum_pixels(rgb_image, get_pixel_lightness),
+        "%s sum_rgb24_lightness width %" PRId32 " differs from the pixels",
+        kernels->name, width);
+
+  sum = kernels->sum_rgb24_darkness_inverse(rgb, width);
+  CHECK(sum == scalar->sum_rgb24_darkness_inverse(rgb, width),
+        "%s sum_rgb24_darkness_inverse width %" PRId32, kernels->name, width);
+  CHECK(sum == sum_pixels(rgb_image, get_pixel_darkness_inverse),
+        "%s sum_rgb24_darkness_inverse width %" PRId32
+        " differs from the pixels",
+        kernels->name, width);
+
+  free_image(&gray_image);
+  free_image(&rgb_image);
+  free(gray);
+  free(rgb);
+}
+
+// Counts, and clears if asked to, the pixels of a one row image within
+// [min, max] a pixel at a time.
+static uint64_t count_within(Image image, uint8_t min, uint8_t max,
+                             bool clear) {
+  uint64_t count = 0;
+
+  for (int32_t x = 0; x < image.frame->width; x++) {
+    uint8_t grayscale = get_pixel_grayscale(image, (Point){x, 0});
+    if (grayscale < min || grayscale > max) {
+      continue;
+    }
+
+    if (clear) {
+      set_pixel(image, (Point){x, 0}, PIXEL_WHITE);
+    }
+    count++;
+  }
+  return count;
+}
+
+static void test_count(const RowKernels *kernels, RowCountKernel kernel,
+                       RowCountKernel scalar, const char *name, int format,
+                       int32_t width, uint8_t min, uint8_t max, bool clear) {
+  size_t size = width * (format == AV_PIX_FMT_RGB24 ? 3 : 1);
+  uint8_t *row = malloc(size);
+  uint8_t *expected = malloc(size);
+
+  fill_random(row, size);
+  memcpy(expected, row, size);
+
+  Image image = row_image(row, width, format, 0);
+  uint64_t count = kernel(row, width, min, max, clear);
+
+  CHECK(count == scalar(expected, width, min, max, clear),
+        "%s %s width %" PRId32 " [%d,%d]", kernels->name, name, width, min,
+        max);
+  CHECK(memcmp(row, expected, size) == 0,
+        "%s %s width %" PRId32 " [%d,%d] cleared other pixels", kernels->name,
+        name, width, min, max);
+  CHECK(count == count_within(image, min, max, clear),
+        "%s %s width %" PRId32 " [%d,%d] differs from the pixels",
+        kernels->name, name, width, min, max);
+  CHECK(memcmp(row, image.frame->data[0], size) == 0,
+        "%s %s width %" PRId32 " [%d,%d] cleared other pixels than set_pixel",
+        kernels->name, name, width, min, max);
+
+  free_image(&image);
+  free(row);
+  free(expected);
+}
+
+static void test_counts(const RowKernels *kernels, const RowKernels *scalar,
+                        int32_t width) {
+  for (size_t t = 0; t < THRESHOLDS_COUNT; t++) {
+    uint8_t threshold = thresholds[t];
+
+    for (int clear = 0; clear <= 1; clear++) {
+      test_count(kernels, kernels->count_gray8_within,
+                 scalar->count_gray8_within, "count_gray8_within",
+                 AV_PIX_FMT_GRAY8, width, 0, threshold, clear);
+      test_count(kernels, kernels->count_gray8_within,
+                 scalar->count_gray8_within, "count_gray8_within",
+                 AV_PIX_FMT_GRAY8, width, threshold, UINT8_MAX, clear);
+      test_count(kernels, kernels->count_rgb24_within,
+                 scalar->count_rgb24_within, "count_rgb24_within",
+                 AV_PIX_FMT_RGB24, width, 0, threshold, clear);
+      test_count(kernels, kernels->count_rgb24_within,
+                 scalar->count_rgb24_within, "count_rgb24_within",
+                 AV_PIX_FMT_RGB24, width, threshold, UINT8_MAX, clear);
+    }
+  }
+}
+
+static void test_convert(const RowKernels *kernels, const RowKernels *scalar,
+                         int32_t width) {
+  uint8_t *rgb = malloc(width * 3);
+  uint8_t *gray = malloc(width);
+  uint8_t *expected = malloc(width);
+
+  fill_random(rgb, width * 3);
+  kernels->convert_rgb24_to_gray8(rgb, gray, width);
+  scalar->convert_rgb24_to_gray8(rgb, expected, width);
+  CHECK(memcmp(gray, expected, width) == 0,
+        "%s convert_rgb24_to_gray8 width %" PRId32, kernels->name, width);
+
+  Image source = row_image(rgb, width, AV_PIX_FMT_RGB24, 0);
+  Image target = copy_to_format(source, AV_PIX_FMT_GRAY8, 0);
+  CHECK(memcmp(gray, target.frame->data[0], width) == 0,
+        "%s convert_rgb24_to_gray8 width %" PRId32
+        " differs from copy_rectangle",
+        kernels->name, width);
+
+  free_image(&source);
+  free_image(&target);
+  free(rgb);
+  free(gray);
+  free(expected);
+}
+
+static void test_pack(const RowKernels *kernels, const RowKernels *scalar,
+                      int32_t width, uint8_t threshold) {
+  size_t bytes = (width + 7) / 8;
+  uint8_t *gray = malloc(width);
+  uint8_t *bits = malloc(bytes);
+  uint8_t *expected = malloc(bytes);
+
+  fill_random(gray, width);
+  // The padding bits must be cleared, whatever was there before.
+  memset(bits, 0xFF, bytes);
+  kernels->pack_gray8_to_monowhite(gray, bits, width, threshold);
+  scalar->pack_gray8_to_monowhite(gray, expected, width, threshold);
+  CHECK(memcmp(bits, expected, bytes) == 0,
+        "%s pack_gray8_to_monowhite width %" PRId32 " threshold %d",
+        kernels->name, width, threshold);
+
+  Image source = row_image(gray, width, AV_PIX_FMT_GRAY8, threshold);
+  Image target = copy_to_format(source, AV_PIX_FMT_MONOWHITE, threshold);
+  const uint8_t *copied = target.frame->data[0];
+  uint8_t padding = 0xFF >> (width % 8 == 0 ? 8 : width % 8);
+  CHECK(memcmp(bits, copied, bytes - 1) == 0 &&
+            (bits[bytes - 1] & ~padding) == (copied[bytes - 1] & ~padding),
+        "%s pack_gray8_to_monowhite width %" PRId32 " threshold %d"
+        " differs from copy_rectangle",
+        kernels->name, width, threshold);
+
+  free_image(&source);
+  free_image(&target);
+  free(gray);
+  free(bits);
+  free(expected);
+}
+
+static void test_row_kernels(const RowKernels *kernels,
+                             const RowKernels *scalar) {
+  for (size_t w = 0; w < WIDTHS_COUNT; w++) {
+    for (int r = 0; r < ROWS_PER_WIDTH; r++) {
+      test_sums(kernels, scalar, widths[w]);
+      test_counts(kernels, scalar, widths[w]);
+      test_convert(kernels, scalar, widths[w]);
+      for (size_t t = 0; t < THRESHOLDS_COUNT; t++) {
+        test_pack(kernels, scalar, widths[w], thresholds[t]);
+      }
+    }
+  }
+}
+
+// Whole factors to shrink by, and the size shrunk to. The sources are one
+// pixel short of another block on each axis, which the reduction drops.
+static const RectangleSize byte_factors[] = {{2, 2}, {3, 3}, {2, 3}, {5, 4}};
+static const RectangleSize bit_factors[] = {{2, 2}, {4, 4}, {2, 4}, {4, 2}};
+static const RectangleSize reduced_size = {13, 5};
+
+#define FACTORS_COUNT (sizeof(byte_factors) / sizeof(byte_factors[0]))
+
+static Image random_image(RectangleSize size, int format, uint8_t threshold) {
+  Image image = create_image(size, format, false, PIXEL_WHITE, threshold);
+
+  for (int32_t y = 0; y < size.height; y++) {
+    fill_random(image.frame->data[0] + y * image.frame->linesize[0],
+                image.frame->linesize[0]);
+  }
+  return image;
+}
+
+// Returns a copy of source shrunk to reduced_size.
+static Image shrink(Image source) {
+  Image image = create_image(size_of_image(source), source.frame->format,
+                             false, PIXEL_WHITE, source.abs_black_threshold);
+
+  copy_rectangle(source, image, full_image(source), POINT_ORIGIN);
+  stretch_and_replace(&image, reduced_size, INTERP_CUBIC);
+  return image;
+}
+
+// Sums the component c (0 to 2 for red to blue) of a block of pixels.
+static uint32_t sum_block(Image image, Point origin, RectangleSize factor,
+                          int c) {
+  uint32_t sum = 0;
+
+  for (int32_t dy = 0; dy < factor.height; dy++) {
+    for (int32_t dx = 0; dx < factor.width; dx++) {
+      Pixel pixel = get_pixel(image, (Point){origin.x + dx, origin.y + dy});
+      sum += c == 0 ? pixel.r : c == 1 ? pixel.g : pixel.b;
+    }
+  }
+  return sum;
+}
+
+static void test_reduce_bytes(int format, RectangleSize factor) {
+  RectangleSize size = {
+      reduced_size.width * factor.width + factor.width - 1,
+      reduced_size.height * factor.height + factor.height - 1,
+  };
+  Image source = random_image(size, format, 0);
+  Image reduced = shrink(source);
+  uint32_t area = factor.width * factor.height;
+
+  for (int32_t y = 0; y < reduced_size.height; y++) {
+    for (int32_t x = 0; x < reduced_size.width; x++) {
+      Point origin = {x * factor.width, y * factor.height};
+      Pixel pixel = get_pixel(reduced, (Point){x, y});
+      uint8_t values[3] = {pixel.r, pixel.g, pixel.b};
+
+      for (int c = 0; c < 3; c++) {
+        uint32_t sum = sum_block(source, origin, factor, c);
+        CHECK(values[c] == (sum + area / 2) / area,
+              "%s by %dx%d: (%d,%d) component %d is %d, not the average of "
+              "%" PRIu32 " over %" PRIu32,
+              av_get_pix_fmt_name(format), factor.width, factor.height, x, y,
+              c, values[c], sum, area);
+      }
+    }
+  }
+
+  free_image(&source);
+  free_image(&reduced);
+}
+
+static void test_reduce_bits(int format, RectangleSize factor,
+                             uint8_t threshold) {
+  RectangleSize size = {
+      reduced_size.width * factor.width + factor.width - 1,
+      reduced_size.height * factor.height + factor.height - 1,
+  };
+  Image source = random_image(size, format, threshold);
+  Image reduced = shrink(source);
+  uint32_t area = factor.width * factor.height;
+
+  for (int32_t y = 0; y < reduced_size.height; y++) {
+    for (int32_t x = 0; x < reduced_size.width; x++) {
+      Point origin = {x * factor.width, y * factor.height};
+      uint32_t average =
+          (sum_block(source, origin, factor, 0) + area / 2) / area;
+      Pixel expected = average < threshold ? PIXEL_BLACK : PIXEL_WHITE;
+
+      CHECK(compare_pixel(get_pixel(reduced, (Point){x, y}), expected) == 0,
+            "%s by %dx%d threshold %d: (%d,%d) is not %s for an average of "
+            "%" PRIu32,
+            av_get_pix_fmt_name(format), factor.width, factor.height,
+            threshold, x, y, average < threshold ? "black" : "white",
+            average);
+    }
+  }
+
+  free_image(&source);
+  free_image(&reduced);
+}
+
+// Two rows of 5 pixels shrunk by 2: the last column is dropped, and the
+// averages are rounded half up.
+static void test_reduce_example(void) {
+  static const uint8_t rows[2][5] = {{0, 255, 10, 20, 99}, {1, 2, 30, 40, 99}};
+  Image image = create_image((RectangleSize){5, 2}, AV_PIX_FMT_GRAY8, false,
+                             PIXEL_WHITE, 0);
+
+  for (int32_t y = 0; y < 2; y++) {
+    memcpy(image.frame->data[0] + y * image.frame->linesize[0], rows[y], 5);
+  }
+  stretch_and_replace(&image, (RectangleSize){2, 1}, INTERP_CUBIC);
+
+  CHECK(image.frame->data[0][0] == 65 && image.frame->data[0][1] == 25,
+        "GRAY8 example reduced to %d,%d rather than 65,25",
+        image.frame->data[0][0], image.frame->data[0][1]);
+  free_image(&image);
+}
+
+// Three rows of 5 pixels decimated by 2: the partial blocks of the last
+// column and row are averaged over the pixels they cover, and the averages
+// are truncated.
+static void test_decimate_example(void) {
+  static const uint8_t rows[3][5] = {
+      {0, 255, 10, 20, 99}, {1, 2, 30, 40, 98}, {7, 8, 9, 10, 11}};
+  static const uint8_t expected[2][3] = {{64, 25, 98}, {7, 9, 11}};
+  Image image = create_image((RectangleSize){5, 3}, AV_PIX_FMT_GRAY8, false,
+                             PIXEL_WHITE, 0);
+
+  for (int32_t y = 0; y < 3; y++) {
+    memcpy(image.frame->data[0] + y * image.frame->linesize[0], rows[y], 5);
+  }
+  Image decimated = decimate_image(image, PLANE_GRAYSCALE, 2);
+
+  for (int32_t y = 0; y < 2; y++) {
+    for (int32_t x = 0; x < 3; x++) {
+      uint8_t value =
+          decimated.frame->data[0][y * decimated.frame->linesize[0] + x];
+      CHECK(value == expected[y][x],
+            "GRAY8 example decimated to %d at (%d,%d) rather than %d", value,
+            x, y, expected[y][x]);
+    }
+  }
+  free_image(&image);
+  free_image(&decimated);
+}
+
+static void test_reductions(void) {
+  test_reduce_example();
+  test_decimate_example();
+
+  for (size_t f = 0; f < FACTORS_COUNT; f++) {
+    test_reduce_bytes(AV_PIX_FMT_RGB24, byte_factors[f]);
+    test_reduce_bytes(AV_PIX_FMT_GRAY8, byte_factors[f]);
+
+    for (size_t t = 0; t < THRESHOLDS_COUNT; t++) {
+      test_reduce_bits(AV_PIX_FMT_MONOWHITE, bit_factors[f], thresholds[t]);
+      test_reduce_bits(AV_PIX_FMT_MONOBLACK, bit_factors[f], thresholds[t]);
+    }
+  }
+}
+
+int main(void) {
+  int cpu_flags = av_get_cpu_flags();
+  const RowKernels *tested[KERNEL_FLAGS_COUNT];
+  size_t tested_count = 0;
+
+  av_force_cpu_flags(0);
+  const RowKernels *scalar = get_row_kernels();
+
+  for (size_t f = 0; f < KERNEL_FLAGS_COUNT; f++) {
+    int flag = kernel_flags[f];
+    if ((cpu_flags & flag) != flag) {
+      continue;
+    }
+
+    // Keep the flags implied by this one, dropping those of faster sets.
+    av_force_cpu_flags(flag == 0 ? 0 : cpu_flags & (flag | (flag - 1)));
+    const RowKernels *kernels = get_row_kernels();
+
+    bool seen = false;
+    for (size_t i = 0; i < tested_count; i++) {
+      seen = seen || tested[i] == kernels;
+    }
+    if (seen) {
+      continue;
+    }
+    tested[tested_count++] = kernels;
+
+    printf("# row kernels: %s\n", kernels->name);
+    fflush(stdout);
+    test_row_kernels(kernels, scalar);
+  }
+  av_force_cpu_flags(-1);
+
+  test_reductions();
+
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+# SPDX-FileCopyrightText: 2021 The unpaper authors
+#
+# SPDX-License-Identifier: GPL-2.0-only
+# SPDX-License-Identifier: MIT
+
+"""Submits a job to an unpaper server started with --serve.
+
+Usage: unpaper_client.py SOCKET [unpaper options] INPUT... OUTPUT...
+
+Paths are resolved by the server, so they should be absolute. If any file is
+'-', standard input is sent along with the job and the images written to '-'
+outputs are printed on standard output. The status of the job is printed on
+standard error.
+"""
+
+import json
+import socket
+import struct
+import sys
+from typing import Any, Dict, Sequence, Tuple
+
+
+def _receive_exactly(connection: socket.socket, size: int) -> bytes:
+    data = bytearray()
+    while len(data) < size:
+        chunk = connection.recv(min(size - len(data), 1 << 20))
+        if not chunk:
+            raise ConnectionError("connection closed by the server")
+        data += chunk
+    return bytes(data)
+
+
+def submit(
+    socket_path: str, args: Sequence[str], data: bytes = b""
+) -> Tuple[Dict[str, Any], bytes]:
+    """Runs a job on the server, returns its status and output."""
+
+    request = bytearray(struct.pack(">I", len(args)))
+    for arg in args:
+        encoded = arg.encode()
+        request += struct.pack(">I", len(encoded)) + encoded
+    request += struct.pack(">Q", len(data)) + data
+
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as connection:
+        connection.connect(socket_path)
+        connection.sendall(request)
+
+        line = bytearray()
+        while not line.endswith(b"\n"):
+            line += _receive_exactly(connection, 1)
+        status = json.loads(line)
+        output = _receive_exactly(connection, status["output_bytes"])
+
+    return status, output
+
+
+def main() -> int:
+    if len(sys.argv) < 2:
+        sys.stderr.write(__doc__)
+        return 2
+
+    args = sys.argv[2:]
+    data = sys.stdin.buffer.read() if "-" in args else b""
+    status, output = submit(sys.argv[1], args, data)
+
+    sys.stdout.buffer.write(output)
+    sys.stderr.write(json.dumps(status) + "\n")
+    return 0 if status["status"] == "ok" else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
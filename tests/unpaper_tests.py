@@ -3,6 +3,7 @@
 # SPDX-License-Identifier: GPL-2.0-only
 # SPDX-License-Identifier: MIT
 
+import json
 import logging
 import os
 import pathlib
@@ -10,11 +11,15 @@ import re
 import shlex
 import subprocess
 import sys
-from typing import Sequence
+import time
+from typing import Optional, Sequence
 
 import pytest
 import PIL.Image
 
+sys.path.insert(0, str(pathlib.Path(__file__).parent))
+import unpaper_client  # noqa: E402
+
 _LOGGER = logging.getLogger(__name__)
 
 
@@ -41,8 +46,9 @@ def compare_images(*, golden: pathlib.Path, result: pathlib.Path) -> float:
 
 
 def run_unpaper(
-    *cmdline: Sequence[str], check: bool = True
+    *cmdline: Sequence[str], check: bool = True, stdin: Optional[bytes] = None
 ) -> subprocess.CompletedProcess:
+    """Runs unpaper; if stdin is given, it is piped in and stdout captured."""
     unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
 
     full_cmdline = [unpaper_path, "-vvv"] + list(cmdline)
@@ -50,7 +56,8 @@ def run_unpaper(
 
     return subprocess.run(
         full_cmdline,
-        stdout=sys.stdout,
+        input=stdin,
+        stdout=sys.stdout if stdin is None else subprocess.PIPE,
         stderr=sys.stderr,
         check=check,
     )
@@ -150,6 +157,30 @@ def test_b3(imgsrc_path, goldendir_path, tmp_path):
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
 
+def test_blank_sheets(imgsrc_path, goldendir_path, tmp_path):
+    """[A1] with every sheet counted as blank: white pages of the same size, or none."""
+    source_path = imgsrc_path / "imgsrc001.png"
+    white_path = tmp_path / "white.pbm"
+    skip_path = tmp_path / "skip.pbm"
+    golden_path = goldendir_path / "goldenA1.pbm"
+    journal_path = tmp_path / "journal.txt"
+    cmdline = ["--blank-density", "1"]
+    skip_cmdline = [*cmdline, "--blank-sheets", "skip", "--journal", str(journal_path)]
+
+    run_unpaper(*cmdline, "--blank-sheets", "white", str(source_path), str(white_path))
+    run_unpaper(*skip_cmdline, str(source_path), str(skip_path))
+
+    white_image = PIL.Image.open(white_path).convert("L")
+    assert white_image.size == PIL.Image.open(golden_path).size
+    assert white_image.getextrema() == (255, 255)
+    assert not skip_path.exists()
+
+    # The skipped sheet is completed, although its output was not written.
+    assert "\tskipped " in journal_path.read_text()
+    run_unpaper(*skip_cmdline, "--resume", str(source_path), str(skip_path))
+    assert len(journal_path.read_text().splitlines()) == 1
+
+
 def test_sheet_background_black(imgsrc_path, goldendir_path, tmp_path):
     """[C1] Black sheet background color."""
 
@@ -210,6 +241,105 @@ def test_negative_shift(imgsrc_path, goldendir_path, tmp_path):
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
 
+def test_post_transforms_compose(imgsrc_path, tmp_path):
+    """Mirroring both ways, shifting and rotating clockwise is shifting back
+    and rotating anti-clockwise."""
+
+    source_path = imgsrc_path / "imgsrc002.png"
+    composed_path = tmp_path / "composed.pbm"
+    rotated_path = tmp_path / "rotated.pbm"
+
+    run_unpaper(
+        "-n",
+        "--sheet-size",
+        "a4",
+        "--post-mirror",
+        "h,v",
+        "--post-shift",
+        "2cm,-3cm",
+        "--post-rotate",
+        "90",
+        str(source_path),
+        str(composed_path),
+    )
+    run_unpaper(
+        "-n",
+        "--sheet-size",
+        "a4",
+        "--post-shift",
+        "-2cm,3cm",
+        "--post-rotate",
+        "-90",
+        str(source_path),
+        str(rotated_path),
+    )
+
+    assert compare_images(golden=rotated_path, result=composed_path) == 0
+
+
+def test_no_processing_merge_split(imgsrc_path, tmp_path):
+    """Splitting a sheet merged from two copies of a page gives back the page."""
+
+    source_path = imgsrc_path / "imgsrc002.png"
+    page_path = tmp_path / "page.pbm"
+    merged_path = tmp_path / "merged.pbm"
+
+    run_unpaper("-n", str(source_path), str(page_path))
+    run_unpaper(
+        "-n",
+        "--input-pages",
+        "2",
+        str(source_path),
+        str(source_path),
+        str(merged_path),
+    )
+    run_unpaper(
+        "-n",
+        "--output-pages",
+        "2",
+        str(merged_path),
+        str(tmp_path / "split%d.pbm"),
+    )
+
+    for i in (1, 2):
+        split_path = tmp_path / f"split{i}.pbm"
+        assert compare_images(golden=page_path, result=split_path) == 0
+
+
+@pytest.mark.parametrize(
+    "palette, expected_mode, expected_header",
+    [
+        ([(i, i, i) for i in range(256)], "L", b"P5"),
+        ([(i, 255 - i, i // 2) for i in range(256)], "RGB", b"P6"),
+        (None, "L", b"P5"),
+    ],
+    ids=["gray-palette", "color-palette", "gray-alpha"],
+)
+def test_converted_input_formats(tmp_path, palette, expected_mode, expected_header):
+    """Palette and gray+alpha inputs, converted when loaded: to PGM if they are
+    all gray, to PPM otherwise."""
+
+    gradient = PIL.Image.linear_gradient("L").resize((64, 48))
+    if palette is None:
+        alpha = PIL.Image.new("L", gradient.size, 128)
+        source = PIL.Image.merge("LA", (gradient, alpha))
+    else:
+        source = PIL.Image.new("P", gradient.size)
+        source.putdata(list(gradient.getdata()))
+        source.putpalette([value for entry in palette for value in entry])
+
+    source_path = tmp_path / "source.png"
+    result_path = tmp_path / "result.pnm"
+    source.save(source_path)
+
+    run_unpaper("-n", str(source_path), str(result_path))
+
+    assert result_path.read_bytes()[:2] == expected_header
+    result = PIL.Image.open(result_path)
+    assert result.mode == expected_mode
+    assert list(result.getdata()) == list(source.convert(expected_mode).getdata())
+
+
 def test_sheet_crop(imgsrc_path, goldendir_path, tmp_path):
     """[D1] Crop to sheet size."""
     source_path = imgsrc_path / "imgsrc003.png"
@@ -283,6 +413,374 @@ def test_e1(imgsrc_path, goldendir_path, tmp_path):
         assert compare_images(golden=golden_path, result=result) < 0.05
 
 
+def test_e1_scan_decimation(imgsrc_path, goldendir_path, tmp_path):
+    """[E1] with the detection scans run on a sheet reduced four times first."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    result_path = tmp_path / "results-%02d.pbm"
+
+    run_unpaper(
+        "--layout", "double", "--output-pages", "2", "--scan-decimation", "4",
+        str(source_path), str(result_path)
+    )
+
+    for page in range(1, 7):
+        golden_path = goldendir_path / f"goldenE1-{page:02d}.pbm"
+        result = tmp_path / f"results-{page:02d}.pbm"
+        assert compare_images(golden=golden_path, result=result) < 0.05
+
+
+def test_e1_coherent_scans(imgsrc_path, goldendir_path, tmp_path):
+    """[E1] with the detection scans of each sheet started near those of the previous one."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    result_path = tmp_path / "results-%02d.pbm"
+
+    run_unpaper(
+        "--layout", "double", "--output-pages", "2", "--coherent-scans",
+        str(source_path), str(result_path)
+    )
+
+    for page in range(1, 7):
+        golden_path = goldendir_path / f"goldenE1-{page:02d}.pbm"
+        result = tmp_path / f"results-{page:02d}.pbm"
+        assert compare_images(golden=golden_path, result=result) < 0.05
+
+
+def test_e1_resume(imgsrc_path, goldendir_path, tmp_path):
+    """[E1] interrupted after the second sheet, then resumed from the journal."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    result_path = tmp_path / "results-%02d.pbm"
+    journal_path = tmp_path / "journal.txt"
+    cmdline = ["--layout", "double", "--output-pages", "2", "--journal", str(journal_path)]
+
+    run_unpaper(*cmdline, "--end-sheet", "2", str(source_path), str(result_path))
+    assert len(journal_path.read_text().splitlines()) == 2
+
+    # Without --resume, the outputs of the first sheets are in the way.
+    unpaper_result = run_unpaper(
+        *cmdline, str(source_path), str(result_path), check=False
+    )
+    assert unpaper_result.returncode != 0
+
+    run_unpaper(*cmdline, "--resume", str(source_path), str(result_path))
+    assert len(journal_path.read_text().splitlines()) == 3
+
+    for page in range(1, 7):
+        golden_path = goldendir_path / f"goldenE1-{page:02d}.pbm"
+        result = tmp_path / f"results-{page:02d}.pbm"
+        assert compare_images(golden=golden_path, result=result) < 0.05
+
+
+def test_e1_cache(imgsrc_path, goldendir_path, tmp_path):
+    """[E1] run twice with a result cache, the second time copying the pages from it."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    cache_path = tmp_path / "cache"
+    cmdline = ["--layout", "double", "--output-pages", "2", "--cache", str(cache_path)]
+
+    run_unpaper(*cmdline, str(source_path), str(tmp_path / "first-%02d.pbm"))
+    assert len(list(cache_path.glob("*/*.state"))) == 3
+
+    run_unpaper(*cmdline, str(source_path), str(tmp_path / "second-%02d.pbm"))
+    assert len(list(cache_path.glob("*/*.state"))) == 3
+
+    for page in range(1, 7):
+        golden_path = goldendir_path / f"goldenE1-{page:02d}.pbm"
+        first = tmp_path / f"first-{page:02d}.pbm"
+        second = tmp_path / f"second-{page:02d}.pbm"
+        assert compare_images(golden=golden_path, result=first) < 0.05
+        assert second.read_bytes() == first.read_bytes()
+
+
+@pytest.mark.parametrize("scans", [[], ["--coherent-scans"]])
+def test_e1_cache_post_options(imgsrc_path, tmp_path, scans):
+    """[E1] rerun with a result cache and a different post-processing option, replaying the detections."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    cache_path = tmp_path / "cache"
+    cmdline = ["--layout", "double", "--output-pages", "2", *scans]
+    post = ["--post-mirror", "horizontal"]
+
+    run_unpaper(
+        *cmdline,
+        "--cache",
+        str(cache_path),
+        str(source_path),
+        str(tmp_path / "first-%02d.pbm"),
+    )
+    run_unpaper(
+        *cmdline,
+        *post,
+        "--cache",
+        str(cache_path),
+        str(source_path),
+        str(tmp_path / "cached-%02d.pbm"),
+    )
+    # The outputs differ, the detections are the same.
+    assert len(list(cache_path.glob("*/*.state"))) == 6
+    assert len(list(cache_path.glob("*/*.detections"))) == 3
+
+    run_unpaper(
+        *cmdline, *post, str(source_path), str(tmp_path / "uncached-%02d.pbm")
+    )
+
+    for page in range(1, 7):
+        cached = tmp_path / f"cached-{page:02d}.pbm"
+        uncached = tmp_path / f"uncached-{page:02d}.pbm"
+        assert cached.read_bytes() == uncached.read_bytes()
+
+
+def test_e1_cache_coherent_scans(imgsrc_path, tmp_path):
+    """[E1] run twice with a result cache and coherent scans, as if run without the cache."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    cache_path = tmp_path / "cache"
+    cmdline = ["--layout", "double", "--output-pages", "2", "--coherent-scans"]
+
+    run_unpaper(*cmdline, str(source_path), str(tmp_path / "uncached-%02d.pbm"))
+    run_unpaper(
+        *cmdline,
+        "--cache",
+        str(cache_path),
+        str(source_path),
+        str(tmp_path / "first-%02d.pbm"),
+    )
+    run_unpaper(
+        *cmdline,
+        "--cache",
+        str(cache_path),
+        str(source_path),
+        str(tmp_path / "second-%02d.pbm"),
+    )
+    assert len(list(cache_path.glob("*/*.state"))) == 3
+
+    # Without hints from the first sheet, the second one is processed again.
+    run_unpaper(
+        *cmdline,
+        "--cache",
+        str(cache_path),
+        "--start-sheet",
+        "2",
+        "--start-output",
+        "3",
+        str(source_path),
+        str(tmp_path / "resumed-%02d.pbm"),
+    )
+    assert len(list(cache_path.glob("*/*.state"))) == 4
+
+    for page in range(1, 7):
+        uncached = (tmp_path / f"uncached-{page:02d}.pbm").read_bytes()
+        assert (tmp_path / f"first-{page:02d}.pbm").read_bytes() == uncached
+        assert (tmp_path / f"second-{page:02d}.pbm").read_bytes() == uncached
+
+
+def test_e1_apply_geometry(imgsrc_path, goldendir_path, tmp_path):
+    """[E1] detect the geometry of each sheet only, then apply it from the concatenated sidecars."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    cmdline = ["--layout", "double", "--output-pages", "2"]
+
+    run_unpaper(
+        *cmdline, "--detect-only", str(source_path), str(tmp_path / "detect-%02d.pbm")
+    )
+    assert not list(tmp_path.glob("*.pbm"))
+
+    geometry_path = tmp_path / "geometry.json"
+    geometry_path.write_bytes(
+        b"".join(
+            (tmp_path / f"detect-{page:02d}.pbm.json").read_bytes()
+            for page in (1, 3, 5)
+        )
+    )
+
+    run_unpaper(
+        *cmdline,
+        "--apply-geometry",
+        str(geometry_path),
+        str(source_path),
+        str(tmp_path / "result-%02d.pbm"),
+    )
+
+    for page in range(1, 7):
+        golden_path = goldendir_path / f"goldenE1-{page:02d}.pbm"
+        result_path = tmp_path / f"result-{page:02d}.pbm"
+        assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+
+def test_e1_stream(imgsrc_path, goldendir_path, tmp_path):
+    """[E1] with the sheets concatenated on standard input and the pages written to standard output."""
+
+    input_stream = b""
+    for index in range(1, 4):
+        sheet_path = tmp_path / f"sheet-{index}.pnm"
+        PIL.Image.open(imgsrc_path / f"imgsrcE{index:03d}.png").save(
+            sheet_path, "PPM"
+        )
+        input_stream += sheet_path.read_bytes()
+
+    unpaper_result = run_unpaper(
+        "--layout", "double", "--output-pages", "2", "-", "-", stdin=input_stream
+    )
+
+    # The output pages are binary PBM images, one after the other.
+    output_stream = unpaper_result.stdout
+    page = 0
+    while output_stream:
+        header = re.match(rb"P4\s+([0-9]+)\s+([0-9]+)\s", output_stream)
+        assert header
+        width, height = int(header.group(1)), int(header.group(2))
+        end = header.end() + (width + 7) // 8 * height
+
+        page += 1
+        result_path = tmp_path / f"results-{page:02d}.pbm"
+        result_path.write_bytes(output_stream[:end])
+        output_stream = output_stream[end:]
+
+        golden_path = goldendir_path / f"goldenE1-{page:02d}.pbm"
+        assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+    assert page == 6
+
+
+def test_serve(imgsrc_path, goldendir_path, tmp_path):
+    """[A1] and [E1] submitted as jobs to a server, with files and streams."""
+
+    socket_path = tmp_path / "unpaper.sock"
+    unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
+    server = subprocess.Popen(
+        [unpaper_path, f"--serve={socket_path}", "--workers=2"]
+    )
+
+    try:
+        for _ in range(100):
+            if socket_path.exists():
+                break
+            time.sleep(0.1)
+
+        result_path = tmp_path / "result.pbm"
+        status, output = unpaper_client.submit(
+            str(socket_path),
+            [str((imgsrc_path / "imgsrc001.png").absolute()), str(result_path)],
+        )
+        assert status["status"] == "ok" and status["sheets"] == 1
+        assert output == b""
+        golden_path = goldendir_path / "goldenA1.pbm"
+        assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+        sheet_path = tmp_path / "sheet.pnm"
+        PIL.Image.open(imgsrc_path / "imgsrcE001.png").save(sheet_path, "PPM")
+        status, output = unpaper_client.submit(
+            str(socket_path),
+            ["--layout", "double", "--output-pages", "2", "-", "-"],
+            sheet_path.read_bytes(),
+        )
+        assert status["status"] == "ok" and status["output_bytes"] == len(output)
+
+        status, output = unpaper_client.submit(
+            str(socket_path), ["--layout", "triple", "-", "-"]
+        )
+        assert status["status"] == "error" and "layout" in status["error"]
+    finally:
+        server.terminate()
+        assert server.wait(timeout=60) == 0
+
+    assert not socket_path.exists()
+
+
+def test_manifest(imgsrc_path, goldendir_path, tmp_path):
+    """[A1] and [E1] listed in a manifest, with per-entry options."""
+
+    manifest_path = tmp_path / "manifest.txt"
+    manifest_path.write_text(
+        "# [A1]\n"
+        f"'{imgsrc_path / 'imgsrc001.png'}' '{tmp_path / 'resultA1.pbm'}'\n"
+        "\n"
+        f"'{imgsrc_path / 'imgsrcE001.png'}' '{tmp_path / 'resultE1-01.pbm'}' "
+        f"'{tmp_path / 'resultE1-02.pbm'}' | --layout double --output-pages 2\n"
+    )
+
+    run_unpaper(f"--manifest={manifest_path}", "--workers=2")
+
+    golden_path = goldendir_path / "goldenA1.pbm"
+    assert compare_images(golden=golden_path, result=tmp_path / "resultA1.pbm") < 0.05
+    for page in ("01", "02"):
+        golden_path = goldendir_path / f"goldenE1-{page}.pbm"
+        result_path = tmp_path / f"resultE1-{page}.pbm"
+        assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+    manifest_path.write_text(f"{imgsrc_path / 'imgsrc001.png'}\n")
+    unpaper_result = run_unpaper(f"--manifest={manifest_path}", check=False)
+    assert unpaper_result.returncode != 0
+
+
+def run_unpaper_stats(*cmdline: Sequence[str]) -> list:
+    """Runs unpaper with --stats=json, returns the reports printed on stderr."""
+    unpaper_path = os.getenv("TEST_UNPAPER_BINARY", "unpaper")
+
+    full_cmdline = [unpaper_path, "--stats=json"] + list(cmdline)
+    print(f"Running {shlex.join(full_cmdline)}")
+
+    unpaper_result = subprocess.run(
+        full_cmdline, stdout=sys.stdout, stderr=subprocess.PIPE, check=True
+    )
+    return [
+        json.loads(line)
+        for line in unpaper_result.stderr.decode().splitlines()
+        if line.startswith("{")
+    ]
+
+
+def check_stats_summary(reports: list, sheets: int):
+    """Checks that the last report adds up the sheet reports before it."""
+    *sheet_reports, summary = reports
+    assert len(sheet_reports) == sheets
+    summary = summary["summary"]
+    assert summary["sheets"] == sheets
+
+    for counter, value in summary["counters"].items():
+        assert value == sum(report["counters"][counter] for report in sheet_reports)
+    for stage, totals in summary["stages"].items():
+        for key in ("calls", "pixels"):
+            assert totals[key] == sum(
+                report["stages"].get(stage, {}).get(key, 0)
+                for report in sheet_reports
+            )
+
+
+def test_stats_json(imgsrc_path, tmp_path):
+    """[E1] and [A1] reported by --stats=json, on the command line and in a manifest."""
+
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    result_path = tmp_path / "results-%02d.pbm"
+    reports = run_unpaper_stats(
+        "--layout", "double", "--output-pages", "2", str(source_path), str(result_path)
+    )
+
+    check_stats_summary(reports, 3)
+    for nr, report in enumerate(reports[:-1], start=1):
+        assert report["sheet"] == nr
+        assert report["input"] == [str(source_path).replace("%03d", f"{nr:03d}")]
+        assert len(report["output"]) == 2
+        assert report["stages"]["load"]["calls"] == 1
+        assert report["stages"]["load"]["pixels"] > 0
+        assert report["stages"]["save"]["pixels"] > 0
+        assert report["counters"]["bytes_read"] > 0
+        assert report["counters"]["bytes_written"] > 0
+
+    manifest_path = tmp_path / "manifest.txt"
+    manifest_path.write_text(
+        f"'{imgsrc_path / 'imgsrc001.png'}' '{tmp_path / 'resultA1.pbm'}'\n"
+        f"'{imgsrc_path / 'imgsrc001.png'}' '{tmp_path / 'resultA1-blank.pbm'}' "
+        "| --blank-density 1 --blank-sheets skip\n"
+    )
+    reports = run_unpaper_stats(f"--manifest={manifest_path}", "--workers=2")
+
+    check_stats_summary(reports, 2)
+    assert reports[-1]["summary"]["counters"]["blank_sheets"] == 1
+
+
 def test_e2(imgsrc_path, goldendir_path, tmp_path):
     """[E2] Splitting 2-page layout into separate output pages (with output wildcard only)."""
 
@@ -461,3 +959,26 @@ def test_invalid_multi_index(imgsrc_path, tmp_path):
         "--no-processing", "1-", str(source_path), str(result_path), check=False
     )
     assert unpaper_result.returncode != 0
+
+
+@pytest.mark.parametrize(
+    "rotations,borders", [("nan", ""), ("1e999", ""), ("0", "[0,0,0,3e9]")]
+)
+def test_invalid_geometry_number(imgsrc_path, tmp_path, rotations, borders):
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+    geometry_path = tmp_path / "geometry.json"
+    geometry_path.write_text(
+        f'{{"sheet":1,"size":[2480,3507],"mask_scans":[],'
+        f'"rotations":[{rotations}],"borders":[{borders}]}}'
+    )
+
+    unpaper_result = run_unpaper(
+        "--apply-geometry",
+        str(geometry_path),
+        str(source_path),
+        str(result_path),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+    assert not result_path.exists()
@@ -8,6 +8,8 @@
 
 #include <assert.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,19 +17,33 @@
 #include <string.h>
 
 #include <sys/stat.h>
+#if !defined(_MSC_VER)
+#include <unistd.h>
+#endif
 
+#include <libavformat/avio.h>
 #include <libavutil/avutil.h>
+#include <libavutil/mem.h>
 
 #include "imageprocess/blit.h"
 #include "imageprocess/deskew.h"
 #include "imageprocess/filters.h"
 #include "imageprocess/image.h"
 #include "imageprocess/interpolate.h"
+#include "imageprocess/pyramid.h"
 #include "imageprocess/masks.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "lib/logging.h"
 #include "lib/options.h"
 #include "lib/physical.h"
+#include "lib/stats.h"
+#include "lib/workqueue.h"
+#include "journal.h"
+#include "libunpaper.h"
+#include "manifest.h"
 #include "parse.h"
+#include "serve.h"
 #include "unpaper.h"
 #include "version.h"
 
@@ -46,6 +62,7 @@
           "page counter for multi-page processing. E.g.: 'scan%%03d.pbm' to "  \
           "process files\n"                                                    \
           "scan001.pbm, scan002.pbm, scan003.pbm etc.\n"                       \
+          "Use '-' to read from standard input or write to standard output.\n" \
           "\n"                                                                 \
           "See 'man unpaper' for options details\n"                            \
           "Report bugs at https://github.com/unpaper/unpaper/issues\n"
@@ -138,904 +155,1110 @@ enum LONG_OPTION_VALUES {
   OPT_DEBUG,
   OPT_DEBUG_SAVE,
   OPT_INTERPOLATE,
+  OPT_STATS,
+  OPT_SERVE,
+  OPT_WORKERS,
+  OPT_MANIFEST,
+  OPT_JOURNAL,
+  OPT_RESUME,
+  OPT_CACHE,
+  OPT_SCAN_DECIMATION,
+  OPT_COHERENT_SCANS,
+  OPT_DETECT_ONLY,
+  OPT_APPLY_GEOMETRY,
+  OPT_BLANK_SHEETS,
+  OPT_BLANK_THRESHOLD,
+  OPT_BLANK_DENSITY,
 };
 
-/****************************************************************************
- * MAIN()                                                                   *
- ****************************************************************************/
+/* --- standard input and output ------------------------------------------ */
+
+#define STREAM_FILENAME "-"
+
+// Images are read from standard input or written to standard output instead
+// of files named '-'.
+static bool isStream(const char *filename) {
+  return strcmp(filename, STREAM_FILENAME) == 0;
+}
+
+// Like a pattern, a stream stands for all the sheets in multi-sheet mode.
+static bool isPattern(const char *filename) {
+  return strchr(filename, '%') != NULL || isStream(filename);
+}
 
 /**
- * The main program.
+ * Opens standard output for the output images. Anything else printed to
+ * standard output from then on goes to standard error instead, so that it
+ * cannot end up in the middle of the images.
  */
-int main(int argc, char *argv[]) {
-  // --- local variables ---
-  Options options;
+static AVIOContext *openStandardOutput(void) {
+  AVIOContext *io = NULL;
+  char url[32];
+  int fd;
+
+  fflush(stdout);
+  fd = dup(STDOUT_FILENO);
+  if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+    errOutput("unable to redirect standard output.");
+  }
 
-  // The variables in the following block need to stay allocated becuse the
-  size_t pointCount = 0;
-  Point points[MAX_POINTS];
-  size_t maskCount = 0;
-  Rectangle masks[MAX_MASKS];
-  size_t preMaskCount = 0;
-  Rectangle preMasks[MAX_MASKS];
-  int32_t middleWipe[2] = {0, 0};
-  Rectangle outsideBorderscanMask[MAX_PAGES]; // set by --layout
-  size_t outsideBorderscanMaskCount = 0;
-  Rectangle blackfilterExclude[MAX_MASKS]; // Required to stay allocated!
-
-  // -------------------------------------------------------------------
-  // --- parse parameters                                            ---
-  // -------------------------------------------------------------------
-
-  {
-    // The following variables are no longer visible after argument parsing
-    // is complete.
-    float whiteThreshold = 0.9;
-    float blackThreshold = 0.33;
-
-    Edges deskewScanEdges = {
-        .left = true, .top = false, .right = true, .bottom = false};
-    int deskewScanSize = 1500;
-    float deskewScanDepth = 0.5;
-    float deskewScanRange = 5.0;
-    float deskewScanStep = 0.1;
-    float deskewScanDeviation = 1.0;
-    Direction maskScanDirections = DIRECTION_HORIZONTAL;
-    RectangleSize maskScanSize = {50, 50};
-    int32_t maskScanDepth[DIRECTIONS_COUNT] = {-1, -1};
-    Delta maskScanStep = {5, 5};
-    float maskScanThreshold[DIRECTIONS_COUNT] = {0.1, 0.1};
-    int maskScanMinimum[DIMENSIONS_COUNT] = {100, 100};
-    int maskScanMaximum[DIMENSIONS_COUNT] = {-1, -1}; // set default later
-    Direction borderScanDirections = DIRECTION_VERTICAL;
-    RectangleSize borderScanSize = {5, 5};
-    Delta borderScanStep = {5, 5};
-    int32_t borderScanThreshold[DIRECTIONS_COUNT] = {5, 5};
-    Edges borderAlign = {
-        .left = false, .top = false, .right = false, .bottom = false}; // center
-    MilsDelta borderAlignMarginPhysical = {0, 0, false};               // center
-
-    int16_t ppi = 300;
-    MilsSize sheetSizePhysical = {-1, -1, false};
-    MilsDelta preShiftPhysical = {0, 0, false};
-    MilsDelta postShiftPhysical = {0, 0, false};
-    MilsSize sizePhysical = {-1, -1, false};
-    MilsSize postSizePhysical = {-1, -1, false};
-    MilsSize stretchSizePhysical = {-1, -1, false};
-    MilsSize postStretchSizePhysical = {-1, -1, false};
-
-    Direction blackfilterScanDirections = DIRECTION_BOTH;
-    RectangleSize blackfilterScanSize = {20, 20};
-    int32_t blackfilterScanDepth[DIRECTIONS_COUNT] = {500, 500};
-    Delta blackfilterScanStep = {5, 5};
-    float blackfilterScanThreshold = 0.95;
-    size_t blackfilterExcludeCount = 0;
-    int blackfilterIntensity = 20;
-    RectangleSize blurfilterScanSize = {100, 100};
-    Delta blurfilterScanStep = {50, 50};
-    float blurfilterIntensity = 0.01;
-    RectangleSize grayfilterScanSize = {50, 50};
-    Delta grayfilterScanStep = {20, 20};
-    float grayfilterThreshold = 0.5;
-
-    options_init(&options);
-
-    int option_index = 0;
-    while (true) {
-      int c;
-
-      static const struct option long_options[] = {
-          {"help", no_argument, NULL, 'h'},
-          {"?", no_argument, NULL, 'h'},
-          {"version", no_argument, NULL, 'V'},
-          {"layout", required_argument, NULL, 'l'},
-          {"#", required_argument, NULL, '#'},
-          {"sheet", required_argument, NULL, '#'},
-          {"start", required_argument, NULL, OPT_START_SHEET},
-          {"start-sheet", required_argument, NULL, OPT_START_SHEET},
-          {"end", required_argument, NULL, OPT_END_SHEET},
-          {"end-sheet", required_argument, NULL, OPT_END_SHEET},
-          {"start-input", required_argument, NULL, OPT_START_INPUT},
-          {"si", required_argument, NULL, OPT_START_INPUT},
-          {"start-output", required_argument, NULL, OPT_START_OUTPUT},
-          {"so", required_argument, NULL, OPT_START_OUTPUT},
-          {"sheet-size", required_argument, NULL, 'S'},
-          {"sheet-background", required_argument, NULL, OPT_SHEET_BACKGROUND},
-          {"exclude", optional_argument, NULL, 'x'},
-          {"no-processing", required_argument, NULL, 'n'},
-          {"pre-rotate", required_argument, NULL, OPT_PRE_ROTATE},
-          {"post-rotate", required_argument, NULL, OPT_POST_ROTATE},
-          {"pre-mirror", required_argument, NULL, 'M'},
-          {"post-mirror", required_argument, NULL, OPT_POST_MIRROR},
-          {"pre-shift", required_argument, NULL, OPT_PRE_SHIFT},
-          {"post-shift", required_argument, NULL, OPT_POST_SHIFT},
-          {"pre-mask", required_argument, NULL, OPT_PRE_MASK},
-          {"size", required_argument, NULL, 's'},
-          {"post-size", required_argument, NULL, OPT_POST_SIZE},
-          {"stretch", required_argument, NULL, OPT_STRETCH},
-          {"post-stretch", required_argument, NULL, OPT_POST_STRETCH},
-          {"zoom", required_argument, NULL, 'z'},
-          {"post-zoom", required_argument, NULL, OPT_POST_ZOOM},
-          {"mask-scan-point", required_argument, NULL, 'p'},
-          {"mask", required_argument, NULL, 'm'},
-          {"wipe", required_argument, NULL, 'W'},
-          {"pre-wipe", required_argument, NULL, OPT_PRE_WIPE},
-          {"post-wipe", required_argument, NULL, OPT_POST_WIPE},
-          {"middle-wipe", required_argument, NULL, OPT_MIDDLE_WIPE},
-          {"mw", required_argument, NULL, OPT_MIDDLE_WIPE},
-          {"border", required_argument, NULL, 'B'},
-          {"pre-border", required_argument, NULL, OPT_PRE_BORDER},
-          {"post-border", required_argument, NULL, OPT_POST_BORDER},
-          {"no-blackfilter", optional_argument, NULL, OPT_NO_BLACK_FILTER},
-          {"blackfilter-scan-direction", required_argument, NULL,
-           OPT_BLACK_FILTER_SCAN_DIRECTION},
-          {"bn", required_argument, NULL, OPT_BLACK_FILTER_SCAN_DIRECTION},
-          {"blackfilter-scan-size", required_argument, NULL,
-           OPT_BLACK_FILTER_SCAN_SIZE},
-          {"bs", required_argument, NULL, OPT_BLACK_FILTER_SCAN_SIZE},
-          {"blackfilter-scan-depth", required_argument, NULL,
-           OPT_BLACK_FILTER_SCAN_DEPTH},
-          {"bd", required_argument, NULL, OPT_BLACK_FILTER_SCAN_DEPTH},
-          {"blackfilter-scan-step", required_argument, NULL,
-           OPT_BLACK_FILTER_SCAN_STEP},
-          {"bp", required_argument, NULL, OPT_BLACK_FILTER_SCAN_STEP},
-          {"blackfilter-scan-threshold", required_argument, NULL,
-           OPT_BLACK_FILTER_SCAN_THRESHOLD},
-          {"bt", required_argument, NULL, OPT_BLACK_FILTER_SCAN_THRESHOLD},
-          {"blackfilter-scan-exclude", required_argument, NULL,
-           OPT_BLACK_FILTER_SCAN_EXCLUDE},
-          {"bx", required_argument, NULL, OPT_BLACK_FILTER_SCAN_EXCLUDE},
-          {"blackfilter-intensity", required_argument, NULL,
-           OPT_BLACK_FILTER_INTENSITY},
-          {"bi", required_argument, NULL, OPT_BLACK_FILTER_INTENSITY},
-          {"no-noisefilter", optional_argument, NULL, OPT_NO_NOISE_FILTER},
-          {"noisefilter-intensity", required_argument, NULL,
-           OPT_NOISE_FILTER_INTENSITY},
-          {"ni", required_argument, NULL, OPT_NOISE_FILTER_INTENSITY},
-          {"no-blurfilter", optional_argument, NULL, OPT_NO_BLUR_FILTER},
-          {"blurfilter-size", required_argument, NULL, OPT_BLUR_FILTER_SIZE},
-          {"ls", required_argument, NULL, OPT_BLUR_FILTER_SIZE},
-          {"blurfilter-step", required_argument, NULL, OPT_BLUR_FILTER_STEP},
-          {"lp", required_argument, NULL, OPT_BLUR_FILTER_STEP},
-          {"blurfilter-intensity", required_argument, NULL,
-           OPT_BLUR_FILTER_INTENSITY},
-          {"li", required_argument, NULL, OPT_BLUR_FILTER_INTENSITY},
-          {"no-grayfilter", optional_argument, NULL, OPT_NO_GRAY_FILTER},
-          {"grayfilter-size", required_argument, NULL, OPT_GRAY_FILTER_SIZE},
-          {"gs", required_argument, NULL, OPT_GRAY_FILTER_SIZE},
-          {"grayfilter-step", required_argument, NULL, OPT_GRAY_FILTER_STEP},
-          {"gp", required_argument, NULL, OPT_GRAY_FILTER_STEP},
-          {"grayfilter-threshold", required_argument, NULL,
-           OPT_GRAY_FILTER_THRESHOLD},
-          {"gt", required_argument, NULL, OPT_GRAY_FILTER_THRESHOLD},
-          {"no-mask-scan", optional_argument, NULL, OPT_NO_MASK_SCAN},
-          {"mask-scan-direction", required_argument, NULL,
-           OPT_MASK_SCAN_DIRECTION},
-          {"mn", required_argument, NULL, OPT_MASK_SCAN_DIRECTION},
-          {"mask-scan-size", required_argument, NULL, OPT_MASK_SCAN_SIZE},
-          {"ms", required_argument, NULL, OPT_MASK_SCAN_SIZE},
-          {"mask-scan-depth", required_argument, NULL, OPT_MASK_SCAN_DEPTH},
-          {"md", required_argument, NULL, OPT_MASK_SCAN_DEPTH},
-          {"mask-scan-step", required_argument, NULL, OPT_MASK_SCAN_STEP},
-          {"mp", required_argument, NULL, OPT_MASK_SCAN_STEP},
-          {"mask-scan-threshold", required_argument, NULL,
-           OPT_MASK_SCAN_THRESHOLD},
-          {"mt", required_argument, NULL, OPT_MASK_SCAN_THRESHOLD},
-          {"mask-scan-minimum", required_argument, NULL, OPT_MASK_SCAN_MINIMUM},
-          {"mm", required_argument, NULL, OPT_MASK_SCAN_MINIMUM},
-          {"mask-scan-maximum", required_argument, NULL, OPT_MASK_SCAN_MAXIMUM},
-          {"mM", required_argument, NULL, OPT_MASK_SCAN_MAXIMUM},
-          {"mask-color", required_argument, NULL, OPT_MASK_COLOR},
-          {"mc", required_argument, NULL, OPT_MASK_COLOR},
-          {"no-mask-center", optional_argument, NULL, OPT_NO_MASK_CENTER},
-          {"no-deskew", optional_argument, NULL, OPT_NO_DESKEW},
-          {"deskew-scan-direction", required_argument, NULL,
-           OPT_DESKEW_SCAN_DIRECTION},
-          {"dn", required_argument, NULL, OPT_DESKEW_SCAN_DIRECTION},
-          {"deskew-scan-size", required_argument, NULL, OPT_DESKEW_SCAN_SIZE},
-          {"ds", required_argument, NULL, OPT_DESKEW_SCAN_SIZE},
-          {"deskew-scan-depth", required_argument, NULL, OPT_DESKEW_SCAN_DEPTH},
-          {"dd", required_argument, NULL, OPT_DESKEW_SCAN_DEPTH},
-          {"deskew-scan-range", required_argument, NULL, OPT_DESKEW_SCAN_RANGE},
-          {"dr", required_argument, NULL, OPT_DESKEW_SCAN_RANGE},
-          {"deskew-scan-step", required_argument, NULL, OPT_DESKEW_SCAN_STEP},
-          {"dp", required_argument, NULL, OPT_DESKEW_SCAN_STEP},
-          {"deskew-scan-deviation", required_argument, NULL,
-           OPT_DESKEW_SCAN_DEVIATION},
-          {"dv", required_argument, NULL, OPT_DESKEW_SCAN_DEVIATION},
-          {"no-border-scan", optional_argument, NULL, OPT_NO_BORDER_SCAN},
-          {"border-scan-direction", required_argument, NULL,
-           OPT_BORDER_SCAN_DIRECTION},
-          {"Bn", required_argument, NULL, OPT_BORDER_SCAN_DIRECTION},
-          {"border-scan-size", required_argument, NULL, OPT_BORDER_SCAN_SIZE},
-          {"Bs", required_argument, NULL, OPT_BORDER_SCAN_SIZE},
-          {"border-scan-step", required_argument, NULL, OPT_BORDER_SCAN_STEP},
-          {"Bp", required_argument, NULL, OPT_BORDER_SCAN_STEP},
-          {"border-scan-threshold", required_argument, NULL,
-           OPT_BORDER_SCAN_THRESHOLD},
-          {"Bt", required_argument, NULL, OPT_BORDER_SCAN_THRESHOLD},
-          {"border-align", required_argument, NULL, OPT_BORDER_ALIGN},
-          {"Ba", required_argument, NULL, OPT_BORDER_ALIGN},
-          {"border-margin", required_argument, NULL, OPT_BORDER_MARGIN},
-          {"Bm", required_argument, NULL, OPT_BORDER_MARGIN},
-          {"no-border-align", optional_argument, NULL, OPT_NO_BORDER_ALIGN},
-          {"no-wipe", optional_argument, NULL, OPT_NO_WIPE},
-          {"no-border", optional_argument, NULL, OPT_NO_BORDER},
-          {"white-threshold", required_argument, NULL, 'w'},
-          {"black-threshold", required_argument, NULL, 'b'},
-          {"input-pages", required_argument, NULL, OPT_INPUT_PAGES},
-          {"ip", required_argument, NULL, OPT_INPUT_PAGES},
-          {"output-pages", required_argument, NULL, OPT_OUTPUT_PAGES},
-          {"op", required_argument, NULL, OPT_OUTPUT_PAGES},
-          {"input-file-sequence", required_argument, NULL,
-           OPT_INPUT_FILE_SEQUENCE},
-          {"if", required_argument, NULL, OPT_INPUT_FILE_SEQUENCE},
-          {"output-file-sequence", required_argument, NULL,
-           OPT_OUTPUT_FILE_SEQUENCE},
-          {"of", required_argument, NULL, OPT_OUTPUT_FILE_SEQUENCE},
-          {"insert-blank", required_argument, NULL, OPT_INSERT_BLANK},
-          {"replace-blank", required_argument, NULL, OPT_REPLACE_BLANK},
-          {"test-only", no_argument, NULL, 'T'},
-          {"no-multi-pages", no_argument, NULL, OPT_NO_MULTI_PAGES},
-          {"dpi", required_argument, NULL, OPT_PPI},
-          {"ppi", required_argument, NULL, OPT_PPI},
-          {"type", required_argument, NULL, 't'},
-          {"quiet", no_argument, NULL, 'q'},
-          {"overwrite", no_argument, NULL, OPT_OVERWRITE},
-          {"verbose", no_argument, NULL, 'v'},
-          {"vv", no_argument, NULL, OPT_VERBOSE_MORE},
-          {"debug", no_argument, NULL, OPT_DEBUG},
-          {"vvv", no_argument, NULL, OPT_DEBUG},
-          {"debug-save", no_argument, NULL, OPT_DEBUG_SAVE},
-          {"vvvv", no_argument, NULL, OPT_DEBUG_SAVE},
-          {"interpolate", required_argument, NULL, OPT_INTERPOLATE},
-          {NULL, no_argument, NULL, 0}};
-
-      c = getopt_long_only(argc, argv, "hVl:S:x::n::M:s:z:p:m:W:B:w:b:Tt:qv",
-                           long_options, &option_index);
-      if (c == -1)
-        break;
-
-      switch (c) {
-      case 'h':
-      case '?':
-        puts(USAGE);
-        return c == '?' ? 1 : 0;
-
-      case 'V':
-        puts(VERSION_STR);
-        return 0;
-
-      case 'l':
-        if (!parse_layout(optarg, &options.layout)) {
-          errOutput("unable to parse layout: '%s'", optarg);
-        }
-        break;
-
-      case '#':
-        parseMultiIndex(optarg, &options.sheet_multi_index);
-        // allow 0 as start sheet, might be overwritten by --start-sheet again
-        if (options.sheet_multi_index.count > 0 &&
-            options.start_sheet > options.sheet_multi_index.indexes[0])
-          options.start_sheet = options.sheet_multi_index.indexes[0];
-        break;
-
-      case OPT_START_SHEET:
-        sscanf(optarg, "%d", &options.start_sheet);
-        break;
-
-      case OPT_END_SHEET:
-        sscanf(optarg, "%d", &options.end_sheet);
-        break;
-
-      case OPT_START_INPUT:
-        sscanf(optarg, "%d", &options.start_input);
-        break;
-
-      case OPT_START_OUTPUT:
-        sscanf(optarg, "%d", &options.start_output);
-        break;
-
-      case 'S':
-        parse_physical_size(optarg, &sheetSizePhysical);
-        break;
-
-      case OPT_SHEET_BACKGROUND:
-        if (!parse_color(optarg, &options.sheet_background)) {
-          errOutput("invalid value for sheet-background: '%s'", optarg);
-        }
-        break;
-
-      case 'x':
-        parseMultiIndex(optarg, &options.exclude_multi_index);
-        if (options.exclude_multi_index.count == -1)
-          options.exclude_multi_index.count = 0; // 'exclude all' makes no sense
-        break;
-
-      case 'n':
-        parseMultiIndex(optarg, &options.ignore_multi_index);
-        break;
-
-      case OPT_PRE_ROTATE:
-        sscanf(optarg, "%hd", &options.pre_rotate);
-        if ((options.pre_rotate != 0) && (abs(options.pre_rotate) != 90)) {
-          fprintf(stderr, "cannot set --pre-rotate value other than -90 or 90, "
-                          "ignoring.\n");
-          options.pre_rotate = 0;
-        }
-        break;
-
-      case OPT_POST_ROTATE:
-        sscanf(optarg, "%hd", &options.post_rotate);
-        if ((options.post_rotate != 0) && (abs(options.post_rotate) != 90)) {
-          fprintf(stderr, "cannot set --post-rotate value other than -90 or "
-                          "90, ignoring.\n");
-          options.post_rotate = 0;
-        }
-        break;
+  snprintf(url, sizeof(url), "pipe:%d", fd);
+  if (avio_open(&io, url, AVIO_FLAG_WRITE) < 0) {
+    errOutput("unable to open standard output.");
+  }
 
-      case 'M':
-        if (!parse_direction(optarg, &options.pre_mirror)) {
-          errOutput("unable to parse pre-mirror directions: '%s'", optarg);
-        };
-        break;
+  return io;
+}
 
-      case OPT_POST_MIRROR:
-        if (!parse_direction(optarg, &options.post_mirror)) {
-          errOutput("unable to parse post-mirror directions: '%s'", optarg);
-        }
-        break;
+/**
+ * Settings of the command line that are not sheet processing options.
+ */
+typedef struct {
+  StatsFormat stats;
+  const char *serve;
+  const char *manifest;
+  int workers;
+  const char *journal;
+  bool resume;
+
+  const char *exitMessage;
+  int exitStatus;
+} RunSettings;
 
-      case OPT_PRE_SHIFT:
-        parse_physical_delta(optarg, &preShiftPhysical);
-        break;
+/**
+ * A run over the sheets given on the command line. Everything allocated for
+ * it is kept here, so that it can be released after an error too.
+ */
+typedef struct {
+  // Images for '-' inputs are read from input, and those for '-' outputs
+  // written to output, which is opened on standard output if NULL.
+  FILE *input;
+  AVIOContext *output;
+  bool ownOutput;
+
+  // Completed sheets are recorded in journal if not NULL, and skipped if
+  // resume is true and the journal already records them.
+  Journal *journal;
+  bool resume;
+
+  // Statistics of the sheets are reported, and added to stats, if not NULL.
+  Statistics *stats;
+
+  UnpaperContext *ctx;
+  uint8_t *inputData[2];
+  UnpaperStream inputs[2];
+  int sheets;
+} Run;
+
+static void releaseInputs(Run *run) {
+  for (int i = 0; i < 2; i++) {
+    closeBufferIO(&run->inputs[i].io);
+    av_freep(&run->inputData[i]);
+    run->inputs[i].name = NULL;
+  }
+}
 
-      case OPT_POST_SHIFT:
-        parse_physical_delta(optarg, &postShiftPhysical);
-        break;
+// Runs of concurrent jobs add their statistics to the same totals.
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
 
-      case OPT_PRE_MASK:
-        if (preMaskCount < MAX_MASKS) {
-          if (parse_rectangle(optarg, &preMasks[preMaskCount])) {
-            preMaskCount++;
-          }
-        } else {
-          fprintf(stderr,
-                  "maximum number of masks (%d) exceeded, ignoring mask %s\n",
-                  MAX_MASKS, optarg);
-        }
-        break;
-
-      case 's':
-        parse_physical_size(optarg, &sizePhysical);
-        break;
-
-      case OPT_POST_SIZE:
-        parse_physical_size(optarg, &postSizePhysical);
-        break;
-
-      case OPT_STRETCH:
-        parse_physical_size(optarg, &stretchSizePhysical);
-        break;
-
-      case OPT_POST_STRETCH:
-        parse_physical_size(optarg, &postStretchSizePhysical);
-        break;
-
-      case 'z':
-        sscanf(optarg, "%f", &options.pre_zoom_factor);
-        break;
-
-      case OPT_POST_ZOOM:
-        sscanf(optarg, "%f", &options.post_zoom_factor);
-        break;
-
-      case 'p':
-        if (pointCount < MAX_POINTS) {
-          int x = -1;
-          int y = -1;
-          sscanf(optarg, "%d,%d", &x, &y);
-          points[pointCount++] = (Point){x, y};
-        } else {
-          fprintf(stderr,
-                  "maximum number of scan points (%d) exceeded, ignoring scan "
-                  "point %s\n",
-                  MAX_POINTS, optarg);
-        }
-        break;
+static void releaseRun(Run *run) {
+  releaseInputs(run);
+  if (run->stats != NULL && run->ctx != NULL) {
+    pthread_mutex_lock(&statsMutex);
+    stats_add(run->stats, unpaper_context_stats(run->ctx));
+    pthread_mutex_unlock(&statsMutex);
+  }
+  unpaper_context_free(run->ctx);
+  run->ctx = NULL;
+  if (run->ownOutput) {
+    avio_closep(&run->output);
+  }
+}
 
-      case 'm':
-        if (maskCount < MAX_MASKS) {
-          if (parse_rectangle(optarg, &masks[maskCount])) {
-            maskCount++;
-          }
-        } else {
-          fprintf(stderr,
-                  "maximum number of masks (%d) exceeded, ignoring mask %s\n",
-                  MAX_MASKS, optarg);
-        }
-        break;
+/**
+ * Parses the options on the command line into options and settings, leaving
+ * optind at the first file. Returns false if the program is to print
+ * settings->exitMessage and exit right away with settings->exitStatus.
+ */
+static bool parseCommandLine(int argc, char *argv[], Options *options,
+                             RunSettings *settings) {
+  float whiteThreshold = 0.9;
+  float blackThreshold = 0.33;
+
+  Edges deskewScanEdges = {
+      .left = true, .top = false, .right = true, .bottom = false};
+  int deskewScanSize = 1500;
+  float deskewScanDepth = 0.5;
+  float deskewScanRange = 5.0;
+  float deskewScanStep = 0.1;
+  float deskewScanDeviation = 1.0;
+  Direction maskScanDirections = DIRECTION_HORIZONTAL;
+  RectangleSize maskScanSize = {50, 50};
+  int32_t maskScanDepth[DIRECTIONS_COUNT] = {-1, -1};
+  Delta maskScanStep = {5, 5};
+  float maskScanThreshold[DIRECTIONS_COUNT] = {0.1, 0.1};
+  int maskScanMinimum[DIMENSIONS_COUNT] = {100, 100};
+  int maskScanMaximum[DIMENSIONS_COUNT] = {-1, -1}; // set default later
+  Direction borderScanDirections = DIRECTION_VERTICAL;
+  RectangleSize borderScanSize = {5, 5};
+  Delta borderScanStep = {5, 5};
+  int32_t borderScanThreshold[DIRECTIONS_COUNT] = {5, 5};
+  int scanDecimation = 1;
+  float blankThreshold = 0.5;
+  float blankDensity = 0.001;
+  Edges borderAlign = {
+      .left = false, .top = false, .right = false, .bottom = false}; // center
+  MilsDelta borderAlignMarginPhysical = {0, 0, false};               // center
+
+  int16_t ppi = 300;
+  MilsSize sheetSizePhysical = {-1, -1, false};
+  MilsDelta preShiftPhysical = {0, 0, false};
+  MilsDelta postShiftPhysical = {0, 0, false};
+  MilsSize sizePhysical = {-1, -1, false};
+  MilsSize postSizePhysical = {-1, -1, false};
+  MilsSize stretchSizePhysical = {-1, -1, false};
+  MilsSize postStretchSizePhysical = {-1, -1, false};
+
+  Direction blackfilterScanDirections = DIRECTION_BOTH;
+  RectangleSize blackfilterScanSize = {20, 20};
+  int32_t blackfilterScanDepth[DIRECTIONS_COUNT] = {500, 500};
+  Delta blackfilterScanStep = {5, 5};
+  float blackfilterScanThreshold = 0.95;
+  size_t blackfilterExcludeCount = 0;
+  int blackfilterIntensity = 20;
+  RectangleSize blurfilterScanSize = {100, 100};
+  Delta blurfilterScanStep = {50, 50};
+  float blurfilterIntensity = 0.01;
+  RectangleSize grayfilterScanSize = {50, 50};
+  Delta grayfilterScanStep = {20, 20};
+  float grayfilterThreshold = 0.5;
+
+  options_init(options);
+
+  // Restart the parsing from the first argument, as jobs of the server parse
+  // their own command lines.
+#if defined(__GLIBC__)
+  optind = 0;
+#else
+  optind = 1;
+#endif
+
+  int option_index = 0;
+  while (true) {
+    int c;
+
+    static const struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"?", no_argument, NULL, 'h'},
+        {"version", no_argument, NULL, 'V'},
+        {"layout", required_argument, NULL, 'l'},
+        {"#", required_argument, NULL, '#'},
+        {"sheet", required_argument, NULL, '#'},
+        {"start", required_argument, NULL, OPT_START_SHEET},
+        {"start-sheet", required_argument, NULL, OPT_START_SHEET},
+        {"end", required_argument, NULL, OPT_END_SHEET},
+        {"end-sheet", required_argument, NULL, OPT_END_SHEET},
+        {"start-input", required_argument, NULL, OPT_START_INPUT},
+        {"si", required_argument, NULL, OPT_START_INPUT},
+        {"start-output", required_argument, NULL, OPT_START_OUTPUT},
+        {"so", required_argument, NULL, OPT_START_OUTPUT},
+        {"sheet-size", required_argument, NULL, 'S'},
+        {"sheet-background", required_argument, NULL, OPT_SHEET_BACKGROUND},
+        {"exclude", optional_argument, NULL, 'x'},
+        {"no-processing", required_argument, NULL, 'n'},
+        {"pre-rotate", required_argument, NULL, OPT_PRE_ROTATE},
+        {"post-rotate", required_argument, NULL, OPT_POST_ROTATE},
+        {"pre-mirror", required_argument, NULL, 'M'},
+        {"post-mirror", required_argument, NULL, OPT_POST_MIRROR},
+        {"pre-shift", required_argument, NULL, OPT_PRE_SHIFT},
+        {"post-shift", required_argument, NULL, OPT_POST_SHIFT},
+        {"pre-mask", required_argument, NULL, OPT_PRE_MASK},
+        {"size", required_argument, NULL, 's'},
+        {"post-size", required_argument, NULL, OPT_POST_SIZE},
+        {"stretch", required_argument, NULL, OPT_STRETCH},
+        {"post-stretch", required_argument, NULL, OPT_POST_STRETCH},
+        {"zoom", required_argument, NULL, 'z'},
+        {"post-zoom", required_argument, NULL, OPT_POST_ZOOM},
+        {"mask-scan-point", required_argument, NULL, 'p'},
+        {"mask", required_argument, NULL, 'm'},
+        {"wipe", required_argument, NULL, 'W'},
+        {"pre-wipe", required_argument, NULL, OPT_PRE_WIPE},
+        {"post-wipe", required_argument, NULL, OPT_POST_WIPE},
+        {"middle-wipe", required_argument, NULL, OPT_MIDDLE_WIPE},
+        {"mw", required_argument, NULL, OPT_MIDDLE_WIPE},
+        {"border", required_argument, NULL, 'B'},
+        {"pre-border", required_argument, NULL, OPT_PRE_BORDER},
+        {"post-border", required_argument, NULL, OPT_POST_BORDER},
+        {"no-blackfilter", optional_argument, NULL, OPT_NO_BLACK_FILTER},
+        {"blackfilter-scan-direction", required_argument, NULL,
+         OPT_BLACK_FILTER_SCAN_DIRECTION},
+        {"bn", required_argument, NULL, OPT_BLACK_FILTER_SCAN_DIRECTION},
+        {"blackfilter-scan-size", required_argument, NULL,
+         OPT_BLACK_FILTER_SCAN_SIZE},
+        {"bs", required_argument, NULL, OPT_BLACK_FILTER_SCAN_SIZE},
+        {"blackfilter-scan-depth", required_argument, NULL,
+         OPT_BLACK_FILTER_SCAN_DEPTH},
+        {"bd", required_argument, NULL, OPT_BLACK_FILTER_SCAN_DEPTH},
+        {"blackfilter-scan-step", required_argument, NULL,
+         OPT_BLACK_FILTER_SCAN_STEP},
+        {"bp", required_argument, NULL, OPT_BLACK_FILTER_SCAN_STEP},
+        {"blackfilter-scan-threshold", required_argument, NULL,
+         OPT_BLACK_FILTER_SCAN_THRESHOLD},
+        {"bt", required_argument, NULL, OPT_BLACK_FILTER_SCAN_THRESHOLD},
+        {"blackfilter-scan-exclude", required_argument, NULL,
+         OPT_BLACK_FILTER_SCAN_EXCLUDE},
+        {"bx", required_argument, NULL, OPT_BLACK_FILTER_SCAN_EXCLUDE},
+        {"blackfilter-intensity", required_argument, NULL,
+         OPT_BLACK_FILTER_INTENSITY},
+        {"bi", required_argument, NULL, OPT_BLACK_FILTER_INTENSITY},
+        {"no-noisefilter", optional_argument, NULL, OPT_NO_NOISE_FILTER},
+        {"noisefilter-intensity", required_argument, NULL,
+         OPT_NOISE_FILTER_INTENSITY},
+        {"ni", required_argument, NULL, OPT_NOISE_FILTER_INTENSITY},
+        {"no-blurfilter", optional_argument, NULL, OPT_NO_BLUR_FILTER},
+        {"blurfilter-size", required_argument, NULL, OPT_BLUR_FILTER_SIZE},
+        {"ls", required_argument, NULL, OPT_BLUR_FILTER_SIZE},
+        {"blurfilter-step", required_argument, NULL, OPT_BLUR_FILTER_STEP},
+        {"lp", required_argument, NULL, OPT_BLUR_FILTER_STEP},
+        {"blurfilter-intensity", required_argument, NULL,
+         OPT_BLUR_FILTER_INTENSITY},
+        {"li", required_argument, NULL, OPT_BLUR_FILTER_INTENSITY},
+        {"no-grayfilter", optional_argument, NULL, OPT_NO_GRAY_FILTER},
+        {"grayfilter-size", required_argument, NULL, OPT_GRAY_FILTER_SIZE},
+        {"gs", required_argument, NULL, OPT_GRAY_FILTER_SIZE},
+        {"grayfilter-step", required_argument, NULL, OPT_GRAY_FILTER_STEP},
+        {"gp", required_argument, NULL, OPT_GRAY_FILTER_STEP},
+        {"grayfilter-threshold", required_argument, NULL,
+         OPT_GRAY_FILTER_THRESHOLD},
+        {"gt", required_argument, NULL, OPT_GRAY_FILTER_THRESHOLD},
+        {"no-mask-scan", optional_argument, NULL, OPT_NO_MASK_SCAN},
+        {"mask-scan-direction", required_argument, NULL,
+         OPT_MASK_SCAN_DIRECTION},
+        {"mn", required_argument, NULL, OPT_MASK_SCAN_DIRECTION},
+        {"mask-scan-size", required_argument, NULL, OPT_MASK_SCAN_SIZE},
+        {"ms", required_argument, NULL, OPT_MASK_SCAN_SIZE},
+        {"mask-scan-depth", required_argument, NULL, OPT_MASK_SCAN_DEPTH},
+        {"md", required_argument, NULL, OPT_MASK_SCAN_DEPTH},
+        {"mask-scan-step", required_argument, NULL, OPT_MASK_SCAN_STEP},
+        {"mp", required_argument, NULL, OPT_MASK_SCAN_STEP},
+        {"mask-scan-threshold", required_argument, NULL,
+         OPT_MASK_SCAN_THRESHOLD},
+        {"mt", required_argument, NULL, OPT_MASK_SCAN_THRESHOLD},
+        {"mask-scan-minimum", required_argument, NULL, OPT_MASK_SCAN_MINIMUM},
+        {"mm", required_argument, NULL, OPT_MASK_SCAN_MINIMUM},
+        {"mask-scan-maximum", required_argument, NULL, OPT_MASK_SCAN_MAXIMUM},
+        {"mM", required_argument, NULL, OPT_MASK_SCAN_MAXIMUM},
+        {"mask-color", required_argument, NULL, OPT_MASK_COLOR},
+        {"mc", required_argument, NULL, OPT_MASK_COLOR},
+        {"no-mask-center", optional_argument, NULL, OPT_NO_MASK_CENTER},
+        {"no-deskew", optional_argument, NULL, OPT_NO_DESKEW},
+        {"deskew-scan-direction", required_argument, NULL,
+         OPT_DESKEW_SCAN_DIRECTION},
+        {"dn", required_argument, NULL, OPT_DESKEW_SCAN_DIRECTION},
+        {"deskew-scan-size", required_argument, NULL, OPT_DESKEW_SCAN_SIZE},
+        {"ds", required_argument, NULL, OPT_DESKEW_SCAN_SIZE},
+        {"deskew-scan-depth", required_argument, NULL, OPT_DESKEW_SCAN_DEPTH},
+        {"dd", required_argument, NULL, OPT_DESKEW_SCAN_DEPTH},
+        {"deskew-scan-range", required_argument, NULL, OPT_DESKEW_SCAN_RANGE},
+        {"dr", required_argument, NULL, OPT_DESKEW_SCAN_RANGE},
+        {"deskew-scan-step", required_argument, NULL, OPT_DESKEW_SCAN_STEP},
+        {"dp", required_argument, NULL, OPT_DESKEW_SCAN_STEP},
+        {"deskew-scan-deviation", required_argument, NULL,
+         OPT_DESKEW_SCAN_DEVIATION},
+        {"dv", required_argument, NULL, OPT_DESKEW_SCAN_DEVIATION},
+        {"no-border-scan", optional_argument, NULL, OPT_NO_BORDER_SCAN},
+        {"border-scan-direction", required_argument, NULL,
+         OPT_BORDER_SCAN_DIRECTION},
+        {"Bn", required_argument, NULL, OPT_BORDER_SCAN_DIRECTION},
+        {"border-scan-size", required_argument, NULL, OPT_BORDER_SCAN_SIZE},
+        {"Bs", required_argument, NULL, OPT_BORDER_SCAN_SIZE},
+        {"border-scan-step", required_argument, NULL, OPT_BORDER_SCAN_STEP},
+        {"Bp", required_argument, NULL, OPT_BORDER_SCAN_STEP},
+        {"border-scan-threshold", required_argument, NULL,
+         OPT_BORDER_SCAN_THRESHOLD},
+        {"Bt", required_argument, NULL, OPT_BORDER_SCAN_THRESHOLD},
+        {"border-align", required_argument, NULL, OPT_BORDER_ALIGN},
+        {"Ba", required_argument, NULL, OPT_BORDER_ALIGN},
+        {"border-margin", required_argument, NULL, OPT_BORDER_MARGIN},
+        {"Bm", required_argument, NULL, OPT_BORDER_MARGIN},
+        {"no-border-align", optional_argument, NULL, OPT_NO_BORDER_ALIGN},
+        {"no-wipe", optional_argument, NULL, OPT_NO_WIPE},
+        {"no-border", optional_argument, NULL, OPT_NO_BORDER},
+        {"white-threshold", required_argument, NULL, 'w'},
+        {"black-threshold", required_argument, NULL, 'b'},
+        {"input-pages", required_argument, NULL, OPT_INPUT_PAGES},
+        {"ip", required_argument, NULL, OPT_INPUT_PAGES},
+        {"output-pages", required_argument, NULL, OPT_OUTPUT_PAGES},
+        {"op", required_argument, NULL, OPT_OUTPUT_PAGES},
+        {"input-file-sequence", required_argument, NULL,
+         OPT_INPUT_FILE_SEQUENCE},
+        {"if", required_argument, NULL, OPT_INPUT_FILE_SEQUENCE},
+        {"output-file-sequence", required_argument, NULL,
+         OPT_OUTPUT_FILE_SEQUENCE},
+        {"of", required_argument, NULL, OPT_OUTPUT_FILE_SEQUENCE},
+        {"insert-blank", required_argument, NULL, OPT_INSERT_BLANK},
+        {"replace-blank", required_argument, NULL, OPT_REPLACE_BLANK},
+        {"test-only", no_argument, NULL, 'T'},
+        {"no-multi-pages", no_argument, NULL, OPT_NO_MULTI_PAGES},
+        {"dpi", required_argument, NULL, OPT_PPI},
+        {"ppi", required_argument, NULL, OPT_PPI},
+        {"type", required_argument, NULL, 't'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"overwrite", no_argument, NULL, OPT_OVERWRITE},
+        {"verbose", no_argument, NULL, 'v'},
+        {"vv", no_argument, NULL, OPT_VERBOSE_MORE},
+        {"debug", no_argument, NULL, OPT_DEBUG},
+        {"vvv", no_argument, NULL, OPT_DEBUG},
+        {"debug-save", no_argument, NULL, OPT_DEBUG_SAVE},
+        {"vvvv", no_argument, NULL, OPT_DEBUG_SAVE},
+        {"interpolate", required_argument, NULL, OPT_INTERPOLATE},
+        {"scan-decimation", required_argument, NULL, OPT_SCAN_DECIMATION},
+        {"coherent-scans", no_argument, NULL, OPT_COHERENT_SCANS},
+        {"stats", required_argument, NULL, OPT_STATS},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"workers", required_argument, NULL, OPT_WORKERS},
+        {"manifest", required_argument, NULL, OPT_MANIFEST},
+        {"journal", required_argument, NULL, OPT_JOURNAL},
+        {"resume", no_argument, NULL, OPT_RESUME},
+        {"cache", required_argument, NULL, OPT_CACHE},
+        {"detect-only", no_argument, NULL, OPT_DETECT_ONLY},
+        {"apply-geometry", required_argument, NULL, OPT_APPLY_GEOMETRY},
+        {"blank-sheets", required_argument, NULL, OPT_BLANK_SHEETS},
+        {"blank-threshold", required_argument, NULL, OPT_BLANK_THRESHOLD},
+        {"blank-density", required_argument, NULL, OPT_BLANK_DENSITY},
+        {NULL, no_argument, NULL, 0}};
+
+    c = getopt_long_only(argc, argv, "hVl:S:x::n::M:s:z:p:m:W:B:w:b:Tt:qv",
+                         long_options, &option_index);
+    if (c == -1)
+      break;
 
-      case 'W':
-        parse_wipe("wipe", optarg, &options.wipes);
-        break;
+    switch (c) {
+    case 'h':
+    case '?':
+      settings->exitMessage = USAGE;
+      settings->exitStatus = c == '?' ? 1 : 0;
+      return false;
+
+    case 'V':
+      settings->exitMessage = VERSION_STR;
+      settings->exitStatus = 0;
+      return false;
+
+    case 'l':
+      if (!parse_layout(optarg, &options->layout)) {
+        errOutput("unable to parse layout: '%s'", optarg);
+      }
+      break;
 
-      case OPT_PRE_WIPE:
-        parse_wipe("pre-wipe", optarg, &options.pre_wipes);
-        break;
+    case '#':
+      parseMultiIndex(optarg, &options->sheet_multi_index);
+      // allow 0 as start sheet, might be overwritten by --start-sheet again
+      if (options->sheet_multi_index.count > 0 &&
+          options->start_sheet > options->sheet_multi_index.indexes[0])
+        options->start_sheet = options->sheet_multi_index.indexes[0];
+      break;
 
-      case OPT_POST_WIPE:
-        parse_wipe("post-wipe", optarg, &options.post_wipes);
-        break;
+    case OPT_START_SHEET:
+      sscanf(optarg, "%d", &options->start_sheet);
+      break;
 
-      case OPT_MIDDLE_WIPE:
-        if (!parse_symmetric_integers(optarg, &middleWipe[0], &middleWipe[1])) {
-          errOutput("unable to parse middle-wipe: '%s'", optarg);
-        }
-        break;
+    case OPT_END_SHEET:
+      sscanf(optarg, "%d", &options->end_sheet);
+      break;
 
-      case 'B':
-        if (!parse_border(optarg, &options.border)) {
-          errOutput("unable to parse border: '%s'", optarg);
-        }
-        break;
+    case OPT_START_INPUT:
+      sscanf(optarg, "%d", &options->start_input);
+      break;
 
-      case OPT_PRE_BORDER:
-        if (!parse_border(optarg, &options.pre_border)) {
-          errOutput("unable to parse pre-border: '%s'", optarg);
-        }
-        break;
+    case OPT_START_OUTPUT:
+      sscanf(optarg, "%d", &options->start_output);
+      break;
 
-      case OPT_POST_BORDER:
-        if (!parse_border(optarg, &options.post_border)) {
-          errOutput("unable to parse post-border: '%s'", optarg);
-        }
-        break;
+    case 'S':
+      parse_physical_size(optarg, &sheetSizePhysical);
+      break;
 
-      case OPT_NO_BLACK_FILTER:
-        parseMultiIndex(optarg, &options.no_blackfilter_multi_index);
-        break;
+    case OPT_SHEET_BACKGROUND:
+      if (!parse_color(optarg, &options->sheet_background)) {
+        errOutput("invalid value for sheet-background: '%s'", optarg);
+      }
+      break;
 
-      case OPT_BLACK_FILTER_SCAN_DIRECTION:
-        if (!parse_direction(optarg, &blackfilterScanDirections)) {
-          errOutput("unable to parse blackfilter-scan-direction: '%s'", optarg);
-        }
-        break;
+    case 'x':
+      parseMultiIndex(optarg, &options->exclude_multi_index);
+      if (options->exclude_multi_index.count == -1)
+        options->exclude_multi_index.count = 0; // 'exclude all' makes no sense
+      break;
 
-      case OPT_BLACK_FILTER_SCAN_SIZE:
-        if (!parse_rectangle_size(optarg, &blackfilterScanSize)) {
-          errOutput("unable to parse blackfilter-scan-size: '%s'", optarg);
-        }
-        break;
+    case 'n':
+      parseMultiIndex(optarg, &options->ignore_multi_index);
+      break;
 
-      case OPT_BLACK_FILTER_SCAN_DEPTH:
-        if (!parse_symmetric_integers(optarg, &blackfilterScanDepth[0],
-                                      &blackfilterScanDepth[1]) ||
-            blackfilterScanDepth[0] <= 0 || blackfilterScanDepth[1] <= 0) {
-          errOutput("unable to parse blackfilter-scan-depth: '%s'", optarg);
-        }
-        break;
+    case OPT_PRE_ROTATE:
+      sscanf(optarg, "%hd", &options->pre_rotate);
+      if ((options->pre_rotate != 0) && (abs(options->pre_rotate) != 90)) {
+        fprintf(stderr, "cannot set --pre-rotate value other than -90 or 90, "
+                        "ignoring.\n");
+        options->pre_rotate = 0;
+      }
+      break;
 
-      case OPT_BLACK_FILTER_SCAN_STEP:
-        if (!parse_scan_step(optarg, &blackfilterScanStep)) {
-          errOutput("unable to parse blackfilter-scan-step: '%s'", optarg);
-        }
-        break;
+    case OPT_POST_ROTATE:
+      sscanf(optarg, "%hd", &options->post_rotate);
+      if ((options->post_rotate != 0) && (abs(options->post_rotate) != 90)) {
+        fprintf(stderr, "cannot set --post-rotate value other than -90 or "
+                        "90, ignoring.\n");
+        options->post_rotate = 0;
+      }
+      break;
 
-      case OPT_BLACK_FILTER_SCAN_THRESHOLD:
-        sscanf(optarg, "%f", &blackfilterScanThreshold);
-        break;
+    case 'M':
+      if (!parse_direction(optarg, &options->pre_mirror)) {
+        errOutput("unable to parse pre-mirror directions: '%s'", optarg);
+      };
+      break;
 
-      case OPT_BLACK_FILTER_SCAN_EXCLUDE:
-        if (blackfilterExcludeCount < MAX_MASKS) {
-          if (parse_rectangle(optarg,
-                              &blackfilterExclude[blackfilterExcludeCount])) {
-            blackfilterExcludeCount++;
-          }
-        } else {
-          fprintf(stderr,
-                  "maximum number of blackfilter exclusion (%d) exceeded, "
-                  "ignoring mask %s\n",
-                  MAX_MASKS, optarg);
+    case OPT_POST_MIRROR:
+      if (!parse_direction(optarg, &options->post_mirror)) {
+        errOutput("unable to parse post-mirror directions: '%s'", optarg);
+      }
+      break;
+
+    case OPT_PRE_SHIFT:
+      parse_physical_delta(optarg, &preShiftPhysical);
+      break;
+
+    case OPT_POST_SHIFT:
+      parse_physical_delta(optarg, &postShiftPhysical);
+      break;
+
+    case OPT_PRE_MASK:
+      if (options->pre_masks_count < MAX_MASKS) {
+        if (parse_rectangle(optarg,
+                            &options->pre_masks[options->pre_masks_count])) {
+          options->pre_masks_count++;
         }
-        break;
+      } else {
+        fprintf(stderr,
+                "maximum number of masks (%d) exceeded, ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
+
+    case 's':
+      parse_physical_size(optarg, &sizePhysical);
+      break;
+
+    case OPT_POST_SIZE:
+      parse_physical_size(optarg, &postSizePhysical);
+      break;
 
-      case OPT_BLACK_FILTER_INTENSITY:
-        sscanf(optarg, "%d", &blackfilterIntensity);
-        break;
+    case OPT_STRETCH:
+      parse_physical_size(optarg, &stretchSizePhysical);
+      break;
 
-      case OPT_NO_NOISE_FILTER:
-        parseMultiIndex(optarg, &options.no_noisefilter_multi_index);
-        break;
+    case OPT_POST_STRETCH:
+      parse_physical_size(optarg, &postStretchSizePhysical);
+      break;
 
-      case OPT_NOISE_FILTER_INTENSITY:
-        sscanf(optarg, "%" SCNu64, &options.noisefilter_intensity);
-        break;
+    case 'z':
+      sscanf(optarg, "%f", &options->pre_zoom_factor);
+      break;
 
-      case OPT_NO_BLUR_FILTER:
-        parseMultiIndex(optarg, &options.no_blurfilter_multi_index);
-        break;
+    case OPT_POST_ZOOM:
+      sscanf(optarg, "%f", &options->post_zoom_factor);
+      break;
 
-      case OPT_BLUR_FILTER_SIZE:
-        if (!parse_rectangle_size(optarg, &blurfilterScanSize)) {
-          errOutput("unable to parse blurfilter-scan-size: '%s'", optarg);
-        }
-        break;
+    case 'p':
+      if (options->points_count < MAX_POINTS) {
+        int x = -1;
+        int y = -1;
+        sscanf(optarg, "%d,%d", &x, &y);
+        options->points[options->points_count++] = (Point){x, y};
+      } else {
+        fprintf(stderr,
+                "maximum number of scan points (%d) exceeded, ignoring scan "
+                "point %s\n",
+                MAX_POINTS, optarg);
+      }
+      break;
 
-      case OPT_BLUR_FILTER_STEP:
-        if (!parse_scan_step(optarg, &blurfilterScanStep)) {
-          errOutput("unable to parse blurfilter-scan-step: '%s'", optarg);
+    case 'm':
+      if (options->masks_count < MAX_MASKS) {
+        if (parse_rectangle(optarg, &options->masks[options->masks_count])) {
+          options->masks_count++;
         }
-        break;
+      } else {
+        fprintf(stderr,
+                "maximum number of masks (%d) exceeded, ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
 
-      case OPT_BLUR_FILTER_INTENSITY:
-        sscanf(optarg, "%f", &blurfilterIntensity);
-        break;
+    case 'W':
+      parse_wipe("wipe", optarg, &options->wipes);
+      break;
 
-      case OPT_NO_GRAY_FILTER:
-        parseMultiIndex(optarg, &options.no_grayfilter_multi_index);
-        break;
+    case OPT_PRE_WIPE:
+      parse_wipe("pre-wipe", optarg, &options->pre_wipes);
+      break;
 
-      case OPT_GRAY_FILTER_SIZE:
-        if (!parse_rectangle_size(optarg, &grayfilterScanSize)) {
-          errOutput("unable to parse grayfilter-scan-size: '%s'", optarg);
-        }
-        break;
+    case OPT_POST_WIPE:
+      parse_wipe("post-wipe", optarg, &options->post_wipes);
+      break;
 
-      case OPT_GRAY_FILTER_STEP:
-        if (!parse_scan_step(optarg, &grayfilterScanStep)) {
-          errOutput("unable to parse grayfilter-scan-step: '%s'", optarg);
-        }
-        break;
+    case OPT_MIDDLE_WIPE:
+      if (!parse_symmetric_integers(optarg, &options->middle_wipe[0],
+                                    &options->middle_wipe[1])) {
+        errOutput("unable to parse middle-wipe: '%s'", optarg);
+      }
+      break;
 
-      case OPT_GRAY_FILTER_THRESHOLD:
-        sscanf(optarg, "%f", &grayfilterThreshold);
-        break;
+    case 'B':
+      if (!parse_border(optarg, &options->border)) {
+        errOutput("unable to parse border: '%s'", optarg);
+      }
+      break;
 
-      case OPT_NO_MASK_SCAN:
-        parseMultiIndex(optarg, &options.no_mask_scan_multi_index);
-        break;
+    case OPT_PRE_BORDER:
+      if (!parse_border(optarg, &options->pre_border)) {
+        errOutput("unable to parse pre-border: '%s'", optarg);
+      }
+      break;
 
-      case OPT_MASK_SCAN_DIRECTION:
-        if (!parse_direction(optarg, &maskScanDirections)) {
-          errOutput("unable to parse mask-scan-direction: '%s'", optarg);
-        }
-        break;
+    case OPT_POST_BORDER:
+      if (!parse_border(optarg, &options->post_border)) {
+        errOutput("unable to parse post-border: '%s'", optarg);
+      }
+      break;
 
-      case OPT_MASK_SCAN_SIZE:
-        if (!parse_rectangle_size(optarg, &maskScanSize)) {
-          errOutput("unable to parse mask-scan-size: '%s'", optarg);
-        }
-        break;
+    case OPT_NO_BLACK_FILTER:
+      parseMultiIndex(optarg, &options->no_blackfilter_multi_index);
+      break;
 
-      case OPT_MASK_SCAN_DEPTH:
-        if (!parse_symmetric_integers(optarg, &maskScanDepth[0],
-                                      &maskScanDepth[1]) ||
-            maskScanDepth[0] <= 0 || maskScanDepth[1] <= 0) {
-          errOutput("unable to parse mask-scan-depth: '%s'", optarg);
-        }
-        break;
+    case OPT_BLACK_FILTER_SCAN_DIRECTION:
+      if (!parse_direction(optarg, &blackfilterScanDirections)) {
+        errOutput("unable to parse blackfilter-scan-direction: '%s'", optarg);
+      }
+      break;
 
-      case OPT_MASK_SCAN_STEP:
-        if (!parse_scan_step(optarg, &maskScanStep)) {
-          errOutput("unable to parse mask-scan-step");
-        }
-        break;
+    case OPT_BLACK_FILTER_SCAN_SIZE:
+      if (!parse_rectangle_size(optarg, &blackfilterScanSize)) {
+        errOutput("unable to parse blackfilter-scan-size: '%s'", optarg);
+      }
+      break;
 
-      case OPT_MASK_SCAN_THRESHOLD:
-        if (!parse_symmetric_floats(optarg, &maskScanThreshold[0],
-                                    &maskScanThreshold[1]) ||
-            maskScanThreshold[0] <= 0 || maskScanThreshold[1] <= 0) {
-          errOutput("unable to parse mask-scan-threshold: '%s'", optarg);
-        }
-        break;
+    case OPT_BLACK_FILTER_SCAN_DEPTH:
+      if (!parse_symmetric_integers(optarg, &blackfilterScanDepth[0],
+                                    &blackfilterScanDepth[1]) ||
+          blackfilterScanDepth[0] <= 0 || blackfilterScanDepth[1] <= 0) {
+        errOutput("unable to parse blackfilter-scan-depth: '%s'", optarg);
+      }
+      break;
 
-      case OPT_MASK_SCAN_MINIMUM:
-        sscanf(optarg, "%d,%d", &maskScanMinimum[WIDTH],
-               &maskScanMinimum[HEIGHT]);
-        break;
+    case OPT_BLACK_FILTER_SCAN_STEP:
+      if (!parse_scan_step(optarg, &blackfilterScanStep)) {
+        errOutput("unable to parse blackfilter-scan-step: '%s'", optarg);
+      }
+      break;
 
-      case OPT_MASK_SCAN_MAXIMUM:
-        sscanf(optarg, "%d,%d", &maskScanMaximum[WIDTH],
-               &maskScanMaximum[HEIGHT]);
-        break;
+    case OPT_BLACK_FILTER_SCAN_THRESHOLD:
+      sscanf(optarg, "%f", &blackfilterScanThreshold);
+      break;
 
-      case OPT_MASK_COLOR:
-        if (!parse_color(optarg, &options.mask_color)) {
-          errOutput("invalid value for mask-color: '%s'", optarg);
+    case OPT_BLACK_FILTER_SCAN_EXCLUDE:
+      if (blackfilterExcludeCount < MAX_MASKS) {
+        if (parse_rectangle(
+                optarg,
+                &options->blackfilter_exclusions[blackfilterExcludeCount])) {
+          blackfilterExcludeCount++;
         }
-        break;
+      } else {
+        fprintf(stderr,
+                "maximum number of blackfilter exclusion (%d) exceeded, "
+                "ignoring mask %s\n",
+                MAX_MASKS, optarg);
+      }
+      break;
 
-      case OPT_NO_MASK_CENTER:
-        parseMultiIndex(optarg, &options.no_mask_center_multi_index);
-        break;
+    case OPT_BLACK_FILTER_INTENSITY:
+      sscanf(optarg, "%d", &blackfilterIntensity);
+      break;
 
-      case OPT_NO_DESKEW:
-        parseMultiIndex(optarg, &options.no_deskew_multi_index);
-        break;
+    case OPT_NO_NOISE_FILTER:
+      parseMultiIndex(optarg, &options->no_noisefilter_multi_index);
+      break;
 
-      case OPT_DESKEW_SCAN_DIRECTION:
-        if (!parse_edges(optarg, &deskewScanEdges)) {
-          errOutput("uanble to parse deskew-scan-direction: '%s'", optarg);
-        }
-        break;
+    case OPT_NOISE_FILTER_INTENSITY:
+      sscanf(optarg, "%" SCNu64, &options->noisefilter_intensity);
+      break;
 
-      case OPT_DESKEW_SCAN_SIZE:
-        sscanf(optarg, "%d", &deskewScanSize);
-        break;
+    case OPT_NO_BLUR_FILTER:
+      parseMultiIndex(optarg, &options->no_blurfilter_multi_index);
+      break;
 
-      case OPT_DESKEW_SCAN_DEPTH:
-        sscanf(optarg, "%f", &deskewScanDepth);
-        break;
+    case OPT_BLUR_FILTER_SIZE:
+      if (!parse_rectangle_size(optarg, &blurfilterScanSize)) {
+        errOutput("unable to parse blurfilter-scan-size: '%s'", optarg);
+      }
+      break;
 
-      case OPT_DESKEW_SCAN_RANGE:
-        sscanf(optarg, "%f", &deskewScanRange);
-        break;
+    case OPT_BLUR_FILTER_STEP:
+      if (!parse_scan_step(optarg, &blurfilterScanStep)) {
+        errOutput("unable to parse blurfilter-scan-step: '%s'", optarg);
+      }
+      break;
 
-      case OPT_DESKEW_SCAN_STEP:
-        sscanf(optarg, "%f", &deskewScanStep);
-        break;
+    case OPT_BLUR_FILTER_INTENSITY:
+      sscanf(optarg, "%f", &blurfilterIntensity);
+      break;
 
-      case OPT_DESKEW_SCAN_DEVIATION:
-        sscanf(optarg, "%f", &deskewScanDeviation);
-        break;
+    case OPT_NO_GRAY_FILTER:
+      parseMultiIndex(optarg, &options->no_grayfilter_multi_index);
+      break;
 
-      case OPT_NO_BORDER_SCAN:
-        parseMultiIndex(optarg, &options.no_border_scan_multi_index);
-        break;
+    case OPT_GRAY_FILTER_SIZE:
+      if (!parse_rectangle_size(optarg, &grayfilterScanSize)) {
+        errOutput("unable to parse grayfilter-scan-size: '%s'", optarg);
+      }
+      break;
 
-      case OPT_BORDER_SCAN_DIRECTION:
-        if (!parse_direction(optarg, &borderScanDirections)) {
-          errOutput("unable to parse border-scan-direction: '%s'", optarg);
-        }
-        break;
+    case OPT_GRAY_FILTER_STEP:
+      if (!parse_scan_step(optarg, &grayfilterScanStep)) {
+        errOutput("unable to parse grayfilter-scan-step: '%s'", optarg);
+      }
+      break;
 
-      case OPT_BORDER_SCAN_SIZE:
-        if (!parse_rectangle_size(optarg, &borderScanSize)) {
-          errOutput("unable to parse border-scan-size: '%s'", optarg);
-        }
-        break;
+    case OPT_GRAY_FILTER_THRESHOLD:
+      sscanf(optarg, "%f", &grayfilterThreshold);
+      break;
 
-      case OPT_BORDER_SCAN_STEP:
-        if (!parse_scan_step(optarg, &borderScanStep)) {
-          errOutput("unable to parse border-scan-step: '%s'", optarg);
-        }
-        break;
+    case OPT_NO_MASK_SCAN:
+      parseMultiIndex(optarg, &options->no_mask_scan_multi_index);
+      break;
 
-      case OPT_BORDER_SCAN_THRESHOLD:
-        if (!parse_symmetric_integers(optarg, &borderScanThreshold[0],
-                                      &borderScanThreshold[1]) ||
-            borderScanThreshold[0] <= 0 || borderScanThreshold <= 0) {
-          errOutput("unable to parse border-scan-threshold: '%s'", optarg);
-        }
-        break;
+    case OPT_MASK_SCAN_DIRECTION:
+      if (!parse_direction(optarg, &maskScanDirections)) {
+        errOutput("unable to parse mask-scan-direction: '%s'", optarg);
+      }
+      break;
 
-      case OPT_BORDER_ALIGN:
-        if (!parse_edges(optarg, &borderAlign)) {
-          errOutput("unable to parse border-align: '%s'", optarg);
-        }
-        break;
-
-      case OPT_BORDER_MARGIN:
-        parse_physical_delta(optarg, &borderAlignMarginPhysical);
-        break;
-
-      case OPT_NO_BORDER_ALIGN:
-        parseMultiIndex(optarg, &options.no_border_align_multi_index);
-        break;
-
-      case OPT_NO_WIPE:
-        parseMultiIndex(optarg, &options.no_wipe_multi_index);
-        break;
-
-      case OPT_NO_BORDER:
-        parseMultiIndex(optarg, &options.no_border_multi_index);
-        break;
-
-      case 'w':
-        sscanf(optarg, "%f", &whiteThreshold);
-        break;
-
-      case 'b':
-        sscanf(optarg, "%f", &blackThreshold);
-        break;
-
-      case OPT_INPUT_PAGES:
-        sscanf(optarg, "%d", &options.input_count);
-        if (!(options.input_count >= 1 && options.input_count <= 2)) {
-          fprintf(
-              stderr,
-              "cannot set --input-pages value other than 1 or 2, ignoring.\n");
-          options.input_count = 1;
-        }
+    case OPT_MASK_SCAN_SIZE:
+      if (!parse_rectangle_size(optarg, &maskScanSize)) {
+        errOutput("unable to parse mask-scan-size: '%s'", optarg);
+      }
+      break;
+
+    case OPT_MASK_SCAN_DEPTH:
+      if (!parse_symmetric_integers(optarg, &maskScanDepth[0],
+                                    &maskScanDepth[1]) ||
+          maskScanDepth[0] <= 0 || maskScanDepth[1] <= 0) {
+        errOutput("unable to parse mask-scan-depth: '%s'", optarg);
+      }
+      break;
 
-        break;
+    case OPT_MASK_SCAN_STEP:
+      if (!parse_scan_step(optarg, &maskScanStep)) {
+        errOutput("unable to parse mask-scan-step");
+      }
+      break;
 
-      case OPT_OUTPUT_PAGES:
-        sscanf(optarg, "%d", &options.output_count);
-        if (!(options.output_count >= 1 && options.output_count <= 2)) {
-          fprintf(
-              stderr,
-              "cannot set --output-pages value other than 1 or 2, ignoring.\n");
-          options.output_count = 1;
-        }
+    case OPT_MASK_SCAN_THRESHOLD:
+      if (!parse_symmetric_floats(optarg, &maskScanThreshold[0],
+                                  &maskScanThreshold[1]) ||
+          maskScanThreshold[0] <= 0 || maskScanThreshold[1] <= 0) {
+        errOutput("unable to parse mask-scan-threshold: '%s'", optarg);
+      }
+      break;
 
-        break;
-
-      case OPT_INPUT_FILE_SEQUENCE:
-      case OPT_OUTPUT_FILE_SEQUENCE:
-        errOutput(
-            "--input-file-sequence and --output-file-sequence are deprecated "
-            "and "
-            "unimplemented.\n"
-            "Please pass input output pairs as arguments to unpaper instead.");
-        break;
-
-      case OPT_INSERT_BLANK:
-        parseMultiIndex(optarg, &options.insert_blank);
-        break;
-
-      case OPT_REPLACE_BLANK:
-        parseMultiIndex(optarg, &options.replace_blank);
-        break;
-
-      case 'T':
-        options.write_output = false;
-        break;
-
-      case OPT_NO_MULTI_PAGES:
-        options.multiple_sheets = false;
-        break;
-
-      case OPT_PPI:
-        sscanf(optarg, "%hd", &ppi);
-        break;
-
-      case 't':
-        if (strcmp(optarg, "pbm") == 0) {
-
-          options.output_pixel_format = AV_PIX_FMT_MONOWHITE;
-        } else if (strcmp(optarg, "pgm") == 0) {
-          options.output_pixel_format = AV_PIX_FMT_GRAY8;
-        } else if (strcmp(optarg, "ppm") == 0) {
-          options.output_pixel_format = AV_PIX_FMT_RGB24;
-        }
-        break;
+    case OPT_MASK_SCAN_MINIMUM:
+      sscanf(optarg, "%d,%d", &maskScanMinimum[WIDTH],
+             &maskScanMinimum[HEIGHT]);
+      break;
+
+    case OPT_MASK_SCAN_MAXIMUM:
+      sscanf(optarg, "%d,%d", &maskScanMaximum[WIDTH],
+             &maskScanMaximum[HEIGHT]);
+      break;
+
+    case OPT_MASK_COLOR:
+      if (!parse_color(optarg, &options->mask_color)) {
+        errOutput("invalid value for mask-color: '%s'", optarg);
+      }
+      break;
+
+    case OPT_NO_MASK_CENTER:
+      parseMultiIndex(optarg, &options->no_mask_center_multi_index);
+      break;
+
+    case OPT_NO_DESKEW:
+      parseMultiIndex(optarg, &options->no_deskew_multi_index);
+      break;
+
+    case OPT_DESKEW_SCAN_DIRECTION:
+      if (!parse_edges(optarg, &deskewScanEdges)) {
+        errOutput("uanble to parse deskew-scan-direction: '%s'", optarg);
+      }
+      break;
 
-      case 'q':
-        verbose = VERBOSE_QUIET;
-        break;
+    case OPT_DESKEW_SCAN_SIZE:
+      sscanf(optarg, "%d", &deskewScanSize);
+      break;
 
-      case OPT_OVERWRITE:
-        options.overwrite_output = true;
-        break;
+    case OPT_DESKEW_SCAN_DEPTH:
+      sscanf(optarg, "%f", &deskewScanDepth);
+      break;
 
-      case 'v':
-        verbose = VERBOSE_NORMAL;
-        break;
+    case OPT_DESKEW_SCAN_RANGE:
+      sscanf(optarg, "%f", &deskewScanRange);
+      break;
 
-      case OPT_VERBOSE_MORE:
-        verbose = VERBOSE_MORE;
-        break;
+    case OPT_DESKEW_SCAN_STEP:
+      sscanf(optarg, "%f", &deskewScanStep);
+      break;
 
-      case OPT_DEBUG:
-        verbose = VERBOSE_DEBUG;
-        break;
+    case OPT_DESKEW_SCAN_DEVIATION:
+      sscanf(optarg, "%f", &deskewScanDeviation);
+      break;
 
-      case OPT_DEBUG_SAVE:
-        verbose = VERBOSE_DEBUG_SAVE;
-        break;
+    case OPT_NO_BORDER_SCAN:
+      parseMultiIndex(optarg, &options->no_border_scan_multi_index);
+      break;
 
-      case OPT_INTERPOLATE:
-        if (!parse_interpolate(optarg, &options.interpolate_type)) {
-          errOutput("unable to parse interpolate: '%s'", optarg);
-        }
-        break;
+    case OPT_BORDER_SCAN_DIRECTION:
+      if (!parse_direction(optarg, &borderScanDirections)) {
+        errOutput("unable to parse border-scan-direction: '%s'", optarg);
       }
-    }
+      break;
 
-    // Expand any physical size to their pixel equivalents.
-    options.pre_shift = mils_delta_to_pixels(preShiftPhysical, ppi);
-    options.post_shift = mils_delta_to_pixels(postShiftPhysical, ppi);
-
-    options.sheet_size = mils_size_to_pixels(sheetSizePhysical, ppi);
-    options.page_size = mils_size_to_pixels(sizePhysical, ppi);
-    options.post_page_size = mils_size_to_pixels(postSizePhysical, ppi);
-    options.stretch_size = mils_size_to_pixels(stretchSizePhysical, ppi);
-    options.post_stretch_size =
-        mils_size_to_pixels(postStretchSizePhysical, ppi);
-
-    // Calculate the constant absolute values based on the relative parameters.
-    options.abs_black_threshold = WHITE * (1.0 - blackThreshold);
-    options.abs_white_threshold = WHITE * (whiteThreshold);
-
-    if (!validate_deskew_parameters(&options.deskew_parameters, deskewScanRange,
-                                    deskewScanStep, deskewScanDeviation,
-                                    deskewScanSize, deskewScanDepth,
-                                    deskewScanEdges)) {
-      errOutput("deskew parameters are not valid.");
-    }
-    if (!validate_mask_detection_parameters(
-            &options.mask_detection_parameters, maskScanDirections,
-            maskScanSize, maskScanDepth, maskScanStep, maskScanThreshold,
-            maskScanMinimum, maskScanMaximum)) {
-      errOutput("mask detection parameters are not valid.");
-    }
-    if (!validate_mask_alignment_parameters(
-            &options.mask_alignment_parameters, borderAlign,
-            mils_delta_to_pixels(borderAlignMarginPhysical, ppi))) {
-      errOutput("mask alignment parameters are not valid.");
-    };
-    if (!validate_border_scan_parameters(&options.border_scan_parameters,
-                                         borderScanDirections, borderScanSize,
-                                         borderScanStep, borderScanThreshold)) {
-      errOutput("border scan parameters are not valid.");
-    };
-    if (!validate_grayfilter_parameters(&options.grayfilter_parameters,
-                                        grayfilterScanSize, grayfilterScanStep,
-                                        grayfilterThreshold)) {
-      errOutput("grayfilter parameters are not valid.");
-    }
-    if (!validate_blackfilter_parameters(
-            &options.blackfilter_parameters, blackfilterScanSize,
-            blackfilterScanStep, blackfilterScanDepth[HORIZONTAL],
-            blackfilterScanDepth[VERTICAL], blackfilterScanDirections,
-            blackfilterScanThreshold, blackfilterIntensity,
-            blackfilterExcludeCount, blackfilterExclude)) {
-      errOutput("blackfilter parameters are not valid.");
-    }
-    if (!validate_blurfilter_parameters(&options.blurfilter_parameters,
-                                        blurfilterScanSize, blurfilterScanStep,
-                                        blurfilterIntensity)) {
-      errOutput("blurfilter parameters are not valid.");
+    case OPT_BORDER_SCAN_SIZE:
+      if (!parse_rectangle_size(optarg, &borderScanSize)) {
+        errOutput("unable to parse border-scan-size: '%s'", optarg);
+      }
+      break;
+
+    case OPT_BORDER_SCAN_STEP:
+      if (!parse_scan_step(optarg, &borderScanStep)) {
+        errOutput("unable to parse border-scan-step: '%s'", optarg);
+      }
+      break;
+
+    case OPT_BORDER_SCAN_THRESHOLD:
+      if (!parse_symmetric_integers(optarg, &borderScanThreshold[0],
+                                    &borderScanThreshold[1]) ||
+          borderScanThreshold[0] <= 0 || borderScanThreshold <= 0) {
+        errOutput("unable to parse border-scan-threshold: '%s'", optarg);
+      }
+      break;
+
+    case OPT_BORDER_ALIGN:
+      if (!parse_edges(optarg, &borderAlign)) {
+        errOutput("unable to parse border-align: '%s'", optarg);
+      }
+      break;
+
+    case OPT_BORDER_MARGIN:
+      parse_physical_delta(optarg, &borderAlignMarginPhysical);
+      break;
+
+    case OPT_NO_BORDER_ALIGN:
+      parseMultiIndex(optarg, &options->no_border_align_multi_index);
+      break;
+
+    case OPT_NO_WIPE:
+      parseMultiIndex(optarg, &options->no_wipe_multi_index);
+      break;
+
+    case OPT_NO_BORDER:
+      parseMultiIndex(optarg, &options->no_border_multi_index);
+      break;
+
+    case 'w':
+      sscanf(optarg, "%f", &whiteThreshold);
+      break;
+
+    case 'b':
+      sscanf(optarg, "%f", &blackThreshold);
+      break;
+
+    case OPT_INPUT_PAGES:
+      sscanf(optarg, "%d", &options->input_count);
+      if (!(options->input_count >= 1 && options->input_count <= 2)) {
+        fprintf(
+            stderr,
+            "cannot set --input-pages value other than 1 or 2, ignoring.\n");
+        options->input_count = 1;
+      }
+
+      break;
+
+    case OPT_OUTPUT_PAGES:
+      sscanf(optarg, "%d", &options->output_count);
+      if (!(options->output_count >= 1 && options->output_count <= 2)) {
+        fprintf(
+            stderr,
+            "cannot set --output-pages value other than 1 or 2, ignoring.\n");
+        options->output_count = 1;
+      }
+
+      break;
+
+    case OPT_INPUT_FILE_SEQUENCE:
+    case OPT_OUTPUT_FILE_SEQUENCE:
+      errOutput(
+          "--input-file-sequence and --output-file-sequence are deprecated "
+          "and "
+          "unimplemented.\n"
+          "Please pass input output pairs as arguments to unpaper instead.");
+      break;
+
+    case OPT_INSERT_BLANK:
+      parseMultiIndex(optarg, &options->insert_blank);
+      break;
+
+    case OPT_REPLACE_BLANK:
+      parseMultiIndex(optarg, &options->replace_blank);
+      break;
+
+    case 'T':
+      options->write_output = false;
+      break;
+
+    case OPT_NO_MULTI_PAGES:
+      options->multiple_sheets = false;
+      break;
+
+    case OPT_PPI:
+      sscanf(optarg, "%hd", &ppi);
+      break;
+
+    case 't':
+      if (strcmp(optarg, "pbm") == 0) {
+
+        options->output_pixel_format = AV_PIX_FMT_MONOWHITE;
+      } else if (strcmp(optarg, "pgm") == 0) {
+        options->output_pixel_format = AV_PIX_FMT_GRAY8;
+      } else if (strcmp(optarg, "ppm") == 0) {
+        options->output_pixel_format = AV_PIX_FMT_RGB24;
+      }
+      break;
+
+    case 'q':
+      set_verbose_level(VERBOSE_QUIET);
+      break;
+
+    case OPT_OVERWRITE:
+      options->overwrite_output = true;
+      break;
+
+    case 'v':
+      set_verbose_level(VERBOSE_NORMAL);
+      break;
+
+    case OPT_VERBOSE_MORE:
+      set_verbose_level(VERBOSE_MORE);
+      break;
+
+    case OPT_DEBUG:
+      set_verbose_level(VERBOSE_DEBUG);
+      break;
+
+    case OPT_DEBUG_SAVE:
+      set_verbose_level(VERBOSE_DEBUG_SAVE);
+      break;
+
+    case OPT_INTERPOLATE:
+      if (!parse_interpolate(optarg, &options->interpolate_type)) {
+        errOutput("unable to parse interpolate: '%s'", optarg);
+      }
+      break;
+
+    case OPT_SCAN_DECIMATION:
+      if (sscanf(optarg, "%d", &scanDecimation) != 1 ||
+          !valid_decimation(scanDecimation)) {
+        errOutput("unable to parse scan-decimation: '%s'", optarg);
+      }
+      break;
+
+    case OPT_COHERENT_SCANS:
+      options->coherent_scans = true;
+      break;
+
+    case OPT_STATS:
+      if (!parse_stats_format(optarg, &settings->stats)) {
+        errOutput("unable to parse stats: '%s'", optarg);
+      }
+      break;
+
+    case OPT_SERVE:
+      settings->serve = optarg;
+      break;
+
+    case OPT_MANIFEST:
+      settings->manifest = optarg;
+      break;
+
+    case OPT_JOURNAL:
+      settings->journal = optarg;
+      break;
+
+    case OPT_RESUME:
+      settings->resume = true;
+      break;
+
+    case OPT_CACHE:
+      options->cache_directory = optarg;
+      break;
+
+    case OPT_DETECT_ONLY:
+      options->detect_only = true;
+      break;
+
+    case OPT_APPLY_GEOMETRY:
+      options->geometry_file = optarg;
+      break;
+
+    case OPT_BLANK_SHEETS:
+      if (!parse_blank_sheets(optarg, &options->blank_sheets)) {
+        errOutput("unable to parse blank-sheets: '%s'", optarg);
+      }
+      break;
+
+    case OPT_BLANK_THRESHOLD:
+      sscanf(optarg, "%f", &blankThreshold);
+      break;
+
+    case OPT_BLANK_DENSITY:
+      sscanf(optarg, "%f", &blankDensity);
+      break;
+
+    case OPT_WORKERS:
+      if (sscanf(optarg, "%d", &settings->workers) != 1 ||
+          settings->workers < 1) {
+        errOutput("unable to parse workers: '%s'", optarg);
+      }
+      break;
     }
+  }
+
+  // Expand any physical size to their pixel equivalents.
+  options->pre_shift = mils_delta_to_pixels(preShiftPhysical, ppi);
+  options->post_shift = mils_delta_to_pixels(postShiftPhysical, ppi);
+
+  options->sheet_size = mils_size_to_pixels(sheetSizePhysical, ppi);
+  options->page_size = mils_size_to_pixels(sizePhysical, ppi);
+  options->post_page_size = mils_size_to_pixels(postSizePhysical, ppi);
+  options->stretch_size = mils_size_to_pixels(stretchSizePhysical, ppi);
+  options->post_stretch_size =
+      mils_size_to_pixels(postStretchSizePhysical, ppi);
 
-    if (options.start_input == -1)
-      options.start_input = (options.start_sheet - 1) * options.input_count + 1;
-    if (options.start_output == -1)
-      options.start_output =
-          (options.start_sheet - 1) * options.output_count + 1;
+  // Calculate the constant absolute values based on the relative parameters.
+  options->abs_black_threshold = WHITE * (1.0 - blackThreshold);
+  options->abs_white_threshold = WHITE * (whiteThreshold);
 
-    if (!options.multiple_sheets && options.end_sheet == -1)
-      options.end_sheet = options.start_sheet;
+  if (options->detect_only && options->geometry_file != NULL) {
+    errOutput("--detect-only and --apply-geometry cannot be combined.");
   }
 
-  /* make sure we have at least two arguments after the options, as
-     that's the minimum amount of parameters we need (one input and
-     one output, or a wildcard of inputs and a wildcard of
-     outputs.
-  */
-  if (optind + 2 > argc)
-    errOutput("no input or output files given.\n");
+  if (!validate_deskew_parameters(&options->deskew_parameters, deskewScanRange,
+                                  deskewScanStep, deskewScanDeviation,
+                                  deskewScanSize, deskewScanDepth,
+                                  deskewScanEdges, scanDecimation)) {
+    errOutput("deskew parameters are not valid.");
+  }
+  if (!validate_mask_detection_parameters(
+          &options->mask_detection_parameters, maskScanDirections,
+          maskScanSize, maskScanDepth, maskScanStep, maskScanThreshold,
+          maskScanMinimum, maskScanMaximum, scanDecimation)) {
+    errOutput("mask detection parameters are not valid.");
+  }
+  if (!validate_mask_alignment_parameters(
+          &options->mask_alignment_parameters, borderAlign,
+          mils_delta_to_pixels(borderAlignMarginPhysical, ppi))) {
+    errOutput("mask alignment parameters are not valid.");
+  };
+  if (!validate_border_scan_parameters(&options->border_scan_parameters,
+                                       borderScanDirections, borderScanSize,
+                                       borderScanStep, borderScanThreshold,
+                                       scanDecimation)) {
+    errOutput("border scan parameters are not valid.");
+  };
+  if (!validate_grayfilter_parameters(&options->grayfilter_parameters,
+                                      grayfilterScanSize, grayfilterScanStep,
+                                      grayfilterThreshold)) {
+    errOutput("grayfilter parameters are not valid.");
+  }
+  if (!validate_blackfilter_parameters(
+          &options->blackfilter_parameters, blackfilterScanSize,
+          blackfilterScanStep, blackfilterScanDepth[HORIZONTAL],
+          blackfilterScanDepth[VERTICAL], blackfilterScanDirections,
+          blackfilterScanThreshold, blackfilterIntensity,
+          blackfilterExcludeCount, options->blackfilter_exclusions)) {
+    errOutput("blackfilter parameters are not valid.");
+  }
+  if (!validate_blurfilter_parameters(&options->blurfilter_parameters,
+                                      blurfilterScanSize, blurfilterScanStep,
+                                      blurfilterIntensity)) {
+    errOutput("blurfilter parameters are not valid.");
+  }
+  if (!validate_blank_parameters(&options->blank_parameters, blankThreshold,
+                                 blankDensity)) {
+    errOutput("blank parameters are not valid.");
+  }
 
-  verboseLog(VERBOSE_NORMAL, WELCOME); // welcome message
+  if (options->start_input == -1)
+    options->start_input =
+        (options->start_sheet - 1) * options->input_count + 1;
+  if (options->start_output == -1)
+    options->start_output =
+        (options->start_sheet - 1) * options->output_count + 1;
+
+  if (!options->multiple_sheets && options->end_sheet == -1)
+    options->end_sheet = options->start_sheet;
+
+  if (settings->resume && settings->journal == NULL) {
+    errOutput("--resume requires --journal.");
+  }
 
-  int inputNr = options.start_input;
-  int outputNr = options.start_output;
+  return true;
+}
 
-  RectangleSize inputSize = {-1, -1};
-  RectangleSize previousSize = {-1, -1};
-  Image sheet = EMPTY_IMAGE;
-  Image page = EMPTY_IMAGE;
+/**
+ * Processes the sheets given by the file arguments starting at argv[arg].
+ */
+static void processSheets(Run *run, Options *options, int argc, char *argv[],
+                          int arg) {
+  int inputNr = options->start_input;
+  int outputNr = options->start_output;
+
+  run->ctx = unpaper_context_new(options, verbose_level(), NULL, NULL);
+  if (run->ctx == NULL) {
+    errOutput("unable to allocate processing context.");
+  }
+  if (run->stats != NULL) {
+    unpaper_context_enable_stats(run->ctx, run->stats->format,
+                                 run->stats->output);
+  }
 
-  for (int nr = options.start_sheet;
-       (options.end_sheet == -1) || (nr <= options.end_sheet); nr++) {
+  for (int nr = options->start_sheet;
+       (options->end_sheet == -1) || (nr <= options->end_sheet); nr++) {
     char inputFilesBuffer[2][PATH_MAX];
     char outputFilesBuffer[2][PATH_MAX];
     char *inputFileNames[2];
     char *outputFileNames[2];
+    UnpaperStream outputs[2] = {{0}};
 
     // -------------------------------------------------------------------
     // --- begin processing                                            ---
     // -------------------------------------------------------------------
 
-    bool inputWildcard =
-        options.multiple_sheets && (strchr(argv[optind], '%') != NULL);
+    bool inputWildcard = options->multiple_sheets && isPattern(argv[arg]);
     bool outputWildcard = false;
 
-    for (int i = 0; i < options.input_count; i++) {
-      bool ins = isInMultiIndex(inputNr, options.insert_blank);
-      bool repl = isInMultiIndex(inputNr, options.replace_blank);
+    for (int i = 0; i < options->input_count; i++) {
+      bool ins = isInMultiIndex(inputNr, options->insert_blank);
+      bool repl = isInMultiIndex(inputNr, options->replace_blank);
 
       if (repl) {
         inputFileNames[i] = NULL;
@@ -1043,17 +1266,17 @@ int main(int argc, char *argv[]) {
       } else if (ins) {
         inputFileNames[i] = NULL; /* insert */
       } else if (inputWildcard) {
-        sprintf(inputFilesBuffer[i], argv[optind], inputNr++);
+        sprintf(inputFilesBuffer[i], argv[arg], inputNr++);
         inputFileNames[i] = inputFilesBuffer[i];
-      } else if (optind >= argc) {
-        if (options.end_sheet == -1) {
-          options.end_sheet = nr - 1;
+      } else if (arg >= argc) {
+        if (options->end_sheet == -1) {
+          options->end_sheet = nr - 1;
           goto sheet_end;
         } else {
           errOutput("not enough input files given.");
         }
       } else {
-        inputFileNames[i] = argv[optind++];
+        inputFileNames[i] = argv[arg++];
       }
       if (inputFileNames[i] == NULL) {
         verboseLog(VERBOSE_DEBUG, "added blank input file\n");
@@ -1061,11 +1284,25 @@ int main(int argc, char *argv[]) {
         verboseLog(VERBOSE_DEBUG, "added input file %s\n", inputFileNames[i]);
       }
 
-      if (inputFileNames[i] != NULL) {
+      run->inputs[i].name = inputFileNames[i];
+      if (inputFileNames[i] != NULL && isStream(inputFileNames[i])) {
+        size_t size;
+        if (run->input == NULL ||
+            !readStreamImage(run->input, "standard input", &run->inputData[i],
+                             &size)) {
+          if (options->end_sheet == -1) {
+            options->end_sheet = nr - 1;
+            goto sheet_end;
+          } else {
+            errOutput("not enough images on standard input.");
+          }
+        }
+        run->inputs[i].io = openBufferIO(run->inputData[i], size);
+      } else if (inputFileNames[i] != NULL) {
         struct stat statBuf;
         if (stat(inputFileNames[i], &statBuf) != 0) {
-          if (options.end_sheet == -1) {
-            options.end_sheet = nr - 1;
+          if (options->end_sheet == -1) {
+            options->end_sheet = nr - 1;
             goto sheet_end;
           } else {
             errOutput("unable to open file %s.", inputFileNames[i]);
@@ -1074,851 +1311,465 @@ int main(int argc, char *argv[]) {
       }
     }
     if (inputWildcard)
-      optind++;
+      arg++;
 
-    if (optind >= argc) { // see if any one of the last two optind++ has pushed
-                          // it over the array boundary
+    if (arg >= argc) { // see if any one of the last two arg++ has pushed
+                       // it over the array boundary
       errOutput("not enough output files given.");
     }
-    outputWildcard =
-        options.multiple_sheets && (strchr(argv[optind], '%') != NULL);
-    for (int i = 0; i < options.output_count; i++) {
+    outputWildcard = options->multiple_sheets && isPattern(argv[arg]);
+    for (int i = 0; i < options->output_count; i++) {
       if (outputWildcard) {
-        sprintf(outputFilesBuffer[i], argv[optind], outputNr++);
+        sprintf(outputFilesBuffer[i], argv[arg], outputNr++);
         outputFileNames[i] = outputFilesBuffer[i];
-      } else if (optind >= argc) {
+      } else if (arg >= argc) {
         errOutput("not enough output files given.");
       } else {
-        outputFileNames[i] = argv[optind++];
+        outputFileNames[i] = argv[arg++];
       }
       verboseLog(VERBOSE_DEBUG, "added output file %s\n", outputFileNames[i]);
 
-      if (!options.overwrite_output) {
+      outputs[i].name = outputFileNames[i];
+    }
+    if (outputWildcard)
+      arg++;
+
+    // Sheets read from or written to streams are not journaled, and neither
+    // are sheets whose pages are not written.
+    bool journaled = run->journal != NULL && !options->detect_only;
+    for (int i = 0; i < options->input_count; i++) {
+      if (inputFileNames[i] != NULL && isStream(inputFileNames[i]))
+        journaled = false;
+    }
+    for (int i = 0; i < options->output_count; i++) {
+      if (isStream(outputFileNames[i]))
+        journaled = false;
+    }
+
+    if (journaled && run->resume &&
+        journal_completed(run->journal, options->input_count,
+                          (const char *const *)inputFileNames,
+                          options->output_count,
+                          (const char *const *)outputFileNames)) {
+      verboseLog(VERBOSE_NORMAL, "sheet %d already processed, skipping.\n",
+                 nr);
+      if (unpaper_skip_sheet(run->ctx, nr,
+                             (const char *const *)inputFileNames) !=
+          UNPAPER_OK) {
+        errOutput("%s", unpaper_last_error(run->ctx));
+      }
+      goto sheet_end;
+    }
+
+    for (int i = 0; i < options->output_count; i++) {
+      if (isStream(outputFileNames[i])) {
+        if (run->output == NULL) {
+          run->output = openStandardOutput();
+          run->ownOutput = true;
+        }
+        outputs[i].io = run->output;
+      } else if (!options->overwrite_output && !options->detect_only) {
         struct stat statbuf;
         if (stat(outputFileNames[i], &statbuf) == 0) {
           errOutput("output file '%s' already present.\n", outputFileNames[i]);
         }
       }
     }
-    if (outputWildcard)
-      optind++;
 
     // ---------------------------------------------------------------
     // --- process single sheet                                    ---
     // ---------------------------------------------------------------
 
-    if (isInMultiIndex(nr, options.sheet_multi_index) &&
-        (!isInMultiIndex(nr, options.exclude_multi_index))) {
-      char s1[1023]; // buffers for result of implode()
-      char s2[1023];
-
-      verboseLog(
-          VERBOSE_NORMAL,
-          "\n-------------------------------------------------------------"
-          "------------------\n");
-
-      if (options.multiple_sheets) {
-        verboseLog(
-            VERBOSE_NORMAL, "Processing sheet #%d: %s -> %s\n", nr,
-            implode(s1, (const char **)inputFileNames, options.input_count),
-            implode(s2, (const char **)outputFileNames, options.output_count));
-      } else {
-        verboseLog(
-            VERBOSE_NORMAL, "Processing sheet: %s -> %s\n",
-            implode(s1, (const char **)inputFileNames, options.input_count),
-            implode(s2, (const char **)outputFileNames, options.output_count));
-      }
-
-      // load input image(s)
-      for (int j = 0; j < options.input_count; j++) {
-        if (inputFileNames[j] !=
-            NULL) { // may be null if --insert-blank or --replace-blank
-          verboseLog(VERBOSE_MORE, "loading file %s.\n", inputFileNames[j]);
-
-          loadImage(inputFileNames[j], &page, options.sheet_background,
-                    options.abs_black_threshold);
-          saveDebug("_loaded_%d.pnm", inputNr - options.input_count + j, page);
-
-          if (options.output_pixel_format == AV_PIX_FMT_NONE &&
-              page.frame != NULL) {
-            options.output_pixel_format = page.frame->format;
-          }
-
-          // pre-rotate
-          if (options.pre_rotate != 0) {
-            verboseLog(VERBOSE_NORMAL, "pre-rotating %hd degrees.\n",
-                       options.pre_rotate);
-
-            flip_rotate_90(&page, options.pre_rotate / 90);
-          }
-
-          // if sheet-size is not known yet (and not forced by --sheet-size),
-          // set now based on size of (first) input image
-          RectangleSize inputSheetSize = {
-              .width = page.frame->width * options.input_count,
-              .height = page.frame->height,
-          };
-          inputSize = coerce_size(
-              inputSize, coerce_size(options.sheet_size, inputSheetSize));
-        } else { // inputFiles[j] == NULL
-          page = EMPTY_IMAGE;
-        }
-
-        // place image into sheet buffer
-        // allocate sheet-buffer if not done yet
-        if ((sheet.frame == NULL) && (inputSize.width != -1) &&
-            (inputSize.height != -1)) {
-          sheet = create_image(inputSize, AV_PIX_FMT_RGB24, true,
-                               options.sheet_background,
-                               options.abs_black_threshold);
-        }
-        if (page.frame != NULL) {
-          saveDebug("_page%d.pnm", inputNr - options.input_count + j, page);
-          saveDebug("_before_center_page%d.pnm",
-                    inputNr - options.input_count + j, sheet);
-
-          center_image(page, sheet,
-                       (Point){(inputSize.width * j / options.input_count), 0},
-                       (RectangleSize){(inputSize.width / options.input_count),
-                                       inputSize.height});
-
-          saveDebug("_after_center_page%d.pnm",
-                    inputNr - options.input_count + j, sheet);
-        }
+    if (isInMultiIndex(nr, options->sheet_multi_index) &&
+        (!isInMultiIndex(nr, options->exclude_multi_index))) {
+      if (unpaper_process_sheet_io(run->ctx, nr, run->inputs, outputs) !=
+          UNPAPER_OK) {
+        errOutput("%s", unpaper_last_error(run->ctx));
       }
-
-      // the only case that buffer is not yet initialized is if all blank pages
-      // have been inserted
-      if (sheet.frame == NULL) {
-        // last chance: try to get previous (unstretched/not zoomed) sheet size
-        inputSize = previousSize;
-        verboseLog(VERBOSE_NORMAL,
-                   "need to guess sheet size from previous sheet: %dx%d\n",
-                   inputSize.width, inputSize.height);
-
-        if ((inputSize.width == -1) || (inputSize.height == -1)) {
-          errOutput("sheet size unknown, use at least one input file per "
-                    "sheet, or force using --sheet-size.");
-        } else {
-          sheet = create_image(inputSize, AV_PIX_FMT_RGB24, true,
-                               options.sheet_background,
-                               options.abs_black_threshold);
-        }
+      run->sheets++;
+
+      if (journaled) {
+        journal_record(run->journal, nr, options->input_count,
+                       (const char *const *)inputFileNames,
+                       options->output_count,
+                       (const char *const *)outputFileNames,
+                       unpaper_last_sheet_skipped(run->ctx));
       }
+    }
 
-      previousSize = inputSize;
-
-      // pre-mirroring
-      if (options.pre_mirror.horizontal || options.pre_mirror.vertical) {
-        verboseLog(VERBOSE_NORMAL, "pre-mirroring %s\n",
-                   direction_to_string(options.pre_mirror));
-
-        mirror(sheet, options.pre_mirror);
-      }
+  sheet_end:
+    releaseInputs(run);
 
-      // pre-shifting
-      if (options.pre_shift.horizontal != 0 ||
-          options.pre_shift.vertical != 0) {
-        verboseLog(VERBOSE_NORMAL, "pre-shifting [%" PRId32 ",%" PRId32 "]\n",
-                   options.pre_shift.horizontal, options.pre_shift.vertical);
+    /* if we're not given an input wildcard, and we finished the
+     * arguments, we don't want to keep looping.
+     */
+    if (arg >= argc && !(inputWildcard && outputWildcard))
+      break;
+    else if (inputWildcard && outputWildcard)
+      arg -= 2;
+  }
+}
 
-        shift_image(&sheet, options.pre_shift);
-      }
+// getopt() keeps its state in globals, so jobs parse one at a time.
+static pthread_mutex_t parseMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool runJobSheets(int argc, char *argv[], Options *options, Run *run,
+                         JobResult *result) {
+  Logger logger = {.verbose = VERBOSE_NONE};
+  Logger *previous = logging_install(&logger);
+  jmp_buf errorHandler;
+  volatile bool parsing = false;
+  RunSettings settings = {.stats = STATS_NONE, .serve = NULL, .workers = -1};
+
+  logger.error_handler = &errorHandler;
+  if (setjmp(errorHandler) != 0) {
+    if (parsing) {
+      pthread_mutex_unlock(&parseMutex);
+    }
+    snprintf(result->error, sizeof(result->error), "%s", logger.error);
+    logging_install(previous);
+    return false;
+  }
 
-      // pre-masking
-      if (preMaskCount > 0) {
-        verboseLog(VERBOSE_NORMAL, "pre-masking\n ");
+  pthread_mutex_lock(&parseMutex);
+  parsing = true;
+  opterr = 0; // report unknown options in the result, not on stderr
+  bool parsed = parseCommandLine(argc, argv, options, &settings);
+  int arg = optind;
+  parsing = false;
+  pthread_mutex_unlock(&parseMutex);
+
+  if (!parsed && settings.exitStatus != 0) {
+    errOutput("unable to parse option '%s'.", argv[arg - 1]);
+  } else if (!parsed) {
+    errOutput("--help and --version are not supported in jobs.");
+  }
+  if (settings.serve != NULL || settings.manifest != NULL ||
+      settings.stats != STATS_NONE) {
+    errOutput("--serve, --manifest and --stats are not supported in jobs; "
+              "give --stats to the server instead.");
+  }
+  if (arg + 2 > argc) {
+    errOutput("no input or output files given.");
+  }
 
-        apply_masks(sheet, preMasks, preMaskCount, options.mask_color);
-      }
+  if (settings.journal != NULL) {
+    run->journal = journal_open(settings.journal, settings.resume);
+    run->resume = settings.resume;
+  }
 
-      // --------------------------------------------------------------
-      // --- verbose parameter output,                              ---
-      // --------------------------------------------------------------
-
-      // parameters and size are known now
-
-      if (verbose >= VERBOSE_MORE) {
-        switch (options.layout) {
-        case LAYOUT_NONE:
-          printf("layout: none\n");
-          break;
-        case LAYOUT_SINGLE:
-          printf("layout: single\n");
-          break;
-        case LAYOUT_DOUBLE:
-          printf("layout: double\n");
-          break;
-        default:
-          assert(false); // unreachable
-        }
+  processSheets(run, options, argc, argv, arg);
 
-        if (options.pre_rotate != 0) {
-          printf("pre-rotate: %d\n", options.pre_rotate);
-        }
-        printf("pre-mirror: %s\n", direction_to_string(options.pre_mirror));
-        if (options.pre_shift.horizontal != 0 ||
-            options.pre_shift.vertical != 0) {
-          printf("pre-shift: [%" PRId32 ",%" PRId32 "]\n",
-                 options.pre_shift.horizontal, options.pre_shift.vertical);
-        }
-        if (options.pre_wipes.count > 0) {
-          printf("pre-wipe: ");
-          for (size_t i = 0; i < options.pre_wipes.count; i++) {
-            print_rectangle(options.pre_wipes.areas[i]);
-          }
-          printf("\n");
-        }
-        if (memcmp(&options.pre_border, &BORDER_NULL, sizeof(BORDER_NULL)) !=
-            0) {
-          printf("pre-border: ");
-          print_border(options.pre_border);
-          printf("\n");
-        }
-        if (preMaskCount > 0) {
-          printf("pre-masking: ");
-          for (int i = 0; i < preMaskCount; i++) {
-            print_rectangle(preMasks[i]);
-          }
-          printf("\n");
-        }
-        if (options.stretch_size.width != -1 ||
-            options.stretch_size.height != -1) {
-          printf("stretch to: %" PRId32 "x%" PRId32 "\n",
-                 options.stretch_size.width, options.stretch_size.height);
-        }
-        if (options.post_stretch_size.width != -1 ||
-            options.post_stretch_size.height != -1) {
-          printf("post-stretch to: %" PRId32 "x%" PRId32 "d\n",
-                 options.post_stretch_size.width,
-                 options.post_stretch_size.height);
-        }
-        if (options.pre_zoom_factor != 1.0) {
-          printf("zoom: %f\n", options.pre_zoom_factor);
-        }
-        if (options.post_zoom_factor != 1.0) {
-          printf("post-zoom: %f\n", options.post_zoom_factor);
-        }
-        if (options.no_blackfilter_multi_index.count != -1) {
-          printf("blackfilter-scan-direction: %s\n",
-                 direction_to_string(
-                     options.blackfilter_parameters.scan_direction));
-          printf("blackfilter-scan-size: ");
-          print_rectangle_size(options.blackfilter_parameters.scan_size);
-          printf("\nblackfilter-scan-depth: [%d,%d]\n",
-                 options.blackfilter_parameters.scan_depth.horizontal,
-                 options.blackfilter_parameters.scan_depth.vertical);
-          printf("blackfilter-scan-step: ");
-          print_delta(options.blackfilter_parameters.scan_step);
-          printf("\nblackfilter-scan-threshold: %d\n",
-                 options.blackfilter_parameters.abs_threshold);
-          if (options.blackfilter_parameters.exclusions_count > 0) {
-            printf("blackfilter-scan-exclude: ");
-            for (size_t i = 0;
-                 i < options.blackfilter_parameters.exclusions_count; i++) {
-              print_rectangle(options.blackfilter_parameters.exclusions[i]);
-            }
-            printf("\n");
-          }
-          printf("blackfilter-intensity: %d\n",
-                 options.blackfilter_parameters.intensity);
-          if (options.no_blackfilter_multi_index.count > 0) {
-            printf("blackfilter DISABLED for sheets: ");
-            printMultiIndex(options.no_blackfilter_multi_index);
-          }
-        } else {
-          printf("blackfilter DISABLED for all sheets.\n");
-        }
-        if (options.no_noisefilter_multi_index.count != -1) {
-          printf("noisefilter-intensity: %" PRIu64 "\n",
-                 options.noisefilter_intensity);
-          if (options.no_noisefilter_multi_index.count > 0) {
-            printf("noisefilter DISABLED for sheets: ");
-            printMultiIndex(options.no_noisefilter_multi_index);
-          }
-        } else {
-          printf("noisefilter DISABLED for all sheets.\n");
-        }
-        if (options.no_blurfilter_multi_index.count != -1) {
-          printf("blurfilter-size: ");
-          print_rectangle_size(options.blurfilter_parameters.scan_size);
-          printf("\nblurfilter-step: ");
-          print_delta(options.blurfilter_parameters.scan_step);
-          printf("\nblurfilter-intensity: %f\n",
-                 options.blurfilter_parameters.intensity);
-          if (options.no_blurfilter_multi_index.count > 0) {
-            printf("blurfilter DISABLED for sheets: ");
-            printMultiIndex(options.no_blurfilter_multi_index);
-          }
-        } else {
-          printf("blurfilter DISABLED for all sheets.\n");
-        }
-        if (options.no_grayfilter_multi_index.count != -1) {
-          printf("grayfilter-size: ");
-          print_rectangle_size(options.grayfilter_parameters.scan_size);
-          printf("\ngrayfilter-step: ");
-          print_delta(options.grayfilter_parameters.scan_step);
-          printf("\ngrayfilter-threshold: %d\n",
-                 options.grayfilter_parameters.abs_threshold);
-          if (options.no_grayfilter_multi_index.count > 0) {
-            printf("grayfilter DISABLED for sheets: ");
-            printMultiIndex(options.no_grayfilter_multi_index);
-          }
-        } else {
-          printf("grayfilter DISABLED for all sheets.\n");
-        }
-        if (options.no_mask_scan_multi_index.count != -1) {
-          printf("mask points: ");
-          for (int i = 0; i < pointCount; i++) {
-            printf("(%d,%d) ", points[i].x, points[i].y);
-          }
-          printf("\n");
-          printf("mask-scan-direction: %s\n",
-                 direction_to_string(
-                     options.mask_detection_parameters.scan_direction));
-          printf("mask-scan-size: ");
-          print_rectangle_size(options.mask_detection_parameters.scan_size);
-          printf("\nmask-scan-depth: [%d,%d]\n",
-                 options.mask_detection_parameters.scan_depth.horizontal,
-                 options.mask_detection_parameters.scan_depth.vertical);
-          printf("mask-scan-step: ");
-          print_delta(options.mask_detection_parameters.scan_step);
-          printf("\nmask-scan-threshold: [%f,%f]\n",
-                 options.mask_detection_parameters.scan_threshold.horizontal,
-                 options.mask_detection_parameters.scan_threshold.vertical);
-          printf("mask-scan-minimum: [%d,%d]\n",
-                 options.mask_detection_parameters.minimum_width,
-                 options.mask_detection_parameters.minimum_height);
-          printf("mask-scan-maximum: [%d,%d]\n",
-                 options.mask_detection_parameters.maximum_width,
-                 options.mask_detection_parameters.maximum_height);
-          printf("mask-color: ");
-          print_color(options.mask_color);
-          printf("\n");
-          if (options.no_mask_scan_multi_index.count > 0) {
-            printf("mask-scan DISABLED for sheets: ");
-            printMultiIndex(options.no_mask_scan_multi_index);
-          }
-        } else {
-          printf("mask-scan DISABLED for all sheets.\n");
-        }
-        if (options.no_deskew_multi_index.count != -1) {
-          printf("deskew-scan-direction: ");
-          print_edges(options.deskew_parameters.scan_edges);
-          printf("deskew-scan-size: %d\n",
-                 options.deskew_parameters.deskewScanSize);
-          printf("deskew-scan-depth: %f\n",
-                 options.deskew_parameters.deskewScanDepth);
-          printf("deskew-scan-range: %f\n",
-                 options.deskew_parameters.deskewScanRangeRad);
-          printf("deskew-scan-step: %f\n",
-                 options.deskew_parameters.deskewScanStepRad);
-          printf("deskew-scan-deviation: %f\n",
-                 options.deskew_parameters.deskewScanDeviationRad);
-          if (options.no_deskew_multi_index.count > 0) {
-            printf("deskew-scan DISABLED for sheets: ");
-            printMultiIndex(options.no_deskew_multi_index);
-          }
-        } else {
-          printf("deskew-scan DISABLED for all sheets.\n");
-        }
-        if (options.no_wipe_multi_index.count != -1) {
-          if (options.wipes.count > 0) {
-            printf("wipe areas: ");
-            for (size_t i = 0; i < options.wipes.count; i++) {
-              print_rectangle(options.wipes.areas[i]);
-            }
-            printf("\n");
-          }
-        } else {
-          printf("wipe DISABLED for all sheets.\n");
-        }
-        if (middleWipe[0] > 0 || middleWipe[1] > 0) {
-          printf("middle-wipe (l,r): %d,%d\n", middleWipe[0], middleWipe[1]);
-        }
-        if (options.no_border_multi_index.count != -1) {
-          if (memcmp(&options.border, &BORDER_NULL, sizeof(BORDER_NULL)) != 0) {
-            printf("explicit border: ");
-            print_border(options.border);
-            printf("\n");
-          }
-        } else {
-          printf("border DISABLED for all sheets.\n");
-        }
-        if (options.no_border_scan_multi_index.count != -1) {
-          printf("border-scan-direction: %s\n",
-                 direction_to_string(
-                     options.border_scan_parameters.scan_direction));
-          printf("border-scan-size: ");
-          print_rectangle_size(options.border_scan_parameters.scan_size);
-          printf("\nborder-scan-step: ");
-          print_delta(options.border_scan_parameters.scan_step);
-          printf("\nborder-scan-threshold: [%d,%d]\n",
-                 options.border_scan_parameters.scan_threshold.horizontal,
-                 options.border_scan_parameters.scan_threshold.vertical);
-          if (options.no_border_scan_multi_index.count > 0) {
-            printf("border-scan DISABLED for sheets: ");
-            printMultiIndex(options.no_border_scan_multi_index);
-          }
-          printf("border-align: ");
-          print_edges(options.mask_alignment_parameters.alignment);
-          printf("border-margin: [%d,%d]\n",
-                 options.mask_alignment_parameters.margin.horizontal,
-                 options.mask_alignment_parameters.margin.vertical);
-        } else {
-          printf("border-scan DISABLED for all sheets.\n");
-        }
-        if (options.post_wipes.count > 0) {
-          printf("post-wipe: ");
-          for (size_t i = 0; i < options.post_wipes.count; i++) {
-            print_rectangle(options.post_wipes.areas[i]);
-          }
-          printf("\n");
-        }
-        if (memcmp(&options.post_border, &BORDER_NULL, sizeof(BORDER_NULL)) !=
-            0) {
-          printf("post-border: ");
-          print_border(options.post_border);
-          printf("\n");
-        }
-        printf("post-mirror: %s\n", direction_to_string(options.post_mirror));
-        if (options.post_shift.horizontal != 0 ||
-            options.post_shift.vertical != 0) {
-          printf("post-shift: [%" PRId32 ",%" PRId32 "]\n",
-                 options.post_shift.horizontal, options.post_shift.vertical);
-        }
-        if (options.post_rotate != 0) {
-          printf("post-rotate: %d\n", options.post_rotate);
-        }
-        // if (options.ignoreMultiIndex.count > 0) {
-        //    printf("EXCLUDE sheets: ");
-        //    printMultiIndex(options.ignoreMultiIndex);
-        //}
-        printf("white-threshold: %d\n", options.abs_white_threshold);
-        printf("black-threshold: %d\n", options.abs_black_threshold);
-        printf("sheet-background: ");
-        print_color(options.sheet_background);
-        printf("\n");
-        printf("input-files per sheet: %d\n", options.input_count);
-        printf("output-files per sheet: %d\n", options.output_count);
-        if (options.sheet_size.width != -1 || options.sheet_size.height != -1) {
-          printf("sheet size forced to: %" PRId32 " x %" PRId32 " pixels\n",
-                 options.sheet_size.width, options.sheet_size.height);
-        }
-        printf("input-file-sequence:  %s\n",
-               implode(s1, (const char **)inputFileNames, options.input_count));
-        printf(
-            "output-file-sequence: %s\n",
-            implode(s1, (const char **)outputFileNames, options.output_count));
-        if (options.overwrite_output) {
-          printf("OVERWRITING EXISTING FILES\n");
-        }
-        printf("\n");
-      }
-      verboseLog(
-          VERBOSE_NORMAL, "input-file%s for sheet %d: %s\n",
-          pluralS(options.input_count), nr,
-          implode(s1, (const char **)inputFileNames, options.input_count));
-      verboseLog(
-          VERBOSE_NORMAL, "output-file%s for sheet %d: %s\n",
-          pluralS(options.output_count), nr,
-          implode(s1, (const char **)outputFileNames, options.output_count));
-      verboseLog(VERBOSE_NORMAL, "sheet size: %dx%d\n", sheet.frame->width,
-                 sheet.frame->height);
-      verboseLog(VERBOSE_NORMAL, "...\n");
-
-      // -------------------------------------------------------
-      // --- process image data                              ---
-      // -------------------------------------------------------
-
-      // stretch
-      inputSize = coerce_size(options.stretch_size, size_of_image(sheet));
-
-      inputSize.width *= options.pre_zoom_factor;
-      inputSize.height *= options.pre_zoom_factor;
-
-      saveDebug("_before-stretch%d.pnm", nr, sheet);
-      stretch_and_replace(&sheet, inputSize, options.interpolate_type);
-      saveDebug("_after-stretch%d.pnm", nr, sheet);
-
-      // size
-      if (options.page_size.width != -1 || options.page_size.height != -1) {
-        inputSize = coerce_size(options.page_size, size_of_image(sheet));
-        saveDebug("_before-resize%d.pnm", nr, sheet);
-        resize_and_replace(&sheet, inputSize, options.interpolate_type);
-        saveDebug("_after-resize%d.pnm", nr, sheet);
-      }
+  logging_install(previous);
+  return true;
+}
 
-      // handle sheet layout
+/**
+ * Runs a job of the server, see JobHandler.
+ */
+static bool runJob(int argc, char *argv[], FILE *input, AVIOContext *output,
+                   JobResult *result, void *opaque) {
+  Options options;
+  Run run = {.input = input, .output = output, .stats = opaque};
+  bool success;
 
-      // LAYOUT_SINGLE
-      if (options.layout == LAYOUT_SINGLE) {
-        // set middle of sheet as single starting point for mask detection
-        if (pointCount == 0) { // no manual settings, use auto-values
-          points[pointCount++] =
-              (Point){sheet.frame->width / 2, sheet.frame->height / 2};
-        }
-        if (options.mask_detection_parameters.maximum_width == -1) {
-          options.mask_detection_parameters.maximum_width = sheet.frame->width;
-        }
-        if (options.mask_detection_parameters.maximum_height == -1) {
-          options.mask_detection_parameters.maximum_height =
-              sheet.frame->height;
-        }
-        // avoid inner half of the sheet to be blackfilter-detectable
-        if (options.blackfilter_parameters.exclusions_count == 0) {
-          // no manual settings, use auto-values
-          RectangleSize sheetSize = size_of_image(sheet);
-          options.blackfilter_parameters
-              .exclusions[options.blackfilter_parameters.exclusions_count++] =
-              rectangle_from_size(
-                  (Point){sheetSize.width / 4, sheetSize.height / 4},
-                  (RectangleSize){.width = sheetSize.width / 2,
-                                  .height = sheetSize.height / 2});
-        }
-        // set single outside border to start scanning for final border-scan
-        if (outsideBorderscanMaskCount ==
-            0) { // no manual settings, use auto-values
-          outsideBorderscanMask[outsideBorderscanMaskCount++] =
-              full_image(sheet);
-        }
+  options_init(&options);
+  success = runJobSheets(argc, argv, &options, &run, result);
+  result->sheets = run.sheets;
 
-        // LAYOUT_DOUBLE
-      } else if (options.layout == LAYOUT_DOUBLE) {
-        // set two middle of left/right side of sheet as starting points for
-        // mask detection
-        if (pointCount == 0) { // no manual settings, use auto-values
-          points[pointCount++] =
-              (Point){sheet.frame->width / 4, sheet.frame->height / 2};
-          points[pointCount++] =
-              (Point){sheet.frame->width - sheet.frame->width / 4,
-                      sheet.frame->height / 2};
-        }
-        if (options.mask_detection_parameters.maximum_width == -1) {
-          options.mask_detection_parameters.maximum_width =
-              sheet.frame->width / 2;
-        }
-        if (options.mask_detection_parameters.maximum_height == -1) {
-          options.mask_detection_parameters.maximum_height =
-              sheet.frame->height;
-        }
-        if (middleWipe[0] > 0 || middleWipe[1] > 0) { // left, right
-          options.wipes.areas[options.wipes.count++] = (Rectangle){{
-              {sheet.frame->width / 2 - middleWipe[0], 0},
-              {sheet.frame->width / 2 + middleWipe[1], sheet.frame->height - 1},
-          }};
-        }
-        // avoid inner half of each page to be blackfilter-detectable
-        if (options.blackfilter_parameters.exclusions_count == 0) {
-          // no manual settings, use auto-values
-          RectangleSize sheetSize = size_of_image(sheet);
-          RectangleSize filterSize = {
-              .width = sheetSize.width / 4,
-              .height = sheetSize.height / 2,
-          };
-          Point firstFilterOrigin = {sheetSize.width / 8, sheetSize.height / 4};
-          Point secondFilterOrigin =
-              shift_point(firstFilterOrigin, (Delta){sheet.frame->width / 2});
-
-          options.blackfilter_parameters
-              .exclusions[options.blackfilter_parameters.exclusions_count++] =
-              rectangle_from_size(firstFilterOrigin, filterSize);
-          options.blackfilter_parameters
-              .exclusions[options.blackfilter_parameters.exclusions_count++] =
-              rectangle_from_size(secondFilterOrigin, filterSize);
-        }
-        // set two outside borders to start scanning for final border-scan
-        if (outsideBorderscanMaskCount ==
-            0) { // no manual settings, use auto-values
-          outsideBorderscanMask[outsideBorderscanMaskCount++] =
-              (Rectangle){{POINT_ORIGIN,
-                           {sheet.frame->width / 2, sheet.frame->height - 1}}};
-          outsideBorderscanMask[outsideBorderscanMaskCount++] =
-              (Rectangle){{{sheet.frame->width / 2, 0},
-                           {sheet.frame->width - 1, sheet.frame->height - 1}}};
-        }
-      }
-      // if maskScanMaximum still unset (no --layout specified), set to full
-      // sheet size now
-      if (options.mask_detection_parameters.maximum_width == -1) {
-        options.mask_detection_parameters.maximum_width = sheet.frame->width;
-      }
-      if (options.mask_detection_parameters.maximum_height == -1) {
-        options.mask_detection_parameters.maximum_height = sheet.frame->height;
-      }
+  releaseRun(&run);
+  journal_close(run.journal);
+  options_free(&options);
+  return success;
+}
 
-      // pre-wipe
-      if (!isExcluded(nr, options.no_wipe_multi_index,
-                      options.ignore_multi_index)) {
-        apply_wipes(sheet, options.pre_wipes, options.mask_color);
-      }
+/**
+ * Options shared by the entries of a manifest with the same overrides, parsed
+ * once for all of them.
+ */
+typedef struct {
+  // Overrides of the entries, joined by newlines.
+  char *key;
+  Options options;
+  VerboseLevel verbose;
+} OptionSet;
+
+typedef struct {
+  const char *manifest;
+  const ManifestEntry *entry;
+  const OptionSet *set;
+  Journal *journal;
+  bool resume;
+  Statistics *stats;
+  bool failed;
+} ManifestJob;
+
+static char *joinOverrides(const ManifestEntry *entry) {
+  size_t length = 1;
+  for (int i = 0; i < entry->option_count; i++) {
+    length += strlen(entry->options[i]) + 1;
+  }
 
-      // pre-border
-      if (!isExcluded(nr, options.no_border_multi_index,
-                      options.ignore_multi_index)) {
-        apply_border(sheet, options.pre_border, options.mask_color);
-      }
+  char *key = calloc(length, 1);
+  if (key == NULL) {
+    errOutput("unable to allocate manifest options.");
+  }
+  for (int i = 0; i < entry->option_count; i++) {
+    strcat(key, entry->options[i]);
+    strcat(key, "\n");
+  }
+  return key;
+}
 
-      // black area filter
-      if (!isExcluded(nr, options.no_blackfilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-blackfilter%d.pnm", nr, sheet);
-        blackfilter(sheet, options.blackfilter_parameters);
-        saveDebug("_after-blackfilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ blackfilter DISABLED for sheet %d\n", nr);
-      }
+/**
+ * Parses the options of the command line up to argv[optionsEnd], which gave
+ * base, followed by the overrides of entry.
+ */
+static void parseOptionSet(OptionSet *set, const char *manifest,
+                           const ManifestEntry *entry, char *argv[],
+                           int optionsEnd, const RunSettings *base) {
+  int argc = optionsEnd + entry->option_count;
+  char **setArgv = calloc(argc + 1, sizeof(char *));
+  if (setArgv == NULL) {
+    errOutput("unable to allocate manifest options.");
+  }
+  memcpy(setArgv, argv, optionsEnd * sizeof(char *));
+  memcpy(setArgv + optionsEnd, entry->options,
+         entry->option_count * sizeof(char *));
+
+  Logger logger = {.verbose = VERBOSE_NONE};
+  Logger *previous = logging_install(&logger);
+  jmp_buf errorHandler;
+  RunSettings settings = {.stats = STATS_NONE, .serve = NULL, .workers = -1};
+
+  logger.error_handler = &errorHandler;
+  if (setjmp(errorHandler) != 0) {
+    logging_install(previous);
+    errOutput("%s:%d: %s", manifest, entry->line, logger.error);
+  }
 
-      // noise filter
-      if (!isExcluded(nr, options.no_noisefilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-noisefilter%d.pnm", nr, sheet);
-        noisefilter(sheet, options.noisefilter_intensity,
-                    options.abs_white_threshold);
-        saveDebug("_after-noisefilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ noisefilter DISABLED for sheet %d\n", nr);
-      }
+  if (!parseCommandLine(argc, setArgv, &set->options, &settings) &&
+      settings.exitStatus != 0) {
+    errOutput("unable to parse option '%s'.", setArgv[optind - 1]);
+  } else if (settings.exitMessage != NULL) {
+    errOutput("--help and --version are not supported in manifests.");
+  }
+  if (optind < argc) {
+    errOutput("unexpected argument '%s' in options.", setArgv[optind]);
+  }
+  if (settings.serve != base->serve || settings.manifest != base->manifest ||
+      settings.stats != base->stats || settings.workers != base->workers ||
+      settings.journal != base->journal || settings.resume != base->resume) {
+    errOutput("--serve, --manifest, --stats, --workers, --journal and --resume "
+              "are not supported in manifests.");
+  }
 
-      // blur filter
-      if (!isExcluded(nr, options.no_blurfilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-blurfilter%d.pnm", nr, sheet);
-        blurfilter(sheet, options.blurfilter_parameters,
-                   options.abs_white_threshold);
-        saveDebug("_after-blurfilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ blurfilter DISABLED for sheet %d\n", nr);
-      }
+  logging_install(previous);
+  set->verbose = logger.verbose;
+  free(setArgv);
+}
 
-      // mask-detection
-      if (!isExcluded(nr, options.no_mask_scan_multi_index,
-                      options.ignore_multi_index)) {
-        detect_masks(sheet, options.mask_detection_parameters, points,
-                     pointCount, masks);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ mask-scan DISABLED for sheet %d\n", nr);
-      }
+static bool runManifestSheets(ManifestJob *job, Options *options, Run *run) {
+  Logger logger = {.verbose = job->set->verbose};
+  Logger *previous = logging_install(&logger);
+  jmp_buf errorHandler;
+
+  logger.error_handler = &errorHandler;
+  if (setjmp(errorHandler) != 0) {
+    fprintf(stderr, "unpaper: error: %s:%d: %s\n", job->manifest,
+            job->entry->line, logger.error);
+    logging_install(previous);
+    return false;
+  }
 
-      // permanently apply masks
-      if (maskCount > 0) {
-        saveDebug("_before-masking%d.pnm", nr, sheet);
-        apply_masks(sheet, masks, maskCount, options.mask_color);
-        saveDebug("_after-masking%d.pnm", nr, sheet);
-      }
+  for (int i = 0; i < job->entry->file_count; i++) {
+    if (isStream(job->entry->files[i])) {
+      errOutput("standard input and output are not supported in manifests.");
+    }
+  }
 
-      // gray filter
-      if (!isExcluded(nr, options.no_grayfilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-grayfilter%d.pnm", nr, sheet);
-        grayfilter(sheet, options.grayfilter_parameters);
-        saveDebug("_after-grayfilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ grayfilter DISABLED for sheet %d\n", nr);
-      }
+  processSheets(run, options, job->entry->file_count, job->entry->files, 0);
 
-      // rotation-detection
-      if ((!isExcluded(nr, options.no_deskew_multi_index,
-                       options.ignore_multi_index))) {
-        saveDebug("_before-deskew%d.pnm", nr, sheet);
-
-        // detect masks again, we may get more precise results now after first
-        // masking and grayfilter
-        if (!isExcluded(nr, options.no_mask_scan_multi_index,
-                        options.ignore_multi_index)) {
-          maskCount = detect_masks(sheet, options.mask_detection_parameters,
-                                   points, pointCount, masks);
-        } else {
-          verboseLog(VERBOSE_MORE, "(mask-scan before deskewing disabled)\n");
-        }
+  logging_install(previous);
+  return true;
+}
 
-        // auto-deskew each mask
-        for (size_t i = 0; i < maskCount; i++) {
-          float rotation =
-              detect_rotation(sheet, masks[i], options.deskew_parameters);
+static void runManifestJob(void *item, void *opaque) {
+  ManifestJob *job = item;
+  // The multi-indexes are shared with the other entries, read-only.
+  Options options = job->set->options;
+  Run run = {.input = NULL,
+             .journal = job->journal,
+             .resume = job->resume,
+             .stats = job->stats};
+
+  job->failed = !runManifestSheets(job, &options, &run);
+  releaseRun(&run);
+}
 
-          verboseLog(VERBOSE_NORMAL, "rotate (%d,%d): %f\n", points[i].x,
-                     points[i].y, rotation);
+/**
+ * Runs the entries of a manifest on a pool of workers, with the options of the
+ * command line up to argv[optionsEnd], which gave settings. Returns the exit
+ * status.
+ */
+static int runManifest(const RunSettings *settings, Statistics *stats,
+                       char *argv[], int optionsEnd) {
+  const char *filename = settings->manifest;
+  Manifest manifest;
+  Journal *journal = NULL;
+  manifest_read(filename, &manifest);
+
+  OptionSet *sets = calloc(manifest.count, sizeof(OptionSet));
+  ManifestJob *jobs = calloc(manifest.count, sizeof(ManifestJob));
+  int setCount = 0;
+  if ((sets == NULL || jobs == NULL) && manifest.count > 0) {
+    errOutput("unable to allocate manifest entries.");
+  }
 
-          if (rotation != 0.0) {
-            saveDebug("_before-deskew-detect%d.pnm", nr * maskCount + i, sheet);
-            deskew(sheet, masks[i], rotation, options.interpolate_type);
-            saveDebug("_after-deskew-detect%d.pnm", nr * maskCount + i, sheet);
-          }
-        }
+  for (int i = 0; i < manifest.count; i++) {
+    const ManifestEntry *entry = &manifest.entries[i];
+    char *key = joinOverrides(entry);
+    OptionSet *set = NULL;
 
-        saveDebug("_after-deskew%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ deskewing DISABLED for sheet %d\n", nr);
+    for (int j = 0; j < setCount && set == NULL; j++) {
+      if (strcmp(sets[j].key, key) == 0) {
+        set = &sets[j];
       }
+    }
+    if (set == NULL) {
+      set = &sets[setCount++];
+      set->key = key;
+      parseOptionSet(set, filename, entry, argv, optionsEnd, settings);
+    } else {
+      free(key);
+    }
 
-      // auto-center masks on either single-page or double-page layout
-      if (!isExcluded(
-              nr, options.no_mask_center_multi_index,
-              options.ignore_multi_index)) { // (maskCount==pointCount to
-                                             // make sure all masks had
-                                             // correctly been detected)
-        // perform auto-masking again to get more precise masks after rotation
-        if (!isExcluded(nr, options.no_mask_scan_multi_index,
-                        options.ignore_multi_index)) {
-          maskCount = detect_masks(sheet, options.mask_detection_parameters,
-                                   points, pointCount, masks);
-        } else {
-          verboseLog(VERBOSE_MORE, "(mask-scan before centering disabled)\n");
-        }
-
-        saveDebug("_before-centering%d.pnm", nr, sheet);
-        // center masks on the sheet, according to their page position
-        for (int i = 0; i < maskCount; i++) {
-          center_mask(sheet, points[i], masks[i]);
-        }
-        saveDebug("_after-centering%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ auto-centering DISABLED for sheet %d\n",
-                   nr);
-      }
+    jobs[i] = (ManifestJob){
+        .manifest = filename,
+        .entry = entry,
+        .set = set,
+    };
+  }
 
-      // explicit wipe
-      if (!isExcluded(nr, options.no_wipe_multi_index,
-                      options.ignore_multi_index)) {
-        apply_wipes(sheet, options.wipes, options.mask_color);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ wipe DISABLED for sheet %d\n", nr);
-      }
+  if (settings->journal != NULL) {
+    journal = journal_open(settings->journal, settings->resume);
+  }
+  for (int i = 0; i < manifest.count; i++) {
+    jobs[i].journal = journal;
+    jobs[i].resume = settings->resume;
+    jobs[i].stats = stats;
+  }
 
-      // explicit border
-      if (!isExcluded(nr, options.no_border_multi_index,
-                      options.ignore_multi_index)) {
-        apply_border(sheet, options.border, options.mask_color);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ border DISABLED for sheet %d\n", nr);
-      }
+  verboseLog(VERBOSE_NORMAL, WELCOME); // welcome message
+  verboseLog(VERBOSE_MORE, "manifest %s: %d entries, %d option sets\n",
+             filename, manifest.count, setCount);
 
-      // border-detection
-      if (!isExcluded(nr, options.no_border_scan_multi_index,
-                      options.ignore_multi_index)) {
-        Rectangle autoborderMask[outsideBorderscanMaskCount];
-        saveDebug("_before-border%d.pnm", nr, sheet);
-        for (int i = 0; i < outsideBorderscanMaskCount; i++) {
-          autoborderMask[i] = border_to_mask(
-              sheet, detect_border(sheet, options.border_scan_parameters,
-                                   outsideBorderscanMask[i]));
-        }
-        apply_masks(sheet, autoborderMask, outsideBorderscanMaskCount,
-                    options.mask_color);
-        for (int i = 0; i < outsideBorderscanMaskCount; i++) {
-          // border-centering
-          if (!isExcluded(nr, options.no_border_align_multi_index,
-                          options.ignore_multi_index)) {
-            align_mask(sheet, autoborderMask[i], outsideBorderscanMask[i],
-                       options.mask_alignment_parameters);
-          } else {
-            verboseLog(VERBOSE_MORE,
-                       "+ border-centering DISABLED for sheet %d\n", nr);
-          }
-        }
-        saveDebug("_after-border%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ border-scan DISABLED for sheet %d\n", nr);
-      }
+  int workers = settings->workers;
+  if (workers == -1) {
+    workers = workqueue_default_workers();
+  }
 
-      // post-wipe
-      if (!isExcluded(nr, options.no_wipe_multi_index,
-                      options.ignore_multi_index)) {
-        apply_wipes(sheet, options.post_wipes, options.mask_color);
-      }
+  WorkQueue *queue = workqueue_new(workers, runManifestJob, NULL);
+  for (int i = 0; i < manifest.count; i++) {
+    workqueue_push(queue, &jobs[i]);
+  }
+  workqueue_finish(queue);
 
-      // post-border
-      if (!isExcluded(nr, options.no_border_multi_index,
-                      options.ignore_multi_index)) {
-        apply_border(sheet, options.post_border, options.mask_color);
-      }
+  int failed = 0;
+  for (int i = 0; i < manifest.count; i++) {
+    failed += jobs[i].failed ? 1 : 0;
+  }
+  if (failed > 0) {
+    fprintf(stderr, "unpaper: %d of %d manifest entries failed.\n", failed,
+            manifest.count);
+  }
 
-      // post-mirroring
-      if (options.post_mirror.horizontal || options.post_mirror.vertical) {
-        verboseLog(VERBOSE_NORMAL, "post-mirroring %s\n",
-                   direction_to_string(options.post_mirror));
-        mirror(sheet, options.post_mirror);
-      }
+  for (int i = 0; i < setCount; i++) {
+    free(sets[i].key);
+    options_free(&sets[i].options);
+  }
+  free(sets);
+  free(jobs);
+  journal_close(journal);
+  manifest_free(&manifest);
 
-      // post-shifting
-      if ((options.post_shift.horizontal != 0) ||
-          ((options.post_shift.vertical != 0))) {
-        verboseLog(VERBOSE_NORMAL, "post-shifting [%" PRId32 ",%" PRId32 "]\n",
-                   options.post_shift.horizontal, options.post_shift.vertical);
+  return failed > 0 ? 1 : 0;
+}
 
-        shift_image(&sheet, options.post_shift);
-      }
+/****************************************************************************
+ * MAIN()                                                                   *
+ ****************************************************************************/
 
-      // post-rotating
-      if (options.post_rotate != 0) {
-        verboseLog(VERBOSE_NORMAL, "post-rotating %d degrees.\n",
-                   options.post_rotate);
-        flip_rotate_90(&sheet, options.post_rotate / 90);
-      }
+/**
+ * The main program.
+ */
+int main(int argc, char *argv[]) {
+  Options options;
+  RunSettings settings = {.stats = STATS_NONE, .serve = NULL, .workers = -1};
+  Statistics stats = EMPTY_STATISTICS;
+  Statistics *runStats = NULL;
 
-      // post-stretch
-      inputSize = coerce_size(options.post_stretch_size, size_of_image(sheet));
+  if (!parseCommandLine(argc, argv, &options, &settings)) {
+    puts(settings.exitMessage);
+    return settings.exitStatus;
+  }
 
-      inputSize.width *= options.post_zoom_factor;
-      inputSize.height *= options.post_zoom_factor;
+  if (settings.stats != STATS_NONE) {
+    stats_enable(&stats, settings.stats, stderr);
+    runStats = &stats;
+  }
 
-      stretch_and_replace(&sheet, inputSize, options.interpolate_type);
+  if (settings.manifest != NULL) {
+    if (settings.serve != NULL) {
+      errOutput("--serve and --manifest cannot be used together.");
+    }
+    if (optind < argc) {
+      errOutput("no input or output files can be given with --manifest.");
+    }
 
-      // post-size
-      if (options.post_page_size.width != -1 ||
-          options.post_page_size.height != -1) {
-        inputSize = coerce_size(options.post_page_size, size_of_image(sheet));
-        resize_and_replace(&sheet, inputSize, options.interpolate_type);
-      }
+    options_free(&options);
+    int status = runManifest(&settings, runStats, argv, optind);
+    stats_print_summary(&stats);
+    return status;
+  }
 
-      // --- write output file ---
+  if (settings.serve != NULL) {
+    if (optind < argc) {
+      errOutput("no input or output files can be given with --serve.");
+    }
+    if (settings.journal != NULL) {
+      errOutput("--journal is not supported with --serve.");
+    }
+    if (settings.workers == -1) {
+      settings.workers = workqueue_default_workers();
+    }
 
-      // write split pages output
+    int status = serve(settings.serve, settings.workers, runJob, runStats);
+    stats_print_summary(&stats);
+    return status;
+  }
 
-      if (options.write_output) {
-        verboseLog(VERBOSE_NORMAL, "writing output.\n");
-        // write files
-        saveDebug("_before-save%d.pnm", nr, sheet);
+  /* make sure we have at least two arguments after the options, as
+     that's the minimum amount of parameters we need (one input and
+     one output, or a wildcard of inputs and a wildcard of
+     outputs.
+  */
+  if (optind + 2 > argc)
+    errOutput("no input or output files given.\n");
 
-        if (options.output_pixel_format == AV_PIX_FMT_NONE) {
-          options.output_pixel_format = sheet.frame->format;
-        }
+  verboseLog(VERBOSE_NORMAL, WELCOME); // welcome message
 
-        for (int j = 0; j < options.output_count; j++) {
-          // get pagebuffer
-          page = create_compatible_image(
-              sheet,
-              (RectangleSize){sheet.frame->width / options.output_count,
-                              sheet.frame->height},
-              false);
-          copy_rectangle(
-              sheet, page,
-              (Rectangle){{{page.frame->width * j, 0},
-                           {page.frame->width * j + page.frame->width,
-                            page.frame->height}}},
-              POINT_ORIGIN);
-
-          verboseLog(VERBOSE_MORE, "saving file %s.\n", outputFileNames[j]);
-
-          saveImage(outputFileNames[j], page, options.output_pixel_format);
-
-          free_image(&page);
-        }
+  Run run = {.input = stdin, .stats = runStats};
+  if (settings.journal != NULL) {
+    run.journal = journal_open(settings.journal, settings.resume);
+    run.resume = settings.resume;
+  }
 
-        free_image(&sheet);
-      }
-    }
+  processSheets(&run, &options, argc, argv, optind);
+  releaseRun(&run);
+  journal_close(run.journal);
 
-  sheet_end:
-    /* if we're not given an input wildcard, and we finished the
-     * arguments, we don't want to keep looping.
-     */
-    if (optind >= argc && !inputWildcard)
-      break;
-    else if (inputWildcard && outputWildcard)
-      optind -= 2;
-  }
+  stats_print_summary(&stats);
 
   return 0;
 }
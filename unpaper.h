@@ -12,7 +12,9 @@
 
 #include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
 
+#include <libavformat/avio.h>
 #include <libavutil/frame.h>
 
 #include "constants.h"
@@ -30,7 +32,33 @@
 void loadImage(const char *filename, Image *image, Pixel sheet_background,
                uint8_t abs_black_threshold);
 
-void saveImage(char *filename, Image image, int outputPixFmt);
+// Like loadImage(), reading from the caller's I/O context or memory buffer
+// instead of a file. name is only used in messages.
+void loadImageFromIO(AVIOContext *io, const char *name, Image *image,
+                     Pixel sheet_background, uint8_t abs_black_threshold);
+void loadImageFromBuffer(const uint8_t *data, size_t size, const char *name,
+                         Image *image, Pixel sheet_background,
+                         uint8_t abs_black_threshold);
+
+// Read-only I/O context on a memory buffer, which has to outlive it.
+AVIOContext *openBufferIO(const uint8_t *data, size_t size);
+void closeBufferIO(AVIOContext **io);
+
+// Reads the next image of a stream into a newly allocated buffer, which the
+// caller releases with av_free(). Binary pnm images can be concatenated in the
+// stream; an image in any other format has to be the last one. Returns false
+// at the end of the stream.
+bool readStreamImage(FILE *stream, const char *name, uint8_t **data,
+                     size_t *size);
+
+void saveImage(const char *filename, Image image, int outputPixFmt);
+
+// Like saveImage(), writing to the caller's I/O context, or to a newly
+// allocated buffer that the caller releases with av_free().
+void saveImageToIO(AVIOContext *io, const char *name, Image image,
+                   int outputPixFmt);
+void saveImageToBuffer(Image image, int outputPixFmt, uint8_t **data,
+                       size_t *size);
 
 void saveDebug(char *filenameTemplate, int index, Image image)
     __attribute__((format(printf, 1, 0)));